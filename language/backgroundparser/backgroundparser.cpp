@@ -23,6 +23,9 @@
 
 #include "backgroundparser.h"
 
+#include <algorithm>
+
+#include <QElapsedTimer>
 #include <QList>
 #include <QMutex>
 #include <QMutexLocker>
@@ -50,14 +53,20 @@
 
 #include "util/debug.h"
 
+#include "fileprefetcher.h"
 #include "parsejob.h"
 #include <editor/modificationrevisionset.h>
+#include <duchain/duchain.h>
+#include <duchain/duchainlock.h>
+#include <duchain/parsingenvironment.h>
+#include <codegen/coderepresentation.h>
 
 using namespace KDevelop;
 
 namespace {
 
-const bool separateThreadForHighPriority = true;
+// Count of threads reserved for documents with NormalPriority or better
+const int interactiveThreads = 1;
 
 /**
  * Elides string in @p path, e.g. "VEEERY/LONG/PATH" -> ".../LONG/PATH"
@@ -134,6 +143,10 @@ inline uint qHash(const DocumentParseTarget& target)
 struct DocumentParsePlan
 {
     QSet<DocumentParseTarget> targets;
+    // The documents imported by this one when it was parsed the last time
+    QVector<IndexedString> dependencies;
+    // Measures the time until the parse job is started
+    QElapsedTimer queuedSince;
 
     ParseJob::SequentialProcessingFlags sequentialProcessingFlags() const
     {
@@ -187,7 +200,9 @@ class KDevelop::BackgroundParserPrivate
 {
 public:
     BackgroundParserPrivate(BackgroundParser *parser, ILanguageController *languageController)
-        :m_parser(parser), m_languageController(languageController), m_shuttingDown(false), m_mutex(QMutex::Recursive)
+        :m_parser(parser), m_languageController(languageController), m_shuttingDown(false)
+        , m_dependencyScheduling(!qEnvironmentVariableIsSet("KDEV_BACKGROUNDPARSER_NO_DEPENDENCIES"))
+        , m_mutex(QMutex::Recursive)
     {
         parser->d = this; //Set this so we can safely call back BackgroundParser from within loadSettings()
 
@@ -207,12 +222,44 @@ public:
 
     ~BackgroundParserPrivate()
     {
-        m_weaver.resume();
-        m_weaver.finish();
+        for (auto& lane : m_lanes) {
+            lane.resume();
+        }
+        for (auto& lane : m_lanes) {
+            lane.finish();
+        }
     }
 
     // Non-mutex guarded functions, only call with m_mutex acquired.
 
+    // The count of parse jobs that may run in @p lane at the same time
+    int laneCapacity(BackgroundParser::Lane lane) const
+    {
+        if (lane == BackgroundParser::InteractiveLane) {
+            return interactiveThreads;
+        }
+        // Leave a core to every running interactive job
+        return qMax(1, m_threads - m_laneStates[BackgroundParser::InteractiveLane].running);
+    }
+
+    int freeThreads(BackgroundParser::Lane lane) const
+    {
+        return laneCapacity(lane) - m_laneStates[lane].running;
+    }
+
+    // Returns the lane that can start a job with @p priority right now, or -1 if none has a free thread.
+    // Interactive jobs use a free thread of the bulk lane when the interactive lane is busy.
+    int laneForPriority(int priority) const
+    {
+        if (priority <= BackgroundParser::NormalPriority && freeThreads(BackgroundParser::InteractiveLane) > 0) {
+            return BackgroundParser::InteractiveLane;
+        }
+        if (freeThreads(BackgroundParser::BulkLane) > 0) {
+            return BackgroundParser::BulkLane;
+        }
+        return -1;
+    }
+
     int currentBestRunningPriority() const
     {
         int bestRunningPriority = BackgroundParser::WorstPriority;
@@ -226,11 +273,46 @@ public:
         return bestRunningPriority;
     }
 
-    IndexedString nextDocumentToParse() const
+    // Whether one of the known imports of the document is being parsed, or waits to be parsed, with at least the same priority
+    bool waitsForDependency(const IndexedString& url, const DocumentParsePlan& parsePlan) const
+    {
+        const int priority = parsePlan.priority();
+        for (const auto& dependency : parsePlan.dependencies) {
+            if (dependency == url) {
+                continue;
+            }
+            const auto jobIt = m_parseJobs.constFind(dependency);
+            if (jobIt != m_parseJobs.constEnd()) {
+                const ParseJob* parseJob = dynamic_cast<const ParseJob*>((*jobIt)->job());
+                Q_ASSERT(parseJob);
+                if (parseJob->parsePriority() <= priority) {
+                    return true;
+                }
+                continue;
+            }
+            const auto it = m_documents.constFind(dependency);
+            if (it != m_documents.constEnd() && it->priority() <= priority) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Walks the queued documents in the order in which they are started, and calls @p visit for every document
+     * that can be started right now, until it returns false.
+     *
+     * @param needFreeThread Whether to stop at the priorities for which no thread is free
+     * @return The first document that was held back only because its imports were not parsed yet
+     */
+    template<typename Visitor>
+    IndexedString visitStartableDocuments(bool needFreeThread, Visitor visit) const
     {
         // Before starting a new job, first wait for all higher-priority ones to finish.
         // That way, parse job priorities can be used for dependency handling.
         const int bestRunningPriority = currentBestRunningPriority();
+        // The first document that was held back only because its imports were not parsed yet
+        IndexedString waitingForDependency;
 
         for (auto it1 = m_documentsForPriority.begin();
              it1 != m_documentsForPriority.end(); ++it1 )
@@ -239,8 +321,8 @@ public:
             if(priority > m_neededPriority)
                 break; //The priority is not good enough to be processed right now
 
-            if (m_parseJobs.count() >= m_threads && priority > BackgroundParser::NormalPriority && !specialParseJob) {
-                break; //The additional parsing thread is reserved for higher priority parsing
+            if (needFreeThread && laneForPriority(priority) == -1) {
+                break; //No thread is free for this and all worse priorities
             }
 
             for (const auto& url : it1.value()) {
@@ -260,12 +342,207 @@ public:
                     continue;
                 }
 
-                return url;
+                // Parse the imports first, so they are not parsed again as part of every importer
+                if (m_dependencyScheduling && waitsForDependency(url, parsePlan)) {
+                    if (waitingForDependency.isEmpty()) {
+                        waitingForDependency = url;
+                    }
+                    continue;
+                }
+
+                if (!visit(url, priority)) {
+                    return waitingForDependency;
+                }
             }
         }
+
+        return waitingForDependency;
+    }
+
+    IndexedString nextDocumentToParse() const
+    {
+        IndexedString next;
+        const auto waitingForDependency = visitStartableDocuments(true, [&next] (const IndexedString& url, int) {
+            next = url;
+            return false;
+        });
+        if (!next.isEmpty()) {
+            return next;
+        }
+
+        // Nothing is running that could resolve the dependencies, so they are cyclic. Break the cycle.
+        if (m_parseJobs.isEmpty()) {
+            return waitingForDependency;
+        }
         return {};
     }
 
+    /**
+     * Asks a running bulk job to stop, through ParseJob::abortRequested(), when a document with an interactive
+     * priority could be parsed right now, but its lane is full. The preempted job loses its work, so nothing
+     * else preempts jobs, running jobs always finish when the needed priority changes.
+     * Preempted documents are queued again once their job finished.
+     */
+    void requestPreemption()
+    {
+        auto canRunNow = [this] (const IndexedString& url) {
+            return !m_parseJobs.contains(url)
+                && !(m_dependencyScheduling && waitsForDependency(url, *m_documents.constFind(url)));
+        };
+        int waitingPriority = BackgroundParser::WorstPriority;
+        for (auto it = m_documentsForPriority.constBegin(); it != m_documentsForPriority.constEnd(); ++it) {
+            if (it.key() > BackgroundParser::NormalPriority) {
+                break;
+            }
+            if (std::any_of(it->constBegin(), it->constEnd(), canRunNow)) {
+                waitingPriority = it.key();
+                break;
+            }
+        }
+        if (waitingPriority > BackgroundParser::NormalPriority || waitingPriority > m_neededPriority
+            || laneForPriority(waitingPriority) != -1)
+        {
+            return;
+        }
+
+        // Preempt the job with the worst priority, unless one is already stopping
+        ParseJob* worstJob = nullptr;
+        for (const auto* decorator : m_parseJobs) {
+            ParseJob* parseJob = dynamic_cast<ParseJob*>(decorator->job());
+            if (parseJob->parsePriority() <= BackgroundParser::NormalPriority) {
+                continue;
+            }
+            if (parseJob->preemptionRequested()) {
+                return;
+            }
+            if (!worstJob || parseJob->parsePriority() > worstJob->parsePriority()) {
+                worstJob = parseJob;
+            }
+        }
+        if (worstJob) {
+            qCDebug(LANGUAGE) << "requesting preemption of" << worstJob->document() << "for a document with priority" << waitingPriority;
+            worstJob->requestPreemption();
+        }
+    }
+
+    /**
+     * Looks up the imports of the documents queued since the last call in the duchain, as far as they are
+     * known from earlier parse runs. All documents are looked up at once, under a single duchain lock.
+     *
+     * Must be called without m_mutex held, as the duchain has to be locked first.
+     */
+    void resolveDependencies()
+    {
+        QVector<IndexedString> urls;
+        {
+            QMutexLocker lock(&m_mutex);
+            if (m_unresolvedDependencies.isEmpty()) {
+                return;
+            }
+            urls.reserve(m_unresolvedDependencies.size());
+            for (const auto& url : m_unresolvedDependencies) {
+                urls << url;
+            }
+            m_unresolvedDependencies.clear();
+        }
+
+        QHash<IndexedString, QVector<IndexedString> > resolved;
+        {
+            DUChainReadLocker lock;
+            for (const auto& url : urls) {
+                QVector<IndexedString> imports;
+                foreach (const ParsingEnvironmentFilePointer& file, DUChain::self()->allEnvironmentFiles(url)) {
+                    foreach (const ParsingEnvironmentFilePointer& import, file->imports()) {
+                        if (!imports.contains(import->url())) {
+                            imports << import->url();
+                        }
+                    }
+                }
+                // documents that were not parsed yet are looked up again when they are queued the next time
+                if (!imports.isEmpty()) {
+                    resolved.insert(url, imports);
+                }
+            }
+        }
+
+        QMutexLocker lock(&m_mutex);
+        for (auto it = resolved.constBegin(); it != resolved.constEnd(); ++it) {
+            // A parse run in between knows better
+            if (!m_knownImports.contains(it.key())) {
+                m_knownImports.insert(it.key(), it.value());
+            }
+            const auto planIt = m_documents.find(it.key());
+            if (planIt != m_documents.end() && planIt->dependencies.isEmpty()) {
+                planIt->dependencies = m_knownImports.value(it.key());
+            }
+        }
+    }
+
+    /**
+     * Remembers the imports of the document parsed by @p job, and drops the queued
+     * reparses of those imports that have been brought up to date by it.
+     *
+     * Must be called without m_mutex held, as the duchain has to be locked first.
+     */
+    void updateAfterParse(ParseJob* job)
+    {
+        const ReferencedTopDUContext top = job->duChain();
+        if (!top) {
+            return;
+        }
+
+        DUChainReadLocker lock;
+        const ParsingEnvironmentFilePointer file = top->parsingEnvironmentFile();
+        if (!file) {
+            return;
+        }
+        const auto importFiles = file->imports();
+
+        QMutexLocker mutexLock(&m_mutex);
+        QVector<IndexedString> imports;
+        imports.reserve(importFiles.size());
+        for (const ParsingEnvironmentFilePointer& import : importFiles) {
+            const IndexedString url = import->url();
+            imports << url;
+
+            const auto planIt = m_documents.find(url);
+            if (planIt == m_documents.end() || m_parseJobs.contains(url)) {
+                continue;
+            }
+            const TopDUContext::Features features = planIt->features();
+            if (features & TopDUContext::ForceUpdate) {
+                continue;
+            }
+            // Other environments of the same document may still be outdated
+            if (DUChain::self()->allEnvironmentFiles(url).size() != 1
+                || import->needsUpdate() || !import->featuresSatisfied(features))
+            {
+                continue;
+            }
+
+            qCDebug(LANGUAGE) << "dropping reparse of" << url << "which was updated while parsing" << job->document()
+                              << "dropped reparses so far:" << m_droppedReparses + 1;
+            const auto notifyWhenReady = planIt->notifyWhenReady();
+            if (!notifyWhenReady.isEmpty()) {
+                const ReferencedTopDUContext importTop(import->topContext());
+                for (const auto& n : notifyWhenReady) {
+                    if (n) {
+                        QMetaObject::invokeMethod(n.data(), "updateReady", Qt::QueuedConnection,
+                                                  Q_ARG(KDevelop::IndexedString, url),
+                                                  Q_ARG(KDevelop::ReferencedTopDUContext, importTop));
+                    }
+                }
+            }
+
+            m_documentsForPriority[planIt->priority()].remove(url);
+            m_documents.erase(planIt);
+            m_prefetcher.discard(url);
+            --m_maxParseJobs;
+            ++m_droppedReparses;
+        }
+        m_knownImports.insert(job->document(), imports);
+    }
+
     /**
      * Create a single delayed parse job
      *
@@ -277,25 +554,29 @@ public:
         if(m_shuttingDown)
             return;
 
-        //Only create parse-jobs for up to thread-count * 2 documents, so we don't fill the memory unnecessarily
-        if (m_parseJobs.count() >= m_threads+1
-            || (m_parseJobs.count() >= m_threads && !separateThreadForHighPriority))
-        {
+        //Only create parse-jobs for free threads, so we don't fill the memory unnecessarily
+        if (laneForPriority(BackgroundParser::BestPriority) == -1) {
             return;
         }
 
         const auto& url = nextDocumentToParse();
-        if (!url.isEmpty()) {
+        if (url.isEmpty()) {
+            requestPreemption();
+        } else {
             qCDebug(LANGUAGE) << "creating parse-job" << url << "new count of active parse-jobs:" << m_parseJobs.count() + 1;
 
             const QString elidedPathString = elidedPathLeft(url.str(), 70);
             emit m_parser->showMessage(m_parser, i18n("Parsing: %1", elidedPathString));
 
             ThreadWeaver::QObjectDecorator* decorator = nullptr;
+            int priority;
+            qint64 latency;
             {
                 // copy shared data before unlocking the mutex
                 const auto parsePlanConstIt = m_documents.constFind(url);
                 const DocumentParsePlan parsePlan = *parsePlanConstIt;
+                priority = parsePlan.priority();
+                latency = parsePlan.queuedSince.elapsed();
 
                 // we must not lock the mutex while creating a parse job
                 // this could in turn lock e.g. the DUChain and then
@@ -322,11 +603,20 @@ public:
             }
 
             if (decorator) {
-                if(m_parseJobs.count() == m_threads+1 && !specialParseJob)
-                    specialParseJob = decorator; //This parse-job is allocated into the reserved thread
+                int lane = laneForPriority(priority);
+                if (lane == -1) {
+                    lane = priority <= BackgroundParser::NormalPriority ? BackgroundParser::InteractiveLane
+                                                                         : BackgroundParser::BulkLane;
+                }
+                LaneState& state = m_laneStates[lane];
+                ++state.running;
+                ++state.started;
+                state.totalLatency += latency;
+                state.maximumLatency = qMax(state.maximumLatency, latency);
 
                 m_parseJobs.insert(url, decorator);
-                m_weaver.enqueue(ThreadWeaver::JobPointer(decorator));
+                m_jobLanes.insert(url, static_cast<BackgroundParser::Lane>(lane));
+                m_lanes[lane].enqueue(ThreadWeaver::JobPointer(decorator));
             } else {
                 --m_maxParseJobs;
             }
@@ -345,9 +635,39 @@ public:
             }
         }
 
+        if (m_documents.isEmpty() && m_parseJobs.isEmpty()) {
+            // Drop the contents that were not taken, e.g. because the requests were reverted
+            m_prefetcher.clear();
+        } else {
+            prefetchUpcoming();
+        }
+
         m_parser->updateProgressData();
     }
 
+    // Reads the files of the project documents that are parsed next ahead, in the order
+    // nextDocumentToParse() is going to pick them once threads are free, until the prefetcher is full
+    void prefetchUpcoming()
+    {
+        if (!FilePrefetcher::enabled()) {
+            return;
+        }
+
+        visitStartableDocuments(false, [this] (const IndexedString& url, int priority) {
+            // Documents with an interactive priority are usually open in an editor
+            if (priority <= BackgroundParser::NormalPriority || artificialCodeRepresentationExists(url)) {
+                return true;
+            }
+            {
+                QMutexLocker lock(&m_managedMutex);
+                if (m_managed.contains(url)) {
+                    return true;
+                }
+            }
+            return m_prefetcher.prefetch(url);
+        });
+    }
+
     // NOTE: you must not access any of the data structures that are protected by any of the
     //       background parser internal mutexes in this method
     //       see also: https://bugs.kde.org/show_bug.cgi?id=355100
@@ -440,8 +760,8 @@ config.readEntry(entry, oldConfig.readEntry(entry, default))
     {
         qCDebug(LANGUAGE) << "Suspending background parser";
 
-        bool s = m_weaver.state()->stateId() == ThreadWeaver::Suspended ||
-                 m_weaver.state()->stateId() == ThreadWeaver::Suspending;
+        bool s = m_lanes[BackgroundParser::BulkLane].state()->stateId() == ThreadWeaver::Suspended ||
+                 m_lanes[BackgroundParser::BulkLane].state()->stateId() == ThreadWeaver::Suspending;
 
         if (s) { // Already suspending
             qCWarning(LANGUAGE) << "Already suspended or suspending";
@@ -449,33 +769,36 @@ config.readEntry(entry, oldConfig.readEntry(entry, default))
         }
 
         m_timer.stop();
-        m_weaver.suspend();
+        for (auto& lane : m_lanes) {
+            lane.suspend();
+        }
     }
 
     void resume()
     {
-        bool s = m_weaver.state()->stateId() == ThreadWeaver::Suspended ||
-                 m_weaver.state()->stateId() == ThreadWeaver::Suspending;
+        bool s = m_lanes[BackgroundParser::BulkLane].state()->stateId() == ThreadWeaver::Suspended ||
+                 m_lanes[BackgroundParser::BulkLane].state()->stateId() == ThreadWeaver::Suspending;
 
         if (m_timer.isActive() && !s) { // Not suspending
             return;
         }
 
         m_timer.start(m_delay);
-        m_weaver.resume();
+        for (auto& lane : m_lanes) {
+            lane.resume();
+        }
     }
 
     BackgroundParser *m_parser;
     ILanguageController* m_languageController;
 
-    //Current parse-job that is executed in the additional thread
-    QPointer<QObject> specialParseJob;
-
     QTimer m_timer;
     int m_delay = 500;
     int m_threads = 1;
 
     bool m_shuttingDown;
+    // Whether documents are held back until their imports have been parsed
+    bool m_dependencyScheduling;
 
     // A list of documents that are planned to be parsed, and their priority
     QHash<IndexedString, DocumentParsePlan > m_documents;
@@ -483,12 +806,33 @@ config.readEntry(entry, oldConfig.readEntry(entry, default))
     QMap<int, QSet<IndexedString> > m_documentsForPriority;
     // Currently running parse jobs
     QHash<IndexedString, ThreadWeaver::QObjectDecorator*> m_parseJobs;
+    // The lane each running parse job was started in
+    QHash<IndexedString, BackgroundParser::Lane> m_jobLanes;
+    FilePrefetcher m_prefetcher;
+    // The imports of each document, as far as they are known
+    QHash<IndexedString, QVector<IndexedString> > m_knownImports;
+    // The queued documents whose imports were not looked up in the duchain yet, see resolveDependencies()
+    QSet<IndexedString> m_unresolvedDependencies;
+    // Count of queued reparses that were dropped, because the document was updated as an import of another one
+    int m_droppedReparses = 0;
+    // Count of parse jobs in the current batch that found the contents unchanged
+    int m_skippedParseJobs = 0;
     // The url for each managed document. Those may temporarily differ from the real url.
     QHash<KTextEditor::Document*, IndexedString> m_managedTextDocumentUrls;
     // Projects currently in progress of loading
     QSet<IProject*> m_loadingProjects;
 
-    ThreadWeaver::Queue m_weaver;
+    struct LaneState
+    {
+        int running = 0;
+        quint64 started = 0;
+        qint64 totalLatency = 0;
+        qint64 maximumLatency = 0;
+    };
+
+    // One queue per BackgroundParser::Lane
+    ThreadWeaver::Queue m_lanes[2];
+    LaneState m_laneStates[2];
 
     // generic high-level mutex
     QMutex m_mutex;
@@ -589,6 +933,7 @@ void BackgroundParser::addDocument(const IndexedString& url, TopDUContext::Featu
 {
 //     qCDebug(LANGUAGE) << "BackgroundParser::addDocument" << url.toUrl();
     Q_ASSERT(isValidURL(url));
+
     QMutexLocker lock(&d->m_mutex);
     {
         DocumentParseTarget target;
@@ -608,6 +953,16 @@ void BackgroundParser::addDocument(const IndexedString& url, TopDUContext::Featu
         }else{
 //             qCDebug(LANGUAGE) << "BackgroundParser::addDocument: queuing" << cleanedUrl;
             d->m_documents[url].targets << target;
+            if (d->m_dependencyScheduling) {
+                // The duchain is only looked at by the scheduler, for all documents queued meanwhile at once
+                const auto importsIt = d->m_knownImports.constFind(url);
+                if (importsIt != d->m_knownImports.constEnd()) {
+                    d->m_documents[url].dependencies = *importsIt;
+                } else {
+                    d->m_unresolvedDependencies.insert(url);
+                }
+            }
+            d->m_documents[url].queuedSince.start();
             d->m_documentsForPriority[d->m_documents[url].priority()].insert(url);
             ++d->m_maxParseJobs; //So the progress-bar waits for this document
         }
@@ -637,6 +992,7 @@ void BackgroundParser::removeDocument(const IndexedString& url, QObject* notifyW
 
         if(d->m_documents[url].targets.isEmpty()) {
             d->m_documents.remove(url);
+            d->m_prefetcher.discard(url);
             --d->m_maxParseJobs;
         }else{
             //Insert with an eventually different priority
@@ -651,6 +1007,9 @@ void BackgroundParser::parseDocuments()
         startTimer(d->m_delay);
         return;
     }
+    if (d->m_dependencyScheduling) {
+        d->resolveDependencies();
+    }
     QMutexLocker lock(&d->m_mutex);
 
     d->parseDocumentsInternal();
@@ -664,17 +1023,48 @@ void BackgroundParser::parseComplete(const ThreadWeaver::JobPointer& job)
     Q_ASSERT(parseJob);
     emit parseJobFinished(parseJob);
 
+    if (d->m_dependencyScheduling) {
+        d->updateAfterParse(parseJob);
+    }
+
     {
         QMutexLocker lock(&d->m_mutex);
 
         d->m_parseJobs.remove(parseJob->document());
+        --d->m_laneStates[d->m_jobLanes.take(parseJob->document())].running;
+        // Jobs that found the document up to date return before reading the contents
+        d->m_prefetcher.discard(parseJob->document());
 
         d->m_jobProgress.remove(parseJob);
 
+        if (parseJob->skippedUnchangedContents()) {
+            ++d->m_skippedParseJobs;
+        }
         ++d->m_doneParseJobs;
         updateProgressData();
     }
 
+    if (parseJob->wasPreempted()) {
+        // Queue the document again, the targets are notified by the job that finally parses it
+        const auto notify = parseJob->notifyWhenReady();
+        parseJob->setNotifyWhenReady({});
+
+        ParseJob::SequentialProcessingFlags flags = ParseJob::IgnoresSequentialProcessing;
+        if (parseJob->requiresSequentialProcessing()) {
+            flags |= ParseJob::RequiresSequentialProcessing;
+        }
+        if (parseJob->respectsSequentialProcessing()) {
+            flags |= ParseJob::RespectsSequentialProcessing;
+        }
+
+        if (notify.isEmpty()) {
+            addDocument(parseJob->document(), parseJob->minimumFeatures(), parseJob->parsePriority(), nullptr, flags);
+        }
+        for (const auto& target : notify) {
+            addDocument(parseJob->document(), parseJob->minimumFeatures(), parseJob->parsePriority(), target.data(), flags);
+        }
+    }
+
     //Continue creating more parse-jobs
     QMetaObject::invokeMethod(this, "parseDocuments", Qt::QueuedConnection);
 }
@@ -712,7 +1102,7 @@ int BackgroundParser::queuedCount() const
 bool BackgroundParser::isIdle() const
 {
     QMutexLocker lock(&d->m_mutex);
-    return d->m_documents.isEmpty() && d->m_weaver.isIdle();
+    return d->m_documents.isEmpty() && d->m_lanes[InteractiveLane].isIdle() && d->m_lanes[BulkLane].isIdle();
 }
 
 void BackgroundParser::setNeededPriority(int priority)
@@ -726,7 +1116,9 @@ void BackgroundParser::abortAllJobs()
 {
     qCDebug(LANGUAGE) << "Aborting all parse jobs";
 
-    d->m_weaver.requestAbort();
+    for (auto& lane : d->m_lanes) {
+        lane.requestAbort();
+    }
 }
 
 void BackgroundParser::suspend()
@@ -750,6 +1142,16 @@ void BackgroundParser::updateProgressData()
         }
         d->m_doneParseJobs = 0;
         d->m_maxParseJobs = 0;
+
+        const auto prefetched = d->m_prefetcher.statistics();
+        qCDebug(LANGUAGE) << "prefetched" << prefetched.prefetched << "files so far," << prefetched.hits
+                          << "of them were taken by parse jobs";
+
+        if (d->m_skippedParseJobs) {
+            qCDebug(LANGUAGE) << "skipped" << d->m_skippedParseJobs << "documents with unchanged contents";
+            emit showMessage(this, i18np("Skipped 1 unchanged file", "Skipped %1 unchanged files", d->m_skippedParseJobs), 5000);
+            d->m_skippedParseJobs = 0;
+        }
     } else {
         float additionalProgress = 0;
         for (auto it = d->m_jobProgress.constBegin(); it != d->m_jobProgress.constEnd(); ++it) {
@@ -766,7 +1168,8 @@ void BackgroundParser::updateProgressData()
 
     // Cancel progress updating and hide progress-bar when parsing is done.
     if(d->m_doneParseJobs == d->m_maxParseJobs
-        || (d->m_neededPriority == BackgroundParser::BestPriority && d->m_weaver.queueLength() == 0))
+        || (d->m_neededPriority == BackgroundParser::BestPriority
+            && d->m_lanes[InteractiveLane].queueLength() == 0 && d->m_lanes[BulkLane].queueLength() == 0))
     {
         if (d->m_progressTimer.isActive()) {
             d->m_progressTimer.stop();
@@ -775,6 +1178,31 @@ void BackgroundParser::updateProgressData()
     }
 }
 
+FilePrefetcher* BackgroundParser::prefetcher() const
+{
+    return &d->m_prefetcher;
+}
+
+BackgroundParser::LaneStatistics BackgroundParser::laneStatistics(Lane lane) const
+{
+    QMutexLocker lock(&d->m_mutex);
+    const auto& state = d->m_laneStates[lane];
+
+    LaneStatistics ret;
+    ret.queued = 0;
+    for (auto it = d->m_documentsForPriority.constBegin(); it != d->m_documentsForPriority.constEnd(); ++it) {
+        if ((it.key() <= NormalPriority) == (lane == InteractiveLane)) {
+            ret.queued += it->size();
+        }
+    }
+    ret.running = state.running;
+    ret.threads = d->laneCapacity(lane);
+    ret.started = state.started;
+    ret.averageLatency = state.started ? state.totalLatency / qint64(state.started) : 0;
+    ret.maximumLatency = state.maximumLatency;
+    return ret;
+}
+
 ParseJob* BackgroundParser::parseJobForDocument(const IndexedString& document) const
 {
     Q_ASSERT(isValidURL(document));
@@ -788,7 +1216,8 @@ void BackgroundParser::setThreadCount(int threadCount)
 {
     if (d->m_threads != threadCount) {
         d->m_threads = threadCount;
-        d->m_weaver.setMaximumNumberOfThreads(d->m_threads+1); //1 Additional thread for high-priority parsing
+        d->m_lanes[BulkLane].setMaximumNumberOfThreads(d->m_threads);
+        d->m_lanes[InteractiveLane].setMaximumNumberOfThreads(interactiveThreads);
     }
 }
 
@@ -47,6 +47,7 @@ namespace KDevelop
 {
 
 class DocumentChangeTracker;
+class FilePrefetcher;
 
 class IDocument;
 class IProject;
@@ -74,7 +75,7 @@ public:
     enum {
         BestPriority = -10000,  ///Best possible job-priority. No jobs should actually have this.
         NormalPriority = 0,     ///Standard job-priority. This priority is used for parse-jobs caused by document-editing/opening.
-                                ///There is an additional parsing-thread reserved for jobs with this and better priority, to improve responsiveness.
+                                ///Jobs with this and better priority run in the InteractiveLane, to improve responsiveness.
         InitialParsePriority = 10000, ///Priority used when adding file on project loading
         WorstPriority = 100000  ///Worst possible job-priority.
     };
@@ -90,7 +91,29 @@ public:
     Q_SCRIPTABLE ParseJob* parseJobForDocument(const IndexedString& document) const;
 
     /**
-     * Set how many ThreadWeaver threads the background parser should set up and use.
+     * The parse jobs are run in separate lanes, so parsing the current document is not delayed by project parsing.
+     */
+    enum Lane {
+        InteractiveLane = 0, ///Has an own thread for documents with NormalPriority or better. When it is busy,
+                             ///these documents take free threads of the BulkLane.
+        BulkLane = 1         ///Runs all other documents, with the configured thread count. While interactive jobs
+                             ///are running, it starts fewer jobs, so they get a core each.
+    };
+
+    struct LaneStatistics
+    {
+        int queued;            ///Count of documents waiting to be parsed with a priority of this lane
+        int running;           ///Count of parse jobs running in this lane
+        int threads;           ///Count of parse jobs this lane may currently run at the same time
+        quint64 started;       ///Count of parse jobs started in this lane so far
+        qint64 averageLatency; ///Average time in milliseconds from queuing a document until its parse job started
+        qint64 maximumLatency; ///Maximum time in milliseconds from queuing a document until its parse job started
+    };
+
+    LaneStatistics laneStatistics(Lane lane) const;
+
+    /**
+     * Set how many ThreadWeaver threads the background parser should set up and use for the BulkLane.
      */
     Q_SCRIPTABLE void setThreadCount(int threadCount);
 
@@ -117,6 +140,12 @@ public:
      * */
     DocumentChangeTracker* trackerForUrl(const IndexedString& url) const;
 
+    /**
+     * Returns the prefetcher that reads the files of queued project documents ahead of their parse jobs.
+     * This function is thread-safe.
+     * */
+    FilePrefetcher* prefetcher() const;
+
 Q_SIGNALS:
     /**
      * Emitted whenever a document parse-job has finished.
@@ -165,6 +194,7 @@ public Q_SLOTS:
      * Queues up the @p url to be parsed.
      * @p features The minimum features that should be computed for this top-context
      * @p priority A value that manages the order of parsing. Documents with lowest priority are parsed first.
+     *             Queued documents that @p url imported in its last parse run are parsed before it, unless their priority is worse.
      * @param notifyWhenReady An optional pointer to a QObject that should contain a slot
      *                        "void updateReady(KDevelop::IndexedString url, KDevelop::ReferencedTopDUContext topContext)".
      *                        The notification is guaranteed to be called once for each call to addDocument. The given top-context
@@ -198,7 +228,7 @@ public Q_SLOTS:
     /// This can be used to temporarily limit the processing to only the most important jobs.
     /// To only enable processing for important jobs, call setNeededPriority(0).
     /// This should only be used to temporarily alter the processing. A progress-bar
-    /// will still be shown for the not yet processed jobs.
+    /// will still be shown for the not yet processed jobs. Jobs that are already running are finished.
     void setNeededPriority(int priority);
     /// Disables all processing of new jobs, equivalent to setNeededPriority(BestPriority)
     void disableProcessing();
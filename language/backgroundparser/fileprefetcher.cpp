@@ -0,0 +1,235 @@
+/* This file is part of KDevelop
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "fileprefetcher.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtConcurrentRun>
+
+#include <serialization/indexedstring.h>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
+namespace KDevelop {
+
+namespace {
+
+// Count of reads that are in flight at the same time
+const int IoThreads = 4;
+// Bounds of the prefetched data that has not been taken yet
+const int MaximumFiles = 64;
+const qint64 MaximumBytes = 32 * 1024 * 1024;
+// Larger files are skipped by ParseJob::readContents(), which also reports the problem
+const qint64 MaximumFileSize = 5 * 1024 * 1024;
+
+bool prefetchEnabled = !qEnvironmentVariableIsSet("KDEV_BACKGROUNDPARSER_NO_PREFETCH");
+
+struct PrefetchedFile
+{
+    enum State {
+        Pending, ///< Waits for an I/O thread
+        Reading,
+        Done
+    };
+
+    State state;
+    // Identifies the read, so a finished read does not fill in a file that was discarded and prefetched again
+    quint64 id;
+    QDateTime lastModified;
+    QByteArray contents;
+};
+
+}
+
+class FilePrefetcherPrivate
+{
+public:
+    FilePrefetcherPrivate()
+        : bytes(0)
+        , nextId(0)
+    {
+        statistics.prefetched = 0;
+        statistics.hits = 0;
+        statistics.bytes = 0;
+        pool.setMaxThreadCount(IoThreads);
+    }
+
+    void read(const IndexedString& url, quint64 id)
+    {
+        {
+            QMutexLocker lock(&mutex);
+            auto it = files.find(url);
+            if (it == files.end() || it->id != id || it->state != PrefetchedFile::Pending) {
+                return;
+            }
+            it->state = PrefetchedFile::Reading;
+        }
+
+        const QString localFile = url.toUrl().toLocalFile();
+        const QFileInfo fileInfo(localFile);
+        const QDateTime lastModified = fileInfo.lastModified();
+
+        QByteArray contents;
+        QFile file(localFile);
+        bool success = fileInfo.size() <= MaximumFileSize && file.open(QIODevice::ReadOnly);
+        if (success) {
+#ifdef Q_OS_LINUX
+            // The whole file is read at once, so let the kernel use a larger readahead window
+            posix_fadvise(file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            contents = file.readAll();
+            success = file.error() == QFile::NoError;
+        }
+
+        QMutexLocker lock(&mutex);
+        auto it = files.find(url);
+        if (it != files.end() && it->id == id) {
+            if (success) {
+                it->state = PrefetchedFile::Done;
+                it->lastModified = lastModified;
+                it->contents = contents;
+                bytes += contents.size();
+                ++statistics.prefetched;
+                statistics.bytes += contents.size();
+            } else {
+                // The parse job reads the file again and reports the error
+                files.erase(it);
+            }
+        }
+        readFinished.wakeAll();
+    }
+
+    void remove(QHash<IndexedString, PrefetchedFile>::iterator it)
+    {
+        bytes -= it->contents.size();
+        files.erase(it);
+    }
+
+    mutable QMutex mutex;
+    QWaitCondition readFinished;
+    QHash<IndexedString, PrefetchedFile> files;
+    qint64 bytes;
+    quint64 nextId;
+    FilePrefetcher::Statistics statistics;
+    QThreadPool pool;
+};
+
+FilePrefetcher::FilePrefetcher()
+    : d(new FilePrefetcherPrivate)
+{
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+    clear();
+    d->pool.waitForDone();
+    delete d;
+}
+
+bool FilePrefetcher::prefetch(const IndexedString& url)
+{
+    if (!prefetchEnabled) {
+        return false;
+    }
+
+    QMutexLocker lock(&d->mutex);
+    if (d->files.size() >= MaximumFiles || d->bytes >= MaximumBytes) {
+        return false;
+    }
+    if (d->files.contains(url)) {
+        return true;
+    }
+
+    PrefetchedFile file;
+    file.state = PrefetchedFile::Pending;
+    file.id = ++d->nextId;
+    d->files.insert(url, file);
+
+    auto priv = d;
+    const quint64 id = file.id;
+    QtConcurrent::run(&d->pool, [priv, url, id] () {
+        priv->read(url, id);
+    });
+    return true;
+}
+
+bool FilePrefetcher::take(const IndexedString& url, const QDateTime& lastModified, QByteArray* contents)
+{
+    QMutexLocker lock(&d->mutex);
+    auto it = d->files.find(url);
+    // Reading the file a second time would only compete with the running read
+    while (it != d->files.end() && it->state == PrefetchedFile::Reading) {
+        d->readFinished.wait(&d->mutex);
+        it = d->files.find(url);
+    }
+    if (it == d->files.end()) {
+        return false;
+    }
+
+    // A read that did not start yet is dropped, the caller reads the file right away
+    if (it->state == PrefetchedFile::Pending || it->lastModified != lastModified) {
+        d->remove(it);
+        return false;
+    }
+
+    *contents = it->contents;
+    d->remove(it);
+    ++d->statistics.hits;
+    return true;
+}
+
+void FilePrefetcher::discard(const IndexedString& url)
+{
+    QMutexLocker lock(&d->mutex);
+    auto it = d->files.find(url);
+    if (it != d->files.end()) {
+        d->remove(it);
+    }
+}
+
+void FilePrefetcher::clear()
+{
+    QMutexLocker lock(&d->mutex);
+    d->files.clear();
+    d->bytes = 0;
+}
+
+FilePrefetcher::Statistics FilePrefetcher::statistics() const
+{
+    QMutexLocker lock(&d->mutex);
+    return d->statistics;
+}
+
+bool FilePrefetcher::enabled()
+{
+    return prefetchEnabled;
+}
+
+void FilePrefetcher::setEnabled(bool enabled)
+{
+    prefetchEnabled = enabled;
+}
+
+}
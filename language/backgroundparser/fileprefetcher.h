@@ -0,0 +1,90 @@
+/* This file is part of KDevelop
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KDEVPLATFORM_FILEPREFETCHER_H
+#define KDEVPLATFORM_FILEPREFETCHER_H
+
+#include <QByteArray>
+#include <QDateTime>
+
+#include <language/languageexport.h>
+
+namespace KDevelop {
+
+class IndexedString;
+class FilePrefetcherPrivate;
+
+/**
+ * Reads the files of queued documents ahead of their parse jobs.
+ *
+ * The files are read by a small pool of I/O threads, so several reads are in flight while the parse threads
+ * are busy, which matters on spinning disks and network file systems where the initial parsing of a project
+ * is bound by the latency of the reads. ParseJob::readContents() takes the prefetched contents, the data is
+ * shared and not copied.
+ *
+ * The amount of prefetched data is bounded, prefetch() refuses further files until the contents are taken.
+ *
+ * This class is thread-safe.
+ */
+class KDEVPLATFORMLANGUAGE_EXPORT FilePrefetcher
+{
+public:
+    struct Statistics
+    {
+        quint64 prefetched; ///< Files that have been read ahead
+        quint64 hits; ///< Prefetched files whose contents were taken by a parse job
+        quint64 bytes; ///< Bytes that have been read ahead
+    };
+
+    FilePrefetcher();
+    /// Waits for the running reads.
+    ~FilePrefetcher();
+
+    /**
+     * Starts reading the file of @p url in the background, unless it is already being prefetched.
+     *
+     * @return False if no more files can be prefetched until some contents are taken.
+     */
+    bool prefetch(const IndexedString& url);
+
+    /**
+     * Takes the prefetched contents of @p url. If the file is being read right now, waits for the read to finish.
+     *
+     * @param lastModified The modification time of the file, prefetched contents of another modification are dropped.
+     * @return False if there are no prefetched contents, then the caller has to read the file itself.
+     */
+    bool take(const IndexedString& url, const QDateTime& lastModified, QByteArray* contents);
+
+    /// Drops the prefetched contents of @p url, or the pending read.
+    void discard(const IndexedString& url);
+    /// Drops all prefetched contents and pending reads.
+    void clear();
+
+    Statistics statistics() const;
+
+    /// Whether files are prefetched at all. Enabled by default, the environment variable KDEV_BACKGROUNDPARSER_NO_PREFETCH disables it.
+    static bool enabled();
+    static void setEnabled(bool enabled);
+
+private:
+    Q_DISABLE_COPY(FilePrefetcher)
+    FilePrefetcherPrivate* const d;
+};
+
+}
+
+#endif
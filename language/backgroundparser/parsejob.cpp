@@ -23,9 +23,14 @@
 #include "parsejob.h"
 
 #include <QFile>
+#include <QFileInfo>
 #include <QByteArray>
+#include <QtEndian>
+
+#include <cstring>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QSet>
 #include <QApplication>
 #include <QDebug>
 
@@ -34,6 +39,7 @@
 #include <ktexteditor/movinginterface.h>
 
 #include "backgroundparser.h"
+#include "fileprefetcher.h"
 #include "util/debug.h"
 #include "duchain/topducontext.h"
 
@@ -59,6 +65,263 @@ static QHash<KDevelop::IndexedString, QList<KDevelop::TopDUContext::Features> >
 namespace KDevelop
 {
 
+namespace {
+
+bool contentHashing = !qEnvironmentVariableIsSet("KDEV_PARSEJOB_NO_CONTENT_HASH");
+
+const quint64 Prime1 = 11400714785074694791ULL;
+const quint64 Prime2 = 14029467366897019727ULL;
+const quint64 Prime3 = 1609587929392839161ULL;
+const quint64 Prime4 = 9650029242287828579ULL;
+const quint64 Prime5 = 2870177450012600261ULL;
+
+inline quint64 rotateLeft(quint64 value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline quint64 read64(const char* data)
+{
+    quint64 value;
+    memcpy(&value, data, sizeof(value));
+    return qFromLittleEndian(value);
+}
+
+inline quint32 read32(const char* data)
+{
+    quint32 value;
+    memcpy(&value, data, sizeof(value));
+    return qFromLittleEndian(value);
+}
+
+inline quint64 hashRound(quint64 accumulator, quint64 input)
+{
+    accumulator += input * Prime2;
+    return rotateLeft(accumulator, 31) * Prime1;
+}
+
+inline quint64 mergeRound(quint64 accumulator, quint64 value)
+{
+    accumulator ^= hashRound(0, value);
+    return accumulator * Prime1 + Prime4;
+}
+
+/**
+ * Computes the 64-bit xxHash of @p contents. Zero is reserved for "unknown", so it is never returned.
+ */
+quint64 contentHash(const QByteArray& contents)
+{
+    const char* data = contents.constData();
+    const char* const end = data + contents.size();
+    quint64 hash;
+
+    if (contents.size() >= 32) {
+        quint64 v1 = Prime1 + Prime2;
+        quint64 v2 = Prime2;
+        quint64 v3 = 0;
+        quint64 v4 = 0 - Prime1;
+        for (; data + 32 <= end; data += 32) {
+            v1 = hashRound(v1, read64(data));
+            v2 = hashRound(v2, read64(data + 8));
+            v3 = hashRound(v3, read64(data + 16));
+            v4 = hashRound(v4, read64(data + 24));
+        }
+        hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+        hash = mergeRound(hash, v1);
+        hash = mergeRound(hash, v2);
+        hash = mergeRound(hash, v3);
+        hash = mergeRound(hash, v4);
+    } else {
+        hash = Prime5;
+    }
+
+    hash += contents.size();
+
+    for (; data + 8 <= end; data += 8) {
+        hash ^= hashRound(0, read64(data));
+        hash = rotateLeft(hash, 27) * Prime1 + Prime4;
+    }
+    if (data + 4 <= end) {
+        hash ^= quint64(read32(data)) * Prime1;
+        hash = rotateLeft(hash, 23) * Prime2 + Prime3;
+        data += 4;
+    }
+    for (; data < end; ++data) {
+        hash ^= quint64(uchar(*data)) * Prime5;
+        hash = rotateLeft(hash, 11) * Prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= Prime2;
+    hash ^= hash >> 29;
+    hash *= Prime3;
+    hash ^= hash >> 32;
+
+    return hash ? hash : 1;
+}
+
+/**
+ * Hashes the file of @p url, or returns zero if it can not be read or its modification-time
+ * is not the one of @p revision anymore.
+ *
+ * Reads from disk, so no duchain lock should be held.
+ */
+quint64 hashFile(const IndexedString& url, const ModificationRevision& revision)
+{
+    const QString localFile = url.toUrl().toLocalFile();
+    QFile disk(localFile);
+    if (ModificationRevision(QFileInfo(localFile).lastModified()) != revision || !disk.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    const QByteArray contents = disk.readAll();
+    // The file may have been written while it was read
+    if (disk.error() != QFile::NoError || ModificationRevision(QFileInfo(localFile).lastModified()) != revision) {
+        return 0;
+    }
+    return contentHash(contents);
+}
+
+bool tracksContentsOnDisk(const IndexedString& url)
+{
+    // Open documents are parsed from the editor, the contents on disk don't matter
+    return !artificialCodeRepresentationExists(url)
+        && !ICore::self()->languageController()->backgroundParser()->trackerForUrl(url);
+}
+
+/// A file whose modification-time changed since it was parsed
+struct ChangedFile
+{
+    IndexedString url;
+    quint64 contentHash;
+    ModificationRevision parsedRevision;
+    ModificationRevision currentRevision;
+};
+
+/**
+ * Collects the files among @p file and its recursive imports whose modification-times changed.
+ *
+ * @p visited receives all checked files, and @p changedFiles the files whose contents have to be hashed
+ * to tell whether they changed.
+ *
+ * The duchain must be read-locked. No file is read here, see contentsUnchanged().
+ *
+ * @return False if one of the files has to be parsed again in any case.
+ */
+bool collectChangedFiles(const ParsingEnvironmentFilePointer& file, QSet<ParsingEnvironmentFilePointer>& visited,
+                         QVector<ChangedFile>& changedFiles)
+{
+    if (visited.contains(file)) {
+        return true;
+    }
+    visited.insert(file);
+
+    const IndexedString url = file->url();
+    const ModificationRevision current = ModificationRevision::revisionForFile(url);
+    if (current != file->modificationRevision()) {
+        if (!file->contentHash() || !tracksContentsOnDisk(url)) {
+            return false;
+        }
+        changedFiles.append({url, file->contentHash(), file->modificationRevision(), current});
+    }
+
+    foreach (const ParsingEnvironmentFilePointer& import, file->imports()) {
+        if (import->needsUpdate() && !collectChangedFiles(import, visited, changedFiles)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks whether the contents of @p changedFiles are the same as when they were parsed.
+ *
+ * Reads the files, so no duchain lock should be held.
+ */
+bool contentsUnchanged(const QVector<ChangedFile>& changedFiles)
+{
+    for (const ChangedFile& changed : changedFiles) {
+        if (hashFile(changed.url, changed.currentRevision) != changed.contentHash) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QMutex hashedImportsMutex;
+/// The ParsingEnvironmentFile::allModificationRevisions() of documents whose recursive imports all got a hash if possible
+QHash<IndexedString, uint> hashedImports;
+
+/**
+ * Records the content hashes of the recursive imports of @p top that have none yet.
+ *
+ * Imported files are often parsed by the job of the importing document, so they would never get
+ * a hash otherwise. Each file is hashed only once, until it is parsed again. The imports are only
+ * walked again once the modification-revisions of the document or one of its imports changed.
+ *
+ * No duchain lock should be held.
+ */
+void recordImportedContentHashes(const ReferencedTopDUContext& top)
+{
+    QHash<IndexedString, QPair<ModificationRevision, quint64>> hashes;
+    IndexedString document;
+    uint revisions = 0;
+    {
+        DUChainReadLocker lock;
+        const ParsingEnvironmentFilePointer file = top->parsingEnvironmentFile();
+        if (!file) {
+            return;
+        }
+        document = file->url();
+        revisions = file->allModificationRevisions().index();
+        {
+            QMutexLocker hashedLock(&hashedImportsMutex);
+            if (hashedImports.value(document) == revisions) {
+                return;
+            }
+        }
+        QSet<ParsingEnvironmentFilePointer> visited;
+        QVector<ParsingEnvironmentFilePointer> pending = file->imports().toVector();
+        while (!pending.isEmpty()) {
+            const ParsingEnvironmentFilePointer import = pending.takeLast();
+            if (visited.contains(import)) {
+                continue;
+            }
+            visited.insert(import);
+            pending += import->imports().toVector();
+
+            const IndexedString url = import->url();
+            if (!import->contentHash() && !hashes.contains(url) && tracksContentsOnDisk(url)
+                && import->modificationRevision() == ModificationRevision::revisionForFile(url))
+            {
+                hashes.insert(url, qMakePair(import->modificationRevision(), quint64(0)));
+            }
+        }
+    }
+    if (!hashes.isEmpty()) {
+        for (auto it = hashes.begin(); it != hashes.end(); ++it) {
+            it->second = hashFile(it.key(), it->first);
+        }
+
+        DUChainWriteLocker lock;
+        for (auto it = hashes.constBegin(); it != hashes.constEnd(); ++it) {
+            if (!it->second) {
+                continue;
+            }
+            foreach (const ParsingEnvironmentFilePointer& file, DUChain::self()->allEnvironmentFiles(it.key())) {
+                // Files that have been parsed meanwhile got the hash of their own contents
+                if (!file->contentHash() && file->modificationRevision() == it->first) {
+                    file->setContentHash(it->second);
+                }
+            }
+        }
+    }
+
+    QMutexLocker hashedLock(&hashedImportsMutex);
+    hashedImports.insert(document, revisions);
+}
+
+}
+
 class ParseJobPrivate
 {
 public:
@@ -67,8 +330,12 @@ public:
           url( url_ )
         , languageSupport( languageSupport_ )
         , abortRequested( 0 )
+        , preemptionRequested( 0 )
+        , preemptionObserved( 0 )
         , hasReadContents( false )
         , aborted( false )
+        , skippedUnchangedContents( false )
+        , contentHash( 0 )
         , features( TopDUContext::VisibleDeclarationsAndContexts )
         , parsePriority( 0 )
         , sequentialProcessingFlags( ParseJob::IgnoresSequentialProcessing )
@@ -87,9 +354,15 @@ public:
     ParseJob::Contents contents;
 
     QAtomicInt abortRequested;
+    QAtomicInt preemptionRequested;
+    // Set once abortRequested() reported the preemption, from then on the job may have stopped early
+    mutable QAtomicInt preemptionObserved;
 
     bool hasReadContents : 1;
     bool aborted : 1;
+    bool skippedUnchangedContents : 1;
+    // Hash of the contents read from disk, or zero
+    quint64 contentHash;
     TopDUContext::Features features;
     QList<QPointer<QObject> > notify;
     QPointer<DocumentChangeTracker> tracker;
@@ -158,6 +431,11 @@ bool ParseJob::success() const
     return !d->aborted;
 }
 
+bool ParseJob::skippedUnchangedContents() const
+{
+    return d->skippedUnchangedContents;
+}
+
 void ParseJob::setMinimumFeatures(TopDUContext::Features features)
 {
     d->features = features;
@@ -198,7 +476,29 @@ ReferencedTopDUContext ParseJob::duChain() const
 
 bool ParseJob::abortRequested() const
 {
-    return d->abortRequested.load();
+    if (d->abortRequested.load()) {
+        return true;
+    }
+    if (d->preemptionRequested.load()) {
+        d->preemptionObserved = 1;
+        return true;
+    }
+    return false;
+}
+
+void ParseJob::requestPreemption()
+{
+    d->preemptionRequested = 1;
+}
+
+bool ParseJob::preemptionRequested() const
+{
+    return d->preemptionRequested.load();
+}
+
+bool ParseJob::wasPreempted() const
+{
+    return d->preemptionObserved.load() && !d->abortRequested.load();
 }
 
 void ParseJob::requestAbort()
@@ -217,6 +517,11 @@ void ParseJob::setNotifyWhenReady(const QList<QPointer< QObject > >& notify
     d->notify = notify;
 }
 
+QList<QPointer<QObject> > ParseJob::notifyWhenReady() const
+{
+    return d->notify;
+}
+
 void ParseJob::setStaticMinimumFeatures(const IndexedString& url, TopDUContext::Features features) {
     QMutexLocker lock(&minimumFeaturesMutex);
     ::staticMinimumFeatures[url].append(features);
@@ -286,6 +591,17 @@ KDevelop::ProblemPointer ParseJob::readContents()
             qCWarning(LANGUAGE) << p->description() << p->explanation();
             return p;
         }
+
+        // The contents may have been read ahead while the parse threads were busy
+        auto prefetcher = ICore::self()->languageController()->backgroundParser()->prefetcher();
+        if (prefetcher->take(document(), lastModified, &d->contents.contents)) {
+            d->contents.modification = KDevelop::ModificationRevision(lastModified);
+            if (contentHashing) {
+                d->contentHash = contentHash(d->contents.contents);
+            }
+            return KDevelop::ProblemPointer();
+        }
+
         QFile file( localFile );
 
         if ( !file.open( QIODevice::ReadOnly ) )
@@ -315,6 +631,9 @@ KDevelop::ProblemPointer ParseJob::readContents()
 
         d->contents.contents = file.readAll(); ///@todo Convert from local encoding to utf-8 if they don't match
         d->contents.modification = KDevelop::ModificationRevision(lastModified);
+        if (contentHashing) {
+            d->contentHash = contentHash(d->contents.contents);
+        }
 
         file.close();
     }
@@ -432,7 +751,9 @@ void ParseJob::translateDUChainToRevision(TopDUContext* context)
         // Perform translation
         MovingInterface* moving = t->documentMovingInterface();
 
-        DUChainWriteLocker wLock;
+        // Only this top-context is changed, so with top-context locking the scoped readers (see DUChainReadScope)
+        // of files that don't import it can proceed
+        TopDUContextWriteLocker wLock(context);
 
         MovingRangeTranslator translator(sourceRevision, targetRevision, moving);
         context->visit(translator);
@@ -470,18 +791,71 @@ bool ParseJob::isUpdateRequired(const IndexedString& languageString)
         if (file->language() != languageString) {
             continue;
         }
-        if (!file->needsUpdate(environment()) && file->featuresSatisfied(minimumFeatures())) {
-            qCDebug(LANGUAGE) << "Already up to date" << document().str();
-            setDuChain(file->topContext());
+        if (!file->featuresSatisfied(minimumFeatures())) {
+            break;
+        }
+        if (file->needsUpdate(environment())) {
+            if (!contentHashing) {
+                break;
+            }
+
+            QSet<ParsingEnvironmentFilePointer> visited;
+            QVector<ChangedFile> changedFiles;
+            if (!collectChangedFiles(file, visited, changedFiles) || changedFiles.isEmpty()) {
+                break;
+            }
+
+            // Don't block the duchain while the files are read
             lock.unlock();
-            highlightDUChain();
-            return false;
+            if (!contentsUnchanged(changedFiles) || abortRequested()) {
+                return !abortRequested();
+            }
+
+            // Only the modification-times changed, so move all checked files over to the current ones
+            DUChainWriteLocker writeLock;
+            foreach (const ParsingEnvironmentFilePointer& checked, visited) {
+                for (const ChangedFile& changed : changedFiles) {
+                    checked->replaceModificationRevision(changed.url, changed.parsedRevision, changed.currentRevision);
+                }
+            }
+            // Other dependencies may have changed as well, or the environment does not match
+            const bool needsUpdate = file->needsUpdate(environment());
+            writeLock.unlock();
+            lock.lock();
+            if (needsUpdate) {
+                break;
+            }
+            qCDebug(LANGUAGE) << "Contents unchanged" << document().str();
+            d->skippedUnchangedContents = true;
         }
-        break;
+        qCDebug(LANGUAGE) << "Already up to date" << document().str();
+        setDuChain(file->topContext());
+        lock.unlock();
+        highlightDUChain();
+        return false;
     }
     return !abortRequested();
 }
 
+void ParseJob::defaultEnd(const ThreadWeaver::JobPointer& self, ThreadWeaver::Thread* thread)
+{
+    if (d->duContext && !d->aborted && !wasPreempted()) {
+        // The language has set the modification-revision of the contents it parsed, so the hash belongs to it
+        if (d->contentHash && !d->skippedUnchangedContents) {
+            TopDUContextWriteLocker lock(d->duContext.data());
+            ParsingEnvironmentFilePointer file = d->duContext->parsingEnvironmentFile();
+            if (file && file->url() == d->url && file->modificationRevision() == d->contents.modification) {
+                file->setContentHash(d->contentHash);
+            }
+        }
+        if (contentHashing) {
+            recordImportedContentHashes(d->duContext);
+        }
+    }
+
+    ThreadWeaver::Sequence::defaultEnd(self, thread);
+}
+
 const ParsingEnvironment* ParseJob::environment() const
 {
     return nullptr;
@@ -138,6 +138,8 @@ public:
     */
     Q_SCRIPTABLE void setNotifyWhenReady(const QList<QPointer<QObject> >& notify);
 
+    QList<QPointer<QObject> > notifyWhenReady() const;
+
     /// Sets the du-context that was created by this parse-job
     Q_SCRIPTABLE virtual void setDuChain(ReferencedTopDUContext duChain);
     /// Returns the set du-context, or zero of none was set.
@@ -145,14 +147,26 @@ public:
 
     /// Overridden to allow jobs to determine if they've been requested to abort
     Q_SCRIPTABLE void requestAbort() override;
-    /// Determine if the job has been requested to abort
+    /// Determine if the job has been requested to abort, or has been preempted
     Q_SCRIPTABLE bool abortRequested() const;
+
+    /// Asks the job to stop, because a document with a better priority waits for a thread.
+    /// From then on abortRequested() returns true. Called by the background parser.
+    void requestPreemption();
+    bool preemptionRequested() const;
+    /// Whether the job may have stopped early because of a preemption, i.e. abortRequested() reported it.
+    /// The background parser queues the document again in that case.
+    bool wasPreempted() const;
     /// Sets success to false, causing failed() to be emitted
     Q_SCRIPTABLE void abortJob();
 
     /// Overridden to convey whether the job succeeded or not.
     Q_SCRIPTABLE bool success() const override;
 
+    /// Whether isUpdateRequired() found the contents of the document and its imports unchanged, although their
+    /// modification-times changed, so the existing top-context was kept
+    bool skippedUnchangedContents() const;
+
     /// Set the minimum features the resulting top-context should have
     Q_SCRIPTABLE void setMinimumFeatures(TopDUContext::Features features);
 
@@ -209,6 +223,9 @@ protected:
      * @param languageString The unique string identifying your language.
      * This must be the same as you assign to the DUChain's environment file.
      *
+     * When only the modification-times of the document or its imports changed, but not their contents,
+     * the stored modification-times are updated and no update is required.
+     *
      * @return True if an update is required, false if the job can return early.
      */
     bool isUpdateRequired(const IndexedString& languageString);
@@ -229,6 +246,9 @@ protected:
      */
     bool hasTracker() const;
 
+    /// Overridden to remember the hash of the parsed contents in the environment file of the new top-context
+    void defaultEnd(const ThreadWeaver::JobPointer& self, ThreadWeaver::Thread* thread) override;
+
 private:
     class ParseJobPrivate* const d;
 };
@@ -29,6 +29,7 @@
 #include <interfaces/icompletionsettings.h>
 
 #include <language/backgroundparser/backgroundparser.h>
+#include <language/backgroundparser/fileprefetcher.h>
 
 #include <KLocalizedString>
 
@@ -54,6 +55,7 @@ ParseProjectJob::ParseProjectJob(IProject* project, bool forceUpdate)
     : m_updated(0)
     , m_forceUpdate(forceUpdate)
     , m_project(project)
+    , m_prefetchHits(0)
 {
     connect(project, &IProject::destroyed, this, &ParseProjectJob::deleteNow);
 
@@ -89,8 +91,13 @@ void ParseProjectJob::updateReady(const IndexedString& url, ReferencedTopDUConte
     if(m_updated % ((m_filesToParse.size() / 100)+1) == 0)
         updateProgress();
 
-    if(m_updated >= m_filesToParse.size())
+    if(m_updated >= m_filesToParse.size()) {
+        const qint64 elapsed = qMax<qint64>(m_timer.elapsed(), 1);
+        const quint64 prefetchHits = ICore::self()->languageController()->backgroundParser()->prefetcher()->statistics().hits - m_prefetchHits;
+        qCDebug(LANGUAGE) << "parsed" << m_updated << "files of project" << m_project->name() << "in" << elapsed << "ms,"
+                          << m_updated * 1000 / elapsed << "files/s," << prefetchHits << "files read ahead";
         deleteLater();
+    }
 }
 
 void ParseProjectJob::start() {
@@ -104,6 +111,8 @@ void ParseProjectJob::start() {
     }
 
     qCDebug(LANGUAGE) << "starting project parse job";
+    m_timer.start();
+    m_prefetchHits = ICore::self()->languageController()->backgroundParser()->prefetcher()->statistics().hits;
 
     TopDUContext::Features processingLevel = m_filesToParse.size() < ICore::self()->languageController()->completionSettings()->minFilesForSimplifiedParsing() ?
                                     TopDUContext::VisibleDeclarationsAndContexts : TopDUContext::SimplifiedVisibleDeclarationsAndContexts;
@@ -23,6 +23,7 @@
 #include <serialization/indexedstring.h>
 #include <language/languageexport.h>
 
+#include <QElapsedTimer>
 #include <QSet>
 
 namespace KDevelop {
@@ -49,6 +50,10 @@ private:
     bool m_forceUpdate;
     KDevelop::IProject* m_project;
     QSet<IndexedString> m_filesToParse;
+    // Measures the time until all files of the project have been parsed
+    QElapsedTimer m_timer;
+    // Prefetched files that had been taken when the job started
+    quint64 m_prefetchHits;
     void updateProgress();
 };
 
@@ -27,6 +27,9 @@
 #include <QTemporaryFile>
 #include <QApplication>
 #include <QSemaphore>
+#include <QThread>
+#include <QDir>
+#include <QFileInfo>
 
 #include <KTextEditor/Editor>
 #include <KTextEditor/View>
@@ -37,7 +40,11 @@
 
 #include <language/duchain/duchain.h>
 #include <language/duchain/duchainlock.h>
+#include <language/duchain/parsingenvironment.h>
+#include <language/duchain/topducontext.h>
+#include <language/editor/modificationrevisionset.h>
 #include <language/backgroundparser/backgroundparser.h>
+#include <language/backgroundparser/fileprefetcher.h>
 
 #include <interfaces/ilanguagecontroller.h>
 #include <interfaces/iplugincontroller.h>
@@ -246,6 +253,355 @@ void TestBackgroundparser::testParseOrdering_noSequentialProcessing()
     QVERIFY(m_jobPlan.runJobs(1000));
 }
 
+void TestBackgroundparser::testParseOrdering_dependencies()
+{
+    m_jobPlan.clear();
+
+    const auto sourceUrl = QUrl::fromLocalFile(QStringLiteral("/test_dep_source.txt"));
+    const auto headerUrl = QUrl::fromLocalFile(QStringLiteral("/test_dep_header.txt"));
+    const IndexedString source(sourceUrl);
+    const IndexedString header(headerUrl);
+
+    // make the import of the header known from an earlier parse run
+    {
+        DUChainWriteLocker lock;
+        auto headerTop = new TopDUContext(header, RangeInRevision(), new ParsingEnvironmentFile(header));
+        DUChain::self()->addDocumentChain(headerTop);
+        auto sourceTop = new TopDUContext(source, RangeInRevision(), new ParsingEnvironmentFile(source));
+        DUChain::self()->addDocumentChain(sourceTop);
+        sourceTop->addImportedParentContext(headerTop);
+    }
+
+    // with the same priority, the header must be parsed first although the source is queued first
+    // and is parsed much faster
+    m_jobPlan.addJob(JobPrototype(sourceUrl, BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 0));
+    m_jobPlan.addJob(JobPrototype(headerUrl, BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 200));
+    QVERIFY(m_jobPlan.runJobs(1000));
+
+    QCOMPARE(m_jobPlan.m_createdJobs, QVector<IndexedString>({header, source}));
+    QCOMPARE(m_jobPlan.m_finishedJobs, QVector<IndexedString>({header, source}));
+
+    DUChainWriteLocker lock;
+    DUChain::self()->removeDocumentChain(DUChain::self()->chainForDocument(source));
+    DUChain::self()->removeDocumentChain(DUChain::self()->chainForDocument(header));
+}
+
+void TestBackgroundparser::testParseOrdering_runningDependency()
+{
+    m_jobPlan.clear();
+    auto parser = ICore::self()->languageController()->backgroundParser();
+
+    const auto sourceUrl = QUrl::fromLocalFile(QStringLiteral("/test_rundep_source.txt"));
+    const auto headerUrl = QUrl::fromLocalFile(QStringLiteral("/test_rundep_header.txt"));
+    const IndexedString source(sourceUrl);
+    const IndexedString header(headerUrl);
+
+    {
+        DUChainWriteLocker lock;
+        auto headerTop = new TopDUContext(header, RangeInRevision(), new ParsingEnvironmentFile(header));
+        DUChain::self()->addDocumentChain(headerTop);
+        auto sourceTop = new TopDUContext(source, RangeInRevision(), new ParsingEnvironmentFile(source));
+        DUChain::self()->addDocumentChain(sourceTop);
+        sourceTop->addImportedParentContext(headerTop);
+    }
+
+    m_jobPlan.addJob(JobPrototype(headerUrl, BackgroundParser::InitialParsePriority, ParseJob::IgnoresSequentialProcessing, 500));
+    m_jobPlan.addJob(JobPrototype(sourceUrl, BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 0));
+
+    parser->addDocument(header, TopDUContext::Empty, BackgroundParser::InitialParsePriority, &m_jobPlan);
+    parser->parseDocuments();
+    QTRY_VERIFY_WITH_TIMEOUT(m_jobPlan.m_createdJobs.contains(header), 1000);
+
+    // the import is parsed with a worse priority, so the edited source does not wait for it
+    parser->addDocument(source, TopDUContext::Empty, BackgroundParser::NormalPriority, &m_jobPlan);
+    parser->parseDocuments();
+    QTRY_COMPARE_WITH_TIMEOUT(m_jobPlan.m_finishedJobs.size(), 2, 2000);
+    QCOMPARE(m_jobPlan.m_finishedJobs, QVector<IndexedString>({source, header}));
+
+    DUChainWriteLocker lock;
+    DUChain::self()->removeDocumentChain(DUChain::self()->chainForDocument(source));
+    DUChain::self()->removeDocumentChain(DUChain::self()->chainForDocument(header));
+}
+
+void TestBackgroundparser::testSkipUnchangedContents()
+{
+    QTemporaryFile file(QDir::tempPath() + QStringLiteral("/kdev-skip-XXXXXX.txt"));
+    QVERIFY(file.open());
+    file.write("unchanged contents");
+    file.close();
+    const auto url = QUrl::fromLocalFile(file.fileName());
+    const IndexedString document(url);
+    const IndexedString language(m_langSupport->name());
+
+    // emulate a language that stores the parsed revision in the environment file
+    bool updateRequired = false;
+    const auto connection = QObject::connect(m_langSupport, &TestLanguageSupport::aboutToCreateParseJob,
+                     m_langSupport, [&] (const IndexedString& url, ParseJob** job) {
+                        auto testJob = new TestParseJob(url, m_langSupport);
+                        testJob->run_callback = [&, testJob] (const IndexedString& url) {
+                            updateRequired = testJob->isUpdateRequired(language);
+                            if (!updateRequired) {
+                                return;
+                            }
+                            testJob->readContents();
+                            DUChainWriteLocker lock;
+                            TopDUContext* top = DUChain::self()->chainForDocument(url);
+                            if (!top) {
+                                auto environmentFile = new ParsingEnvironmentFile(url);
+                                environmentFile->setLanguage(language);
+                                top = new TopDUContext(url, RangeInRevision(0, 0, INT_MAX, INT_MAX), environmentFile);
+                                DUChain::self()->addDocumentChain(top);
+                            }
+                            top->parsingEnvironmentFile()->setModificationRevision(testJob->contents().modification);
+                            testJob->setDuChain(top);
+                        };
+                        *job = testJob;
+                    }, Qt::DirectConnection);
+
+    auto parse = [&] () {
+        // make sure the new modification-times are seen
+        ModificationRevision::clearModificationCache(document);
+        ModificationRevisionSet::clearCache();
+        m_jobPlan.clear();
+        m_jobPlan.addJob(JobPrototype(url, BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 0));
+        return m_jobPlan.runJobs(1000);
+    };
+
+    QVERIFY(parse());
+    QVERIFY(updateRequired);
+    {
+        DUChainReadLocker lock;
+        QVERIFY(DUChain::self()->chainForDocument(document)->parsingEnvironmentFile()->contentHash());
+    }
+
+    // rewrite the same contents with a new modification-time
+    QTest::qSleep(1100);
+    QVERIFY(file.open());
+    file.write("unchanged contents");
+    file.close();
+    QVERIFY(parse());
+    QVERIFY(!updateRequired);
+    {
+        DUChainReadLocker lock;
+        auto environmentFile = DUChain::self()->chainForDocument(document)->parsingEnvironmentFile();
+        QVERIFY(!environmentFile->needsUpdate());
+        QCOMPARE(environmentFile->modificationRevision(), ModificationRevision::revisionForFile(document));
+    }
+
+    // changed contents are parsed again
+    QTest::qSleep(1100);
+    QVERIFY(file.open());
+    file.write("changed contents");
+    file.close();
+    QVERIFY(parse());
+    QVERIFY(updateRequired);
+
+    QObject::disconnect(connection);
+    DUChainWriteLocker lock;
+    DUChain::self()->removeDocumentChain(DUChain::self()->chainForDocument(document));
+}
+
+void TestBackgroundparser::testImportedContentHashes()
+{
+    QTemporaryFile headerFile(QDir::tempPath() + QStringLiteral("/kdev-import-XXXXXX.txt"));
+    QVERIFY(headerFile.open());
+    headerFile.write("imported contents");
+    headerFile.close();
+    const IndexedString header(QUrl::fromLocalFile(headerFile.fileName()));
+    ModificationRevision::clearModificationCache(header);
+    const auto url = QUrl::fromLocalFile(QStringLiteral("/test_imported_hashes.txt"));
+    const IndexedString language(m_langSupport->name());
+
+    // emulate a language that parses the imported file within the job of the importing document
+    const auto connection = QObject::connect(m_langSupport, &TestLanguageSupport::aboutToCreateParseJob,
+                     m_langSupport, [&] (const IndexedString& url, ParseJob** job) {
+                        auto testJob = new TestParseJob(url, m_langSupport);
+                        testJob->run_callback = [&, testJob] (const IndexedString& url) {
+                            DUChainWriteLocker lock;
+                            auto headerEnvironment = new ParsingEnvironmentFile(header);
+                            headerEnvironment->setLanguage(language);
+                            auto headerTop = new TopDUContext(header, RangeInRevision(0, 0, INT_MAX, INT_MAX), headerEnvironment);
+                            DUChain::self()->addDocumentChain(headerTop);
+                            headerEnvironment->setModificationRevision(ModificationRevision::revisionForFile(header));
+
+                            auto environmentFile = new ParsingEnvironmentFile(url);
+                            environmentFile->setLanguage(language);
+                            auto top = new TopDUContext(url, RangeInRevision(0, 0, INT_MAX, INT_MAX), environmentFile);
+                            DUChain::self()->addDocumentChain(top);
+                            top->addImportedParentContext(headerTop);
+                            testJob->setDuChain(top);
+                        };
+                        *job = testJob;
+                    }, Qt::DirectConnection);
+
+    m_jobPlan.clear();
+    m_jobPlan.addJob(JobPrototype(url, BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 0));
+    QVERIFY(m_jobPlan.runJobs(1000));
+
+    QObject::disconnect(connection);
+    DUChainWriteLocker lock;
+    TopDUContext* headerTop = DUChain::self()->chainForDocument(header);
+    QVERIFY(headerTop);
+    QVERIFY(headerTop->parsingEnvironmentFile()->contentHash());
+    DUChain::self()->removeDocumentChain(DUChain::self()->chainForDocument(IndexedString(url)));
+    DUChain::self()->removeDocumentChain(headerTop);
+}
+
+void TestBackgroundparser::testParseLanes()
+{
+    m_jobPlan.clear();
+    auto parser = ICore::self()->languageController()->backgroundParser();
+    const auto interactiveBefore = parser->laneStatistics(BackgroundParser::InteractiveLane);
+    const auto bulkBefore = parser->laneStatistics(BackgroundParser::BulkLane);
+
+    // more project files than threads
+    for ( int i = 0; i < 8; ++i ) {
+        m_jobPlan.addJob(JobPrototype(QUrl::fromLocalFile("/test_lanes_bulk__" + QString::number(i) + ".txt"),
+                                      BackgroundParser::InitialParsePriority, ParseJob::IgnoresSequentialProcessing, 300));
+    }
+    // two edited documents, the second one has to take a thread of the bulk lane
+    m_jobPlan.addJob(JobPrototype(QUrl::fromLocalFile(QStringLiteral("/test_lanes_interactive1.txt")),
+                                  BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 50));
+    m_jobPlan.addJob(JobPrototype(QUrl::fromLocalFile(QStringLiteral("/test_lanes_interactive2.txt")),
+                                  BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 50));
+    QVERIFY(m_jobPlan.runJobs(2000));
+
+    // the edited documents do not wait for the project files
+    QVERIFY(m_jobPlan.m_finishedJobs.indexOf(IndexedString(QUrl::fromLocalFile(QStringLiteral("/test_lanes_interactive1.txt")))) < 2);
+    QVERIFY(m_jobPlan.m_finishedJobs.indexOf(IndexedString(QUrl::fromLocalFile(QStringLiteral("/test_lanes_interactive2.txt")))) < 2);
+
+    const auto interactive = parser->laneStatistics(BackgroundParser::InteractiveLane);
+    const auto bulk = parser->laneStatistics(BackgroundParser::BulkLane);
+    QCOMPARE(interactive.started - interactiveBefore.started, quint64(1));
+    QCOMPARE(bulk.started - bulkBefore.started, quint64(9));
+    QCOMPARE(interactive.running, 0);
+    QCOMPARE(bulk.running, 0);
+    QCOMPARE(bulk.queued, 0);
+    QCOMPARE(bulk.threads, parser->threadCount());
+    QVERIFY(bulk.maximumLatency >= 300);
+    qDebug() << "average latency interactive:" << interactive.averageLatency << "ms, bulk:" << bulk.averageLatency << "ms";
+}
+
+void TestBackgroundparser::testPreemption()
+{
+    m_jobPlan.clear();
+    auto parser = ICore::self()->languageController()->backgroundParser();
+
+    // an edited document that occupies the interactive lane
+    const auto busyUrl = QUrl::fromLocalFile(QStringLiteral("/test_preempt_busy.txt"));
+    m_jobPlan.addJob(JobPrototype(busyUrl, BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 1500));
+    // project files that fill the remaining threads, and only stop when an abort is requested
+    QVector<IndexedString> bulkDocuments;
+    for ( int i = 0; i < parser->threadCount() - 1; ++i ) {
+        const auto url = QUrl::fromLocalFile("/test_preempt_bulk__" + QString::number(i) + ".txt");
+        m_jobPlan.addJob(JobPrototype(url, BackgroundParser::InitialParsePriority, ParseJob::IgnoresSequentialProcessing, 0));
+        bulkDocuments << IndexedString(url);
+    }
+    const auto interactiveUrl = QUrl::fromLocalFile(QStringLiteral("/test_preempt_interactive.txt"));
+    const IndexedString interactive(interactiveUrl);
+    m_jobPlan.addJob(JobPrototype(interactiveUrl, BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 0));
+
+    QAtomicInt bulkStarted;
+    QAtomicInt preemptedRuns;
+    QAtomicInt interactiveFinished;
+    const auto connection = QObject::connect(m_langSupport, &TestLanguageSupport::aboutToCreateParseJob,
+                     m_langSupport, [&] (const IndexedString& url, ParseJob** job) {
+                        if (!bulkDocuments.contains(url)) {
+                            return;
+                        }
+                        auto testJob = new TestParseJob(url, m_langSupport);
+                        testJob->run_callback = [&, testJob] (const IndexedString& /*url*/) {
+                            bulkStarted.ref();
+                            QElapsedTimer timer;
+                            timer.start();
+                            while (!timer.hasExpired(2000) && !interactiveFinished.load()) {
+                                if (testJob->abortRequested()) {
+                                    preemptedRuns.ref();
+                                    return;
+                                }
+                                QThread::msleep(5);
+                            }
+                        };
+                        *job = testJob;
+                    }, Qt::DirectConnection);
+
+    foreach(const JobPrototype& job, m_jobPlan.m_jobs) {
+        if (job.m_url != interactive) {
+            parser->addDocument(job.m_url, TopDUContext::Empty, job.m_priority, &m_jobPlan, job.m_flags);
+        }
+    }
+    parser->parseDocuments();
+    QTRY_COMPARE_WITH_TIMEOUT(bulkStarted.load(), bulkDocuments.size(), 1000);
+
+    // all threads are busy, the edited document makes one of the project files yield
+    parser->addDocument(interactive, TopDUContext::Empty, BackgroundParser::NormalPriority, &m_jobPlan);
+    parser->parseDocuments();
+    QTRY_VERIFY_WITH_TIMEOUT(m_jobPlan.m_finishedJobs.contains(interactive), 1000);
+    interactiveFinished = 1;
+    QCOMPARE(preemptedRuns.load(), 1);
+
+    // the preempted document is parsed again, and its target is notified only once
+    QTRY_COMPARE_WITH_TIMEOUT(m_jobPlan.m_finishedJobs.size(), m_jobPlan.m_jobs.size(), 3000);
+    QCOMPARE(bulkStarted.load(), bulkDocuments.size() + 1);
+    QCOMPARE(m_jobPlan.m_createdJobs.size(), m_jobPlan.m_jobs.size() + 1);
+
+    QObject::disconnect(connection);
+}
+
+void TestBackgroundparser::testNeededPriorityFinishesRunningJobs()
+{
+    m_jobPlan.clear();
+    auto parser = ICore::self()->languageController()->backgroundParser();
+
+    QVector<IndexedString> documents;
+    for ( int i = 0; i < 2; ++i ) {
+        const auto url = QUrl::fromLocalFile("/test_neededpriority_" + QString::number(i) + ".txt");
+        m_jobPlan.addJob(JobPrototype(url, BackgroundParser::InitialParsePriority, ParseJob::IgnoresSequentialProcessing, 0));
+        documents << IndexedString(url);
+    }
+
+    QAtomicInt started;
+    QAtomicInt aborted;
+    QAtomicInt release;
+    const auto connection = QObject::connect(m_langSupport, &TestLanguageSupport::aboutToCreateParseJob,
+                     m_langSupport, [&] (const IndexedString& url, ParseJob** job) {
+                        if (!documents.contains(url)) {
+                            return;
+                        }
+                        auto testJob = new TestParseJob(url, m_langSupport);
+                        testJob->run_callback = [&, testJob] (const IndexedString& /*url*/) {
+                            started.ref();
+                            QElapsedTimer timer;
+                            timer.start();
+                            while (!timer.hasExpired(2000) && !release.load()) {
+                                if (testJob->abortRequested()) {
+                                    aborted.ref();
+                                    return;
+                                }
+                                QThread::msleep(5);
+                            }
+                        };
+                        *job = testJob;
+                    }, Qt::DirectConnection);
+
+    foreach(const JobPrototype& job, m_jobPlan.m_jobs) {
+        parser->addDocument(job.m_url, TopDUContext::Empty, job.m_priority, &m_jobPlan, job.m_flags);
+    }
+    parser->parseDocuments();
+    QTRY_COMPARE_WITH_TIMEOUT(started.load(), documents.size(), 1000);
+
+    // disabling the processing only holds back new jobs
+    parser->disableProcessing();
+    QTest::qWait(100);
+    release = 1;
+    QTRY_COMPARE_WITH_TIMEOUT(m_jobPlan.m_finishedJobs.size(), documents.size(), 1000);
+    QCOMPARE(aborted.load(), 0);
+    QCOMPARE(m_jobPlan.m_createdJobs.size(), documents.size());
+    parser->enableProcessing();
+
+    QObject::disconnect(connection);
+}
+
 void TestBackgroundparser::testParseOrdering_lockup()
 {
     m_jobPlan.clear();
@@ -279,6 +635,58 @@ void TestBackgroundparser::testParseOrdering_simple()
     QVERIFY(m_jobPlan.runJobs(1000));
 }
 
+void TestBackgroundparser::testFilePrefetcher()
+{
+    QTemporaryFile file(QDir::tempPath() + QStringLiteral("/kdev-prefetch-XXXXXX.txt"));
+    QVERIFY(file.open());
+    file.write("prefetched contents");
+    file.close();
+    const IndexedString document(QUrl::fromLocalFile(file.fileName()));
+    const QDateTime lastModified = QFileInfo(file.fileName()).lastModified();
+
+    const bool wasEnabled = FilePrefetcher::enabled();
+    FilePrefetcher::setEnabled(true);
+    FilePrefetcher prefetcher;
+
+    QVERIFY(prefetcher.prefetch(document));
+    QTRY_COMPARE(prefetcher.statistics().prefetched, quint64(1));
+    QCOMPARE(prefetcher.statistics().bytes, quint64(19));
+
+    // the contents of another modification are dropped
+    QByteArray contents;
+    QVERIFY(!prefetcher.take(document, lastModified.addSecs(-10), &contents));
+    QVERIFY(!prefetcher.take(document, lastModified, &contents));
+    QCOMPARE(prefetcher.statistics().hits, quint64(0));
+
+    QVERIFY(prefetcher.prefetch(document));
+    QTRY_COMPARE(prefetcher.statistics().prefetched, quint64(2));
+    QVERIFY(prefetcher.take(document, lastModified, &contents));
+    QCOMPARE(contents, QByteArray("prefetched contents"));
+    QCOMPARE(prefetcher.statistics().hits, quint64(1));
+    // the contents are handed out only once
+    QVERIFY(!prefetcher.take(document, lastModified, &contents));
+
+    // discarded contents are not handed out
+    QVERIFY(prefetcher.prefetch(document));
+    QTRY_COMPARE(prefetcher.statistics().prefetched, quint64(3));
+    prefetcher.discard(document);
+    QVERIFY(!prefetcher.take(document, lastModified, &contents));
+
+    // contents that a parse job did not take are dropped once it finished
+    auto parser = ICore::self()->languageController()->backgroundParser();
+    const quint64 prefetchedBefore = parser->prefetcher()->statistics().prefetched;
+    QVERIFY(parser->prefetcher()->prefetch(document));
+    QTRY_COMPARE(parser->prefetcher()->statistics().prefetched, prefetchedBefore + 1);
+    m_jobPlan.clear();
+    m_jobPlan.addJob(JobPrototype(document.toUrl(), BackgroundParser::NormalPriority, ParseJob::IgnoresSequentialProcessing, 0));
+    QVERIFY(m_jobPlan.runJobs(1000));
+    QVERIFY(!parser->prefetcher()->take(document, lastModified, &contents));
+
+    FilePrefetcher::setEnabled(false);
+    QVERIFY(!prefetcher.prefetch(document));
+    FilePrefetcher::setEnabled(wasEnabled);
+}
+
 void TestBackgroundparser::benchmark()
 {
     const int jobs = 10000;
@@ -101,9 +101,19 @@ private slots:
     void testParseOrdering_lockup();
     void testParseOrdering_foregroundThread();
     void testParseOrdering_noSequentialProcessing();
+    void testParseOrdering_dependencies();
+    void testParseOrdering_runningDependency();
+    void testParseLanes();
+    void testPreemption();
+    void testNeededPriorityFinishesRunningJobs();
 
     void testNoDeadlockInJobCreation();
 
+    void testSkipUnchangedContents();
+    void testImportedContentHashes();
+
+    void testFilePrefetcher();
+
     void benchmark();
 
     void benchmarkDocumentChanges();
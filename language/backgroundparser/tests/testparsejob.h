@@ -36,6 +36,7 @@ public:
     void run(ThreadWeaver::JobPointer self, ThreadWeaver::Thread* thread) override;
     ControlFlowGraph* controlFlowGraph() override;
     DataAccessRepository* dataAccessInformation() override;
+    using ParseJob::isUpdateRequired;
 
     int duration_ms;
     std::function<void(const IndexedString&)> run_callback;
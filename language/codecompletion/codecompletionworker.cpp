@@ -155,16 +155,22 @@ void CodeCompletionWorker::computeCompletions(KDevelop::DUContextPointer context
     m->setCompletionContext(completionContext);
 
   if( completionContext && completionContext->isValid() ) {
-    {
-      DUChainReadLocker lock(DUChain::lock());
+    DUChainReadLocker lock(DUChain::lock());
+
+    if (!context) {
+      failed();
+      qCDebug(LANGUAGE) << "Completion context disappeared before completions could be calculated";
+      return;
+    }
 
-      if (!context) {
-        failed();
-        qCDebug(LANGUAGE) << "Completion context disappeared before completions could be calculated";
-        return;
-      }
+    QList<CompletionTreeItemPointer> items;
+    {
+      //The items are taken from what is visible from the document, so with top-context locking,
+      //files that are not imported by it can be parsed meanwhile
+      DUChainReadScope scope(context->topContext());
+      lock.unlock();
+      items = completionContext->completionItems(aborting(), fullCompletion());
     }
-    QList<CompletionTreeItemPointer> items = completionContext->completionItems(aborting(), fullCompletion());
 
     if (aborting()) {
       failed();
@@ -33,6 +33,7 @@
 #include "../duchainpointer.h"
 #include "../duchainlock.h"
 #include "../duchain.h"
+#include "../duchainarena.h"
 #include "../ducontext.h"
 #include "../identifier.h"
 #include "../parsingenvironment.h"
@@ -85,6 +86,10 @@ public:
                               ReferencedTopDUContext updateContext
                                     = ReferencedTopDUContext() )
   {
+    //Keeps the items created for a new top-context together. Updates keep many old items alive,
+    //which would pin the chunks of the new ones.
+    DUChainArena arena(!updateContext.data());
+
     m_compilingContexts = true;
     m_url = url;
 
@@ -123,6 +128,8 @@ protected:
    */
   virtual void supportBuild( T* node, DUContext* context = 0 )
   {
+    DUChainArena arena(!m_recompiling);
+
     if (!context)
       context = contextFromNode(node);
 
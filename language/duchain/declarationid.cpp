@@ -107,10 +107,10 @@ KDevVarLengthArray<Declaration*> DeclarationId::getDeclarations(const TopDUConte
 
     if(top) {
       //Do filtering
-      PersistentSymbolTable::FilteredDeclarationIterator filter =
-          PersistentSymbolTable::self().getFilteredDeclarations(id, top->recursiveImportIndices());
-      for(; filter; ++filter) {
-          Declaration* decl = filter->data();
+      const KDevVarLengthArray<IndexedDeclaration> visible =
+          PersistentSymbolTable::self().copyFilteredDeclarations(id, top->recursiveImportIndices());
+      for(const IndexedDeclaration& iDecl : visible) {
+          Declaration* decl = iDecl.data();
           if(decl && m_indirectData.additionalIdentity == decl->additionalIdentity()) {
             //Hit
             ret.append(decl);
@@ -118,10 +118,8 @@ KDevVarLengthArray<Declaration*> DeclarationId::getDeclarations(const TopDUConte
       }
     }else{
       //Just accept anything
-      PersistentSymbolTable::Declarations decls = PersistentSymbolTable::self().getDeclarations(id);
-      PersistentSymbolTable::Declarations::Iterator decl = decls.iterator();
-      for(; decl; ++decl) {
-        const IndexedDeclaration& iDecl(*decl);
+      const KDevVarLengthArray<IndexedDeclaration> decls = PersistentSymbolTable::self().copyDeclarations(id);
+      for(const IndexedDeclaration& iDecl : decls) {
 
           ///@todo think this over once we don't pull in all imported top-context any more
         //Don't trigger loading of top-contexts from here, it will create a lot of problems
@@ -163,10 +161,10 @@ Declaration* DeclarationId::getDeclaration(const TopDUContext* top, bool instant
 
     if(top) {
       //Do filtering
-      PersistentSymbolTable::FilteredDeclarationIterator filter =
-          PersistentSymbolTable::self().getFilteredDeclarations(id, top->recursiveImportIndices());
-      for(; filter; ++filter) {
-          Declaration* decl = filter->data();
+      const KDevVarLengthArray<IndexedDeclaration> visible =
+          PersistentSymbolTable::self().copyFilteredDeclarations(id, top->recursiveImportIndices());
+      for(const IndexedDeclaration& iDecl : visible) {
+          Declaration* decl = iDecl.data();
           if(decl && m_indirectData.additionalIdentity == decl->additionalIdentity()) {
             //Hit
             ret = decl;
@@ -176,10 +174,8 @@ Declaration* DeclarationId::getDeclaration(const TopDUContext* top, bool instant
       }
     }else{
       //Just accept anything
-      PersistentSymbolTable::Declarations decls = PersistentSymbolTable::self().getDeclarations(id);
-      PersistentSymbolTable::Declarations::Iterator decl = decls.iterator();
-      for(; decl; ++decl) {
-        const IndexedDeclaration& iDecl(*decl);
+      const KDevVarLengthArray<IndexedDeclaration> decls = PersistentSymbolTable::self().copyDeclarations(id);
+      for(const IndexedDeclaration& iDecl : decls) {
 
         ///@todo think this over once we don't pull in all imported top-context any more
         //Don't trigger loading of top-contexts from here, it will create a lot of problems
@@ -0,0 +1,288 @@
+/* This file is part of KDevelop
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "declarationidindex.h"
+
+#include <algorithm>
+
+#include "appendedlist.h"
+#include "declarationid.h"
+#include "duchainlock.h"
+#include "serialization/itemrepository.h"
+
+namespace KDevelop {
+
+namespace {
+
+template<class Data>
+void appendVarInt(Data& data, uint value)
+{
+  while(value >= 0x80) {
+    data.append(uchar(value | 0x80));
+    value >>= 7;
+  }
+  data.append(uchar(value));
+}
+
+uint readVarInt(const uchar*& data)
+{
+  uint value = 0;
+  uint shift = 0;
+  uchar byte;
+  do {
+    byte = *data++;
+    value |= uint(byte & 0x7f) << shift;
+    shift += 7;
+  } while(byte & 0x80);
+  return value;
+}
+
+//Every posting is stored as the distance of its top-context to the one of the previous posting, followed by the local index
+template<class Data>
+void encodePostings(const DeclarationIdIndex::Postings& postings, Data& data)
+{
+  uint previousTopContext = 0;
+  foreach(const DeclarationIdIndex::Posting& posting, postings) {
+    Q_ASSERT(posting.topContext >= previousTopContext);
+    appendVarInt(data, posting.topContext - previousTopContext);
+    appendVarInt(data, posting.localIndex);
+    previousTopContext = posting.topContext;
+  }
+}
+
+void decodePostings(const uchar* data, uint size, uint count, DeclarationIdIndex::Postings& postings)
+{
+  const uchar* end = data + size;
+  postings.reserve(count);
+  uint topContext = 0;
+  while(data < end) {
+    topContext += readVarInt(data);
+    const DeclarationIdIndex::Posting posting = {topContext, readVarInt(data)};
+    postings.append(posting);
+  }
+  Q_ASSERT(uint(postings.size()) == count);
+}
+
+}
+
+DEFINE_LIST_MEMBER_HASH(DeclarationIdIndexItem, postings, uchar)
+
+class DeclarationIdIndexItem {
+  public:
+  DeclarationIdIndexItem() : kind(0), count(0) {
+    initializeAppendedLists();
+  }
+  DeclarationIdIndexItem(const DeclarationIdIndexItem& rhs, bool dynamic = true) : declaration(rhs.declaration), kind(rhs.kind), count(rhs.count) {
+    initializeAppendedLists(dynamic);
+    copyListsFrom(rhs);
+  }
+
+  ~DeclarationIdIndexItem() {
+    freeAppendedLists();
+  }
+
+  unsigned int hash() const {
+    //We only compare the declaration and the kind. This allows us implementing a map, although the item-repository
+    //originally represents a set.
+    return declaration.hash() * 3 + kind;
+  }
+
+  unsigned int itemSize() const {
+    return dynamicSize();
+  }
+
+  uint classSize() const {
+    return sizeof(DeclarationIdIndexItem);
+  }
+
+  DeclarationIdIndex::Postings decode() const {
+    DeclarationIdIndex::Postings ret;
+    decodePostings(postings(), postingsSize(), count, ret);
+    return ret;
+  }
+
+  DeclarationId declaration;
+  uint kind;
+  uint count;
+
+  START_APPENDED_LISTS(DeclarationIdIndexItem);
+  APPENDED_LIST_FIRST(DeclarationIdIndexItem, uchar, postings);
+  END_APPENDED_LISTS(DeclarationIdIndexItem, postings);
+};
+
+class DeclarationIdIndexRequestItem {
+  public:
+
+  DeclarationIdIndexRequestItem(const DeclarationIdIndexItem& item) : m_item(item) {
+  }
+  enum {
+    AverageSize = 40 //This should be the approximate average size of an Item
+  };
+
+  unsigned int hash() const {
+    return m_item.hash();
+  }
+
+  uint itemSize() const {
+      return m_item.itemSize();
+  }
+
+  void createItem(DeclarationIdIndexItem* item) const {
+    new (item) DeclarationIdIndexItem(m_item, false);
+  }
+
+  static void destroy(DeclarationIdIndexItem* item, KDevelop::AbstractItemRepository&) {
+    item->~DeclarationIdIndexItem();
+  }
+
+  static bool persistent(const DeclarationIdIndexItem* /*item*/) {
+    return true;
+  }
+
+  bool equals(const DeclarationIdIndexItem* item) const {
+    return m_item.declaration == item->declaration && m_item.kind == item->kind;
+  }
+
+  const DeclarationIdIndexItem& m_item;
+};
+
+struct DeclarationIdCollector {
+  explicit DeclarationIdCollector(uint _kind) : kind(_kind) {
+  }
+
+  bool operator()(const DeclarationIdIndexItem* item) {
+    if(item->kind == kind)
+      ids.append(item->declaration);
+    return true;
+  }
+
+  uint kind;
+  QVector<DeclarationId> ids;
+};
+
+class DeclarationIdIndexPrivate
+{
+public:
+
+  DeclarationIdIndexPrivate() : m_index(QStringLiteral("Declaration Id Index")) {
+  }
+
+  //Replaces the postings of the given item with @p postings
+  void replace(DeclarationIdIndexItem& item, uint oldIndex, const DeclarationIdIndex::Postings& postings) {
+    if(oldIndex) {
+      m_index.deleteItem(oldIndex);
+      Q_ASSERT(m_index.findIndex(item) == 0);
+    }
+
+    if(!postings.isEmpty()) {
+      encodePostings(postings, item.postingsList());
+      item.count = postings.size();
+      //This inserts the changed item
+      m_index.index(DeclarationIdIndexRequestItem(item));
+    }
+  }
+
+  //Maps declaration-ids and kinds to postings
+  ItemRepository<DeclarationIdIndexItem, DeclarationIdIndexRequestItem> m_index;
+};
+
+DeclarationIdIndex::DeclarationIdIndex() : d(new DeclarationIdIndexPrivate())
+{
+}
+
+DeclarationIdIndex::~DeclarationIdIndex()
+{
+  delete d;
+}
+
+DeclarationIdIndex& DeclarationIdIndex::self()
+{
+  static DeclarationIdIndex globalIndex;
+  return globalIndex;
+}
+
+void DeclarationIdIndex::add(Kind kind, const DeclarationId& id, const Posting& posting)
+{
+  DUChainCrossFileLocker crossFileLock;
+  DeclarationIdIndexItem item;
+  item.declaration = id;
+  item.kind = kind;
+
+  Postings postings;
+  uint index = d->m_index.findIndex(item);
+  if(index)
+    postings = d->m_index.itemFromIndex(index)->decode();
+
+  Posting* position = std::lower_bound(postings.begin(), postings.end(), posting);
+  if(position != postings.end() && *position == posting)
+    return; //Already there
+
+  postings.insert(position - postings.begin(), posting);
+  d->replace(item, index, postings);
+}
+
+void DeclarationIdIndex::remove(Kind kind, const DeclarationId& id, const Posting& posting)
+{
+  DUChainCrossFileLocker crossFileLock;
+  DeclarationIdIndexItem item;
+  item.declaration = id;
+  item.kind = kind;
+
+  uint index = d->m_index.findIndex(item);
+  if(!index)
+    return;
+
+  Postings postings = d->m_index.itemFromIndex(index)->decode();
+  Posting* position = std::lower_bound(postings.begin(), postings.end(), posting);
+  if(position == postings.end() || !(*position == posting))
+    return;
+
+  postings.remove(position - postings.begin());
+  d->replace(item, index, postings);
+}
+
+bool DeclarationIdIndex::contains(Kind kind, const DeclarationId& id) const
+{
+  DUChainCrossFileLocker crossFileLock;
+  DeclarationIdIndexItem item;
+  item.declaration = id;
+  item.kind = kind;
+  return (bool) d->m_index.findIndex(item);
+}
+
+DeclarationIdIndex::Postings DeclarationIdIndex::postings(Kind kind, const DeclarationId& id) const
+{
+  DUChainCrossFileLocker crossFileLock;
+  DeclarationIdIndexItem item;
+  item.declaration = id;
+  item.kind = kind;
+
+  uint index = d->m_index.findIndex(item);
+  if(index)
+    return d->m_index.itemFromIndex(index)->decode();
+  return Postings();
+}
+
+QVector<DeclarationId> DeclarationIdIndex::ids(Kind kind) const
+{
+  QMutexLocker lock(d->m_index.mutex());
+  DeclarationIdCollector collector(kind);
+  d->m_index.visitAllItems(collector);
+  return collector.ids;
+}
+
+}
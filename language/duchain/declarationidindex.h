@@ -0,0 +1,90 @@
+/* This file is part of KDevelop
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KDEVPLATFORM_DECLARATIONIDINDEX_H
+#define KDEVPLATFORM_DECLARATIONIDINDEX_H
+
+#include <QtCore/QVector>
+
+#include <language/languageexport.h>
+#include <util/kdevvarlengtharray.h>
+
+namespace KDevelop {
+
+class DeclarationId;
+
+/**
+ * Reverse index from Declaration-Ids to the places that refer to them, shared by Uses, Definitions and Importers.
+ *
+ * Every (kind, id) pair maps to one postings list, sorted by top-context index and then by local index. The list is
+ * stored delta-encoded with variable-length integers, so most postings only take two or three bytes, and the postings
+ * of one declaration are stored in one place, no matter which kind of reference is looked up.
+ *
+ * Protected through DUChainLock, and DUChainCrossFileLocker with top-context locking.
+ */
+class KDEVPLATFORMLANGUAGE_EXPORT DeclarationIdIndex
+{
+  public:
+    enum Kind {
+      UseKind = 0, ///< The top-contexts that use the declaration, the local index is always zero
+      DefinitionKind = 1, ///< The definitions of the declaration
+      ImporterKind = 2 ///< The contexts that import the context of the declaration
+    };
+
+    struct Posting
+    {
+      uint topContext;
+      uint localIndex;
+
+      bool operator<(const Posting& rhs) const
+      {
+        return topContext < rhs.topContext || (topContext == rhs.topContext && localIndex < rhs.localIndex);
+      }
+
+      bool operator==(const Posting& rhs) const
+      {
+        return topContext == rhs.topContext && localIndex == rhs.localIndex;
+      }
+    };
+
+    typedef KDevVarLengthArray<Posting> Postings;
+
+    DeclarationIdIndex();
+    ~DeclarationIdIndex();
+
+    static DeclarationIdIndex& self();
+
+    void add(Kind kind, const DeclarationId& id, const Posting& posting);
+    void remove(Kind kind, const DeclarationId& id, const Posting& posting);
+
+    bool contains(Kind kind, const DeclarationId& id) const;
+
+    ///Returns all postings of the id, sorted
+    Postings postings(Kind kind, const DeclarationId& id) const;
+
+    ///Returns all ids that have postings of the given kind
+    QVector<DeclarationId> ids(Kind kind) const;
+
+  private:
+    class DeclarationIdIndexPrivate* d;
+};
+
+}
+
+Q_DECLARE_TYPEINFO(KDevelop::DeclarationIdIndex::Posting, Q_PRIMITIVE_TYPE);
+
+#endif
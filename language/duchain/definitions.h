@@ -35,6 +35,7 @@ namespace KDevelop {
 
 /**
  * Global mapping of one Declaration-Ids to multiple Definitions, protected through DUChainLock.
+ * The mapping is stored in DeclarationIdIndex.
  * */
   class KDEVPLATFORMLANGUAGE_EXPORT Definitions {
     public:
@@ -54,9 +55,6 @@ namespace KDevelop {
 
     /// Dump contents of the definitions repository to stream @p out
     void dump(const QTextStream& out);
-
-    private:
-      class DefinitionsPrivate* d;
   };
 }
 
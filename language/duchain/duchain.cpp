@@ -30,6 +30,8 @@
 #include <QtCore/QThread>
 #include <QtCore/QWaitCondition>
 #include <QtCore/QMutex>
+#include <QtCore/QElapsedTimer>
+#include <QtConcurrentMap>
 
 #include <interfaces/idocumentcontroller.h>
 #include <interfaces/icore.h>
@@ -45,6 +47,7 @@
 #include "topducontext.h"
 #include "topducontextdata.h"
 #include "topducontextdynamicdata.h"
+#include "topducontextsegmentstore.h"
 #include "parsingenvironment.h"
 #include "declaration.h"
 #include "definitions.h"
@@ -57,6 +60,7 @@
 #include "serialization/itemrepository.h"
 #include "waitforupdate.h"
 #include "importers.h"
+#include "declarationidindex.h"
 
 #if HAVE_MALLOC_TRIM
 #include "malloc.h"
@@ -298,12 +302,18 @@ class DUChainPrivate
       DUChainPrivate* m_data;
   };
 public:
-  DUChainPrivate() : m_chainsMutex(QMutex::Recursive), m_cleanupMutex(QMutex::Recursive), instance(nullptr), m_cleanupDisabled(false), m_destroyed(false), m_environmentListInfo(QStringLiteral("Environment Lists")), m_environmentInfo(QStringLiteral("Environment Information"))
+  DUChainPrivate() : m_chainsMutex(QMutex::Recursive), m_cleanupMutex(QMutex::Recursive), instance(nullptr), m_cleanupDisabled(false), m_parallelStore(true), m_destroyed(false), m_environmentListInfo(QStringLiteral("Environment Lists")), m_environmentInfo(QStringLiteral("Environment Information"))
   {
 #if defined(TEST_NO_CLEANUP)
     m_cleanupDisabled = true;
 #endif
 
+    lock.setTopContextLocking(qEnvironmentVariableIsSet("KDEV_DUCHAIN_TOP_CONTEXT_LOCKING"));
+    lock.setProfiling(qEnvironmentVariableIsSet("KDEV_DUCHAIN_LOCK_PROFILING"));
+    m_parallelStore = !qEnvironmentVariableIsSet("KDEV_DUCHAIN_SERIAL_STORE");
+    //Register the packed top-context store with the repository registry before anything is loaded
+    TopDUContextSegmentStore::self();
+
     duChainPrivateSelf = this;
     qRegisterMetaType<DUChainBasePointer>("KDevelop::DUChainBasePointer");
     qRegisterMetaType<DUContextPointer>("KDevelop::DUContextPointer");
@@ -434,6 +444,8 @@ public:
   Uses m_uses;
   QSet<uint> m_loading;
   bool m_cleanupDisabled;
+  ///Whether the top-contexts are serialized on the global thread-pool during the cleanup
+  bool m_parallelStore;
 
   //List of available top-context indices, protected by m_chainsMutex
   QVector<uint> m_availableTopContextIndices;
@@ -677,6 +689,21 @@ public:
     }
   }
 
+  ///Writes the given top-contexts to disk. The write-lock must be held during the whole call.
+  ///With parallel storing the contexts are distributed over the global thread-pool. Every thread only touches
+  ///its own top-context, the reference-counted ranges are registered per thread, and the appends to the segment
+  ///store are serialized by its mutex.
+  void storeTopContexts(QVector<TopDUContext*> contexts) {
+    if(m_parallelStore && contexts.size() > 1) {
+      QtConcurrent::blockingMap(contexts, [](TopDUContext* context) {
+        context->m_dynamicData->store();
+      });
+    }else{
+      foreach(TopDUContext* context, contexts)
+        context->m_dynamicData->store();
+    }
+  }
+
   QMutex& cleanupMutex() {
     return m_cleanupMutex;
   }
@@ -761,17 +788,54 @@ public:
       }
     }
 
-    foreach(TopDUContext* context, workOnContexts) {
+    {
+      QElapsedTimer storeTimer;
+      storeTimer.start();
+
+      //Only the contexts that actually changed need to be written, the others would return from store() immediately.
+      //They are remembered by index, as they may be removed by other threads while the lock is broken.
+      QVector<uint> changedContexts;
+      foreach(TopDUContext* context, workOnContexts) {
+        if(context->m_dynamicData->hasChanged())
+          changedContexts << context->ownIndex();
+      }
 
-      context->m_dynamicData->store();
+      //During the soft cleanups the lock is broken after every batch, during the final one everything is stored at once
+      const int batchSize = retries ? (m_parallelStore ? qMax(1, QThread::idealThreadCount()) : 1) : changedContexts.size();
+
+      for(int start = 0; start < changedContexts.size(); start += batchSize) {
+        if(retries && !m_parallelStore) {
+          //Storing only changes the stored top-context, so with top-context locking the scoped readers
+          //(see DUChainReadScope) of files that don't import it can proceed meanwhile
+          writeLock.unlock();
+          foreach(uint index, changedContexts.mid(start, batchSize)) {
+            TopDUContextWriteLocker contextLock(index);
+            if(TopDUContext* context = readChainForIndex(index))
+              context->m_dynamicData->store();
+          }
+          writeLock.lock();
+          continue;
+        }
 
-      if(retries) {
-        //Eventually give other threads a chance to access the duchain
-        writeLock.unlock();
-        //Sleep to give the other threads a realistic chance to get a read-lock in between
-        QThread::usleep(500);
-        writeLock.lock();
+        QVector<TopDUContext*> batch;
+        foreach(uint index, changedContexts.mid(start, batchSize)) {
+          if(TopDUContext* context = readChainForIndex(index))
+            batch << context;
+        }
+        storeTopContexts(batch);
+
+        if(retries) {
+          //Eventually give other threads a chance to access the duchain
+          writeLock.unlock();
+          //Sleep to give the other threads a realistic chance to get a read-lock in between
+          QThread::usleep(500);
+          writeLock.lock();
+        }
       }
+
+      if(!changedContexts.isEmpty())
+        qCDebug(LANGUAGE) << "stored" << changedContexts.size() << "of" << workOnContexts.size() << "top-contexts"
+                          << (m_parallelStore ? "in parallel" : "serially") << "in" << storeTimer.elapsed() << "ms";
     }
 
       //Unload all top-contexts that don't have a reference-count and that are not imported by a referenced one
@@ -1172,6 +1236,7 @@ void DUChain::initialize()
   initTypeRepository();
   initInstantiationInformationRepository();
 
+  DeclarationIdIndex::self();
   Importers::self();
 
   globalImportIdentifier();
@@ -1600,6 +1665,10 @@ void DUChain::shutdown()
 
   qCDebug(LANGUAGE) << "Cleaning up and shutting down DUChain";
 
+  if (lock()->profiling()) {
+    qCDebug(LANGUAGE).noquote() << lock()->profilingReport();
+  }
+
   QMutexLocker lock(&sdDUChainPrivate->cleanupMutex());
 
   {
@@ -1621,6 +1690,9 @@ void DUChain::shutdown()
     //Crashes here may happen in an inconsistent state, thus this makes sense, to protect the user from more crashes
     globalItemRepositoryRegistry().lockForWriting();
     finalCleanup();
+    //With a writable mapping the cleanup has already changed the files, so they have to be brought into a consistent state
+    if(itemRepositoryUsesWritableMapping())
+      globalItemRepositoryRegistry().store();
     globalItemRepositoryRegistry().unlockForWriting();
   }
 
@@ -1739,6 +1811,22 @@ void DUChain::storeToDisk() {
   sdDUChainPrivate->m_cleanupDisabled = wasDisabled;
 }
 
+void DUChain::setParallelStoring(bool enable) {
+  sdDUChainPrivate->m_parallelStore = enable;
+}
+
+bool DUChain::parallelStoring() const {
+  return sdDUChainPrivate->m_parallelStore;
+}
+
+void DUChain::setLazyItemLoading(bool enable) {
+  TopDUContextDynamicData::setLazyItemLoading(enable);
+}
+
+bool DUChain::lazyItemLoading() const {
+  return TopDUContextDynamicData::lazyItemLoading();
+}
+
 bool DUChain::compareToDisk() {
 
   DUChainWriteLocker writeLock(DUChain::lock());
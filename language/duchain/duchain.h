@@ -243,6 +243,16 @@ public:
   ///Stores the whole duchain and all its repositories in the current state to disk
   ///The duchain must not be locked in any way
   void storeToDisk();
+
+  ///Whether the top-contexts are serialized in parallel on the global thread-pool when the duchain is stored.
+  ///Enabled by default, the environment variable KDEV_DUCHAIN_SERIAL_STORE disables it.
+  void setParallelStoring(bool enable);
+  bool parallelStoring() const;
+
+  ///Whether the child contexts and local declarations of a top-context loaded from disk are only created once they are accessed.
+  ///Enabled by default, the environment variable KDEV_DUCHAIN_EAGER_ITEM_LOADING disables it.
+  void setLazyItemLoading(bool enable);
+  bool lazyItemLoading() const;
   
   ///Compares the whole duchain and all its repositories in the current state to disk
   ///When the comparison fails, debug-output will show why
@@ -0,0 +1,307 @@
+/* This file is part of KDevelop
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "duchainarena.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef Q_OS_WIN
+#include <malloc.h>
+#endif
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QGlobalStatic>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QThreadStorage>
+
+namespace KDevelop {
+
+namespace {
+
+const int ChunkShift = 18;
+const std::size_t ChunkSize = std::size_t(1) << ChunkShift;
+//Bigger allocations are taken from the heap, so they don't waste the rest of a chunk
+const std::size_t MaximumArenaAllocation = 8 * 1024;
+const std::size_t Alignment = 16;
+
+//Placed at the start of every chunk. Chunks are aligned to ChunkSize, so the chunk of an item is found
+//by rounding its address down, and no header is needed in front of the items.
+struct Chunk
+{
+  //One reference for every item in the chunk, and one while the chunk is used for allocation
+  QAtomicInt references;
+  char* position;
+  char* end;
+};
+
+const std::size_t ChunkHeaderSize = (sizeof(Chunk) + Alignment - 1) & ~(Alignment - 1);
+
+/**
+ * Tells whether an address lies within a chunk, so deallocate() can tell arena items from heap allocations.
+ *
+ * It is a bitmap with one bit for every ChunkSize block of the address space. The leaves of the bitmap are
+ * created on demand and never freed, so lookups need no lock. Chunks above the covered address space are not used.
+ */
+const int AddressBits = sizeof(void*) == 8 ? 48 : 32;
+const int LeafShift = 15;
+const int ChunkNumberBits = AddressBits - ChunkShift;
+const std::size_t LeafCount = ChunkNumberBits > LeafShift ? std::size_t(1) << (ChunkNumberBits - LeafShift) : 1;
+
+struct ChunkMapLeaf
+{
+  QAtomicInt words[(1 << LeafShift) / 32];
+};
+
+QAtomicPointer<ChunkMapLeaf> chunkMap[LeafCount];
+
+bool isCoveredByChunkMap(quintptr address)
+{
+  return (address >> ChunkShift) < (quintptr(1) << ChunkNumberBits);
+}
+
+void setChunkMapped(const Chunk* chunk, bool mapped)
+{
+  const quintptr number = quintptr(chunk) >> ChunkShift;
+  QAtomicPointer<ChunkMapLeaf>& leafPointer(chunkMap[number >> LeafShift]);
+  ChunkMapLeaf* leaf = leafPointer.loadAcquire();
+  if(!leaf) {
+    ChunkMapLeaf* created = new ChunkMapLeaf;
+    if(leafPointer.testAndSetOrdered(nullptr, created, leaf)) {
+      leaf = created;
+    } else {
+      delete created;
+    }
+  }
+
+  QAtomicInt& word(leaf->words[(number & ((1 << LeafShift) - 1)) / 32]);
+  const int bit = 1 << (number % 32);
+  if(mapped)
+    word.fetchAndOrRelease(bit);
+  else
+    word.fetchAndAndRelease(~bit);
+}
+
+//Returns the chunk that @p pointer was allocated from, or zero if it comes from the heap
+Chunk* chunkForAllocation(void* pointer)
+{
+  const quintptr address = quintptr(pointer);
+  if(!isCoveredByChunkMap(address))
+    return nullptr;
+
+  const quintptr number = address >> ChunkShift;
+  const ChunkMapLeaf* leaf = chunkMap[number >> LeafShift].loadAcquire();
+  if(!leaf || !(leaf->words[(number & ((1 << LeafShift) - 1)) / 32].loadAcquire() & (1 << (number % 32))))
+    return nullptr;
+
+  return reinterpret_cast<Chunk*>(address & ~quintptr(ChunkSize - 1));
+}
+
+void* allocateChunkMemory()
+{
+#ifdef Q_OS_WIN
+  return _aligned_malloc(ChunkSize, ChunkSize);
+#else
+  void* memory = nullptr;
+  if(posix_memalign(&memory, ChunkSize, ChunkSize))
+    return nullptr;
+  return memory;
+#endif
+}
+
+void freeChunkMemory(void* memory)
+{
+#ifdef Q_OS_WIN
+  _aligned_free(memory);
+#else
+  std::free(memory);
+#endif
+}
+
+struct ThreadArena;
+
+//Allocations are counted per thread, so the parse threads don't contend on shared counters.
+//statistics() sums the counters of the living threads and those of the threads that exited.
+struct Counters
+{
+  Counters() : exitedArenaAllocations(0), exitedHeapAllocations(0) {}
+
+  QMutex mutex;
+  QSet<ThreadArena*> threads;
+  quint64 exitedArenaAllocations;
+  quint64 exitedHeapAllocations;
+};
+
+//The arena of the main thread may outlive file statics, so the counters are checked for destruction
+Q_GLOBAL_STATIC(Counters, counters)
+
+struct ThreadArena
+{
+  ThreadArena() : chunk(nullptr), depth(0) {
+    if(Counters* c = counters()) {
+      QMutexLocker lock(&c->mutex);
+      c->threads.insert(this);
+    }
+  }
+
+  ~ThreadArena() {
+    if(Counters* c = counters()) {
+      QMutexLocker lock(&c->mutex);
+      c->threads.remove(this);
+      c->exitedArenaAllocations += arenaAllocations.load();
+      c->exitedHeapAllocations += heapAllocations.load();
+    }
+  }
+
+  //Only the owning thread writes the counters, so they are increased without read-modify-write operations
+  static void count(QAtomicInteger<quint64>& counter) {
+    counter.store(counter.load() + 1);
+  }
+
+  Chunk* chunk;
+  int depth;
+  QAtomicInteger<quint64> arenaAllocations;
+  QAtomicInteger<quint64> heapAllocations;
+};
+
+QThreadStorage<ThreadArena> threadArenas;
+bool arenasEnabled = !qEnvironmentVariableIsSet("KDEV_DUCHAIN_NO_ARENA");
+//Only changed once per chunk, so a shared counter is fine
+QAtomicInt chunkCount;
+
+void releaseChunk(Chunk* chunk)
+{
+  if(!chunk->references.deref()) {
+    //Unmapped before it is freed, so heap allocations that reuse the memory are not taken for items
+    setChunkMapped(chunk, false);
+    chunk->~Chunk();
+    freeChunkMemory(chunk);
+    chunkCount.deref();
+  }
+}
+
+//Returns zero if no chunk could be created, then the items are allocated from the heap
+Chunk* createChunk()
+{
+  void* memory = allocateChunkMemory();
+  if(!memory)
+    return nullptr;
+  if(!isCoveredByChunkMap(quintptr(memory) + ChunkSize - 1)) {
+    freeChunkMemory(memory);
+    return nullptr;
+  }
+
+  Chunk* chunk = new (memory) Chunk;
+  chunk->references.store(1);
+  chunk->position = static_cast<char*>(memory) + ChunkHeaderSize;
+  chunk->end = static_cast<char*>(memory) + ChunkSize;
+  chunkCount.ref();
+  setChunkMapped(chunk, true);
+  return chunk;
+}
+
+}
+
+DUChainArena::DUChainArena(bool open)
+  : m_open(open)
+{
+  if(m_open)
+    ++threadArenas.localData().depth;
+}
+
+DUChainArena::~DUChainArena()
+{
+  if(!m_open)
+    return;
+
+  ThreadArena& arena(threadArenas.localData());
+  if(--arena.depth == 0 && arena.chunk) {
+    releaseChunk(arena.chunk);
+    arena.chunk = nullptr;
+  }
+}
+
+void* DUChainArena::allocate(std::size_t size)
+{
+  const std::size_t alignedSize = (size + Alignment - 1) & ~(Alignment - 1);
+
+  ThreadArena& arena(threadArenas.localData());
+  if(arenasEnabled && arena.depth && alignedSize <= MaximumArenaAllocation) {
+    if(!arena.chunk || std::size_t(arena.chunk->end - arena.chunk->position) < alignedSize) {
+      if(arena.chunk)
+        releaseChunk(arena.chunk);
+      arena.chunk = createChunk();
+    }
+
+    if(arena.chunk) {
+      void* memory = arena.chunk->position;
+      arena.chunk->position += alignedSize;
+      arena.chunk->references.ref();
+      ThreadArena::count(arena.arenaAllocations);
+      return memory;
+    }
+  }
+
+  void* memory = std::malloc(size);
+  if(!memory)
+    throw std::bad_alloc();
+
+  ThreadArena::count(arena.heapAllocations);
+  return memory;
+}
+
+void DUChainArena::deallocate(void* pointer)
+{
+  if(!pointer)
+    return;
+
+  if(Chunk* chunk = chunkForAllocation(pointer))
+    releaseChunk(chunk);
+  else
+    std::free(pointer);
+}
+
+bool DUChainArena::enabled()
+{
+  return arenasEnabled;
+}
+
+void DUChainArena::setEnabled(bool enabled)
+{
+  arenasEnabled = enabled;
+}
+
+DUChainArena::Statistics DUChainArena::statistics()
+{
+  Statistics ret;
+  ret.arenaAllocations = 0;
+  ret.heapAllocations = 0;
+  if(Counters* c = counters()) {
+    QMutexLocker lock(&c->mutex);
+    ret.arenaAllocations = c->exitedArenaAllocations;
+    ret.heapAllocations = c->exitedHeapAllocations;
+    foreach(const ThreadArena* arena, c->threads) {
+      ret.arenaAllocations += arena->arenaAllocations.load();
+      ret.heapAllocations += arena->heapAllocations.load();
+    }
+  }
+  ret.chunks = chunkCount.load();
+  return ret;
+}
+
+}
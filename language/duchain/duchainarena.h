@@ -0,0 +1,77 @@
+/* This file is part of KDevelop
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KDEVPLATFORM_DUCHAINARENA_H
+#define KDEVPLATFORM_DUCHAINARENA_H
+
+#include <cstddef>
+
+#include <QtCore/QtGlobal>
+
+#include <language/languageexport.h>
+
+namespace KDevelop {
+
+/**
+ * Allocator for duchain items and their dynamic data.
+ *
+ * While a DUChainArena object exists, all DUChainBase objects and DUChainBaseData objects created by the same thread
+ * are placed next to each other into large chunks, instead of being allocated one by one from the heap. The builders
+ * open an arena while building a new top-context, so the items of one top-context end up in a few chunks, which avoids
+ * contention on the heap between the parse threads. Updates of existing top-contexts keep many of the old items, so
+ * they don't use an arena.
+ *
+ * Deleting an item does not free its memory right away, a chunk is freed as a whole once all items in it are deleted.
+ * That usually happens when the top-context is stored, as the dynamic data is dropped then, or when it is destroyed.
+ * A single item that lives longer, e.g. one that is moved to another top-context, keeps its whole chunk of 256 KB
+ * alive. So only open an arena around code that creates items which are deleted together, and allocate long-lived
+ * items outside of it. Allocations larger than 8 KB are always taken from the heap.
+ *
+ * Outside of an arena, items are allocated from the heap as usual, without any overhead.
+ */
+class KDEVPLATFORMLANGUAGE_EXPORT DUChainArena
+{
+  public:
+    struct Statistics
+    {
+      quint64 arenaAllocations;
+      quint64 heapAllocations;
+      uint chunks; ///< Count of chunks that are currently allocated
+    };
+
+    ///Opens an arena for the current thread, unless @p open is false. Nested arenas share the chunks of the outermost one.
+    explicit DUChainArena(bool open = true);
+    ~DUChainArena();
+
+    static void* allocate(std::size_t size);
+    static void deallocate(void* pointer);
+
+    ///Whether arenas are used at all. Enabled by default, the environment variable KDEV_DUCHAIN_NO_ARENA disables it.
+    static bool enabled();
+    static void setEnabled(bool enabled);
+
+    static Statistics statistics();
+
+  private:
+    Q_DISABLE_COPY(DUChainArena)
+
+    bool m_open;
+};
+
+}
+
+#endif
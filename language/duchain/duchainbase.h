@@ -22,6 +22,7 @@
 
 #include <language/languageexport.h>
 #include "appendedlist.h"
+#include "duchainarena.h"
 #include "duchainpointer.h"
 #include <language/editor/persistentmovingrange.h>
 #include <language/editor/rangeinrevision.h>
@@ -110,6 +111,20 @@ public:
     static bool appendedListDynamicDefault() {
       return !shouldCreateConstantData();
     }
+
+    ///Dynamic data is allocated through DUChainArena, see there
+    static void* operator new(std::size_t size) {
+      return DUChainArena::allocate(size);
+    }
+    static void operator delete(void* pointer) {
+      DUChainArena::deallocate(pointer);
+    }
+    ///Used to construct data in place, for example when storing it
+    static void* operator new(std::size_t, void* place) {
+      return place;
+    }
+    static void operator delete(void*, void*) {
+    }
 };
 
 /**
@@ -131,6 +146,14 @@ public:
   /// Destructor
   virtual ~DUChainBase();
 
+  ///Items are allocated through DUChainArena, see there
+  static void* operator new(std::size_t size) {
+    return DUChainArena::allocate(size);
+  }
+  static void operator delete(void* pointer) {
+    DUChainArena::deallocate(pointer);
+  }
+
   /**
    * Determine the top context to which this object belongs.
    */
@@ -21,109 +21,956 @@
 
 #include "duchainlock.h"
 #include "duchain.h"
+#include "topducontext.h"
+#include "util/debug.h"
 
 #include <QThread>
 #include <QThreadStorage>
 #include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QWaitCondition>
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
 
 ///@todo Always prefer exactly that lock that is requested by the thread that has the foreground mutex,
 ///           to reduce the amount of UI blocking.
 
-//Microseconds to sleep when waiting for a lock
-const uint uSleepTime = 500;
+//Milliseconds a new reader waits at most for queued writers while no writer holds the lock. This bounds the
+//damage if the thread holding a read-lock waits for another thread that just wants to read as well.
+const int maxWriterPreferenceTime = 100;
 
 namespace KDevelop
 {
 
+namespace {
+
+/**
+ * The modes in which the chain can be locked by multiple threads at once. Next to them there is the exclusive write-lock.
+ *
+ * Read is the classical global read-lock. TopContextRead and TopContextWrite are taken on the global lock by threads
+ * that lock single top-contexts, they are intention modes: Only the per-top-context lock tells what is actually accessed.
+ * Read conflicts with TopContextWrite, as a global reader may look at any top-context.
+ */
+enum SharedMode {
+  Read,
+  TopContextRead,
+  TopContextWrite,
+  SharedModeCount
+};
+
+struct HeldTopContext
+{
+  uint index;
+  int readerRecursion;
+  int writerRecursion;
+};
+
+struct ThreadState
+{
+  ThreadState()
+    : readScope(nullptr)
+    , scopedReads(0)
+  {
+    for (int& recursion : sharedRecursion) {
+      recursion = 0;
+    }
+  }
+
+  HeldTopContext* findTopContext(uint index)
+  {
+    auto it = heldTopContexts.find(index);
+    return it == heldTopContexts.end() ? nullptr : &*it;
+  }
+
+  int sharedRecursion[SharedModeCount];
+  ///Hashed, as the read-locks within a DUChainReadScope hold the recursive imports of a top-context
+  QHash<uint, HeldTopContext> heldTopContexts;
+  ///The top-contexts of the active DUChainReadScope, or zero
+  const QVector<uint>* readScope;
+  ///The top-contexts locked for the global read-locks granted within the scope
+  QVector<uint> lockedScope;
+  ///Recursion of the global read-locks granted within the scope, they are not counted in sharedRecursion
+  int scopedReads;
+};
+
+///The state of a single top-context lock, protected by DUChainLockPrivate::m_topContextMutex
+struct TopContextLock
+{
+  QThread* writer = nullptr;
+  int writerRecursion = 0;
+  int readerRecursion = 0;
+  ///Count of threads holding or waiting for this lock. The lock is dropped from the hash once it reaches zero.
+  int users = 0;
+};
+
+}
+
+/**
+ * Wait- and hold-time statistics of the acquisitions through the lockers, per acquisition site.
+ *
+ * Recording is lock-free: The sites live in a fixed open-addressing table, and all statistics are atomic counters,
+ * so the overhead is two clock reads per acquisition plus a few uncontended atomic additions.
+ */
+class DUChainLockProfile
+{
+public:
+  enum Mode {
+    Read,
+    Write,
+    TopContextRead,
+    TopContextWrite
+  };
+
+  enum {
+    SiteCount = 1024,
+    ///Log2-buckets of microseconds, the last one collects everything above 2^22 us
+    HistogramBuckets = 24
+  };
+
+  struct Site
+  {
+    QAtomicPointer<const char> file;
+    ///((line + 1) << 2) | mode, zero while the site is being claimed
+    QAtomicInt key;
+    QAtomicInt count;
+    QAtomicInt waitHistogram[HistogramBuckets];
+    QAtomicInt holdHistogram[HistogramBuckets];
+    QAtomicInteger<qint64> waitTotal;
+    QAtomicInteger<qint64> waitMax;
+    QAtomicInteger<qint64> holdTotal;
+    QAtomicInteger<qint64> holdMax;
+    ///Time other threads spent waiting while this site held the write-lock
+    QAtomicInteger<qint64> blockedOthers;
+  };
+
+  ///State carried from before an acquisition to after it
+  struct Acquisition
+  {
+    qint64 start;
+    Site* holder;
+  };
+
+  DUChainLockProfile()
+  {
+    m_timer.start();
+  }
+
+  qint64 now() const
+  {
+    return m_timer.nsecsElapsed();
+  }
+
+  Site* site(const char* file, int line, Mode mode)
+  {
+    if (!file) {
+      file = "unknown";
+    }
+    const int key = ((line + 1) << 2) | mode;
+    const uint hash = uint(quintptr(file) >> 3) * 2654435761u + uint(key) * 40503u;
+    for (uint probe = 0; probe < SiteCount; ++probe) {
+      Site& candidate = m_sites[(hash + probe) % SiteCount];
+      const char* candidateFile = candidate.file.loadAcquire();
+      if (!candidateFile) {
+        if (candidate.file.testAndSetOrdered(nullptr, file)) {
+          candidate.key.storeRelease(key);
+          return &candidate;
+        }
+        candidateFile = candidate.file.loadAcquire();
+      }
+      if (candidateFile != file) {
+        continue;
+      }
+      int candidateKey;
+      while (!(candidateKey = candidate.key.loadAcquire())) {
+        //Another thread is just claiming the slot
+        QThread::yieldCurrentThread();
+      }
+      if (candidateKey == key) {
+        return &candidate;
+      }
+    }
+    //The table is full, account the acquisition to the last slot
+    return &m_sites[SiteCount - 1];
+  }
+
+  void recordWait(Site* site, qint64 nanoseconds, Site* holder)
+  {
+    site->count.fetchAndAddRelaxed(1);
+    record(site->waitHistogram, site->waitTotal, site->waitMax, nanoseconds);
+    if (holder && holder != site) {
+      holder->blockedOthers.fetchAndAddRelaxed(nanoseconds);
+    }
+  }
+
+  void recordHold(Site* site, qint64 nanoseconds)
+  {
+    record(site->holdHistogram, site->holdTotal, site->holdMax, nanoseconds);
+  }
+
+  QString report(int maxSites) const;
+
+  ///The outermost site holding the global write-lock
+  QAtomicPointer<Site> m_writerSite;
+
+private:
+  static void record(QAtomicInt* histogram, QAtomicInteger<qint64>& total, QAtomicInteger<qint64>& max, qint64 nanoseconds)
+  {
+    int bucket = 0;
+    for (qint64 microseconds = nanoseconds / 1000; microseconds && bucket < HistogramBuckets - 1; microseconds >>= 1) {
+      ++bucket;
+    }
+    histogram[bucket].fetchAndAddRelaxed(1);
+    total.fetchAndAddRelaxed(nanoseconds);
+    qint64 currentMax = max.load();
+    while (nanoseconds > currentMax && !max.testAndSetRelaxed(currentMax, nanoseconds)) {
+      currentMax = max.load();
+    }
+  }
+
+  QElapsedTimer m_timer;
+  Site m_sites[SiteCount];
+};
+
+namespace {
+
+struct SiteSummary
+{
+  QString location;
+  int mode;
+  qint64 count;
+  qint64 waitHistogram[DUChainLockProfile::HistogramBuckets];
+  qint64 holdHistogram[DUChainLockProfile::HistogramBuckets];
+  qint64 waitTotal;
+  qint64 waitMax;
+  qint64 holdTotal;
+  qint64 holdMax;
+  qint64 blockedOthers;
+};
+
+QString formatTime(qint64 nanoseconds)
+{
+  if (nanoseconds >= 1000000) {
+    return QStringLiteral("%1ms").arg(nanoseconds / 1000000.0, 0, 'f', 1);
+  }
+  return QStringLiteral("%1us").arg(nanoseconds / 1000);
+}
+
+///The upper bound of the histogram bucket containing the given percentile
+QString histogramPercentile(const qint64* histogram, qint64 count, double percentile)
+{
+  if (!count) {
+    return QStringLiteral("-");
+  }
+  qint64 seen = 0;
+  for (int bucket = 0; bucket < DUChainLockProfile::HistogramBuckets - 1; ++bucket) {
+    seen += histogram[bucket];
+    if (seen >= count * percentile) {
+      return QLatin1Char('<') + formatTime(qint64(1000) << bucket);
+    }
+  }
+  return QLatin1Char('>') + formatTime(qint64(1000) << (DUChainLockProfile::HistogramBuckets - 2));
+}
+
+}
+
+QString DUChainLockProfile::report(int maxSites) const
+{
+  //Merge the sites by their location, the same file may be referenced through different string literals
+  QHash<QPair<QString, int>, SiteSummary> summaries;
+  for (const Site& site : m_sites) {
+    const char* file = site.file.loadAcquire();
+    const int key = site.key.loadAcquire();
+    if (!file || !key) {
+      continue;
+    }
+    //Only keep the last two path components
+    QString location = QString::fromUtf8(file);
+    const int slash = location.lastIndexOf(QLatin1Char('/'), location.lastIndexOf(QLatin1Char('/')) - 1);
+    if (slash >= 0 && location.lastIndexOf(QLatin1Char('/')) > 0) {
+      location = location.mid(slash + 1);
+    }
+    if ((key >> 2) - 1 > 0) {
+      location += QLatin1Char(':') + QString::number((key >> 2) - 1);
+    }
+    const int mode = key & 3;
+
+    auto it = summaries.find(qMakePair(location, mode));
+    if (it == summaries.end()) {
+      SiteSummary summary = {location, mode, 0, {}, {}, 0, 0, 0, 0, 0};
+      it = summaries.insert(qMakePair(location, mode), summary);
+    }
+    SiteSummary& summary = *it;
+    summary.count += site.count.load();
+    for (int bucket = 0; bucket < HistogramBuckets; ++bucket) {
+      summary.waitHistogram[bucket] += site.waitHistogram[bucket].load();
+      summary.holdHistogram[bucket] += site.holdHistogram[bucket].load();
+    }
+    summary.waitTotal += site.waitTotal.load();
+    summary.waitMax = qMax(summary.waitMax, site.waitMax.load());
+    summary.holdTotal += site.holdTotal.load();
+    summary.holdMax = qMax(summary.holdMax, site.holdMax.load());
+    summary.blockedOthers += site.blockedOthers.load();
+  }
+
+  QVector<SiteSummary> sorted;
+  sorted.reserve(summaries.size());
+  foreach (const SiteSummary& summary, summaries) {
+    sorted << summary;
+  }
+  //The worst holders are the ones that blocked others longest, then the ones that held the lock longest
+  std::sort(sorted.begin(), sorted.end(), [] (const SiteSummary& lhs, const SiteSummary& rhs) {
+    if (lhs.blockedOthers != rhs.blockedOthers) {
+      return lhs.blockedOthers > rhs.blockedOthers;
+    }
+    return lhs.holdTotal > rhs.holdTotal;
+  });
+
+  static const char* const modeNames[] = {"read", "write", "top-read", "top-write"};
+  QString ret = QStringLiteral("DUChain lock profile, %1 acquisition sites, worst holders first:\n").arg(sorted.size());
+  for (int a = 0; a < sorted.size() && a < maxSites; ++a) {
+    const SiteSummary& summary = sorted[a];
+    ret += QStringLiteral("%1 %2: %3x, held %4 (p50 %5, p99 %6, max %7), waited %8 (p99 %9, max %10), blocked others %11\n")
+      .arg(QLatin1String(modeNames[summary.mode]), -9)
+      .arg(summary.location)
+      .arg(summary.count)
+      .arg(formatTime(summary.holdTotal))
+      .arg(histogramPercentile(summary.holdHistogram, summary.count, 0.5))
+      .arg(histogramPercentile(summary.holdHistogram, summary.count, 0.99))
+      .arg(formatTime(summary.holdMax))
+      .arg(formatTime(summary.waitTotal))
+      .arg(histogramPercentile(summary.waitHistogram, summary.count, 0.99))
+      .arg(formatTime(summary.waitMax))
+      .arg(formatTime(summary.blockedOthers));
+  }
+  return ret;
+}
+
+/**
+ * The uncontended paths only touch the atomic counters. Threads that cannot get the lock immediately
+ * register themselves in m_waitingReaders/m_waitingWriters and block on a wait condition, instead of polling.
+ * Whoever changes the lock state re-checks the waiting counters afterwards and wakes the sleepers under m_mutex.
+ * Since the waiters increase their counter before re-checking the lock state, and both sides separate their change
+ * from the following check with storeLoadBarrier(), either the waiter sees the new state or the releaser sees the waiter.
+ *
+ * Writers are preferred: As soon as a writer waits, new (non-recursive) readers block as well.
+ * To keep readers from starving under a constant stream of writers, every released write-lock starts a
+ * new reader batch: Readers that were already waiting when it was released may then acquire the lock even if
+ * further writers are waiting, so a reader waits for at most one writer after the one it queued behind,
+ * or maxWriterPreferenceTime if the lock is only held by other readers.
+ *
+ * The per-top-context locks are rarely contended for long, so they are kept in a hash under m_topContextMutex.
+ */
 class DUChainLockPrivate
 {
 public:
   DUChainLockPrivate()
     : m_writer(nullptr)
     , m_writerRecursion(0)
-    , m_totalReaderRecursion(0)
+    , m_waitingReaders(0)
+    , m_waitingWriters(0)
+    , m_readerBatch(0)
+    , m_writeLockGeneration(0)
+    , m_topContextLocking(false)
+    , m_checkLockOrder(false)
+    , m_crossFileMutex(QMutex::Recursive)
+    , m_profile(nullptr)
   { }
 
-  int ownReaderRecursion() const
+  ~DUChainLockPrivate()
+  {
+    delete m_profile;
+  }
+
+  ThreadState& threadState()
+  {
+    return m_threadState.localData();
+  }
+
+  ///Returns the new total recursion of @p mode
+  ///Orders the preceding lock state change before the following loads. The ordered read-modify-write operations
+  ///are only acquire-release, which allows a later load to be satisfied before the change is visible to other threads.
+  static void storeLoadBarrier()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  int changeRecursion(ThreadState& state, SharedMode mode, int difference)
+  {
+    state.sharedRecursion[mode] += difference;
+    Q_ASSERT(state.sharedRecursion[mode] >= 0);
+    return m_sharedRecursion[mode].fetchAndAddOrdered(difference) + difference;
+  }
+
+  ///Whether the current thread may take @p mode without looking at other threads, because it already holds
+  ///the write-lock or a mode at least as strong
+  bool grantedRecursively(const ThreadState& state, SharedMode mode) const
+  {
+    if (state.sharedRecursion[mode] || m_writer.loadAcquire() == QThread::currentThread()) {
+      return true;
+    }
+    switch (mode) {
+      case Read:
+        //Nested global read-locks of top-context writers, eg. from utility code. They are counted normally,
+        //so no further top-context writers can start while they are held.
+        return state.sharedRecursion[TopContextWrite];
+      case TopContextRead:
+        return state.sharedRecursion[Read] || state.sharedRecursion[TopContextWrite];
+      default:
+        return false;
+    }
+  }
+
+  ///Whether another thread holds a mode that excludes @p mode. The exclusive writer is not checked.
+  bool conflicts(SharedMode mode) const
+  {
+    switch (mode) {
+      case Read:
+        return m_sharedRecursion[TopContextWrite].load();
+      case TopContextWrite:
+        return m_sharedRecursion[Read].load();
+      default:
+        return false;
+    }
+  }
+
+  bool lockShared(SharedMode mode, uint timeout)
+  {
+    ThreadState& state = threadState();
+    if (grantedRecursively(state, mode)) {
+      //Waiting writers must not block us here, as they are waiting for exactly this thread.
+      changeRecursion(state, mode, 1);
+      return true;
+    }
+
+    //It is not allowed to acquire a top-context write-lock while holding a global read-lock
+    Q_ASSERT(mode != TopContextWrite || state.sharedRecursion[Read] == 0);
+
+    if (m_checkLockOrder && mode == Read && !state.heldTopContexts.isEmpty()) {
+      //The global read-lock waits for all top-context writers, which in turn may wait for our top-contexts
+      QMutexLocker lock(&m_topContextMutex);
+      for (const HeldTopContext& held : state.heldTopContexts) {
+        qCWarning(LANGUAGE) << "lock order inversion: global read-lock requested while holding top-context" << held.index;
+        m_lockOrderViolations.append(qMakePair(held.index, 0u));
+      }
+    }
+
+    ///Step 1: Increase the own recursion. This will make sure no further conflicting locks will succeed
+    changeRecursion(state, mode, 1);
+    storeLoadBarrier();
+
+    if (!m_writer.loadAcquire() && m_waitingWriters.load() == 0 && !conflicts(mode)) {
+      //Successful lock: There is no writer, and nobody waits for becoming one
+      return true;
+    }
+
+    ///Step 2: Back off and block until the conflicting locks are gone
+    releaseShared(state, mode, false);
+    return lockSharedSlow(state, mode, timeout);
+  }
+
+  ///Drops a shared lock that was only taken tentatively, or released, and wakes up the waiters if it was the last one.
+  ///@param locked Whether m_mutex is already held by the caller
+  void releaseShared(ThreadState& state, SharedMode mode, bool locked)
+  {
+    if (changeRecursion(state, mode, -1) != 0) {
+      return;
+    }
+    storeLoadBarrier();
+    if (!m_waitingWriters.load() && (mode == TopContextRead || !m_waitingReaders.load())) {
+      return;
+    }
+    if (!locked) {
+      QMutexLocker lock(&m_mutex);
+      m_writerCondition.wakeAll();
+      m_readerCondition.wakeAll();
+    } else {
+      m_writerCondition.wakeAll();
+      m_readerCondition.wakeAll();
+    }
+  }
+
+  ///Tries to get the write-lock without blocking. Must not be called when the current thread is the writer.
+  bool tryLockForWrite(bool locked)
+  {
+    if (sharedLocksHeld() || !m_writerRecursion.testAndSetOrdered(0, 1)) {
+      return false;
+    }
+
+    //Now we can be sure that there is no other writer, as we have increased m_writerRecursion from 0 to 1
+    m_writer.fetchAndStoreOrdered(QThread::currentThread());
+    storeLoadBarrier();
+    if (!sharedLocksHeld()) {
+      //There is still no readers, we have successfully acquired a write-lock
+      return true;
+    }
+
+    //A reader came in between. Back off, and wake up everyone who might have blocked on us in the meantime.
+    clearWriter(locked, false);
+    return false;
+  }
+
+  bool sharedLocksHeld() const
+  {
+    return m_sharedRecursion[Read].load() || m_sharedRecursion[TopContextRead].load()
+           || m_sharedRecursion[TopContextWrite].load();
+  }
+
+  /**
+   * Resets the writer, and wakes up all threads that are blocked in the slow paths.
+   * @param locked Whether m_mutex is already held by the caller
+   * @param newReaderBatch Whether the currently waiting readers may overtake waiting writers
+   */
+  void clearWriter(bool locked, bool newReaderBatch)
   {
-    return m_readerRecursion.localData();
+    //The order is important here, m_writerRecursion protects m_writer
+    m_writer.fetchAndStoreOrdered(nullptr);
+    m_writerRecursion.fetchAndStoreOrdered(0);
+    storeLoadBarrier();
+
+    if (m_waitingReaders.load() == 0 && m_waitingWriters.load() == 0) {
+      return;
+    }
+
+    if (!locked) {
+      m_mutex.lock();
+    }
+    if (newReaderBatch) {
+      ++m_readerBatch;
+    }
+    m_readerCondition.wakeAll();
+    m_writerCondition.wakeAll();
+    if (!locked) {
+      m_mutex.unlock();
+    }
   }
 
-  void changeOwnReaderRecursion(int difference)
+  ///Returns how many milliseconds are left until @p timeout is reached, or ULONG_MAX if @p timeout is zero.
+  static unsigned long remainingTime(const QElapsedTimer& timer, uint timeout)
   {
-    m_readerRecursion.localData() += difference;
-    Q_ASSERT(m_readerRecursion.localData() >= 0);
-    m_totalReaderRecursion.fetchAndAddOrdered(difference);
+    if (!timeout) {
+      return ULONG_MAX;
+    }
+    return qMax<qint64>(0, timeout - timer.elapsed());
   }
 
+  bool lockSharedSlow(ThreadState& state, SharedMode mode, uint timeout);
+  bool lockForWriteSlow(uint timeout);
+
+  bool lockTopContext(uint index, bool write, uint timeout);
+  void releaseTopContext(uint index, bool write);
+  bool lockTopContexts(const QVector<uint>& indices, uint timeout);
+  void releaseTopContexts(const QVector<uint>& indices);
+  ///Returns whether the lock became free for others. m_topContextMutex must be locked.
+  bool releaseTopContextLocked(ThreadState& state, uint index, bool write);
+  ///Records the order in which the current thread acquires @p index after the top-contexts it already holds
+  void checkLockOrder(const ThreadState& state, uint index);
+  bool lockOrderReaches(uint from, uint to) const;
+
   ///Holds the writer that currently has the write-lock, or zero. Is protected by m_writerRecursion.
   QAtomicPointer<QThread> m_writer;
 
   ///How often is the chain write-locked by the writer? This value protects m_writer,
   ///m_writer may only be changed by the thread that successfully increases this value from 0 to 1
   QAtomicInt m_writerRecursion;
-  ///How often is the chain read-locked recursively by all readers? Should be sum of all m_readerRecursion values
-  QAtomicInt m_totalReaderRecursion;
+  ///How often is the chain locked recursively in the shared modes by all threads? Should be the sum of the
+  ///sharedRecursion values of all thread states
+  QAtomicInt m_sharedRecursion[SharedModeCount];
+
+  QThreadStorage<ThreadState> m_threadState;
 
-  QThreadStorage<int> m_readerRecursion;
+  ///Count of threads blocked in lockSharedSlow() resp. lockForWriteSlow(). Only changed while m_mutex is held.
+  QAtomicInt m_waitingReaders;
+  QAtomicInt m_waitingWriters;
+  ///Increased whenever a write-lock is released, protected by m_mutex
+  int m_readerBatch;
+  ///Increased whenever the write-lock is released completely, see DUChainLock::writeLockGeneration()
+  QAtomicInt m_writeLockGeneration;
+
+  ///Only protects the waiting, the lock state itself is kept in the atomics above
+  QMutex m_mutex;
+  QWaitCondition m_readerCondition;
+  QWaitCondition m_writerCondition;
+
+  bool m_topContextLocking;
+  bool m_checkLockOrder;
+
+  ///Protects everything below
+  QMutex m_topContextMutex;
+  QWaitCondition m_topContextCondition;
+  QHash<uint, TopContextLock> m_topContextLocks;
+  ///Edges from each top-context to the ones that were locked while holding it
+  QHash<uint, QSet<uint>> m_lockOrder;
+  QVector<QPair<uint, uint>> m_lockOrderViolations;
+
+  QMutex m_crossFileMutex;
+
+  ///Created when profiling is enabled for the first time, and kept until destruction afterwards
+  DUChainLockProfile* m_profile;
+  QAtomicInt m_profiling;
+
+  DUChainLockProfile::Acquisition profileAcquisitionStart() const
+  {
+    if (!m_profiling.load()) {
+      return {-1, nullptr};
+    }
+    return {m_profile->now(), m_profile->m_writerSite.loadAcquire()};
+  }
+
+  ///Records the wait, and returns the time the lock was acquired at if the hold time should be recorded, else -1
+  qint64 profileAcquired(const DUChainLockProfile::Acquisition& acquisition, const char* file, int line,
+                         DUChainLockProfile::Mode mode, bool locked)
+  {
+    if (acquisition.start < 0) {
+      return -1;
+    }
+    const qint64 now = m_profile->now();
+    DUChainLockProfile::Site* site = m_profile->site(file, line, mode);
+    m_profile->recordWait(site, now - acquisition.start, acquisition.holder);
+    if (!locked) {
+      return -1;
+    }
+    if (mode == DUChainLockProfile::Write && m_writerRecursion.load() == 1) {
+      m_profile->m_writerSite.storeRelease(site);
+    }
+    return now;
+  }
+
+  ///Must be called before the lock is actually released
+  void profileReleasing(qint64 lockedAt, const char* file, int line, DUChainLockProfile::Mode mode)
+  {
+    if (lockedAt < 0) {
+      return;
+    }
+    if (mode == DUChainLockProfile::Write && m_writerRecursion.load() == 1) {
+      m_profile->m_writerSite.storeRelease(nullptr);
+    }
+    m_profile->recordHold(m_profile->site(file, line, mode), m_profile->now() - lockedAt);
+  }
 };
 
-DUChainLock::DUChainLock()
-  : d(new DUChainLockPrivate)
+bool DUChainLockPrivate::lockSharedSlow(ThreadState& state, SharedMode mode, uint timeout)
+{
+  QElapsedTimer t;
+  t.start();
+
+  QMutexLocker lock(&m_mutex);
+  m_waitingReaders.fetchAndAddOrdered(1);
+  storeLoadBarrier();
+  const int batch = m_readerBatch;
+
+  bool success = false;
+  while (true) {
+    const bool preferWriters = m_waitingWriters.load() && batch == m_readerBatch
+                               && t.elapsed() < maxWriterPreferenceTime;
+    if (!m_writer.loadAcquire() && !preferWriters && !conflicts(mode)) {
+      changeRecursion(state, mode, 1);
+      storeLoadBarrier();
+      if (!m_writer.loadAcquire() && !conflicts(mode)) {
+        success = true;
+        break;
+      }
+      //Somebody slipped in, they will wake us up again once they are done
+      releaseShared(state, mode, true);
+    }
+
+    unsigned long waitTime = remainingTime(t, timeout);
+    if (!waitTime) {
+      break;
+    }
+    if (preferWriters) {
+      waitTime = qMin<unsigned long>(waitTime, maxWriterPreferenceTime - t.elapsed() + 1);
+    }
+    m_readerCondition.wait(&m_mutex, waitTime);
+  }
+
+  m_waitingReaders.fetchAndAddOrdered(-1);
+  return success;
+}
+
+bool DUChainLockPrivate::lockForWriteSlow(uint timeout)
 {
+  QElapsedTimer t;
+  t.start();
+
+  QMutexLocker lock(&m_mutex);
+  m_waitingWriters.fetchAndAddOrdered(1);
+  storeLoadBarrier();
+
+  bool success = false;
+  while (true) {
+    if (tryLockForWrite(true)) {
+      success = true;
+      break;
+    }
+
+    const unsigned long waitTime = remainingTime(t, timeout);
+    if (!waitTime) {
+      break;
+    }
+    m_writerCondition.wait(&m_mutex, waitTime);
+  }
+
+  if (m_waitingWriters.fetchAndAddOrdered(-1) == 1 && !success) {
+    //Readers may have queued up behind us only because of the writer preference
+    m_readerCondition.wakeAll();
+  }
+  return success;
 }
 
-DUChainLock::~DUChainLock()
+bool DUChainLockPrivate::lockTopContext(uint index, bool write, uint timeout)
 {
-  delete d;
+  QElapsedTimer t;
+  if (timeout) {
+    t.start();
+  }
+
+  ThreadState& state = threadState();
+  QMutexLocker lock(&m_topContextMutex);
+
+  if (HeldTopContext* held = state.findTopContext(index)) {
+    TopContextLock& topLock = m_topContextLocks[index];
+    if (write) {
+      //It is not allowed to acquire a write-lock while holding read-lock
+      Q_ASSERT(held->writerRecursion);
+      ++held->writerRecursion;
+      ++topLock.writerRecursion;
+    } else {
+      ++held->readerRecursion;
+      ++topLock.readerRecursion;
+    }
+    return true;
+  }
+
+  if (m_checkLockOrder) {
+    checkLockOrder(state, index);
+  }
+
+  ++m_topContextLocks[index].users;
+  while (true) {
+    //The hash may have been changed while waiting, so look the lock up again
+    TopContextLock& topLock = m_topContextLocks[index];
+    if (!topLock.writer && (!write || !topLock.readerRecursion)) {
+      HeldTopContext held = {index, 0, 0};
+      if (write) {
+        topLock.writer = QThread::currentThread();
+        ++topLock.writerRecursion;
+        held.writerRecursion = 1;
+      } else {
+        ++topLock.readerRecursion;
+        held.readerRecursion = 1;
+      }
+      state.heldTopContexts.insert(index, held);
+      return true;
+    }
+
+    const unsigned long waitTime = remainingTime(t, timeout);
+    if (!waitTime) {
+      if (--topLock.users == 0) {
+        m_topContextLocks.remove(index);
+      }
+      return false;
+    }
+    m_topContextCondition.wait(&m_topContextMutex, waitTime);
+  }
 }
 
-bool DUChainLock::lockForRead(unsigned int timeout)
+void DUChainLockPrivate::releaseTopContext(uint index, bool write)
+{
+  ThreadState& state = threadState();
+  QMutexLocker lock(&m_topContextMutex);
+  if (releaseTopContextLocked(state, index, write)) {
+    m_topContextCondition.wakeAll();
+  }
+}
+
+bool DUChainLockPrivate::releaseTopContextLocked(ThreadState& state, uint index, bool write)
 {
-  ///Step 1: Increase the own reader-recursion. This will make sure no further write-locks will succeed
-  d->changeOwnReaderRecursion(1);
+  auto held = state.heldTopContexts.find(index);
+  Q_ASSERT(held != state.heldTopContexts.end());
+  auto it = m_topContextLocks.find(index);
+  Q_ASSERT(it != m_topContextLocks.end());
 
-  QThread* w = d->m_writer.loadAcquire();
-  if (w == nullptr || w == QThread::currentThread()) {
-    //Successful lock: Either there is no writer, or we hold the write-lock by ourselves
+  bool released = false;
+  if (write) {
+    Q_ASSERT(held->writerRecursion > 0 && it->writer == QThread::currentThread());
+    --held->writerRecursion;
+    if (--it->writerRecursion == 0) {
+      it->writer = nullptr;
+      released = true;
+    }
   } else {
-    ///Step 2: Start spinning until there is no writer any more
+    Q_ASSERT(held->readerRecursion > 0);
+    --held->readerRecursion;
+    released = --it->readerRecursion == 0;
+  }
 
-    QElapsedTimer t;
-    if (timeout) {
-      t.start();
+  if (!held->readerRecursion && !held->writerRecursion) {
+    state.heldTopContexts.erase(held);
+    if (--it->users == 0) {
+      m_topContextLocks.erase(it);
+      return false;
     }
+  }
+  return released;
+}
 
-    while (d->m_writer.loadAcquire()) {
-      if (!timeout || t.elapsed() < timeout) {
-        QThread::usleep(uSleepTime);
-      } else {
-        //Fail!
-        d->changeOwnReaderRecursion(-1);
-        return false;
+bool DUChainLockPrivate::lockTopContexts(const QVector<uint>& indices, uint timeout)
+{
+  QElapsedTimer t;
+  if (timeout) {
+    t.start();
+  }
+
+  ThreadState& state = threadState();
+  QMutexLocker lock(&m_topContextMutex);
+
+  //All the top-contexts are taken at once, so no lock order is established between them, and a writer
+  //of one of them never waits for a reader that holds some of them while waiting for the rest
+  while (true) {
+    bool blocked = false;
+    for (uint index : indices) {
+      if (state.heldTopContexts.contains(index)) {
+        continue;
+      }
+      auto it = m_topContextLocks.constFind(index);
+      if (it != m_topContextLocks.constEnd() && it->writer) {
+        blocked = true;
+        break;
       }
     }
+    if (!blocked) {
+      break;
+    }
+
+    const unsigned long waitTime = remainingTime(t, timeout);
+    if (!waitTime) {
+      return false;
+    }
+    m_topContextCondition.wait(&m_topContextMutex, waitTime);
   }
 
+  for (uint index : indices) {
+    TopContextLock& topLock = m_topContextLocks[index];
+    ++topLock.readerRecursion;
+    if (HeldTopContext* held = state.findTopContext(index)) {
+      ++held->readerRecursion;
+    } else {
+      ++topLock.users;
+      HeldTopContext newHeld = {index, 1, 0};
+      state.heldTopContexts.insert(index, newHeld);
+    }
+  }
   return true;
 }
 
+void DUChainLockPrivate::releaseTopContexts(const QVector<uint>& indices)
+{
+  ThreadState& state = threadState();
+  QMutexLocker lock(&m_topContextMutex);
+  bool released = false;
+  for (uint index : indices) {
+    released |= releaseTopContextLocked(state, index, false);
+  }
+  if (released) {
+    m_topContextCondition.wakeAll();
+  }
+}
+
+void DUChainLockPrivate::checkLockOrder(const ThreadState& state, uint index)
+{
+  for (const HeldTopContext& held : state.heldTopContexts) {
+    QSet<uint>& successors = m_lockOrder[held.index];
+    if (successors.contains(index)) {
+      continue;
+    }
+    if (lockOrderReaches(index, held.index)) {
+      //Another thread may hold @p index while waiting for held.index
+      qCWarning(LANGUAGE) << "lock order inversion: top-context" << index << "is locked while holding" << held.index
+                          << "but was locked before it elsewhere";
+      m_lockOrderViolations.append(qMakePair(held.index, index));
+      continue;
+    }
+    successors.insert(index);
+  }
+}
+
+bool DUChainLockPrivate::lockOrderReaches(uint from, uint to) const
+{
+  QVector<uint> pending;
+  QSet<uint> visited;
+  pending.append(from);
+  while (!pending.isEmpty()) {
+    const uint current = pending.takeLast();
+    if (current == to) {
+      return true;
+    }
+    if (visited.contains(current)) {
+      continue;
+    }
+    visited.insert(current);
+    foreach (uint successor, m_lockOrder.value(current)) {
+      pending.append(successor);
+    }
+  }
+  return false;
+}
+
+DUChainLock::DUChainLock()
+  : d(new DUChainLockPrivate)
+{
+}
+
+DUChainLock::~DUChainLock()
+{
+  delete d;
+}
+
+bool DUChainLock::lockForRead(unsigned int timeout)
+{
+  ThreadState& state = d->threadState();
+  //Within a DUChainReadScope, only the top-contexts of the scope are read, so writers of other top-contexts
+  //need not be excluded. A thread that already holds the whole chain just locks it recursively.
+  if (state.readScope && !state.sharedRecursion[Read] && !currentThreadHasWriteLock()) {
+    if (!state.scopedReads) {
+      if (!lockForTopContextsRead(*state.readScope, timeout)) {
+        return false;
+      }
+      state.lockedScope = *state.readScope;
+    }
+    ++state.scopedReads;
+    return true;
+  }
+  return d->lockShared(Read, timeout);
+}
+
 void DUChainLock::releaseReadLock()
 {
-  d->changeOwnReaderRecursion(-1);
+  ThreadState& state = d->threadState();
+  if (state.scopedReads && !state.sharedRecursion[Read]) {
+    if (--state.scopedReads == 0) {
+      releaseTopContextsReadLock(state.lockedScope);
+      state.lockedScope.clear();
+    }
+    return;
+  }
+  d->releaseShared(state, Read, false);
 }
 
 bool DUChainLock::currentThreadHasReadLock()
 {
-  return (bool)d->ownReaderRecursion();
+  const ThreadState& state = d->threadState();
+  return state.sharedRecursion[Read] || state.scopedReads;
 }
 
 bool DUChainLock::lockForWrite(uint timeout)
 {
   //It is not allowed to acquire a write-lock while holding read-lock
 
-  Q_ASSERT(d->ownReaderRecursion() == 0);
+  Q_ASSERT(d->threadState().sharedRecursion[Read] == 0);
 
   if (d->m_writer.load() == QThread::currentThread()) {
     //We already hold the write lock, just increase the recursion count and return
@@ -131,47 +978,24 @@ bool DUChainLock::lockForWrite(uint timeout)
     return true;
   }
 
-  QElapsedTimer t;
-  if (timeout) {
-    t.start();
-  }
-
-  while (1) {
-    //Try acquiring the write-lcok
-    if (d->m_totalReaderRecursion.load() == 0 && d->m_writerRecursion.testAndSetOrdered(0, 1)) {
-      //Now we can be sure that there is no other writer, as we have increased m_writerRecursion from 0 to 1
-      d->m_writer = QThread::currentThread();
-      if (d->m_totalReaderRecursion.load() == 0) {
-        //There is still no readers, we have successfully acquired a write-lock
-        return true;
-      } else {
-        //There may be readers.. we have to continue spinning
-        d->m_writer = nullptr;
-        d->m_writerRecursion = 0;
-      }
-    }
+  //Nor is it allowed while holding top-context locks
+  Q_ASSERT(d->threadState().sharedRecursion[TopContextRead] == 0);
+  Q_ASSERT(d->threadState().sharedRecursion[TopContextWrite] == 0);
 
-    if (!timeout || t.elapsed() < timeout) {
-      QThread::usleep(uSleepTime);
-    } else {
-      //Fail!
-      return false;
-    }
+  if (d->tryLockForWrite(false)) {
+    return true;
   }
 
-  return false;
+  return d->lockForWriteSlow(timeout);
 }
 
 void DUChainLock::releaseWriteLock()
 {
   Q_ASSERT(currentThreadHasWriteLock());
 
-  //The order is important here, m_writerRecursion protects m_writer
-
-  //TODO: could testAndSet here
   if (d->m_writerRecursion.load() == 1) {
-    d->m_writer = nullptr;
-    d->m_writerRecursion = 0;
+    d->m_writeLockGeneration.fetchAndAddRelease(1);
+    d->clearWriter(false, true);
   } else {
     d->m_writerRecursion.fetchAndAddOrdered(-1);
   }
@@ -182,10 +1006,170 @@ bool DUChainLock::currentThreadHasWriteLock()
   return d->m_writer.load() == QThread::currentThread();
 }
 
-DUChainReadLocker::DUChainReadLocker(DUChainLock* duChainLock, uint timeout)
+unsigned int DUChainLock::writeLockGeneration() const
+{
+  return d->m_writeLockGeneration.loadAcquire();
+}
+
+bool DUChainLock::lockForTopContextRead(uint topContextIndex, unsigned int timeout)
+{
+  QElapsedTimer t;
+  if (timeout) {
+    t.start();
+  }
+
+  if (!d->lockShared(TopContextRead, timeout)) {
+    return false;
+  }
+
+  //Keep the remaining time at least at one millisecond, as zero means no timeout
+  const uint remaining = timeout ? qMax<qint64>(1, timeout - t.elapsed()) : 0;
+  if (!d->lockTopContext(topContextIndex, false, remaining)) {
+    d->releaseShared(d->threadState(), TopContextRead, false);
+    return false;
+  }
+  return true;
+}
+
+void DUChainLock::releaseTopContextReadLock(uint topContextIndex)
+{
+  d->releaseTopContext(topContextIndex, false);
+  d->releaseShared(d->threadState(), TopContextRead, false);
+}
+
+bool DUChainLock::lockForTopContextsRead(const QVector<uint>& topContextIndices, unsigned int timeout)
+{
+  QElapsedTimer t;
+  if (timeout) {
+    t.start();
+  }
+
+  if (!d->lockShared(TopContextRead, timeout)) {
+    return false;
+  }
+
+  const uint remaining = timeout ? qMax<qint64>(1, timeout - t.elapsed()) : 0;
+  if (!d->lockTopContexts(topContextIndices, remaining)) {
+    d->releaseShared(d->threadState(), TopContextRead, false);
+    return false;
+  }
+  return true;
+}
+
+void DUChainLock::releaseTopContextsReadLock(const QVector<uint>& topContextIndices)
+{
+  d->releaseTopContexts(topContextIndices);
+  d->releaseShared(d->threadState(), TopContextRead, false);
+}
+
+bool DUChainLock::lockForTopContextWrite(uint topContextIndex, unsigned int timeout)
+{
+  QElapsedTimer t;
+  if (timeout) {
+    t.start();
+  }
+
+  if (!d->lockShared(TopContextWrite, timeout)) {
+    return false;
+  }
+
+  const uint remaining = timeout ? qMax<qint64>(1, timeout - t.elapsed()) : 0;
+  if (!d->lockTopContext(topContextIndex, true, remaining)) {
+    d->releaseShared(d->threadState(), TopContextWrite, false);
+    return false;
+  }
+  return true;
+}
+
+void DUChainLock::releaseTopContextWriteLock(uint topContextIndex)
+{
+  d->releaseTopContext(topContextIndex, true);
+  d->releaseShared(d->threadState(), TopContextWrite, false);
+}
+
+bool DUChainLock::currentThreadHasTopContextReadLock(uint topContextIndex)
+{
+  ThreadState& state = d->threadState();
+  if (!topContextIndex) {
+    return !state.heldTopContexts.isEmpty();
+  }
+  return state.findTopContext(topContextIndex);
+}
+
+bool DUChainLock::currentThreadHasTopContextWriteLock(uint topContextIndex)
+{
+  ThreadState& state = d->threadState();
+  if (topContextIndex) {
+    const HeldTopContext* held = state.findTopContext(topContextIndex);
+    return held && held->writerRecursion;
+  }
+  for (const HeldTopContext& held : state.heldTopContexts) {
+    if (held.writerRecursion) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DUChainLock::topContextLocking() const
+{
+  return d->m_topContextLocking;
+}
+
+void DUChainLock::setTopContextLocking(bool enabled)
+{
+  d->m_topContextLocking = enabled;
+}
+
+QMutex* DUChainLock::crossFileMutex() const
+{
+  return &d->m_crossFileMutex;
+}
+
+bool DUChainLock::profiling() const
+{
+  return d->m_profiling.load();
+}
+
+void DUChainLock::setProfiling(bool enabled)
+{
+  QMutexLocker lock(&d->m_mutex);
+  if (enabled && !d->m_profile) {
+    d->m_profile = new DUChainLockProfile;
+  }
+  d->m_profiling.storeRelease(enabled);
+}
+
+QString DUChainLock::profilingReport(int maxSites) const
+{
+  QMutexLocker lock(&d->m_mutex);
+  if (!d->m_profile) {
+    return QString();
+  }
+  return d->m_profile->report(maxSites);
+}
+
+void DUChainLock::setLockOrderChecking(bool enabled)
+{
+  QMutexLocker lock(&d->m_topContextMutex);
+  d->m_checkLockOrder = enabled;
+  d->m_lockOrder.clear();
+  d->m_lockOrderViolations.clear();
+}
+
+QVector<QPair<uint, uint>> DUChainLock::lockOrderViolations() const
+{
+  QMutexLocker lock(&d->m_topContextMutex);
+  return d->m_lockOrderViolations;
+}
+
+DUChainReadLocker::DUChainReadLocker(DUChainLock* duChainLock, uint timeout, const char* file, int line)
   : m_lock(duChainLock ? duChainLock : DUChain::lock())
   , m_locked(false)
   , m_timeout(timeout)
+  , m_file(file)
+  , m_line(line)
+  , m_lockedAt(-1)
 {
   lock();
 }
@@ -208,8 +1192,10 @@ bool DUChainReadLocker::lock()
 
   bool l = false;
   if (m_lock) {
+    const auto acquisition = m_lock->d->profileAcquisitionStart();
     l = m_lock->lockForRead(m_timeout);
     Q_ASSERT(m_timeout || l);
+    m_lockedAt = m_lock->d->profileAcquired(acquisition, m_file, m_line, DUChainLockProfile::Read, l);
   };
 
   m_locked = l;
@@ -220,15 +1206,19 @@ bool DUChainReadLocker::lock()
 void DUChainReadLocker::unlock()
 {
   if (m_locked && m_lock) {
+    m_lock->d->profileReleasing(m_lockedAt, m_file, m_line, DUChainLockProfile::Read);
     m_lock->releaseReadLock();
     m_locked = false;
   }
 }
 
-DUChainWriteLocker::DUChainWriteLocker(DUChainLock* duChainLock, uint timeout)
+DUChainWriteLocker::DUChainWriteLocker(DUChainLock* duChainLock, uint timeout, const char* file, int line)
   : m_lock(duChainLock ? duChainLock : DUChain::lock())
   , m_locked(false)
   , m_timeout(timeout)
+  , m_file(file)
+  , m_line(line)
+  , m_lockedAt(-1)
 {
   lock();
 }
@@ -238,6 +1228,11 @@ DUChainWriteLocker::~DUChainWriteLocker()
   unlock();
 }
 
+bool DUChainWriteLocker::locked() const
+{
+  return m_locked;
+}
+
 bool DUChainWriteLocker::lock()
 {
   if (m_locked) {
@@ -246,8 +1241,10 @@ bool DUChainWriteLocker::lock()
 
   bool l = false;
   if (m_lock) {
+    const auto acquisition = m_lock->d->profileAcquisitionStart();
     l = m_lock->lockForWrite(m_timeout);
     Q_ASSERT(m_timeout || l);
+    m_lockedAt = m_lock->d->profileAcquired(acquisition, m_file, m_line, DUChainLockProfile::Write, l);
   };
 
   m_locked = l;
@@ -255,17 +1252,187 @@ bool DUChainWriteLocker::lock()
   return l;
 }
 
-bool DUChainWriteLocker::locked() const
+void DUChainWriteLocker::unlock()
+{
+  if (m_locked && m_lock) {
+    m_lock->d->profileReleasing(m_lockedAt, m_file, m_line, DUChainLockProfile::Write);
+    m_lock->releaseWriteLock();
+    m_locked = false;
+  }
+}
+
+TopDUContextReadLocker::TopDUContextReadLocker(const TopDUContext* topContext, DUChainLock* duChainLock, uint timeout, const char* file, int line)
+  : TopDUContextReadLocker(topContext ? topContext->ownIndex() : 0, duChainLock, timeout, file, line)
+{
+}
+
+TopDUContextReadLocker::TopDUContextReadLocker(uint topContextIndex, DUChainLock* duChainLock, uint timeout, const char* file, int line)
+  : m_lock(duChainLock ? duChainLock : DUChain::lock())
+  , m_topContextIndex(topContextIndex)
+  , m_locked(false)
+  , m_topContextLocked(false)
+  , m_timeout(timeout)
+  , m_file(file)
+  , m_line(line)
+  , m_lockedAt(-1)
+{
+  lock();
+}
+
+TopDUContextReadLocker::~TopDUContextReadLocker()
+{
+  unlock();
+}
+
+bool TopDUContextReadLocker::locked() const
 {
   return m_locked;
 }
 
-void DUChainWriteLocker::unlock()
+bool TopDUContextReadLocker::lock()
+{
+  if (m_locked) {
+    return true;
+  }
+
+  bool l = false;
+  if (m_lock) {
+    m_topContextLocked = m_topContextIndex && m_lock->topContextLocking();
+    const auto acquisition = m_lock->d->profileAcquisitionStart();
+    if (m_topContextLocked) {
+      l = m_lock->lockForTopContextRead(m_topContextIndex, m_timeout);
+    } else {
+      l = m_lock->lockForRead(m_timeout);
+    }
+    Q_ASSERT(m_timeout || l);
+    m_lockedAt = m_lock->d->profileAcquired(acquisition, m_file, m_line, m_topContextLocked ? DUChainLockProfile::TopContextRead : DUChainLockProfile::Read, l);
+  };
+
+  m_locked = l;
+
+  return l;
+}
+
+void TopDUContextReadLocker::unlock()
 {
   if (m_locked && m_lock) {
-    m_lock->releaseWriteLock();
+    m_lock->d->profileReleasing(m_lockedAt, m_file, m_line, m_topContextLocked ? DUChainLockProfile::TopContextRead : DUChainLockProfile::Read);
+    if (m_topContextLocked) {
+      m_lock->releaseTopContextReadLock(m_topContextIndex);
+    } else {
+      m_lock->releaseReadLock();
+    }
     m_locked = false;
   }
 }
 
+TopDUContextWriteLocker::TopDUContextWriteLocker(const TopDUContext* topContext, DUChainLock* duChainLock, uint timeout, const char* file, int line)
+  : TopDUContextWriteLocker(topContext ? topContext->ownIndex() : 0, duChainLock, timeout, file, line)
+{
+}
+
+TopDUContextWriteLocker::TopDUContextWriteLocker(uint topContextIndex, DUChainLock* duChainLock, uint timeout, const char* file, int line)
+  : m_lock(duChainLock ? duChainLock : DUChain::lock())
+  , m_topContextIndex(topContextIndex)
+  , m_locked(false)
+  , m_topContextLocked(false)
+  , m_timeout(timeout)
+  , m_file(file)
+  , m_line(line)
+  , m_lockedAt(-1)
+{
+  lock();
+}
+
+TopDUContextWriteLocker::~TopDUContextWriteLocker()
+{
+  unlock();
+}
+
+bool TopDUContextWriteLocker::locked() const
+{
+  return m_locked;
+}
+
+bool TopDUContextWriteLocker::lock()
+{
+  if (m_locked) {
+    return true;
+  }
+
+  bool l = false;
+  if (m_lock) {
+    m_topContextLocked = m_topContextIndex && m_lock->topContextLocking();
+    const auto acquisition = m_lock->d->profileAcquisitionStart();
+    if (m_topContextLocked) {
+      l = m_lock->lockForTopContextWrite(m_topContextIndex, m_timeout);
+    } else {
+      l = m_lock->lockForWrite(m_timeout);
+    }
+    Q_ASSERT(m_timeout || l);
+    m_lockedAt = m_lock->d->profileAcquired(acquisition, m_file, m_line, m_topContextLocked ? DUChainLockProfile::TopContextWrite : DUChainLockProfile::Write, l);
+  };
+
+  m_locked = l;
+
+  return l;
+}
+
+void TopDUContextWriteLocker::unlock()
+{
+  if (m_locked && m_lock) {
+    m_lock->d->profileReleasing(m_lockedAt, m_file, m_line, m_topContextLocked ? DUChainLockProfile::TopContextWrite : DUChainLockProfile::Write);
+    if (m_topContextLocked) {
+      m_lock->releaseTopContextWriteLock(m_topContextIndex);
+    } else {
+      m_lock->releaseWriteLock();
+    }
+    m_locked = false;
+  }
+}
+
+DUChainReadScope::DUChainReadScope(const TopDUContext* topContext, DUChainLock* duChainLock)
+  : m_lock(duChainLock ? duChainLock : DUChain::lock())
+{
+  ThreadState& state = m_lock->d->threadState();
+  if (!topContext || !m_lock->topContextLocking() || state.readScope || state.scopedReads) {
+    return;
+  }
+  Q_ASSERT(m_lock->currentThreadHasReadLock() || m_lock->currentThreadHasWriteLock());
+
+  for (Utils::Set::Iterator it = topContext->recursiveImportIndices().set().iterator(); it; ++it) {
+    m_scope << *it;
+  }
+  if (!m_scope.contains(topContext->ownIndex())) {
+    m_scope << topContext->ownIndex();
+  }
+  state.readScope = &m_scope;
+}
+
+DUChainReadScope::~DUChainReadScope()
+{
+  if (!m_scope.isEmpty()) {
+    ThreadState& state = m_lock->d->threadState();
+    //The read-locks within the scope must be released before it
+    Q_ASSERT(!state.scopedReads);
+    state.readScope = nullptr;
+  }
+}
+
+DUChainCrossFileLocker::DUChainCrossFileLocker(DUChainLock* duChainLock)
+{
+  DUChainLock* lock = duChainLock ? duChainLock : DUChain::lock();
+  m_mutex = lock->topContextLocking() ? lock->crossFileMutex() : nullptr;
+  if (m_mutex) {
+    m_mutex->lock();
+  }
+}
+
+DUChainCrossFileLocker::~DUChainCrossFileLocker()
+{
+  if (m_mutex) {
+    m_mutex->unlock();
+  }
+}
+
 }
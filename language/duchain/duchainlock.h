@@ -21,9 +21,35 @@
 
 #include <language/languageexport.h>
 
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+class QMutex;
+
+/**
+ * The acquisition site the lockers record for the lock profile, see DUChainLock::setProfiling().
+ * As default arguments these builtins evaluate to the location of the caller.
+ */
+#if defined(__has_builtin)
+#  if __has_builtin(__builtin_FILE) && __has_builtin(__builtin_LINE)
+#    define KDEV_DUCHAIN_LOCK_SITE_FILE __builtin_FILE()
+#    define KDEV_DUCHAIN_LOCK_SITE_LINE __builtin_LINE()
+#  endif
+#elif defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#  define KDEV_DUCHAIN_LOCK_SITE_FILE __builtin_FILE()
+#  define KDEV_DUCHAIN_LOCK_SITE_LINE __builtin_LINE()
+#endif
+#ifndef KDEV_DUCHAIN_LOCK_SITE_FILE
+#  define KDEV_DUCHAIN_LOCK_SITE_FILE nullptr
+#  define KDEV_DUCHAIN_LOCK_SITE_LINE 0
+#endif
+
 namespace KDevelop
 {
 
+class TopDUContext;
+
 // #define NO_DUCHAIN_LOCK_TESTING
 
 /**
@@ -34,9 +60,9 @@ namespace KDevelop
  * From within a Declaration or DUContext, ENSURE_CAN_WRITE and ENSURE_CAN_READ should be used instead of these.
  */
 #if !defined(NDEBUG) && !defined(NO_DUCHAIN_LOCK_TESTING)
-#define ENSURE_CHAIN_READ_LOCKED Q_ASSERT(KDevelop::DUChain::lock()->currentThreadHasReadLock() || KDevelop::DUChain::lock()->currentThreadHasWriteLock());
-#define ENSURE_CHAIN_WRITE_LOCKED Q_ASSERT(KDevelop::DUChain::lock()->currentThreadHasWriteLock());
-#define ENSURE_CHAIN_NOT_LOCKED Q_ASSERT(!KDevelop::DUChain::lock()->currentThreadHasReadLock() && !KDevelop::DUChain::lock()->currentThreadHasWriteLock());
+#define ENSURE_CHAIN_READ_LOCKED Q_ASSERT(KDevelop::DUChain::lock()->currentThreadHasReadLock() || KDevelop::DUChain::lock()->currentThreadHasWriteLock() || KDevelop::DUChain::lock()->currentThreadHasTopContextReadLock());
+#define ENSURE_CHAIN_WRITE_LOCKED Q_ASSERT(KDevelop::DUChain::lock()->currentThreadHasWriteLock() || KDevelop::DUChain::lock()->currentThreadHasTopContextWriteLock());
+#define ENSURE_CHAIN_NOT_LOCKED Q_ASSERT(!KDevelop::DUChain::lock()->currentThreadHasReadLock() && !KDevelop::DUChain::lock()->currentThreadHasWriteLock() && !KDevelop::DUChain::lock()->currentThreadHasTopContextReadLock());
 #else
 #define ENSURE_CHAIN_READ_LOCKED
 #define ENSURE_CHAIN_WRITE_LOCKED
@@ -45,6 +71,24 @@ namespace KDevelop
 
 /**
  * Customized read/write locker for the definition-use chain.
+ *
+ * By default the whole chain is protected by one global lock. With setTopContextLocking(true), every top-context
+ * can additionally be locked on its own through TopDUContextReadLocker and TopDUContextWriteLocker. Those lockers
+ * take the global lock in an intention mode first: Global write-locks still exclude everything, and global
+ * read-locks exclude top-context writers, so code using DUChainReadLocker and DUChainWriteLocker keeps working
+ * unchanged.
+ *
+ * Readers that only look at one file and what is visible from it, like highlighting and code completion, declare
+ * that through DUChainReadScope. It locks the top-context and its recursive imports, so parsing a file does not
+ * block readers of files that do not import it, even though the code within the scope uses DUChainReadLocker.
+ *
+ * The structures shared between all top-contexts (PersistentSymbolTable, Uses, Definitions and Importers) are
+ * protected by the short crossFileMutex() while top-context locking is enabled, see DUChainCrossFileLocker.
+ *
+ * Lock order: The global lock comes first, then the top-contexts, then the cross-file mutex. A thread that holds
+ * top-context locks must not request a global read- or write-lock, unless it holds a top-context write-lock, in
+ * which case nested global read-locks are granted. Multiple top-contexts must always be locked in the same order,
+ * setLockOrderChecking() helps finding violations.
  */
 class KDEVPLATFORMLANGUAGE_EXPORT DUChainLock
 {
@@ -99,7 +143,128 @@ public:
    */
   bool currentThreadHasWriteLock();
 
+  /**
+   * Returns how often the write lock was released completely. As the writer excludes all readers, data
+   * that was in use by readers when this was read is not used anymore once it has changed.
+   */
+  unsigned int writeLockGeneration() const;
+
+  /**
+   * Acquires a read lock on the top-context with the given index only. Other top-contexts may be written
+   * concurrently. Read-locks on top-contexts are recursive, and can be acquired by threads that write-lock
+   * the same top-context or the whole chain.
+   *
+   * @param timeout A locking timeout in milliseconds, or zero to wait until the lock is acquired.
+   * @note This always locks per top-context. Use TopDUContextReadLocker, which respects topContextLocking().
+   */
+  bool lockForTopContextRead(unsigned int topContextIndex, unsigned int timeout = 0);
+
+  /**
+   * Releases a previously acquired top-context read lock.
+   */
+  void releaseTopContextReadLock(unsigned int topContextIndex);
+
+  /**
+   * Acquires read locks on all the given top-contexts at once. As no top-context is held while waiting for
+   * the others, no lock order needs to be kept between them.
+   *
+   * @param topContextIndices The top-contexts to lock, without duplicates
+   * @param timeout A locking timeout in milliseconds, or zero to wait until the lock is acquired.
+   * @note This always locks per top-context. DUChainReadScope uses it for the global read-locks within a scope.
+   */
+  bool lockForTopContextsRead(const QVector<unsigned int>& topContextIndices, unsigned int timeout = 0);
+
+  /**
+   * Releases the read locks acquired through lockForTopContextsRead().
+   */
+  void releaseTopContextsReadLock(const QVector<unsigned int>& topContextIndices);
+
+  /**
+   * Acquires a write lock on the top-context with the given index only. Write locks are recursive.
+   *
+   * @param timeout A locking timeout in milliseconds, or zero to wait until the lock is acquired.
+   * \warning Top-context write-locks can NOT be acquired by threads that already have a read-lock on the same
+   *          top-context, or a global read-lock.
+   */
+  bool lockForTopContextWrite(unsigned int topContextIndex, unsigned int timeout = 0);
+
+  /**
+   * Releases a previously acquired top-context write lock.
+   */
+  void releaseTopContextWriteLock(unsigned int topContextIndex);
+
+  /**
+   * Determines if the current thread has a read- or write-lock on the given top-context,
+   * or on any top-context if @p topContextIndex is zero.
+   */
+  bool currentThreadHasTopContextReadLock(unsigned int topContextIndex = 0);
+
+  /**
+   * Determines if the current thread has a write-lock on the given top-context,
+   * or on any top-context if @p topContextIndex is zero.
+   */
+  bool currentThreadHasTopContextWriteLock(unsigned int topContextIndex = 0);
+
+  /**
+   * Whether TopDUContextReadLocker and TopDUContextWriteLocker lock single top-contexts.
+   * If false, they lock the whole chain. Disabled by default, DUChain::lock() enables it if the
+   * KDEV_DUCHAIN_TOP_CONTEXT_LOCKING environment variable is set.
+   */
+  bool topContextLocking() const;
+
+  /**
+   * Switches the top-context locking mode.
+   * \warning Only call this while no thread holds or waits for a lock.
+   */
+  void setTopContextLocking(bool enabled);
+
+  /**
+   * The mutex protecting the structures shared by all top-contexts while top-context locking is enabled.
+   * It is recursive.
+   */
+  QMutex* crossFileMutex() const;
+
+  /**
+   * Enables recording in which order the top-contexts are locked. Whenever a thread locks them in an order that
+   * contradicts an order seen before, which may deadlock, a warning is printed and the pair is remembered.
+   * Enabling or disabling it resets the recorded data.
+   */
+  void setLockOrderChecking(bool enabled);
+
+  /**
+   * The detected lock order inversions, as pairs of the held top-context index and the requested one.
+   * The requested index is zero if the global read-lock was requested.
+   */
+  QVector<QPair<unsigned int, unsigned int>> lockOrderViolations() const;
+
+  /**
+   * Whether the lockers record wait- and hold-time histograms per acquisition site.
+   * DUChain::lock() enables it if the KDEV_DUCHAIN_LOCK_PROFILING environment variable is set,
+   * and then prints the report when shutting down.
+   */
+  bool profiling() const;
+
+  /**
+   * Enables or disables the profiling. The recorded data is kept when disabling it.
+   * The overhead is low enough to keep it enabled permanently.
+   */
+  void setProfiling(bool enabled);
+
+  /**
+   * Returns a human-readable table of the acquisition sites recorded while profiling.
+   * The sites that kept other threads waiting for the write-lock longest come first,
+   * followed by the ones with the longest total hold time.
+   * @param maxSites Count of sites to list
+   */
+  QString profilingReport(int maxSites = 20) const;
+
 private:
+  friend class DUChainReadLocker;
+  friend class DUChainWriteLocker;
+  friend class TopDUContextReadLocker;
+  friend class TopDUContextWriteLocker;
+  friend class DUChainReadScope;
+
   class DUChainLockPrivate* const d;
 };
 
@@ -114,8 +279,10 @@ public:
    *
    * \param duChainLock lock to read-acquire. If this is left zero, DUChain::lock() is used.
    * \param timeout Timeout in milliseconds. If this is not zero, you've got to check locked() to see whether the lock succeeded.
+   * \param file, line The acquisition site for DUChainLock::profilingReport(). @p file may also be a free-form tag.
    */
-  explicit DUChainReadLocker(DUChainLock* duChainLock = nullptr, unsigned int timeout = 0);
+  explicit DUChainReadLocker(DUChainLock* duChainLock = nullptr, unsigned int timeout = 0,
+                             const char* file = KDEV_DUCHAIN_LOCK_SITE_FILE, int line = KDEV_DUCHAIN_LOCK_SITE_LINE);
 
   /// Destructor.
   ~DUChainReadLocker();
@@ -133,6 +300,10 @@ private:
   DUChainLock* m_lock;
   bool m_locked;
   unsigned int m_timeout;
+  const char* m_file;
+  int m_line;
+  ///When the lock was acquired, if the hold time is profiled, else -1
+  qint64 m_lockedAt;
 };
 
 /**
@@ -146,8 +317,10 @@ public:
    *
    * \param duChainLock lock to write-acquire. If this is left zero, DUChain::lock() is used.
    * \param timeout Timeout in milliseconds. If this is not zero, you've got to check locked() to see whether the lock succeeded.
+   * \param file, line The acquisition site for DUChainLock::profilingReport(). @p file may also be a free-form tag.
    */
-  explicit DUChainWriteLocker(DUChainLock* duChainLock = nullptr, unsigned int timeout = 0);
+  explicit DUChainWriteLocker(DUChainLock* duChainLock = nullptr, unsigned int timeout = 0,
+                              const char* file = KDEV_DUCHAIN_LOCK_SITE_FILE, int line = KDEV_DUCHAIN_LOCK_SITE_LINE);
   /// Destructor.
   ~DUChainWriteLocker();
 
@@ -164,6 +337,145 @@ private:
   DUChainLock* m_lock;
   bool m_locked;
   unsigned int m_timeout;
+  const char* m_file;
+  int m_line;
+  ///When the lock was acquired, if the hold time is profiled, else -1
+  qint64 m_lockedAt;
+};
+
+/**
+ * Read locker for a single top-context. Locks the whole chain if top-context locking is disabled.
+ * @see DUChainLock::lockForTopContextRead
+ */
+class KDEVPLATFORMLANGUAGE_EXPORT TopDUContextReadLocker
+{
+public:
+  /**
+   * Constructor.  Attempts to acquire a read lock.
+   *
+   * \param topContext The top-context to lock. If it is zero, the whole chain is read-locked.
+   * \param duChainLock lock to read-acquire. If this is left zero, DUChain::lock() is used.
+   * \param timeout Timeout in milliseconds. If this is not zero, you've got to check locked() to see whether the lock succeeded.
+   * \param file, line The acquisition site for DUChainLock::profilingReport()
+   */
+  explicit TopDUContextReadLocker(const TopDUContext* topContext, DUChainLock* duChainLock = nullptr, unsigned int timeout = 0,
+                                  const char* file = KDEV_DUCHAIN_LOCK_SITE_FILE, int line = KDEV_DUCHAIN_LOCK_SITE_LINE);
+  explicit TopDUContextReadLocker(unsigned int topContextIndex, DUChainLock* duChainLock = nullptr, unsigned int timeout = 0,
+                                  const char* file = KDEV_DUCHAIN_LOCK_SITE_FILE, int line = KDEV_DUCHAIN_LOCK_SITE_LINE);
+
+  /// Destructor.
+  ~TopDUContextReadLocker();
+
+  /// Acquire the read lock (again). Uses the same timeout given to the constructor.
+  bool lock();
+  /// Unlock the read lock.
+  void unlock();
+
+  ///Returns true if a lock was requested and the lock succeeded, else false
+  bool locked() const;
+
+private:
+  DUChainLock* m_lock;
+  unsigned int m_topContextIndex;
+  bool m_locked;
+  ///Whether only the top-context was locked, the locking mode may change in between
+  bool m_topContextLocked;
+  unsigned int m_timeout;
+  const char* m_file;
+  int m_line;
+  ///When the lock was acquired, if the hold time is profiled, else -1
+  qint64 m_lockedAt;
+};
+
+/**
+ * Write locker for a single top-context. Locks the whole chain if top-context locking is disabled.
+ * @see DUChainLock::lockForTopContextWrite
+ */
+class KDEVPLATFORMLANGUAGE_EXPORT TopDUContextWriteLocker
+{
+public:
+  /**
+   * Constructor.  Attempts to acquire a write lock.
+   *
+   * \param topContext The top-context to lock. If it is zero, the whole chain is write-locked.
+   * \param duChainLock lock to write-acquire. If this is left zero, DUChain::lock() is used.
+   * \param timeout Timeout in milliseconds. If this is not zero, you've got to check locked() to see whether the lock succeeded.
+   * \param file, line The acquisition site for DUChainLock::profilingReport()
+   */
+  explicit TopDUContextWriteLocker(const TopDUContext* topContext, DUChainLock* duChainLock = nullptr, unsigned int timeout = 0,
+                                   const char* file = KDEV_DUCHAIN_LOCK_SITE_FILE, int line = KDEV_DUCHAIN_LOCK_SITE_LINE);
+  explicit TopDUContextWriteLocker(unsigned int topContextIndex, DUChainLock* duChainLock = nullptr, unsigned int timeout = 0,
+                                   const char* file = KDEV_DUCHAIN_LOCK_SITE_FILE, int line = KDEV_DUCHAIN_LOCK_SITE_LINE);
+
+  /// Destructor.
+  ~TopDUContextWriteLocker();
+
+  /// Acquire the write lock (again). Uses the same timeout given to the constructor.
+  bool lock();
+  /// Unlock the write lock.
+  void unlock();
+
+  ///Returns true if a lock was requested and the lock succeeded, else false
+  bool locked() const;
+
+private:
+  DUChainLock* m_lock;
+  unsigned int m_topContextIndex;
+  bool m_locked;
+  ///Whether only the top-context was locked, the locking mode may change in between
+  bool m_topContextLocked;
+  unsigned int m_timeout;
+  const char* m_file;
+  int m_line;
+  ///When the lock was acquired, if the hold time is profiled, else -1
+  qint64 m_lockedAt;
+};
+
+/**
+ * Declares that the current thread only reads a top-context and what is visible from it, like highlighting
+ * and code completion do.
+ *
+ * With top-context locking, the global read-locks the current thread acquires within the scope, eg. through
+ * DUChainReadLocker, only lock the top-context and its recursive imports, see DUChainLock::lockForTopContextsRead().
+ * So they don't wait for the parsing of files that are not imported by the top-context, and don't block it either.
+ * The scope itself holds no lock. Without top-context locking, or within another scope, this does nothing.
+ */
+class KDEVPLATFORMLANGUAGE_EXPORT DUChainReadScope
+{
+public:
+  /**
+   * Constructor. The chain must be locked by the current thread, as the recursive imports of @p topContext
+   * are taken here. Later changes of the imports are not reflected by the scope.
+   *
+   * \param topContext The top-context that is read
+   * \param duChainLock The lock the scope applies to. If this is left zero, DUChain::lock() is used.
+   */
+  explicit DUChainReadScope(const TopDUContext* topContext, DUChainLock* duChainLock = nullptr);
+  /// Destructor.
+  ~DUChainReadScope();
+
+private:
+  Q_DISABLE_COPY(DUChainReadScope)
+
+  DUChainLock* m_lock;
+  ///The top-contexts of the scope, empty if it is inactive
+  QVector<unsigned int> m_scope;
+};
+
+/**
+ * Locks DUChainLock::crossFileMutex() while top-context locking is enabled, and does nothing otherwise,
+ * as the global write-lock already serializes all modifications then.
+ *
+ * Hold it for short periods only, and do not acquire any DUChain locks while holding it.
+ */
+class KDEVPLATFORMLANGUAGE_EXPORT DUChainCrossFileLocker
+{
+public:
+  explicit DUChainCrossFileLocker(DUChainLock* duChainLock = nullptr);
+  ~DUChainCrossFileLocker();
+
+private:
+  QMutex* m_mutex;
 };
 
 /**
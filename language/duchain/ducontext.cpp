@@ -115,21 +115,13 @@ void DUContext::rebuildDynamicData(DUContext* parent, uint ownIndex) {
   m_dynamicData->m_parentContext = DUContextPointer(parent);
   m_dynamicData->m_context = this;
 
+  //The child contexts and local declarations are only created once they are needed
   m_dynamicData->m_childContexts.clear();
-  m_dynamicData->m_childContexts.reserve(d_func()->m_childContextsSize());
-  FOREACH_FUNCTION(const LocalIndexedDUContext& ctx, d_func()->m_childContexts) {
-    m_dynamicData->m_childContexts << ctx.data(m_dynamicData->m_topContext);
-  }
-
   m_dynamicData->m_localDeclarations.clear();
-  m_dynamicData->m_localDeclarations.reserve(d_func()->m_localDeclarationsSize());
-  FOREACH_FUNCTION(const LocalIndexedDeclaration& idx, d_func()->m_localDeclarations) {
-    auto declaration = idx.data(m_dynamicData->m_topContext);
-    if (!declaration) {
-      qCWarning(LANGUAGE) << "child declaration number" << idx.localIndex() << "of" << d_func_dynamic()->m_localDeclarationsSize() << "is invalid";
-      continue;
-    }
-    m_dynamicData->m_localDeclarations << declaration;
+  m_dynamicData->m_childrenLoaded.storeRelease(0);
+
+  if (!TopDUContextDynamicData::lazyItemLoading()) {
+    m_dynamicData->loadChildren();
   }
 
   DUChainBase::rebuildDynamicData(parent, ownIndex);
@@ -164,9 +156,38 @@ DUContextDynamicData::DUContextDynamicData(DUContext* d)
   : m_topContext(nullptr)
   , m_indexInTopContext(0)
   , m_context(d)
+  , m_childrenLoaded(1)
 {
 }
 
+void DUContextDynamicData::loadChildrenFromData() const
+{
+  //Multiple readers may get here at the same time, so the items of one top-context are created under its item mutex
+  QMutexLocker lock(m_topContext->m_dynamicData->itemMutex());
+  if (m_childrenLoaded.load()) {
+    return;
+  }
+
+  m_childContexts.clear();
+  m_childContexts.reserve(d_func()->m_childContextsSize());
+  FOREACH_FUNCTION(const LocalIndexedDUContext& ctx, d_func()->m_childContexts) {
+    m_childContexts << ctx.data(m_topContext);
+  }
+
+  m_localDeclarations.clear();
+  m_localDeclarations.reserve(d_func()->m_localDeclarationsSize());
+  FOREACH_FUNCTION(const LocalIndexedDeclaration& idx, d_func()->m_localDeclarations) {
+    auto declaration = idx.data(m_topContext);
+    if (!declaration) {
+      qCWarning(LANGUAGE) << "child declaration number" << idx.localIndex() << "of" << d_func()->m_localDeclarationsSize() << "is invalid";
+      continue;
+    }
+    m_localDeclarations << declaration;
+  }
+
+  m_childrenLoaded.storeRelease(1);
+}
+
 void DUContextDynamicData::scopeIdentifier(bool includeClasses, QualifiedIdentifier& target) const {
   if (m_parentContext)
     m_parentContext->m_dynamicData->scopeIdentifier(includeClasses, target);
@@ -209,6 +230,8 @@ void DUContextDynamicData::addDeclaration( Declaration * newDeclaration )
 
   CursorInRevision start = newDeclaration->range().start;
 
+  loadChildren();
+
   bool inserted = false;
   ///@todo Do binary search to find the position
   for (int i = m_localDeclarations.size() - 1; i >= 0; --i) {
@@ -238,6 +261,11 @@ void DUContextDynamicData::addDeclaration( Declaration * newDeclaration )
 
 bool DUContextDynamicData::removeDeclaration(Declaration* declaration)
 {
+  if (!m_childrenLoaded.load()) {
+    //Nothing has been created from the stored list yet, so don't do that just to remove one entry
+    return d_func_dynamic()->m_localDeclarationsList().removeOne(LocalIndexedDeclaration(declaration));
+  }
+
   const int idx = m_localDeclarations.indexOf(declaration);
   if (idx != -1) {
     Q_ASSERT(d_func()->m_localDeclarations()[idx].data(m_topContext) == declaration);
@@ -263,6 +291,8 @@ void DUContextDynamicData::addChildContext( DUContext * context )
 
   bool inserted = false;
 
+  loadChildren();
+
   int childCount = m_childContexts.size();
 
   for (int i = childCount-1; i >= 0; --i) {///@todo Do binary search to find the position
@@ -289,6 +319,10 @@ void DUContextDynamicData::addChildContext( DUContext * context )
 bool DUContextDynamicData::removeChildContext( DUContext* context ) {
 //   ENSURE_CAN_WRITE
 
+  if (!m_childrenLoaded.load()) {
+    return d_func_dynamic()->m_childContextsList().removeOne(LocalIndexedDUContext(context));
+  }
+
   const int idx = m_childContexts.indexOf(context);
   if (idx != -1) {
     m_childContexts.remove(idx);
@@ -441,8 +475,9 @@ DUContext::~DUContext( )
 
   deleteLocalDeclarations();
 
-  //If the top-context is being delete, we don't need to spend time rebuilding the inner structure.
-  //That's expensive, especially when the data is not dynamic.
+  //If the top-context is being deleted, we don't need to spend time rebuilding the inner structure.
+  //That's expensive, especially when the data is not dynamic, as it would be copied to remove this context.
+  //When the whole top-context is unloaded, the parent may also be iterating its children right now.
   if(!top->deleting() || !top->isOnDisk()) {
     if (m_dynamicData->m_parentContext)
       m_dynamicData->m_parentContext->m_dynamicData->removeChildContext(this);
@@ -458,7 +493,7 @@ QVector< DUContext * > DUContext::childContexts( ) const
 {
   ENSURE_CAN_READ
 
-  return m_dynamicData->m_childContexts;
+  return m_dynamicData->childContexts();
 }
 
 Declaration* DUContext::owner() const {
@@ -619,13 +654,11 @@ void DUContext::findLocalDeclarationsInternal( const IndexedIdentifier& identifi
 
     TopDUContext* top = topContext();
 
-    uint count;
-    const IndexedDeclaration* declarations;
-    PersistentSymbolTable::self().declarations(id, count, declarations);
-    for (uint a = 0; a < count; ++a) {
+    const KDevVarLengthArray<IndexedDeclaration> declarations = PersistentSymbolTable::self().copyDeclarations(id);
+    for (const IndexedDeclaration& declaration : declarations) {
       ///@todo Eventually do efficient iteration-free filtering
-      if (declarations[a].topContextIndex() == top->ownIndex()) {
-        Declaration* decl = declarations[a].declaration();
+      if (declaration.topContextIndex() == top->ownIndex()) {
+        Declaration* decl = declaration.declaration();
         if (decl && contextIsChildOrEqual(decl->context(), this)) {
           Declaration* checked = checker.check(decl);
           if (checked) {
@@ -890,7 +923,7 @@ DUContext * DUContext::findContext( const CursorInRevision& position, DUContext*
   if (!parent)
     parent = const_cast<DUContext*>(this);
 
-  foreach (DUContext* context, parent->m_dynamicData->m_childContexts) {
+  foreach (DUContext* context, parent->m_dynamicData->childContexts()) {
     if (context->range().contains(position)) {
       DUContext* ret = findContext(position, context);
       if (!ret) {
@@ -909,7 +942,7 @@ bool DUContext::parentContextOf(DUContext* context) const
   if (this == context)
     return true;
 
-  foreach (DUContext* child, m_dynamicData->m_childContexts) {
+  foreach (DUContext* child, m_dynamicData->childContexts()) {
     if (child->parentContextOf(context)) {
       return true;
     }
@@ -938,7 +971,7 @@ QVector<Declaration*> DUContext::localDeclarations(const TopDUContext* source) c
   ENSURE_CAN_READ
   // TODO: remove this parameter once we kill old-cpp
   Q_UNUSED(source);
-  return m_dynamicData->m_localDeclarations;
+  return m_dynamicData->localDeclarations();
 }
 
 void DUContext::mergeDeclarationsInternal(QList< QPair<Declaration*, int> >& definitions,
@@ -1014,8 +1047,20 @@ void DUContext::deleteLocalDeclarations()
   if (d_func()->m_localDeclarations()) {
     indexedLocal.append(d_func()->m_localDeclarations(), d_func()->m_localDeclarationsSize());
   }
-  foreach (const LocalIndexedDeclaration& indexed, m_dynamicData->m_localDeclarations) {
-    delete indexed.data(topContext());
+
+  TopDUContext* top = topContext();
+  if (!m_dynamicData->m_childrenLoaded.load() && top->deleting() && top->isOnDisk()) {
+    //The top-context is being unloaded, so only the declarations that have been created need to be deleted
+    foreach (const LocalIndexedDeclaration& indexed, indexedLocal) {
+      if (indexed.isLoaded(top)) {
+        delete indexed.data(top);
+      }
+    }
+    return;
+  }
+
+  foreach (const LocalIndexedDeclaration& indexed, m_dynamicData->localDeclarations()) {
+    delete indexed.data(top);
   }
   m_dynamicData->m_localDeclarations.clear();
 }
@@ -1024,9 +1069,25 @@ void DUContext::deleteChildContextsRecursively()
 {
   ENSURE_CAN_WRITE
 
+  TopDUContext* top = topContext();
+  if (!m_dynamicData->m_childrenLoaded.load() && top->deleting() && top->isOnDisk()) {
+    //The top-context is being unloaded, so only the child contexts that have been created need to be deleted.
+    //The children don't update their parent then. The list is copied anyway, so deleting a child can't change it while it is iterated.
+    KDevVarLengthArray<LocalIndexedDUContext> indexedChildren;
+    if (d_func()->m_childContexts()) {
+      indexedChildren.append(d_func()->m_childContexts(), d_func()->m_childContextsSize());
+    }
+    foreach (const LocalIndexedDUContext& ctx, indexedChildren) {
+      if (ctx.isLoaded(top)) {
+        delete ctx.data(top);
+      }
+    }
+    return;
+  }
+
   // note: don't use qDeleteAll here because child ctx deletion changes m_dynamicData->m_childContexts
   // also note: foreach iterates on a copy, so this is safe
-  foreach (DUContext* ctx, m_dynamicData->m_childContexts) {
+  foreach (DUContext* ctx, m_dynamicData->childContexts()) {
     delete ctx;
   }
   m_dynamicData->m_childContexts.clear();
@@ -1034,7 +1095,7 @@ void DUContext::deleteChildContextsRecursively()
 
 QVector<Declaration *> DUContext::clearLocalDeclarations( )
 {
-  auto copy = m_dynamicData->m_localDeclarations;
+  auto copy = m_dynamicData->localDeclarations();
   foreach (Declaration* dec, copy) {
     dec->setContext(nullptr);
   }
@@ -1143,7 +1204,7 @@ void DUContext::deleteUsesRecursively()
 {
   deleteUses();
 
-  foreach (DUContext* childContext, m_dynamicData->m_childContexts) {
+  foreach (DUContext* childContext, m_dynamicData->childContexts()) {
     childContext->deleteUsesRecursively();
   }
 }
@@ -1350,7 +1411,7 @@ DUContext * DUContext::findContextAt(const CursorInRevision & position, bool inc
     return nullptr;
   }
 
-  const auto childContexts = m_dynamicData->m_childContexts;
+  const auto childContexts = m_dynamicData->childContexts();
   for(int a = childContexts.size() - 1; a >= 0; --a) {
     if (DUContext* specific = childContexts[a]->findContextAt(position, includeRightBorder)) {
       return specific;
@@ -1367,7 +1428,7 @@ Declaration * DUContext::findDeclarationAt(const CursorInRevision & position) co
   if (!range().contains(position))
     return nullptr;
 
-  foreach (Declaration* child, m_dynamicData->m_localDeclarations) {
+  foreach (Declaration* child, m_dynamicData->localDeclarations()) {
     if (child->range().contains(position)) {
       return child;
     }
@@ -1383,7 +1444,7 @@ DUContext* DUContext::findContextIncluding(const RangeInRevision& range) const
   if (!this->range().contains(range))
     return nullptr;
 
-  foreach (DUContext* child, m_dynamicData->m_childContexts) {
+  foreach (DUContext* child, m_dynamicData->childContexts()) {
     if (DUContext* specific = child->findContextIncluding(range)) {
       return specific;
     }
@@ -1442,14 +1503,14 @@ void DUContext::cleanIfNotEncountered(const QSet<DUChainBase*>& encountered)
   if (d_func()->m_localDeclarations()) {
     indexedLocal.append(d_func()->m_localDeclarations(), d_func()->m_localDeclarationsSize());
   }
-  foreach (const LocalIndexedDeclaration& indexed, m_dynamicData->m_localDeclarations) {
+  foreach (const LocalIndexedDeclaration& indexed, m_dynamicData->localDeclarations()) {
     auto dec = indexed.data(topContext());
     if (dec && !encountered.contains(dec) && (!dec->isAutoDeclaration() || !dec->hasUses())) {
       delete dec;
     }
   }
 
-  foreach (DUContext* childContext, m_dynamicData->m_childContexts) {
+  foreach (DUContext* childContext, m_dynamicData->childContexts()) {
     if (!encountered.contains(childContext)) {
       delete childContext;
     }
@@ -1663,11 +1724,11 @@ void DUContext::visit(DUChainVisitor& visitor)
 
   visitor.visit(this);
 
-  foreach (Declaration* decl, m_dynamicData->m_localDeclarations) {
+  foreach (Declaration* decl, m_dynamicData->localDeclarations()) {
     visitor.visit(decl);
   }
 
-  foreach (DUContext* childContext, m_dynamicData->m_childContexts) {
+  foreach (DUContext* childContext, m_dynamicData->childContexts()) {
     childContext->visit(visitor);
   }
 }
@@ -1681,6 +1742,7 @@ void DUContext::resortLocalDeclarations()
 {
   ENSURE_CAN_WRITE
 
+  m_dynamicData->loadChildren();
   std::sort(m_dynamicData->m_localDeclarations.begin(), m_dynamicData->m_localDeclarations.end(), sortByRange);
 
   auto top = topContext();
@@ -1695,6 +1757,7 @@ void DUContext::resortChildContexts()
 {
   ENSURE_CAN_WRITE
 
+  m_dynamicData->loadChildren();
   std::sort(m_dynamicData->m_childContexts.begin(), m_dynamicData->m_childContexts.end(), sortByRange);
 
   auto top = topContext();
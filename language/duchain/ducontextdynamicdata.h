@@ -24,6 +24,8 @@
 
 #include "ducontextdata.h"
 
+#include <QtCore/QAtomicInt>
+
 namespace KDevelop {
 
 ///This class contains data that is only runtime-dependant and does not need to be stored to disk
@@ -45,10 +47,34 @@ public:
   
   DUContext* m_context;
 
-  // cache of unserialized child contexts
-  QVector<DUContext*> m_childContexts;
-  // cache of unserialized local declarations
-  QVector<Declaration*> m_localDeclarations;
+  // cache of unserialized child contexts, use childContexts() for reading
+  mutable QVector<DUContext*> m_childContexts;
+  // cache of unserialized local declarations, use localDeclarations() for reading
+  mutable QVector<Declaration*> m_localDeclarations;
+  // whether the caches above are filled. For contexts loaded from disk this only happens on first use,
+  // so only the items of a top-context that are actually needed get created.
+  mutable QAtomicInt m_childrenLoaded;
+
+  /// Fills the caches of child contexts and local declarations, if that did not happen yet.
+  /// Must be called before changing the caches.
+  inline void loadChildren() const
+  {
+    if (!m_childrenLoaded.loadAcquire()) {
+      loadChildrenFromData();
+    }
+  }
+
+  inline const QVector<DUContext*>& childContexts() const
+  {
+    loadChildren();
+    return m_childContexts;
+  }
+
+  inline const QVector<Declaration*>& localDeclarations() const
+  {
+    loadChildren();
+    return m_localDeclarations;
+  }
 
    /**
    * Adds a child context.
@@ -86,6 +112,9 @@ public:
         , index(0)
         , nextChild(0)
       {
+        if (data) {
+          data->loadChildren();
+        }
       }
 
       const DUContextDynamicData* data;
@@ -160,6 +189,9 @@ public:
    * */
   bool imports(const DUContext* context, const TopDUContext* source,
                QSet<const DUContextDynamicData*>* recursionGuard) const;
+
+private:
+  void loadChildrenFromData() const;
 };
 
 }
@@ -20,6 +20,7 @@
 #include "identifier.h"
 
 #include <QtCore/QHash>
+#include <QtCore/QVarLengthArray>
 #include "stringhelpers.h"
 #include "appendedlist_static.h"
 #include "serialization/itemrepository.h"
@@ -28,6 +29,7 @@
 
 #include <serialization/indexedstring.h>
 #include <utility>
+#include <vector>
 
 #define ifDebug(x)
 
@@ -239,12 +241,18 @@ public:
     Q_ASSERT(dynamic);
     uint currentStart = start;
 
+    QVarLengthArray<Identifier, 8> identifiers;
     while( currentStart < (uint)str.length() ) {
-      identifiersList.append(IndexedIdentifier(Identifier( str, currentStart, &currentStart )));
+      identifiers.append(Identifier( str, currentStart, &currentStart ));
       while( currentStart < (uint)str.length() && (str[currentStart] == ' ' ) )
         ++currentStart;
       currentStart += 2; //Skip "::"
     }
+
+    //Put all parts into the repository at once, instead of locking it for every part
+    Identifier::indexMany(identifiers.data(), identifiers.size());
+    for(const Identifier& identifier : identifiers)
+      identifiersList.append(IndexedIdentifier(identifier));
   }
 
   inline void clearHash() const
@@ -631,6 +639,30 @@ void Identifier::makeConstant() const
   cd = identifierRepository()->itemFromIndex( m_index );
 }
 
+void Identifier::indexMany(Identifier* identifiers, int count)
+{
+  std::vector<IdentifierItemRequest> requests;
+  QVarLengthArray<int, 8> requestPositions;
+  requests.reserve(count);
+  for(int a = 0; a < count; ++a) {
+    if(!identifiers[a].m_index) {
+      requests.push_back(IdentifierItemRequest(*identifiers[a].dd));
+      requestPositions.append(a);
+    }
+  }
+
+  if(requests.empty())
+    return;
+
+  const QVector<uint> indices = identifierRepository()->indexMany(requests.data(), requests.size());
+  for(int a = 0; a < indices.size(); ++a) {
+    Identifier& identifier = identifiers[requestPositions[a]];
+    identifier.m_index = indices[a];
+    delete identifier.dd;
+    identifier.cd = identifierRepository()->itemFromIndex(identifier.m_index);
+  }
+}
+
 void Identifier::prepareWrite()
 {
   if(m_index) {
@@ -223,6 +223,13 @@ public:
   uint index() const;
 
   bool inRepository() const;
+
+  /**
+   * Adds all @p count identifiers starting at @p identifiers to the global identifier repository.
+   *
+   * This is equivalent to calling index() on every one of them, but locks the repository only once.
+   */
+  static void indexMany(Identifier* identifiers, int count);
 private:
   void makeConstant() const;
   void prepareWrite();
@@ -56,9 +56,6 @@ namespace KDevelop {
     KDevVarLengthArray<IndexedDUContext> importers(const DeclarationId& id) const;
 
     static Importers& self();
-    
-    private:
-      class ImportersPrivate* d;
   };
 }
 
@@ -353,6 +353,9 @@ void ParsingEnvironmentFile::setModificationRevision( const KDevelop::Modificati
   qCDebug(LANGUAGE) <<  id(this) << "setting modification-revision" << rev.toString();
   }
 #endif
+  //The hash belongs to the contents of the previous revision
+  if(rev != d_func()->m_modificationTime)
+    d_func_dynamic()->m_contentHash = 0;
   d_func_dynamic()->m_modificationTime = rev;
 #ifdef LEXERCACHE_DEBUG
   if(debugging()) {
@@ -367,6 +370,34 @@ KDevelop::ModificationRevision ParsingEnvironmentFile::modificationRevision() co
   return d_func()->m_modificationTime;
 }
 
+quint64 ParsingEnvironmentFile::contentHash() const {
+  ENSURE_READ_LOCKED
+  return d_func()->m_contentHash;
+}
+
+void ParsingEnvironmentFile::setContentHash(quint64 hash) {
+  ENSURE_WRITE_LOCKED
+  d_func_dynamic()->m_contentHash = hash;
+}
+
+bool ParsingEnvironmentFile::replaceModificationRevision(const IndexedString& url, const ModificationRevision& oldRevision, const ModificationRevision& revision) {
+  ENSURE_WRITE_LOCKED
+
+  if(url == d_func()->m_url) {
+    if(oldRevision != d_func()->m_modificationTime)
+      return false;
+    const quint64 hash = d_func()->m_contentHash;
+    setModificationRevision(revision);
+    d_func_dynamic()->m_contentHash = hash;
+    return true;
+  }
+
+  if(!d_func_dynamic()->m_allModificationRevisions.removeModificationRevision(url, oldRevision))
+    return false;
+  d_func_dynamic()->m_allModificationRevisions.addModificationRevision(url, revision);
+  return true;
+}
+
 IndexedString ParsingEnvironmentFile::language() const {
   return d_func()->m_language;
 }
@@ -93,11 +93,13 @@ class KDEVPLATFORMLANGUAGE_EXPORT ParsingEnvironment
 ///ParsingEnvironmentFile
 class KDEVPLATFORMLANGUAGE_EXPORT ParsingEnvironmentFileData : public DUChainBaseData {
   public:
-  ParsingEnvironmentFileData() : m_isProxyContext(false), m_features(TopDUContext::VisibleDeclarationsAndContexts) {
+  ParsingEnvironmentFileData() : m_isProxyContext(false), m_features(TopDUContext::VisibleDeclarationsAndContexts), m_contentHash(0) {
   }
   bool m_isProxyContext;
   TopDUContext::Features m_features;
   KDevelop::ModificationRevision m_modificationTime;
+  ///Hash of the contents that were parsed at m_modificationTime, or zero if unknown
+  quint64 m_contentHash;
   ModificationRevisionSet m_allModificationRevisions;
   KDevelop::IndexedString m_url;
   KDevelop::IndexedTopDUContext m_topContext;
@@ -182,6 +184,17 @@ class KDEVPLATFORMLANGUAGE_EXPORT ParsingEnvironmentFile : public DUChainBase, p
     
     KDevelop::ModificationRevision modificationRevision() const;
 
+    ///The hash of the file contents that were parsed at modificationRevision(), or zero if it is not known.
+    ///ParseJob uses it to skip parsing when only the modification-time of a file has changed.
+    quint64 contentHash() const;
+
+    void setContentHash(quint64 hash);
+
+    ///Replaces @p oldRevision of @p url with @p revision, in the own modification-revision and in the dependencies.
+    ///Use this when the contents of @p url are known to be unchanged since @p oldRevision.
+    ///@return Whether @p oldRevision was contained.
+    bool replaceModificationRevision(const IndexedString& url, const ModificationRevision& oldRevision, const ModificationRevision& revision);
+
     ///Clears the modification times of all dependencies
     void clearModificationRevisions();
     
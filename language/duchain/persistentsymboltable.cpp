@@ -21,6 +21,8 @@
 #include <QHash>
 #include <QVector>
 
+#include <list>
+
 #include "declaration.h"
 #include "declarationid.h"
 #include "appendedlist.h"
@@ -120,41 +122,129 @@ class PersistentSymbolTableRequestItem {
   const PersistentSymbolTableItem& m_item;
 };
 
-template<class ValueType>
+//The declarations of one identifier that are visible from one import set
 struct CacheEntry {
-  
-  typedef KDevVarLengthArray<ValueType> Data;
-  typedef QHash<TopDUContext::IndexedRecursiveImports, Data > DataHash;
-  
-  DataHash m_hash;
+  IndexedQualifiedIdentifier id;
+  TopDUContext::IndexedRecursiveImports visibility;
+  KDevVarLengthArray<IndexedDeclaration> data;
+  //The DUChainLock::writeLockGeneration() the entry was dropped from the cache in
+  uint retiredGeneration;
 };
 
+typedef std::list<CacheEntry> CacheEntryList;
+
 class PersistentSymbolTablePrivate
 {
 public:
 
-  PersistentSymbolTablePrivate() : m_declarations(QStringLiteral("Persistent Declaration Table")) {
+  PersistentSymbolTablePrivate() : m_declarations(QStringLiteral("Persistent Declaration Table")), m_cacheSize(4096), m_cacheStatistics() {
+  }
+
+  //Removes the least recently used entries until the cache fits into m_cacheSize
+  void evictCacheEntries() {
+    while(m_cacheStatistics.entries > m_cacheSize) {
+      CacheEntryList::iterator last = --m_cacheEntries.end();
+      removeFromCacheIndex(last);
+      retireCacheEntry(last);
+      --m_cacheStatistics.entries;
+      ++m_cacheStatistics.evictions;
+    }
+  }
+
+  //Returned iterators may still point into the entry, so it is only deleted in releaseRetiredCacheEntries()
+  void retireCacheEntry(CacheEntryList::iterator entry) {
+    entry->retiredGeneration = DUChain::lock()->writeLockGeneration();
+    m_retiredCacheEntries.splice(m_retiredCacheEntries.end(), m_cacheEntries, entry);
+  }
+
+  //Deletes the retired entries once the write-lock was released since they were retired. The iterators into them
+  //are only valid while the duchain is locked, and the writer excluded everyone else in between.
+  void releaseRetiredCacheEntries() {
+    const uint generation = DUChain::lock()->writeLockGeneration();
+    while(!m_retiredCacheEntries.empty() && m_retiredCacheEntries.front().retiredGeneration != generation)
+      m_retiredCacheEntries.pop_front();
+  }
+
+  //During long read-only phases, many entries may wait for the next write, so no more results are cached
+  //once as many retired entries wait as the cache holds. The budget is available again after the next write.
+  bool canCacheEntry() const {
+    return m_retiredCacheEntries.size() < m_cacheSize;
   }
+
+  void removeFromCacheIndex(CacheEntryList::iterator entry) {
+    QHash<IndexedQualifiedIdentifier, QHash<TopDUContext::IndexedRecursiveImports, CacheEntryList::iterator> >::iterator it = m_declarationsCache.find(entry->id);
+    Q_ASSERT(it != m_declarationsCache.end());
+    it->remove(entry->visibility);
+    if(it->isEmpty())
+      m_declarationsCache.erase(it);
+  }
+
+  //Drops the cached declarations of the given identifier, because they have changed
+  void invalidateCache(const IndexedQualifiedIdentifier& id) {
+    QHash<IndexedQualifiedIdentifier, QHash<TopDUContext::IndexedRecursiveImports, CacheEntryList::iterator> >::iterator it = m_declarationsCache.find(id);
+    if(it == m_declarationsCache.end())
+      return;
+
+    foreach(CacheEntryList::iterator entry, *it) {
+      retireCacheEntry(entry);
+      --m_cacheStatistics.entries;
+      ++m_cacheStatistics.invalidations;
+    }
+    m_declarationsCache.erase(it);
+  }
+
   //Maps declaration-ids to declarations
   ItemRepository<PersistentSymbolTableItem, PersistentSymbolTableRequestItem, true, false> m_declarations;
-  
-  
-  QHash<IndexedQualifiedIdentifier, CacheEntry<IndexedDeclaration> > m_declarationsCache;
-  
+
+  //The filtered declarations, the most recently used first. List nodes never move, so iterators
+  //returned by getFilteredDeclarations() stay valid while entries are reordered.
+  CacheEntryList m_cacheEntries;
+  //Entries dropped from m_cacheEntries, in the order they were dropped. They are kept until releaseRetiredCacheEntries()
+  CacheEntryList m_retiredCacheEntries;
+  QHash<IndexedQualifiedIdentifier, QHash<TopDUContext::IndexedRecursiveImports, CacheEntryList::iterator> > m_declarationsCache;
+  uint m_cacheSize;
+  PersistentSymbolTable::CacheStatistics m_cacheStatistics;
+
   //We cache the imports so the currently used nodes are very close in memory, which leads to much better CPU cache utilization
   QHash<TopDUContext::IndexedRecursiveImports, PersistentSymbolTable::CachedIndexedRecursiveImports> m_importsCache;
 };
 
 void PersistentSymbolTable::clearCache()
 {
+  DUChainCrossFileLocker crossFileLock;
   ENSURE_CHAIN_WRITE_LOCKED
   {
     QMutexLocker lock(d->m_declarations.mutex());
     d->m_importsCache.clear();
     d->m_declarationsCache.clear();
+    d->releaseRetiredCacheEntries();
+    while(!d->m_cacheEntries.empty())
+      d->retireCacheEntry(d->m_cacheEntries.begin());
+    d->m_cacheStatistics.entries = 0;
   }
 }
 
+void PersistentSymbolTable::setCacheSize(uint entries)
+{
+  DUChainCrossFileLocker crossFileLock;
+  QMutexLocker lock(d->m_declarations.mutex());
+  d->m_cacheSize = entries;
+  d->releaseRetiredCacheEntries();
+  d->evictCacheEntries();
+}
+
+uint PersistentSymbolTable::cacheSize() const
+{
+  return d->m_cacheSize;
+}
+
+PersistentSymbolTable::CacheStatistics PersistentSymbolTable::cacheStatistics() const
+{
+  DUChainCrossFileLocker crossFileLock;
+  QMutexLocker lock(d->m_declarations.mutex());
+  return d->m_cacheStatistics;
+}
+
 PersistentSymbolTable::PersistentSymbolTable() : d(new PersistentSymbolTablePrivate())
 {
 }
@@ -168,10 +258,12 @@ PersistentSymbolTable::~PersistentSymbolTable()
 
 void PersistentSymbolTable::addDeclaration(const IndexedQualifiedIdentifier& id, const IndexedDeclaration& declaration)
 {
+  DUChainCrossFileLocker crossFileLock;
   QMutexLocker lock(d->m_declarations.mutex());
   ENSURE_CHAIN_WRITE_LOCKED
   
-  d->m_declarationsCache.remove(id);
+  d->releaseRetiredCacheEntries();
+  d->invalidateCache(id);
   
   PersistentSymbolTableItem item;
   item.id = id;
@@ -214,10 +306,12 @@ void PersistentSymbolTable::addDeclaration(const IndexedQualifiedIdentifier& id,
 
 void PersistentSymbolTable::removeDeclaration(const IndexedQualifiedIdentifier& id, const IndexedDeclaration& declaration)
 {
+  DUChainCrossFileLocker crossFileLock;
   QMutexLocker lock(d->m_declarations.mutex());
   ENSURE_CHAIN_WRITE_LOCKED
   
-  d->m_declarationsCache.remove(id);
+  d->releaseRetiredCacheEntries();
+  d->invalidateCache(id);
   Q_ASSERT(!d->m_declarationsCache.contains(id));
   
   PersistentSymbolTableItem item;
@@ -272,9 +366,12 @@ struct DeclarationCacheVisitor {
 
 PersistentSymbolTable::FilteredDeclarationIterator PersistentSymbolTable::getFilteredDeclarations(const IndexedQualifiedIdentifier& id, const TopDUContext::IndexedRecursiveImports& visibility) const {
   
+  DUChainCrossFileLocker crossFileLock;
   QMutexLocker lock(d->m_declarations.mutex());
   ENSURE_CHAIN_READ_LOCKED
   
+  d->releaseRetiredCacheEntries();
+
   Declarations decls = getDeclarations(id).iterator();
   
   CachedIndexedRecursiveImports cachedImports;
@@ -290,14 +387,30 @@ PersistentSymbolTable::FilteredDeclarationIterator PersistentSymbolTable::getFil
   if(decls.dataSize() > MinimumCountForCache)
   {
     //Do visibility caching
-    CacheEntry<IndexedDeclaration>& cached(d->m_declarationsCache[id]);
-    CacheEntry<IndexedDeclaration>::DataHash::const_iterator cacheIt = cached.m_hash.constFind(visibility);
-    if(cacheIt != cached.m_hash.constEnd())
-      return FilteredDeclarationIterator(Declarations::Iterator(cacheIt->constData(), cacheIt->size(), -1), cachedImports);
+    QHash<TopDUContext::IndexedRecursiveImports, CacheEntryList::iterator>& cached(d->m_declarationsCache[id]);
+    QHash<TopDUContext::IndexedRecursiveImports, CacheEntryList::iterator>::const_iterator cacheIt = cached.constFind(visibility);
+    if(cacheIt != cached.constEnd()) {
+      ++d->m_cacheStatistics.hits;
+      //Mark the entry as most recently used
+      d->m_cacheEntries.splice(d->m_cacheEntries.begin(), d->m_cacheEntries, *cacheIt);
+      const KDevVarLengthArray<IndexedDeclaration>& cache((*cacheIt)->data);
+      return FilteredDeclarationIterator(Declarations::Iterator(cache.constData(), cache.size(), -1), cachedImports);
+    }
 
-    CacheEntry<IndexedDeclaration>::DataHash::iterator insertIt = cached.m_hash.insert(visibility, KDevVarLengthArray<IndexedDeclaration>());
-    
-    KDevVarLengthArray<IndexedDeclaration>& cache(*insertIt);
+    ++d->m_cacheStatistics.misses;
+    if(!d->canCacheEntry()) {
+      if(cached.isEmpty())
+        d->m_declarationsCache.remove(id);
+      return FilteredDeclarationIterator(decls.iterator(), cachedImports);
+    }
+    d->m_cacheEntries.push_front(CacheEntry());
+    cached.insert(visibility, d->m_cacheEntries.begin());
+    ++d->m_cacheStatistics.entries;
+
+    CacheEntry& entry(d->m_cacheEntries.front());
+    entry.id = id;
+    entry.visibility = visibility;
+    KDevVarLengthArray<IndexedDeclaration>& cache(entry.data);
     
     {
       typedef ConvenientEmbeddedSetTreeFilterVisitor<IndexedDeclaration, IndexedDeclarationHandler, IndexedTopDUContext, CachedIndexedRecursiveImports, DeclarationTopContextExtractor, DeclarationCacheVisitor> FilteredDeclarationCacheVisitor;
@@ -306,14 +419,37 @@ PersistentSymbolTable::FilteredDeclarationIterator PersistentSymbolTable::getFil
       DeclarationCacheVisitor v(cache);
       FilteredDeclarationCacheVisitor visitor(v, decls.iterator(), cachedImports);
     }
-    
+
+    //Evicted entries are kept until the write-lock was released, so the returned iterator stays valid even if the new entry is evicted
+    d->evictCacheEntries();
+
     return FilteredDeclarationIterator(Declarations::Iterator(cache.constData(), cache.size(), -1), cachedImports, true);
   }else{
     return FilteredDeclarationIterator(decls.iterator(), cachedImports);
   }
 }
 
+KDevVarLengthArray<IndexedDeclaration> PersistentSymbolTable::copyDeclarations(const IndexedQualifiedIdentifier& id) const
+{
+  DUChainCrossFileLocker crossFileLock;
+  KDevVarLengthArray<IndexedDeclaration> ret;
+  const Declarations decls = getDeclarations(id);
+  for(Declarations::Iterator it = decls.iterator(); it; ++it)
+    ret.append(*it);
+  return ret;
+}
+
+KDevVarLengthArray<IndexedDeclaration> PersistentSymbolTable::copyFilteredDeclarations(const IndexedQualifiedIdentifier& id, const TopDUContext::IndexedRecursiveImports& visibility) const
+{
+  DUChainCrossFileLocker crossFileLock;
+  KDevVarLengthArray<IndexedDeclaration> ret;
+  for(FilteredDeclarationIterator it = getFilteredDeclarations(id, visibility); it; ++it)
+    ret.append(*it);
+  return ret;
+}
+
 PersistentSymbolTable::Declarations PersistentSymbolTable::getDeclarations(const IndexedQualifiedIdentifier& id) const {
+  DUChainCrossFileLocker crossFileLock;
   QMutexLocker lock(d->m_declarations.mutex());
   ENSURE_CHAIN_READ_LOCKED
   
@@ -332,6 +468,7 @@ PersistentSymbolTable::Declarations PersistentSymbolTable::getDeclarations(const
 
 void PersistentSymbolTable::declarations(const IndexedQualifiedIdentifier& id, uint& countTarget, const IndexedDeclaration*& declarationsTarget) const
 {
+  DUChainCrossFileLocker crossFileLock;
   QMutexLocker lock(d->m_declarations.mutex());
   ENSURE_CHAIN_READ_LOCKED
   
@@ -411,6 +548,9 @@ void PersistentSymbolTable::dump(const QTextStream& out)
 
     qout << "Statistics:" << endl;
     qout << d->m_declarations.statistics() << endl;
+    qout << "Cache: entries:" << d->m_cacheStatistics.entries << "hits:" << d->m_cacheStatistics.hits
+         << "misses:" << d->m_cacheStatistics.misses << "evictions:" << d->m_cacheStatistics.evictions
+         << "invalidations:" << d->m_cacheStatistics.invalidations << endl;
   }
 }
 
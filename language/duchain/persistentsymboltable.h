@@ -97,18 +97,20 @@ struct KDEVPLATFORMLANGUAGE_EXPORT RecursiveImportCacheRepository {
     ~PersistentSymbolTable();
 
     ///Adds declaration @p declaration with id @p id to the symbol table
-    ///@warning DUChain must be write locked
+    ///@warning DUChain, or the top-context of @p declaration, must be write locked
     void addDeclaration(const IndexedQualifiedIdentifier& id, const IndexedDeclaration& declaration);
 
     ///Adds declaration @p declaration with id @p id to the symbol table
-    ///@warning DUChain must be write locked
+    ///@warning DUChain, or the top-context of @p declaration, must be write locked
     void removeDeclaration(const IndexedQualifiedIdentifier& id, const IndexedDeclaration& declaration);
 
     ///Retrieves all the declarations for a given IndexedQualifiedIdentifier in an efficient way.
     ///@param id The IndexedQualifiedIdentifier for which the declarations should be retrieved
     ///@param count A reference that will be filled with the count of retrieved declarations
     ///@param declarations A reference to a pointer, that will be filled with a pointer to the retrieved declarations.
-    ///@warning DUChain must be read locked as long as the returned data is used
+    ///@warning DUChain must be read locked as long as the returned data is used. With top-context locking,
+    ///         readers that only hold top-context locks (see DUChainReadScope) must hold a DUChainCrossFileLocker
+    ///         as well, or use copyDeclarations().
     void declarations(const IndexedQualifiedIdentifier& id, uint& count, const IndexedDeclaration*& declarations) const;
 
     typedef ConstantConvenientEmbeddedSet<IndexedDeclaration, IndexedDeclarationHandler> Declarations;
@@ -116,7 +118,9 @@ struct KDEVPLATFORMLANGUAGE_EXPORT RecursiveImportCacheRepository {
     ///Retrieves all the declarations for a given IndexedQualifiedIdentifier in an efficient way, and returns
     ///them in a structure that is more convenient than declarations().
     ///@param id The IndexedQualifiedIdentifier for which the declarations should be retrieved
-    ///@warning DUChain must be read locked as long as the returned data is used
+    ///@warning DUChain must be read locked as long as the returned data is used. With top-context locking,
+    ///         readers that only hold top-context locks (see DUChainReadScope) must hold a DUChainCrossFileLocker
+    ///         as well, or use copyDeclarations().
     Declarations getDeclarations(const IndexedQualifiedIdentifier& id) const;
 
     typedef Utils::StorableSet<IndexedTopDUContext, IndexedTopDUContextIndexConversion, RecursiveImportCacheRepository, true> CachedIndexedRecursiveImports;
@@ -124,9 +128,18 @@ struct KDEVPLATFORMLANGUAGE_EXPORT RecursiveImportCacheRepository {
     typedef ConvenientEmbeddedSetTreeFilterIterator<IndexedDeclaration, IndexedDeclarationHandler, IndexedTopDUContext, CachedIndexedRecursiveImports, DeclarationTopContextExtractor> FilteredDeclarationIterator;
     ///Retrieves an iterator to all declarations of the given id, filtered by the visilibity given through @a visibility
     ///This is very efficient since it uses a cache
-    ///The returned iterator is valid as long as the duchain read lock is held
+    ///The returned iterator is valid as long as the duchain read lock is held. With top-context locking, readers that
+    ///only hold top-context locks (see DUChainReadScope) must hold a DUChainCrossFileLocker as well, or use copyFilteredDeclarations().
     FilteredDeclarationIterator getFilteredDeclarations(const IndexedQualifiedIdentifier& id, const TopDUContext::IndexedRecursiveImports& visibility) const;
 
+    ///Returns a copy of the declarations for the given id, which stays valid when declarations are added or removed concurrently.
+    ///Only the DUChain read lock, or a top-context read lock, is required.
+    KDevVarLengthArray<IndexedDeclaration> copyDeclarations(const IndexedQualifiedIdentifier& id) const;
+
+    ///Returns a copy of the declarations for the given id that are visible through @a visibility, see getFilteredDeclarations().
+    ///It stays valid when declarations are added or removed concurrently. Only the DUChain read lock, or a top-context read lock, is required.
+    KDevVarLengthArray<IndexedDeclaration> copyFilteredDeclarations(const IndexedQualifiedIdentifier& id, const TopDUContext::IndexedRecursiveImports& visibility) const;
+
     static PersistentSymbolTable& self();
 
     //Very expensive: Checks for problems in the symbol table
@@ -135,6 +148,23 @@ struct KDEVPLATFORMLANGUAGE_EXPORT RecursiveImportCacheRepository {
     //Clears the internal cache. Should be called regularly to save memory
     //The duchain must be read-locked
     void clearCache();
+
+    struct CacheStatistics {
+      uint entries; ///< Count of cached (identifier, visibility) results
+      uint hits;
+      uint misses;
+      uint evictions; ///< Results dropped because the cache was full
+      uint invalidations; ///< Results dropped because declarations were added or removed
+    };
+
+    ///Sets the maximum count of filtered results cached by getFilteredDeclarations(). When it is exceeded,
+    ///the least recently used results are dropped. As returned iterators may still point into them, their memory
+    ///is only released once the DUChain write-lock was released, see DUChainLock::writeLockGeneration().
+    ///While as many dropped results wait for that as the cache holds, further results are not cached.
+    void setCacheSize(uint entries);
+    uint cacheSize() const;
+
+    CacheStatistics cacheStatistics() const;
     
     private:
       class PersistentSymbolTablePrivate* d;
@@ -0,0 +1,222 @@
+/*
+ * This file is part of KDevelop
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "bench_duchainlock.h"
+
+#include <language/duchain/duchainlock.h>
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QThread>
+#include <QThreadPool>
+#include <QThreadStorage>
+#include <QVector>
+#include <QtConcurrentRun>
+#include <QtTest/QTest>
+
+#include <algorithm>
+
+QTEST_GUILESS_MAIN(BenchDUChainLock);
+
+using namespace KDevelop;
+
+namespace {
+
+/**
+ * The DUChainLock as it was before it blocked on wait conditions: Contended acquisitions poll the lock state,
+ * sleeping 500 microseconds in between. Kept here to compare the latencies against.
+ */
+class SpinningDUChainLock
+{
+public:
+  bool lockForRead()
+  {
+    changeOwnReaderRecursion(1);
+    QThread* w = m_writer.loadAcquire();
+    if (w == nullptr || w == QThread::currentThread()) {
+      return true;
+    }
+    while (m_writer.loadAcquire()) {
+      QThread::usleep(500);
+    }
+    return true;
+  }
+
+  void releaseReadLock()
+  {
+    changeOwnReaderRecursion(-1);
+  }
+
+  bool lockForWrite()
+  {
+    if (m_writer.load() == QThread::currentThread()) {
+      m_writerRecursion.fetchAndAddRelaxed(1);
+      return true;
+    }
+    while (1) {
+      if (m_totalReaderRecursion.load() == 0 && m_writerRecursion.testAndSetOrdered(0, 1)) {
+        m_writer = QThread::currentThread();
+        if (m_totalReaderRecursion.load() == 0) {
+          return true;
+        }
+        m_writer = nullptr;
+        m_writerRecursion = 0;
+      }
+      QThread::usleep(500);
+    }
+  }
+
+  void releaseWriteLock()
+  {
+    if (m_writerRecursion.load() == 1) {
+      m_writer = nullptr;
+      m_writerRecursion = 0;
+    } else {
+      m_writerRecursion.fetchAndAddOrdered(-1);
+    }
+  }
+
+private:
+  void changeOwnReaderRecursion(int difference)
+  {
+    m_readerRecursion.localData() += difference;
+    m_totalReaderRecursion.fetchAndAddOrdered(difference);
+  }
+
+  QAtomicPointer<QThread> m_writer;
+  QAtomicInt m_writerRecursion;
+  QAtomicInt m_totalReaderRecursion;
+  QThreadStorage<int> m_readerRecursion;
+};
+
+///Simulates the work done while holding the lock, or between two acquisitions
+void work(int iterations)
+{
+  volatile int sum = 0;
+  for (int i = 0; i < iterations; ++i) {
+    sum += i;
+  }
+}
+
+struct Latencies
+{
+  ///Acquisition latencies in nanoseconds
+  QVector<qint64> read;
+  QVector<qint64> write;
+};
+
+/**
+ * Lets @p readers threads take read-locks while @p writers threads take write-locks on the same @p lock,
+ * and records how long every single acquisition took.
+ */
+template<class Lock>
+Latencies runContention(Lock& lock, int readers, int writers, int acquisitions)
+{
+  QVector<QVector<qint64>> latencies(readers + writers);
+  QVector<QFuture<void>> futures;
+  for (int i = 0; i < readers + writers; ++i) {
+    const bool writer = i >= readers;
+    QVector<qint64>& threadLatencies = latencies[i];
+    futures << QtConcurrent::run([&lock, &threadLatencies, writer, acquisitions] () {
+      threadLatencies.reserve(acquisitions);
+      QElapsedTimer timer;
+      for (int a = 0; a < acquisitions; ++a) {
+        timer.start();
+        if (writer) {
+          lock.lockForWrite();
+          threadLatencies << timer.nsecsElapsed();
+          work(2000);
+          lock.releaseWriteLock();
+          work(20000);
+        } else {
+          lock.lockForRead();
+          threadLatencies << timer.nsecsElapsed();
+          work(1000);
+          lock.releaseReadLock();
+          work(5000);
+        }
+      }
+    });
+  }
+  foreach (const QFuture<void>& future, futures) {
+    future.waitForFinished();
+  }
+
+  Latencies ret;
+  for (int i = 0; i < latencies.size(); ++i) {
+    (i >= readers ? ret.write : ret.read) += latencies[i];
+  }
+  return ret;
+}
+
+QString percentiles(QVector<qint64> latencies)
+{
+  if (latencies.isEmpty()) {
+    return QStringLiteral("-");
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies] (double p) {
+    return latencies[qMin(latencies.size() - 1, int(latencies.size() * p))] / 1000.0;
+  };
+  return QStringLiteral("p50 %1us p99 %2us p99.9 %3us max %4us")
+    .arg(percentile(0.5)).arg(percentile(0.99)).arg(percentile(0.999)).arg(latencies.last() / 1000.0);
+}
+
+}
+
+void BenchDUChainLock::contention()
+{
+  QFETCH(bool, spinning);
+  QFETCH(int, readers);
+  QFETCH(int, writers);
+
+  QThreadPool::globalInstance()->setMaxThreadCount(qMax(readers + writers, QThread::idealThreadCount()));
+  const int acquisitions = 2000;
+
+  Latencies latencies;
+  QBENCHMARK_ONCE {
+    if (spinning) {
+      SpinningDUChainLock lock;
+      latencies = runContention(lock, readers, writers, acquisitions);
+    } else {
+      DUChainLock lock;
+      latencies = runContention(lock, readers, writers, acquisitions);
+    }
+  }
+  QCOMPARE(latencies.read.size(), readers * acquisitions);
+  QCOMPARE(latencies.write.size(), writers * acquisitions);
+
+  qDebug() << "read: " << qPrintable(percentiles(latencies.read));
+  qDebug() << "write:" << qPrintable(percentiles(latencies.write));
+}
+
+void BenchDUChainLock::contention_data()
+{
+  QTest::addColumn<bool>("spinning");
+  QTest::addColumn<int>("readers");
+  QTest::addColumn<int>("writers");
+
+  QTest::newRow("spinning-read-mostly") << true << 6 << 1;
+  QTest::newRow("blocking-read-mostly") << false << 6 << 1;
+  QTest::newRow("spinning-mixed") << true << 4 << 4;
+  QTest::newRow("blocking-mixed") << false << 4 << 4;
+  QTest::newRow("spinning-write-only") << true << 0 << 4;
+  QTest::newRow("blocking-write-only") << false << 0 << 4;
+}
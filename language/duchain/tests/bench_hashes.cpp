@@ -25,6 +25,9 @@
 #include <tests/testcore.h>
 #include <tests/autotestshell.h>
 #include <QDateTime>
+#include <QDirIterator>
+#include <QFile>
+#include <QRegularExpression>
 #include <QTextCodec>
 #include <QVector>
 #include <QtTest/QTest>
@@ -314,3 +317,81 @@ void BenchHashes::typeRepo_data()
   QTest::newRow("unordered_map") << 5;
   QTest::newRow("nested-vector") << 6;
 }
+
+// the hash IndexedString used before it switched to CRC32C
+static uint djb2Hash(const char* str, unsigned short length)
+{
+  uint hash = 5381;
+  for (int a = length - 1; a >= 0; --a) {
+    hash = ((hash << 5) + hash) + *str;
+    ++str;
+  }
+  return hash;
+}
+
+// the identifiers and file paths found in the kdevplatform sources
+static void sourceCorpora(QVector<QByteArray>* identifiers, QVector<QByteArray>* paths)
+{
+  const QString thisFile = QFINDTESTDATA("bench_hashes.cpp");
+  if (thisFile.isEmpty()) {
+    return;
+  }
+  QDir sourceDir = QFileInfo(thisFile).dir();
+  sourceDir.cd(QStringLiteral("../../.."));
+
+  const QRegularExpression identifier(QStringLiteral("[A-Za-z_][A-Za-z0-9_]*"));
+  QDirIterator it(sourceDir.absolutePath(), {QStringLiteral("*.h"), QStringLiteral("*.cpp")}, QDir::Files, QDirIterator::Subdirectories);
+  while (it.hasNext()) {
+    const QString path = it.next();
+    *paths << path.toUtf8();
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+      continue;
+    }
+    const QString contents = QString::fromUtf8(file.readAll());
+    auto matches = identifier.globalMatch(contents);
+    while (matches.hasNext()) {
+      *identifiers << matches.next().captured().toUtf8();
+    }
+  }
+}
+
+void BenchHashes::hashString()
+{
+  QFETCH(bool, crc32c);
+  QFETCH(QVector<QByteArray>, corpus);
+
+  uint sum = 0;
+  if (crc32c) {
+    QBENCHMARK {
+      foreach(const QByteArray& string, corpus) {
+        sum += IndexedString::hashString(string.constData(), string.size());
+      }
+    }
+  } else {
+    QBENCHMARK {
+      foreach(const QByteArray& string, corpus) {
+        sum += djb2Hash(string.constData(), string.size());
+      }
+    }
+  }
+  QVERIFY(sum);
+}
+
+void BenchHashes::hashString_data()
+{
+  QTest::addColumn<bool>("crc32c");
+  QTest::addColumn<QVector<QByteArray>>("corpus");
+
+  QVector<QByteArray> identifiers;
+  QVector<QByteArray> paths;
+  sourceCorpora(&identifiers, &paths);
+  if (identifiers.isEmpty()) {
+    QSKIP("kdevplatform sources not found");
+  }
+
+  QTest::newRow("identifiers-djb2") << false << identifiers;
+  QTest::newRow("identifiers-crc32c") << true << identifiers;
+  QTest::newRow("paths-djb2") << false << paths;
+  QTest::newRow("paths-crc32c") << true << paths;
+}
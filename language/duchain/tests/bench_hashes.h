@@ -44,6 +44,8 @@ private slots:
   void remove_data();
   void typeRepo();
   void typeRepo_data();
+  void hashString();
+  void hashString_data();
 };
 
 #endif // KDEVPLATFORM_BENCH_HASHES_H
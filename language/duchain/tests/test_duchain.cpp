@@ -25,12 +25,16 @@
 
 #include <QTest>
 #include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QFile>
 
 #include <tests/autotestshell.h>
 #include <tests/testcore.h>
 
 #include <language/duchain/duchain.h>
 #include <language/duchain/duchainlock.h>
+#include <language/duchain/duchainarena.h>
 #include <language/duchain/persistentsymboltable.h>
 #include <language/duchain/codemodel.h>
 #include <language/duchain/types/typesystemdata.h>
@@ -39,7 +43,11 @@
 #include <language/duchain/declarationdata.h>
 #include <language/duchain/duchainregister.h>
 #include <language/duchain/problem.h>
+#include <language/duchain/localindexeddeclaration.h>
+#include <language/duchain/declarationidindex.h>
+#include <language/duchain/uses.h>
 #include <language/duchain/parsingenvironment.h>
+#include <language/duchain/topducontextsegmentstore.h>
 
 #include <language/codegen/coderepresentation.h>
 
@@ -52,6 +60,8 @@
 #include <iterator> // needed for std::insert_iterator on windows
 #include <QThread>
 
+#include <functional>
+
 //Extremely slow
 // #define TEST_NORMAL_IMPORTS
 
@@ -369,6 +379,175 @@ void TestDUChain::testSymbolTableValid() {
   PersistentSymbolTable::self().dump(QTextStream(stdout));
 }
 
+void TestDUChain::testPendingRecursiveImports()
+{
+  DUChainWriteLocker lock;
+  auto header = new TopDUContext(IndexedString(QStringLiteral("/pendingimports/header.h")), RangeInRevision());
+  DUChain::self()->addDocumentChain(header);
+  auto source = new TopDUContext(IndexedString(QStringLiteral("/pendingimports/source.cpp")), RangeInRevision());
+  DUChain::self()->addDocumentChain(source);
+  auto importer = new TopDUContext(IndexedString(QStringLiteral("/pendingimports/importer.cpp")), RangeInRevision());
+  DUChain::self()->addDocumentChain(importer);
+  importer->addImportedParentContext(source);
+
+  // the changes of all importers are applied at the end of the import update,
+  // independent of which write-lock is held and when it is released
+  source->addImportedParentContext(header);
+  QVERIFY(source->recursiveImportIndices().contains(IndexedTopDUContext(header)));
+  QVERIFY(importer->recursiveImportIndices().contains(IndexedTopDUContext(header)));
+  lock.unlock();
+
+  {
+    DUChainReadLocker readLock;
+    QVERIFY(importer->recursiveImportIndices().contains(IndexedTopDUContext(header)));
+    QVERIFY(importer->imports(header, CursorInRevision::invalid()));
+  }
+
+  lock.lock();
+  source->removeImportedParentContext(header);
+  QVERIFY(!importer->recursiveImportIndices().contains(IndexedTopDUContext(header)));
+  lock.unlock();
+  {
+    DUChainReadLocker readLock;
+    QVERIFY(!importer->recursiveImportIndices().contains(IndexedTopDUContext(header)));
+  }
+
+  lock.lock();
+  DUChain::self()->removeDocumentChain(importer);
+  DUChain::self()->removeDocumentChain(source);
+  DUChain::self()->removeDocumentChain(header);
+}
+
+void TestDUChain::testSymbolTableCache()
+{
+  PersistentSymbolTable& table = PersistentSymbolTable::self();
+  const uint oldCacheSize = table.cacheSize();
+  const IndexedQualifiedIdentifier id(QualifiedIdentifier(QStringLiteral("cachedSymbol")));
+
+  DUChainWriteLocker lock;
+  table.clearCache();
+
+  QList<TopDUContext*> tops;
+  QList<IndexedDeclaration> declarations;
+  for (int i = 0; i < 3; ++i) {
+    const IndexedString url(QStringLiteral("/symboltable/cache/%1").arg(i));
+    auto top = new TopDUContext(url, {0, 0, 10, 0}, new ParsingEnvironmentFile(url));
+    DUChain::self()->addDocumentChain(top);
+    auto dec = new Declaration({0, 0, 0, 1}, top);
+    dec->setIdentifier(Identifier(QStringLiteral("cachedSymbol")));
+    tops << top;
+    declarations << IndexedDeclaration(dec);
+  }
+  tops[0]->addImportedParentContext(tops[1]);
+  table.addDeclaration(id, declarations[0]);
+  table.addDeclaration(id, declarations[1]);
+
+  auto countVisible = [&](TopDUContext* top) {
+    int count = 0;
+    for (PersistentSymbolTable::FilteredDeclarationIterator it = table.getFilteredDeclarations(id, top->recursiveImportIndices()); it; ++it) {
+      ++count;
+    }
+    return count;
+  };
+
+  const PersistentSymbolTable::CacheStatistics initial = table.cacheStatistics();
+  QCOMPARE(countVisible(tops[0]), 2);
+  QCOMPARE(countVisible(tops[0]), 2);
+  QCOMPARE(countVisible(tops[1]), 1);
+  PersistentSymbolTable::CacheStatistics statistics = table.cacheStatistics();
+  QCOMPARE(statistics.hits - initial.hits, 1u);
+  QCOMPARE(statistics.misses - initial.misses, 2u);
+  QCOMPARE(statistics.entries, initial.entries + 2);
+
+  // only the results for the changed identifier are dropped
+  table.addDeclaration(id, declarations[2]);
+  statistics = table.cacheStatistics();
+  QCOMPARE(statistics.invalidations - initial.invalidations, 2u);
+  QCOMPARE(statistics.entries, initial.entries);
+  QCOMPARE(countVisible(tops[2]), 1);
+  QCOMPARE(countVisible(tops[0]), 2);
+
+  // the least recently used result is dropped when the cache is full
+  table.setCacheSize(1);
+  statistics = table.cacheStatistics();
+  QCOMPARE(statistics.entries, 1u);
+  QCOMPARE(statistics.evictions - initial.evictions, 1u);
+  QCOMPARE(countVisible(tops[0]), 2);
+  QCOMPARE(table.cacheStatistics().hits, statistics.hits + 1);
+  QCOMPARE(countVisible(tops[2]), 1);
+  QCOMPARE(table.cacheStatistics().misses, statistics.misses + 1);
+  // the dropped result is only deleted once the write lock was released, until then no further results are cached,
+  // not even by writes
+  QCOMPARE(table.cacheStatistics().evictions, statistics.evictions);
+  const IndexedQualifiedIdentifier otherId(QualifiedIdentifier(QStringLiteral("otherCachedSymbol")));
+  table.addDeclaration(otherId, declarations[2]);
+  table.removeDeclaration(otherId, declarations[2]);
+  QCOMPARE(countVisible(tops[2]), 1);
+  QCOMPARE(table.cacheStatistics().evictions, statistics.evictions);
+  lock.unlock();
+  lock.lock();
+  QCOMPARE(countVisible(tops[2]), 1);
+  QCOMPARE(table.cacheStatistics().entries, 1u);
+  QCOMPARE(table.cacheStatistics().evictions, statistics.evictions + 1);
+
+  // the copies stay valid without the cross-file lock
+  const KDevVarLengthArray<IndexedDeclaration> visible = table.copyFilteredDeclarations(id, tops[2]->recursiveImportIndices());
+  QCOMPARE(visible.size(), 1);
+  QCOMPARE(visible[0], declarations[2]);
+  QCOMPARE(table.copyDeclarations(id).size(), 3);
+
+  table.setCacheSize(oldCacheSize);
+  foreach (const IndexedDeclaration& declaration, declarations) {
+    table.removeDeclaration(id, declaration);
+  }
+  table.clearCache();
+  foreach (TopDUContext* top, tops) {
+    DUChain::self()->removeDocumentChain(top);
+  }
+}
+
+void TestDUChain::testDeclarationIdIndex()
+{
+  DeclarationIdIndex& index = DeclarationIdIndex::self();
+  const DeclarationId id(IndexedQualifiedIdentifier(QualifiedIdentifier(QStringLiteral("indexedDeclarationId"))));
+  const DeclarationIdIndex::Posting postings[] = {{70000, 3}, {5, 1}, {70000, 1}, {1u << 30, 0}, {5, 200000}};
+
+  DUChainWriteLocker lock;
+  QVERIFY(!index.contains(DeclarationIdIndex::DefinitionKind, id));
+  for (const DeclarationIdIndex::Posting& posting : postings) {
+    index.add(DeclarationIdIndex::DefinitionKind, id, posting);
+  }
+  // adding a posting twice has no effect
+  index.add(DeclarationIdIndex::DefinitionKind, id, postings[0]);
+  QVERIFY(index.contains(DeclarationIdIndex::DefinitionKind, id));
+  QVERIFY(!index.contains(DeclarationIdIndex::UseKind, id));
+
+  DeclarationIdIndex::Postings stored = index.postings(DeclarationIdIndex::DefinitionKind, id);
+  QCOMPARE(stored.size(), 5);
+  for (int i = 1; i < stored.size(); ++i) {
+    QVERIFY(stored[i - 1] < stored[i]);
+  }
+  QCOMPARE(stored[0].topContext, 5u);
+  QCOMPARE(stored[1].localIndex, 200000u);
+  QCOMPARE(stored[4].topContext, 1u << 30);
+  QVERIFY(index.ids(DeclarationIdIndex::DefinitionKind).contains(id));
+
+  std::set<uint> visible;
+  visible.insert(70000);
+  visible.insert(70001);
+  stored = index.postings(DeclarationIdIndex::DefinitionKind, id, TopDUContext::IndexedRecursiveImports(visible));
+  QCOMPARE(stored.size(), 2);
+  QCOMPARE(stored[0].localIndex, 1u);
+  QCOMPARE(stored[1].localIndex, 3u);
+
+  index.remove(DeclarationIdIndex::DefinitionKind, id, postings[2]);
+  QCOMPARE(index.postings(DeclarationIdIndex::DefinitionKind, id).size(), 4);
+  for (const DeclarationIdIndex::Posting& posting : postings) {
+    index.remove(DeclarationIdIndex::DefinitionKind, id, posting);
+  }
+  QVERIFY(!index.contains(DeclarationIdIndex::DefinitionKind, id));
+}
+
 void TestDUChain::testIndexedStrings() {
 
   int testCount  = 600000;
@@ -666,6 +845,25 @@ public:
   }
 };
 
+///Runs a function in an own thread, used to hold locks while the test thread checks them
+class FunctionThread : public QThread
+{
+public:
+  explicit FunctionThread(const std::function<void()>& function)
+    : m_function(function)
+  {
+  }
+
+protected:
+  void run() override
+  {
+    m_function();
+  }
+
+private:
+  std::function<void()> m_function;
+};
+
 void TestDUChain::testLockForWrite()
 {
   ThreadList threads;
@@ -710,6 +908,264 @@ void TestDUChain::testLockForReadWrite()
   QVERIFY(threads.join(1000));
 }
 
+void TestDUChain::testTopContextLocking()
+{
+  DUChainLock lock;
+  lock.setTopContextLocking(true);
+
+  QAtomicInt locked(0);
+  QAtomicInt release(0);
+  FunctionThread writer([&] () {
+    TopDUContextWriteLocker writeLock(1, &lock);
+    locked = 1;
+    while (!release.load()) {
+      QThread::msleep(1);
+    }
+  });
+  writer.start();
+  while (!locked.load()) {
+    QThread::msleep(1);
+  }
+
+  {
+    //Other top-contexts are not blocked by the writer
+    TopDUContextReadLocker readLock(2, &lock, 100);
+    QVERIFY(readLock.locked());
+    QVERIFY(lock.currentThreadHasTopContextReadLock(2));
+    QVERIFY(!lock.currentThreadHasTopContextReadLock(1));
+  }
+  {
+    TopDUContextWriteLocker writeLock(2, &lock, 100);
+    QVERIFY(writeLock.locked());
+    QVERIFY(lock.currentThreadHasTopContextWriteLock());
+    //Top-context writers may read globally
+    DUChainReadLocker readLock(&lock, 100);
+    QVERIFY(readLock.locked());
+  }
+  {
+    //The written top-context and the global locks are blocked
+    TopDUContextReadLocker readLock(1, &lock, 100);
+    QVERIFY(!readLock.locked());
+    DUChainReadLocker globalReadLock(&lock, 100);
+    QVERIFY(!globalReadLock.locked());
+    DUChainWriteLocker globalWriteLock(&lock, 100);
+    QVERIFY(!globalWriteLock.locked());
+  }
+
+  release = 1;
+  QVERIFY(writer.wait(1000));
+
+  {
+    DUChainReadLocker readLock(&lock, 100);
+    QVERIFY(readLock.locked());
+    //Readers of single top-contexts can join global readers, writers can't
+    TopDUContextReadLocker topReadLock(1, &lock, 100);
+    QVERIFY(topReadLock.locked());
+  }
+
+  //Without top-context locking, the lockers lock the whole chain
+  lock.setTopContextLocking(false);
+  {
+    TopDUContextReadLocker readLock(1, &lock);
+    QVERIFY(lock.currentThreadHasReadLock());
+    QVERIFY(!lock.currentThreadHasTopContextReadLock());
+  }
+  {
+    TopDUContextWriteLocker writeLock(1, &lock);
+    QVERIFY(lock.currentThreadHasWriteLock());
+  }
+}
+
+void TestDUChain::testTopContextLockOrder()
+{
+  DUChainLock lock;
+  lock.setTopContextLocking(true);
+  lock.setLockOrderChecking(true);
+
+  //Lock random pairs of top-contexts in ascending order, mixed with global locks. A deadlock shows up as a timeout.
+  const int topContexts = 6;
+  QAtomicInt failures(0);
+  QVector<QSharedPointer<FunctionThread>> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads << QSharedPointer<FunctionThread>(new FunctionThread([&lock, &failures, t] () {
+      uint seed = t + 1;
+      for (int i = 0; i < 2000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        uint first = 1 + (seed >> 16) % topContexts;
+        uint second = 1 + (seed >> 8) % topContexts;
+        if (first > second) {
+          qSwap(first, second);
+        }
+        if (seed % 23 == 0) {
+          DUChainWriteLocker writeLock(&lock, 5000);
+          failures.fetchAndAddOrdered(!writeLock.locked());
+          continue;
+        }
+        if (seed % 7 == 0) {
+          DUChainReadLocker readLock(&lock, 5000);
+          failures.fetchAndAddOrdered(!readLock.locked());
+          continue;
+        }
+        if (first == second) {
+          TopDUContextWriteLocker writeLock(first, &lock, 5000);
+          failures.fetchAndAddOrdered(!writeLock.locked());
+        } else if (seed & 1) {
+          TopDUContextWriteLocker writeLock(first, &lock, 5000);
+          TopDUContextReadLocker readLock(second, &lock, 5000);
+          failures.fetchAndAddOrdered(!writeLock.locked() || !readLock.locked());
+        } else {
+          TopDUContextReadLocker readLock(first, &lock, 5000);
+          TopDUContextWriteLocker writeLock(second, &lock, 5000);
+          failures.fetchAndAddOrdered(!readLock.locked() || !writeLock.locked());
+        }
+      }
+    }));
+  }
+  foreach (const QSharedPointer<FunctionThread>& thread, threads) {
+    thread->start();
+  }
+  foreach (const QSharedPointer<FunctionThread>& thread, threads) {
+    QVERIFY(thread->wait(60000));
+  }
+  QCOMPARE(failures.load(), 0);
+  QVERIFY(lock.lockOrderViolations().isEmpty());
+
+  //Locking in the opposite order is reported
+  {
+    TopDUContextReadLocker readLock(topContexts, &lock);
+    TopDUContextReadLocker secondReadLock(1, &lock);
+  }
+  QCOMPARE(lock.lockOrderViolations().size(), 1);
+  QCOMPARE(lock.lockOrderViolations().first(), qMakePair(uint(topContexts), 1u));
+
+  //As is requesting a global read-lock while only reading a top-context
+  {
+    TopDUContextReadLocker readLock(1, &lock);
+    DUChainReadLocker globalReadLock(&lock);
+  }
+  QCOMPARE(lock.lockOrderViolations().size(), 2);
+}
+
+void TestDUChain::testDUChainReadScope()
+{
+  DUChainWriteLocker lock;
+  auto header = new TopDUContext(IndexedString(QStringLiteral("/readscope/header.h")), RangeInRevision());
+  DUChain::self()->addDocumentChain(header);
+  auto source = new TopDUContext(IndexedString(QStringLiteral("/readscope/source.cpp")), RangeInRevision());
+  DUChain::self()->addDocumentChain(source);
+  source->addImportedParentContext(header);
+  auto unrelated = new TopDUContext(IndexedString(QStringLiteral("/readscope/unrelated.cpp")), RangeInRevision());
+  DUChain::self()->addDocumentChain(unrelated);
+  lock.unlock();
+
+  DUChainLock* duchainLock = DUChain::lock();
+  duchainLock->setTopContextLocking(true);
+
+  //Reads within the scope only wait for writers of the scope
+  auto readWhileWriting = [&] (const TopDUContext* written) {
+    QAtomicInt locked(0);
+    QAtomicInt release(0);
+    FunctionThread writer([&] () {
+      TopDUContextWriteLocker writeLock(written);
+      locked = 1;
+      while (!release.load()) {
+        QThread::msleep(1);
+      }
+    });
+
+    DUChainReadLocker readLock;
+    DUChainReadScope scope(source);
+    readLock.unlock();
+
+    writer.start();
+    while (!locked.load()) {
+      QThread::msleep(1);
+    }
+    bool ret;
+    {
+      DUChainReadLocker scopedReadLock(nullptr, 100);
+      ret = scopedReadLock.locked();
+      if (ret) {
+        ret = duchainLock->currentThreadHasReadLock() && duchainLock->currentThreadHasTopContextReadLock(header->ownIndex())
+              && !duchainLock->currentThreadHasTopContextReadLock(unrelated->ownIndex());
+      }
+    }
+    release = 1;
+    writer.wait();
+    return ret;
+  };
+  QVERIFY(readWhileWriting(unrelated));
+  QVERIFY(!readWhileWriting(header));
+  QVERIFY(!readWhileWriting(source));
+  QVERIFY(!duchainLock->currentThreadHasTopContextReadLock());
+
+  //Outside of a scope the whole chain is read
+  {
+    TopDUContextWriteLocker writeLock(unrelated);
+    QAtomicInt readLocked(1);
+    FunctionThread reader([&] () {
+      DUChainReadLocker readLock(nullptr, 100);
+      readLocked = readLock.locked();
+    });
+    reader.start();
+    reader.wait();
+    QVERIFY(!readLocked.load());
+  }
+
+  duchainLock->setTopContextLocking(false);
+
+  lock.lock();
+  DUChain::self()->removeDocumentChain(unrelated);
+  DUChain::self()->removeDocumentChain(source);
+  DUChain::self()->removeDocumentChain(header);
+}
+
+void TestDUChain::testLockProfiling()
+{
+  DUChainLock lock;
+  QVERIFY(lock.profilingReport().isEmpty());
+  lock.setProfiling(true);
+
+  QAtomicInt locked(0);
+  FunctionThread writer([&] () {
+    DUChainWriteLocker writeLock(&lock, 0, "slowWriter");
+    locked = 1;
+    QThread::msleep(50);
+  });
+  writer.start();
+  while (!locked.load()) {
+    QThread::msleep(1);
+  }
+  {
+    DUChainReadLocker readLock(&lock, 0, "blockedReader");
+  }
+  QVERIFY(writer.wait(1000));
+  for (int i = 0; i < 10; ++i) {
+    DUChainReadLocker readLock(&lock);
+  }
+
+  const QString report = lock.profilingReport();
+  qDebug() << report;
+  const QStringList lines = report.split(QLatin1Char('\n'), QString::SkipEmptyParts);
+  QCOMPARE(lines.size(), 4);
+  //The writer blocked the reader, so it is the worst holder
+  QVERIFY(lines[1].startsWith(QLatin1String("write")));
+  QVERIFY(lines[1].contains(QLatin1String("slowWriter")));
+  QVERIFY(!lines[1].contains(QLatin1String("blocked others 0us")));
+  QVERIFY(report.contains(QLatin1String("blockedReader")));
+  //Without a tag, the site is the caller's location if the compiler supports it
+  const QString untagged = lines[2].contains(QLatin1String("blockedReader")) ? lines[3] : lines[2];
+  QVERIFY(untagged.contains(QLatin1String("test_duchain.cpp:")) || untagged.contains(QLatin1String("unknown")));
+  QVERIFY(untagged.contains(QLatin1String(": 10x")));
+
+  //Disabling keeps the data, but does not record anymore
+  lock.setProfiling(false);
+  {
+    DUChainReadLocker readLock(&lock, 0, "notRecorded");
+  }
+  QVERIFY(!lock.profilingReport().contains(QLatin1String("notRecorded")));
+}
+
 void TestDUChain::testProblemSerialization()
 {
   DUChain::self()->disablePersistentStorage(false);
@@ -787,6 +1243,122 @@ void TestDUChain::testProblemSerialization()
   QVERIFY(parent->diagnostics().isEmpty());
 }
 
+static QByteArray readRecord(const TopDUContextSegmentStore& store, uint topContextIndex)
+{
+  const auto record = store.read(topContextIndex);
+  return QByteArray(record.data, record.size);
+}
+
+void TestDUChain::testTopContextSegmentStore()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const QString segmentsPath = dir.path() + QStringLiteral("/topcontext_segments/");
+
+  const QByteArray first(3000, 'a');
+  const QByteArray second(1000, 'b');
+
+  {
+    TopDUContextSegmentStore store(nullptr);
+    QVERIFY(store.open(dir.path()));
+
+    store.write(1, first);
+    store.write(2, first);
+    QVERIFY(store.contains(1));
+    {
+      const auto firstRecord = store.read(1);
+      QVERIFY(firstRecord.isValid());
+      QCOMPARE(QByteArray(firstRecord.data, firstRecord.size), first);
+
+      // the segment is mapped again when it grows, the old mapping stays valid for its users
+      store.write(1, second);
+      QCOMPARE(readRecord(store, 1), second);
+      QCOMPARE(QByteArray(firstRecord.data, firstRecord.size), first);
+    }
+
+    store.remove(2);
+    QVERIFY(!store.contains(2));
+    QVERIFY(!store.read(2).isValid());
+
+    auto stats = store.statistics();
+    QCOMPARE(stats.records, 1u);
+    QVERIFY(stats.liveBytes < stats.totalBytes);
+
+    QVERIFY(store.compact() > 0);
+    stats = store.statistics();
+    QCOMPARE(stats.segments, 1u);
+    QCOMPARE(stats.records, 1u);
+    QCOMPARE(stats.liveBytes, stats.totalBytes);
+    QCOMPARE(readRecord(store, 1), second);
+
+    store.close(true);
+  }
+
+  { // load the stored index
+    TopDUContextSegmentStore store(nullptr);
+    QVERIFY(store.open(dir.path()));
+    QCOMPARE(readRecord(store, 1), second);
+    QVERIFY(!store.contains(2));
+  }
+
+  // simulate a crash while a record was appended, and before the index was stored
+  QVERIFY(QFile::remove(segmentsPath + QStringLiteral("index")));
+  const QStringList segments = QDir(segmentsPath).entryList({QStringLiteral("segment_*")}, QDir::Files);
+  QCOMPARE(segments.size(), 1);
+  {
+    QFile segment(segmentsPath + segments.first());
+    QVERIFY(segment.open(QIODevice::WriteOnly | QIODevice::Append));
+    segment.write("torn");
+  }
+
+  { // rebuild the index from the segments
+    TopDUContextSegmentStore store(nullptr);
+    QVERIFY(store.open(dir.path()));
+    QCOMPARE(readRecord(store, 1), second);
+    QVERIFY(!store.contains(2));
+
+    store.write(3, first);
+    QCOMPARE(readRecord(store, 3), first);
+    QCOMPARE(store.statistics().liveBytes, store.statistics().totalBytes);
+  }
+}
+
+void TestDUChain::testPackedTopContextStorage()
+{
+  TopDUContextSegmentStore::setEnabled(true);
+
+  const IndexedString url(QStringLiteral("/packed/test/file"));
+  uint topIndex = 0;
+
+  {
+    DUChainWriteLocker lock;
+    auto top = new TopDUContext(url, {0, 0, 10, 0}, new ParsingEnvironmentFile(url));
+    auto dec = new Declaration({0, 0, 0, 1}, top);
+    dec->setIdentifier(Identifier(QStringLiteral("packed")));
+    DUChain::self()->addDocumentChain(top);
+    topIndex = top->ownIndex();
+  }
+
+  // the top-context is not referenced, so it is unloaded after storing it
+  DUChain::self()->storeToDisk();
+  QVERIFY(TopDUContextSegmentStore::self().contains(topIndex));
+
+  {
+    DUChainWriteLocker lock;
+    auto top = DUChain::self()->chainForDocument(url);
+    QVERIFY(top);
+    QCOMPARE(top->ownIndex(), topIndex);
+    QCOMPARE(top->localDeclarations().size(), 1);
+    QCOMPARE(top->localDeclarations().first()->identifier(), Identifier(QStringLiteral("packed")));
+
+    DUChain::self()->removeDocumentChain(top);
+  }
+
+  QVERIFY(!TopDUContextSegmentStore::self().contains(topIndex));
+
+  TopDUContextSegmentStore::setEnabled(false);
+}
+
 void TestDUChain::testIdentifiers()
 {
   QualifiedIdentifier aj(QStringLiteral("::Area::jump"));
@@ -971,16 +1543,35 @@ void TestDUChain::benchTypeRegistry_data()
 
 void TestDUChain::benchDuchainReadLocker()
 {
+  QFETCH(bool, profiling);
+  DUChain::lock()->setProfiling(profiling);
   QBENCHMARK {
     DUChainReadLocker lock;
   }
+  DUChain::lock()->setProfiling(false);
+}
+
+void TestDUChain::benchDuchainReadLocker_data()
+{
+  QTest::addColumn<bool>("profiling");
+
+  QTest::newRow("plain") << false;
+  QTest::newRow("profiling") << true;
 }
 
 void TestDUChain::benchDuchainWriteLocker()
 {
+  QFETCH(bool, profiling);
+  DUChain::lock()->setProfiling(profiling);
   QBENCHMARK {
     DUChainWriteLocker lock;
   }
+  DUChain::lock()->setProfiling(false);
+}
+
+void TestDUChain::benchDuchainWriteLocker_data()
+{
+  benchDuchainReadLocker_data();
 }
 
 void TestDUChain::benchDUChainItemFactory_copy()
@@ -1030,5 +1621,290 @@ void TestDUChain::benchDeclarationQualifiedIdentifier()
   QVERIFY(count > 0);
 }
 
+void TestDUChain::benchStoreTopContexts()
+{
+  QFETCH(bool, parallel);
+
+  const bool wasParallel = DUChain::self()->parallelStoring();
+  DUChain::self()->setParallelStoring(parallel);
+
+  QList<ReferencedTopDUContext> tops;
+  {
+    DUChainWriteLocker lock;
+    for (int i = 0; i < 200; ++i) {
+      const IndexedString url(QStringLiteral("/bench/store/%1/%2.cpp").arg(parallel).arg(i));
+      auto top = new TopDUContext(url, {0, 0, INT_MAX, INT_MAX}, new ParsingEnvironmentFile(url));
+      DUChain::self()->addDocumentChain(top);
+      for (int j = 0; j < 200; ++j) {
+        auto ctx = new DUContext({j, 0, j, 10}, top);
+        auto dec = new Declaration({j, 0, j, 1}, ctx);
+        dec->setIdentifier(Identifier(QStringLiteral("decl%1").arg(j)));
+      }
+      tops << ReferencedTopDUContext(top);
+    }
+  }
+
+  QBENCHMARK_ONCE {
+    DUChain::self()->storeToDisk();
+  }
+
+  {
+    DUChainWriteLocker lock;
+    foreach (const ReferencedTopDUContext& top, tops) {
+      DUChain::self()->removeDocumentChain(top.data());
+    }
+  }
+
+  DUChain::self()->setParallelStoring(wasParallel);
+}
+
+void TestDUChain::benchStoreTopContexts_data()
+{
+  QTest::addColumn<bool>("parallel");
+
+  QTest::newRow("serial") << false;
+  QTest::newRow("parallel") << true;
+}
+
+void TestDUChain::benchLoadTopContext()
+{
+  QFETCH(bool, lazy);
+
+  const bool wasLazy = DUChain::self()->lazyItemLoading();
+  DUChain::self()->setLazyItemLoading(lazy);
+
+  const IndexedString url(QStringLiteral("/bench/load/%1.cpp").arg(lazy));
+  const int contextCount = 100;
+  const int declarationsPerContext = 100;
+  const int declarationCount = contextCount * declarationsPerContext;
+  {
+    DUChainWriteLocker lock;
+    auto top = new TopDUContext(url, {0, 0, INT_MAX, INT_MAX}, new ParsingEnvironmentFile(url));
+    DUChain::self()->addDocumentChain(top);
+    for (int i = 0; i < contextCount; ++i) {
+      auto ctx = new DUContext({i, 0, i, INT_MAX}, top);
+      for (int j = 0; j < declarationsPerContext; ++j) {
+        auto dec = new Declaration({i, j, i, j + 1}, ctx);
+        dec->setIdentifier(Identifier(QStringLiteral("decl%1_%2").arg(i).arg(j)));
+      }
+    }
+  }
+
+  // the top-context is not referenced, so it is unloaded after storing it
+  DUChain::self()->storeToDisk();
+
+  DUChainWriteLocker lock;
+  TopDUContext* top = nullptr;
+  Declaration* dec = nullptr;
+  QBENCHMARK_ONCE {
+    top = DUChain::self()->chainForDocument(url);
+    dec = LocalIndexedDeclaration(declarationCount / 2).data(top);
+  }
+  QVERIFY(top);
+  QVERIFY(dec);
+  QCOMPARE(dec->identifier(), Identifier(QStringLiteral("decl%1_%2").arg(contextCount / 2 - 1).arg(declarationsPerContext - 1)));
+
+  // only the requested declaration and the contexts on its way are created
+  int loadedDeclarations = 0;
+  for (int i = 1; i <= declarationCount; ++i) {
+    if (LocalIndexedDeclaration(i).isLoaded(top)) {
+      ++loadedDeclarations;
+    }
+  }
+  qDebug() << "declarations created after loading:" << loadedDeclarations << "of" << declarationCount;
+  if (lazy) {
+    QVERIFY(loadedDeclarations < declarationsPerContext);
+  } else {
+    QCOMPARE(loadedDeclarations, declarationCount);
+  }
+
+  // the remaining items are created on access
+  QCOMPARE(top->childContexts().size(), contextCount);
+  QCOMPARE(top->childContexts().last()->localDeclarations().size(), declarationsPerContext);
+
+  DUChain::self()->removeDocumentChain(top);
+  DUChain::self()->setLazyItemLoading(wasLazy);
+}
+
+void TestDUChain::benchLoadTopContext_data()
+{
+  QTest::addColumn<bool>("lazy");
+
+  QTest::newRow("eager") << false;
+  QTest::newRow("lazy") << true;
+}
+
+void TestDUChain::benchToggleRootImport()
+{
+  QFETCH(bool, lookup);
+
+  // every file includes up to two files that come before it, so the first file is imported by all others
+  const int fileCount = 10000;
+  QVector<TopDUContext*> files;
+  TopDUContext* header = nullptr;
+  {
+    DUChainWriteLocker lock;
+    for (int i = 0; i < fileCount; ++i) {
+      auto top = new TopDUContext(IndexedString(QStringLiteral("/bench/imports/%1/%2.h").arg(lookup).arg(i)), RangeInRevision());
+      DUChain::self()->addDocumentChain(top);
+      if (i) {
+        top->addImportedParentContext(files[(i - 1) / 2]);
+        if (i > 2) {
+          top->addImportedParentContext(files[(i - 1) / 3]);
+        }
+      }
+      files << top;
+    }
+    header = new TopDUContext(IndexedString(QStringLiteral("/bench/imports/%1/header.h").arg(lookup)), RangeInRevision());
+    DUChain::self()->addDocumentChain(header);
+  }
+
+  QBENCHMARK {
+    DUChainWriteLocker lock;
+    files.first()->addImportedParentContext(header);
+    if (lookup) {
+      foreach (TopDUContext* top, files) {
+        QVERIFY(top->recursiveImportIndices().contains(IndexedTopDUContext(header)));
+      }
+    }
+    files.first()->removeImportedParentContext(header);
+    if (lookup) {
+      foreach (TopDUContext* top, files) {
+        QVERIFY(!top->recursiveImportIndices().contains(IndexedTopDUContext(header)));
+      }
+    }
+  }
+
+  DUChainWriteLocker lock;
+  QVERIFY(!files.last()->imports(header, CursorInRevision::invalid()));
+  QVERIFY(files.last()->imports(files.first(), CursorInRevision::invalid()));
+  for (int i = fileCount - 1; i >= 0; --i) {
+    DUChain::self()->removeDocumentChain(files[i]);
+  }
+  DUChain::self()->removeDocumentChain(header);
+}
+
+void TestDUChain::benchToggleRootImport_data()
+{
+  QTest::addColumn<bool>("lookup");
+
+  QTest::newRow("toggle") << false;
+  QTest::newRow("toggle-and-lookup") << true;
+}
+
+void TestDUChain::benchUsesLookup()
+{
+  // a popular declaration that is used in every file of a large project
+  const int fileCount = 10000;
+  const DeclarationId id(IndexedQualifiedIdentifier(QualifiedIdentifier(QStringLiteral("popularDeclaration"))));
+  {
+    DUChainWriteLocker lock;
+    for (int i = 1; i <= fileCount; ++i) {
+      DUChain::uses()->addUse(id, IndexedTopDUContext(i));
+    }
+  }
+
+  DUChainReadLocker lock;
+  int count = 0;
+  QBENCHMARK {
+    count = DUChain::uses()->uses(id).size();
+  }
+  QCOMPARE(count, fileCount);
+  lock.unlock();
+
+  DUChainWriteLocker writeLock;
+  for (int i = 1; i <= fileCount; ++i) {
+    DUChain::uses()->removeUse(id, IndexedTopDUContext(i));
+  }
+  QVERIFY(!DUChain::uses()->hasUses(id));
+}
+
+void TestDUChain::testDUChainArena()
+{
+  const bool wasEnabled = DUChainArena::enabled();
+  DUChainArena::setEnabled(true);
+
+  DUChainWriteLocker lock;
+  const IndexedString url(QStringLiteral("/duchainarena/test.cpp"));
+  auto top = new TopDUContext(url, {0, 0, INT_MAX, INT_MAX});
+  DUChain::self()->addDocumentChain(top);
+
+  DUChainArena::Statistics before = DUChainArena::statistics();
+  Declaration* fromArena;
+  {
+    DUChainArena arena;
+    fromArena = new Declaration({0, 0, 0, 1}, top);
+  }
+  DUChainArena::Statistics after = DUChainArena::statistics();
+  QVERIFY(after.arenaAllocations > before.arenaAllocations);
+  QCOMPARE(after.heapAllocations, before.heapAllocations);
+
+  // a closed arena, like the builders use when updating, and no arena allocate from the heap
+  before = after;
+  Declaration* fromClosedArena;
+  {
+    DUChainArena arena(false);
+    fromClosedArena = new Declaration({1, 0, 1, 1}, top);
+  }
+  auto fromHeap = new Declaration({2, 0, 2, 1}, top);
+  after = DUChainArena::statistics();
+  QCOMPARE(after.arenaAllocations, before.arenaAllocations);
+  QVERIFY(after.heapAllocations > before.heapAllocations);
+
+  // the items are released to wherever they came from, the chunk goes away with its last item
+  const uint chunks = after.chunks;
+  delete fromClosedArena;
+  delete fromHeap;
+  QCOMPARE(DUChainArena::statistics().chunks, chunks);
+  delete fromArena;
+  QCOMPARE(DUChainArena::statistics().chunks, chunks - 1);
+
+  DUChain::self()->removeDocumentChain(top);
+  DUChainArena::setEnabled(wasEnabled);
+}
+
+void TestDUChain::benchBuildTopContext()
+{
+  QFETCH(bool, arena);
+
+  const bool wasEnabled = DUChainArena::enabled();
+  DUChainArena::setEnabled(arena);
+
+  const int contextCount = 100;
+  const int declarationsPerContext = 100;
+  const DUChainArena::Statistics before = DUChainArena::statistics();
+  int run = 0;
+  QBENCHMARK {
+    DUChainWriteLocker lock;
+    // the builders open an arena for every top-context they build
+    DUChainArena scope;
+    const IndexedString url(QStringLiteral("/bench/build/%1/%2.cpp").arg(arena).arg(run++));
+    auto top = new TopDUContext(url, {0, 0, INT_MAX, INT_MAX});
+    DUChain::self()->addDocumentChain(top);
+    for (int i = 0; i < contextCount; ++i) {
+      auto ctx = new DUContext({i, 0, i, INT_MAX}, top);
+      for (int j = 0; j < declarationsPerContext; ++j) {
+        new Declaration({i, j, i, j + 1}, ctx);
+      }
+    }
+    DUChain::self()->removeDocumentChain(top);
+  }
+  const DUChainArena::Statistics after = DUChainArena::statistics();
+  qDebug() << "arena allocations:" << after.arenaAllocations - before.arenaAllocations
+           << "heap allocations:" << after.heapAllocations - before.heapAllocations
+           << "chunks:" << after.chunks;
+  QCOMPARE(after.arenaAllocations > before.arenaAllocations, arena);
+
+  DUChainArena::setEnabled(wasEnabled);
+}
+
+void TestDUChain::benchBuildTopContext_data()
+{
+  QTest::addColumn<bool>("arena");
+
+  QTest::newRow("heap") << false;
+  QTest::newRow("arena") << true;
+}
+
 #include "test_duchain.moc"
 #include "moc_test_duchain.cpp"
@@ -39,12 +39,21 @@ private slots:
     void testStringSets();
 #endif
     void testSymbolTableValid();
+    void testSymbolTableCache();
+    void testPendingRecursiveImports();
+    void testDeclarationIdIndex();
     void testIndexedStrings();
     void testImportStructure();
     void testLockForWrite();
     void testLockForRead();
     void testLockForReadWrite();
+    void testTopContextLocking();
+    void testTopContextLockOrder();
+    void testDUChainReadScope();
+    void testLockProfiling();
     void testProblemSerialization();
+    void testTopContextSegmentStore();
+    void testPackedTopContextStorage();
     void testIdentifiers();
     ///NOTE: these are not "automated"!
 //     void testImportCache();
@@ -53,10 +62,22 @@ private slots:
     void benchTypeRegistry();
     void benchTypeRegistry_data();
     void benchDuchainWriteLocker();
+    void benchDuchainWriteLocker_data();
     void benchDuchainReadLocker();
+    void benchDuchainReadLocker_data();
     void benchDUChainItemFactory_copy();
     void benchDUChainItemFactory_copy_data();
     void benchDeclarationQualifiedIdentifier();
+    void benchStoreTopContexts();
+    void benchStoreTopContexts_data();
+    void benchLoadTopContext();
+    void benchLoadTopContext_data();
+    void benchToggleRootImport();
+    void benchToggleRootImport_data();
+    void benchUsesLookup();
+    void testDUChainArena();
+    void benchBuildTopContext();
+    void benchBuildTopContext_data();
 };
 
 #endif // KDEVPLATFORM_TEST_DUCHAIN_H
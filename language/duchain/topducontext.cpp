@@ -98,6 +98,13 @@ void removeFromVector(QVector<T>& vec, const T& t) {
 
 QMutex importStructureMutex(QMutex::Recursive);
 
+class TopDUContextLocalPrivate;
+//The top-contexts whose recursive import changes were not applied yet, protected by importStructureMutex
+QSet<TopDUContextLocalPrivate*> pendingRecursiveImports;
+
+//Applies the collected recursive import changes of all top-contexts, importStructureMutex must be locked
+void applyPendingRecursiveImports();
+
 //Contains data that is not shared among top-contexts that share their duchain entries
 class TopDUContextLocalPrivate {
 public:
@@ -111,6 +118,8 @@ public:
     //Either we use some other contexts data and have no users, or we own the data and have users that share it.
     QMutexLocker lock(&importStructureMutex);
 
+    pendingRecursiveImports.remove(this);
+
     foreach(const DUContext::Import& import, m_importedContexts)
       if(DUChain::self()->isInMemory(import.topContextIndex()) && dynamic_cast<TopDUContext*>(import.context(nullptr)))
         dynamic_cast<TopDUContext*>(import.context(nullptr))->m_local->m_directImporters.remove(m_ctxt);
@@ -139,6 +148,8 @@ public:
         top->m_local->addImportedContextRecursively(m_ctxt, false, true);
       }
     }
+    //Nobody else sees this top-context yet, so its own set can be built right away
+    applyRecursiveImportChanges();
   }
 
   //Index of this top-context within the duchain
@@ -185,6 +196,7 @@ public:
     m_importedContexts.clear();
 
     rebuildImportStructureRecursion(rebuild);
+    applyPendingRecursiveImports();
 
     Q_ASSERT(m_recursiveImports.isEmpty());
 //     Q_ASSERT(m_recursiveImports.size() == m_indexedRecursiveImports.count()-1);
@@ -206,6 +218,8 @@ public:
       for(RecursiveImports::const_iterator it = b.constBegin(); it != b.constEnd(); ++it)
         addImportedContextRecursion(context, it.key(), (*it).first+1, temporary); //Add contexts that were imported earlier into the given one
     }
+
+    applyPendingRecursiveImports();
   }
 
   //Removes the context from this and all contexts that import this, and manages m_recursiveImports
@@ -230,6 +244,7 @@ public:
     }
 
     rebuildImportStructureRecursion(rebuild);
+    applyPendingRecursiveImports();
   }
 
   void removeImportedContextsRecursively(const QList<TopDUContext*>& contexts, bool local) {
@@ -257,6 +272,7 @@ public:
     }
 
     rebuildImportStructureRecursion(rebuild);
+    applyPendingRecursiveImports();
   }
 
   //Has an entry for every single recursively imported file, that contains the shortest path, and the next context on that path to the imported context.
@@ -264,8 +280,50 @@ public:
   //What makes this most complicated is the fact that loops are allowed in the import structure.
   typedef QHash<const TopDUContext*, QPair<int, const TopDUContext*> > RecursiveImports;
   mutable RecursiveImports m_recursiveImports;
-  mutable TopDUContext::IndexedRecursiveImports m_indexedRecursiveImports;
+
+  //Applies the collected changes to m_indexedRecursiveImports. The readers of the set are synchronized through the
+  //duchain lock, so this may only be called while they are excluded, i.e. with the duchain write-lock or the
+  //top-context write-lock of the context whose imports are changed held, as all its importers import it as well.
+  void applyRecursiveImportChanges() {
+    QMutexLocker lock(&importStructureMutex);
+
+    if(!m_addedRecursiveImports.isEmpty()) {
+      m_indexedRecursiveImports += TopDUContext::IndexedRecursiveImports(std::set<uint>(m_addedRecursiveImports.constBegin(), m_addedRecursiveImports.constEnd()));
+      m_addedRecursiveImports.clear();
+    }
+    if(!m_removedRecursiveImports.isEmpty()) {
+      m_indexedRecursiveImports -= TopDUContext::IndexedRecursiveImports(std::set<uint>(m_removedRecursiveImports.constBegin(), m_removedRecursiveImports.constEnd()));
+      m_removedRecursiveImports.clear();
+    }
+    pendingRecursiveImports.remove(this);
+  }
+
+  //The indices of m_recursiveImports plus the own index, as of the end of the last import update
+  TopDUContext::IndexedRecursiveImports m_indexedRecursiveImports;
+
   private:
+  //Every change of m_indexedRecursiveImports creates new sets in the set-repository. A changed import of a widely
+  //imported context changes the sets of all its importers, often multiple times while the structure is rebuilt, so
+  //the changes are only collected here, and applied at once at the end of the import update.
+  void recursiveImportAdded(const TopDUContext* imported) {
+    if(!m_removedRecursiveImports.remove(imported->ownIndex()))
+      m_addedRecursiveImports.insert(imported->ownIndex());
+    recursiveImportsChanged();
+  }
+
+  void recursiveImportRemoved(const TopDUContext* imported) {
+    if(!m_addedRecursiveImports.remove(imported->ownIndex()))
+      m_removedRecursiveImports.insert(imported->ownIndex());
+    recursiveImportsChanged();
+  }
+
+  void recursiveImportsChanged() {
+    pendingRecursiveImports.insert(this);
+  }
+
+  QSet<uint> m_addedRecursiveImports;
+  QSet<uint> m_removedRecursiveImports;
+
   void addImportedContextRecursion(const TopDUContext* traceNext, const TopDUContext* imported, int depth, bool temporary = false) {
 
     if(m_ctxt->usingImportsCache())
@@ -287,7 +345,7 @@ public:
       //Insert new path to "imported"
       m_recursiveImports[imported] = qMakePair(depth, traceNext);
 
-      m_indexedRecursiveImports.insert(imported->indexed());
+      recursiveImportAdded(imported);
 //       Q_ASSERT(m_indexedRecursiveImports.size() == m_recursiveImports.size()+1);
 
       Q_ASSERT(traceNext != m_ctxt);
@@ -346,7 +404,7 @@ public:
                                       //Just updating these complex structures is very hard.
                                       Q_ASSERT(imported != m_ctxt);
 
-        m_indexedRecursiveImports.remove(imported->indexed());
+        recursiveImportRemoved(imported);
 //         Q_ASSERT(m_indexedRecursiveImports.size() == m_recursiveImports.size());
 
         rebuild.insert(qMakePair(m_ctxt, imported));
@@ -375,13 +433,20 @@ public:
 const TopDUContext::IndexedRecursiveImports& TopDUContext::recursiveImportIndices() const
 {
 //   No lock-check for performance reasons
-  QMutexLocker lock(&importStructureMutex);
   if(!d_func()->m_importsCache.isEmpty())
     return d_func()->m_importsCache;
 
+  //The set is only changed at the end of an import update, while the writer excludes the readers of the set
   return m_local->m_indexedRecursiveImports;
 }
 
+void applyPendingRecursiveImports()
+{
+  //Applying removes the top-context from the set
+  while(!pendingRecursiveImports.isEmpty())
+    (*pendingRecursiveImports.begin())->applyRecursiveImportChanges();
+}
+
 void TopDUContextData::updateImportCacheRecursion(uint baseIndex, IndexedTopDUContext currentContext, TopDUContext::IndexedRecursiveImports& visited) {
   if(visited.contains(currentContext.index()))
     return;
@@ -643,29 +708,15 @@ struct TopDUContext::FindDeclarationsAcceptor {
     qCDebug(LANGUAGE) << "accepting" << id.toString();
 #endif
 
-    PersistentSymbolTable::Declarations allDecls;
-
-    //This iterator efficiently filters the visible declarations out of all declarations
-    PersistentSymbolTable::FilteredDeclarationIterator filter;
-
-    //This is used if filtering is disabled
-    PersistentSymbolTable::Declarations::Iterator unchecked;
-    if(check.flags & DUContext::NoImportsCheck) {
-      allDecls = PersistentSymbolTable::self().getDeclarations(id);
-      unchecked = allDecls.iterator();
-    } else
-      filter = PersistentSymbolTable::self().getFilteredDeclarations(id, top->recursiveImportIndices());
+    //The declarations are copied, as checking them may load top-contexts, while other files
+    //can change the symbol table with top-context locking
+    KDevVarLengthArray<IndexedDeclaration> decls;
+    if(check.flags & DUContext::NoImportsCheck)
+      decls = PersistentSymbolTable::self().copyDeclarations(id);
+    else
+      decls = PersistentSymbolTable::self().copyFilteredDeclarations(id, top->recursiveImportIndices());
 
-    while(filter || unchecked) {
-
-      IndexedDeclaration iDecl;
-      if(filter) {
-        iDecl = *filter;
-        ++filter;
-      } else {
-        iDecl = *unchecked;
-        ++unchecked;
-      }
+    for(const IndexedDeclaration& iDecl : decls) {
       Declaration* decl = iDecl.data();
 
       if(!decl)
@@ -772,17 +823,17 @@ bool TopDUContext::applyAliases( const QualifiedIdentifier& previous, const Sear
 #endif
 
     if(aliasId.inRepository()) {
-    //This iterator efficiently filters the visible declarations out of all declarations
-      PersistentSymbolTable::FilteredDeclarationIterator filter = PersistentSymbolTable::self().getFilteredDeclarations(aliasId, recursiveImportIndices());
+      //The visible declarations are copied, as the search recurses while they are processed
+      const KDevVarLengthArray<IndexedDeclaration> aliases = PersistentSymbolTable::self().copyFilteredDeclarations(aliasId, recursiveImportIndices());
 
-      if(filter) {
+      if(!aliases.isEmpty()) {
         DeclarationChecker check(this, position, AbstractType::Ptr(), NoSearchFlags, nullptr);
 
         //The first part of the identifier has been found as a namespace-alias.
         //In c++, we only need the first alias. However, just to be correct, follow them all for now.
-        for(; filter; ++filter)
+        for(const IndexedDeclaration& iAliasDecl : aliases)
         {
-          Declaration* aliasDecl = filter->data();
+          Declaration* aliasDecl = iAliasDecl.data();
           if(!aliasDecl)
             continue;
 
@@ -853,15 +904,15 @@ bool TopDUContext::applyAliases( const QualifiedIdentifier& previous, const Sear
 #endif
 
     if(importId.inRepository()) {
-      //This iterator efficiently filters the visible declarations out of all declarations
-      PersistentSymbolTable::FilteredDeclarationIterator filter = PersistentSymbolTable::self().getFilteredDeclarations(importId, recursiveImportIndices());
+      //The visible declarations are copied, as the search recurses while they are processed
+      const KDevVarLengthArray<IndexedDeclaration> imports = PersistentSymbolTable::self().copyFilteredDeclarations(importId, recursiveImportIndices());
 
-      if(filter) {
+      if(!imports.isEmpty()) {
         DeclarationChecker check(this, position, AbstractType::Ptr(), NoSearchFlags, nullptr);
 
-        for(; filter; ++filter)
+        for(const IndexedDeclaration& iImportDecl : imports)
         {
-          Declaration* importDecl = filter->data();
+          Declaration* importDecl = iImportDecl.data();
           if(!importDecl)
             continue;
 
@@ -989,7 +1040,6 @@ bool TopDUContext::importsPrivate(const DUContext * origin, const CursorInRevisi
   Q_UNUSED(position);
 
   if( const TopDUContext* top = dynamic_cast<const TopDUContext*>(origin) ) {
-    QMutexLocker lock(&importStructureMutex);
     bool ret = recursiveImportIndices().contains(IndexedTopDUContext(const_cast<TopDUContext*>(top)));
     if(top == this)
       Q_ASSERT(ret);
@@ -1012,7 +1062,7 @@ void TopDUContext::clearImportedParentContexts() {
 
   Q_ASSERT(m_local->m_recursiveImports.count() == 0);
 
-  Q_ASSERT(m_local->m_indexedRecursiveImports.count() == 1);
+  Q_ASSERT(recursiveImportIndices().count() == 1);
 
   Q_ASSERT(imports(this, CursorInRevision::invalid()));
 }
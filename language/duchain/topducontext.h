@@ -286,6 +286,7 @@ public:
   
   ///Returns the set of all recursively imported top-contexts. If import-caching is used, this returns the cached set.
   ///The list also contains this context itself. This set is used to determine declaration-visibility from within this top-context.
+  ///The duchain must be read-locked, or with top-context locking this top-context and its imports, see DUChainReadScope.
   const IndexedRecursiveImports& recursiveImportIndices() const;
 
   /**
@@ -347,6 +348,7 @@ protected:
   friend class TopDUContextDynamicData;
   friend class Declaration;
   friend class DUContext;
+  friend class DUContextDynamicData;
   friend class Problem;
   friend class IndexedDeclaration;
   friend class IndexedDUContext;
@@ -23,7 +23,9 @@
 #include <QStandardPaths>
 #include <typeinfo>
 #include <QtCore/QFile>
+#include <QtCore/QBuffer>
 #include <QtCore/QByteArray>
+#include <QtCore/QScopedPointer>
 
 #include "declaration.h"
 #include "declarationdata.h"
@@ -45,6 +47,8 @@ using namespace KDevelop;
 
 namespace {
 
+bool lazyItemLoadingEnabled = !qEnvironmentVariableIsSet("KDEV_DUCHAIN_EAGER_ITEM_LOADING");
+
 /**
  * Serialize @p item into @p data and update @p totalDataOffset.
  *
@@ -160,6 +164,59 @@ QString pathForTopContext(const uint topContextIndex)
   return basePath() + QString::number(topContextIndex);
 }
 
+/**
+ * Gives sequential access to the stored data of a top-context. The data is read from the packed
+ * segment store if it contains the top-context, else from the own file of the top-context.
+ */
+class StoredTopContext
+{
+public:
+  explicit StoredTopContext(const uint topContextIndex)
+    : m_record(TopDUContextSegmentStore::self().read(topContextIndex))
+  {
+    if (m_record.isValid()) {
+      m_buffer.setData(QByteArray::fromRawData(m_record.data, m_record.size));
+      m_device = &m_buffer;
+    } else {
+      m_file.reset(new QFile(pathForTopContext(topContextIndex)));
+      m_device = m_file.data();
+    }
+  }
+
+  bool open()
+  {
+    return m_device->open(QIODevice::ReadOnly);
+  }
+
+  QIODevice* device() const
+  {
+    return m_device;
+  }
+
+  QString name() const
+  {
+    return m_file ? m_file->fileName() : QStringLiteral("packed top-context record");
+  }
+
+  /// Invalid if the data is read from a file
+  const TopDUContextSegmentStore::Record& record() const
+  {
+    return m_record;
+  }
+
+  /// Transfers the ownership of the file to the caller, zero if the data is read from the segment store
+  QFile* takeFile()
+  {
+    return m_file.take();
+  }
+
+private:
+  TopDUContextSegmentStore::Record m_record;
+  QBuffer m_buffer;
+  QScopedPointer<QFile> m_file;
+  QIODevice* m_device;
+};
+
 enum LoadType {
   PartialLoad, ///< Only load the direct member data
   FullLoad     ///< Load everything, including appended lists
@@ -167,16 +224,16 @@ enum LoadType {
 template<typename F>
 void loadTopDUContextData(const uint topContextIndex, LoadType loadType, F callback)
 {
-  QFile file(pathForTopContext(topContextIndex));
-  if (!file.open(QIODevice::ReadOnly)) {
+  StoredTopContext source(topContextIndex);
+  if (!source.open()) {
     return;
   }
 
   uint readValue;
-  file.read((char*)&readValue, sizeof(uint));
+  source.device()->read((char*)&readValue, sizeof(uint));
   // now readValue is filled with the top-context data size
   Q_ASSERT(readValue >= sizeof(TopDUContextData));
-  const QByteArray data = file.read(loadType == FullLoad ? readValue : sizeof(TopDUContextData));
+  const QByteArray data = source.device()->read(loadType == FullLoad ? readValue : sizeof(TopDUContextData));
   const TopDUContextData* topData = reinterpret_cast<const TopDUContextData*>(data.constData());
   callback(topData);
 }
@@ -231,7 +288,9 @@ void TopDUContextDynamicData::DUChainItemStorage<Item>::clearItems()
   //For that reason we have to check here, and delete all remaining declarations.
   qDeleteAll(temporaryItems);
   temporaryItems.clear();
-  qDeleteAll(items);
+  for (const auto& slot : items) {
+    delete slot.load();
+  }
   items.clear();
 }
 
@@ -239,7 +298,10 @@ namespace KDevelop {
 template<>
 void TopDUContextDynamicData::DUChainItemStorage<ProblemPointer>::clearItems()
 {
-  // don't delete anything - the problem is shared
+  // don't delete anything - the problem is shared, only drop the references
+  for (const auto& slot : items) {
+    Slot::release(slot.load());
+  }
   items.clear();
 }
 }
@@ -255,8 +317,8 @@ void TopDUContextDynamicData::DUChainItemStorage<Item>::clearItemIndex(const Ite
       return;
     } else {
       const uint realIndex = index - 1;
-      Q_ASSERT(items[realIndex] == item);
-      items[realIndex] = nullptr;
+      Q_ASSERT(items[realIndex].load() == Slot::pointer(item));
+      Slot::release(items[realIndex].fetchAndStoreRelease(nullptr));
 
       if (realIndex < (uint)offsets.size()) {
         offsets[realIndex] = ItemDataInfo();
@@ -282,7 +344,7 @@ void TopDUContextDynamicData::DUChainItemStorage<Item>::storeData(uint& currentD
   auto const oldOffsets = offsets;
   offsets.clear();
   for (int a = 0; a < items.size(); ++a) {
-    auto item = items[a];
+    const Item item = Slot::item(items[a].load());
     if (!item) {
       if (oldOffsets.size() > a && oldOffsets[a].dataOffset) {
         //Directly copy the old data range into the new data
@@ -304,8 +366,8 @@ void TopDUContextDynamicData::DUChainItemStorage<Item>::storeData(uint& currentD
 
 #ifndef QT_NO_DEBUG
   if (!isSharedDataItem<Item>()) {
-    for (auto item : items) {
-      if (item) {
+    for (const auto& slot : items) {
+      if (auto item = slot.load()) {
         validateItem(item->d_func(), data->m_mappedData, data->m_mappedDataSize);
       }
     }
@@ -316,7 +378,8 @@ void TopDUContextDynamicData::DUChainItemStorage<Item>::storeData(uint& currentD
 template<typename Item>
 bool TopDUContextDynamicData::DUChainItemStorage<Item>::itemsHaveChanged() const
 {
-  for (auto item : items) {
+  for (const auto& slot : items) {
+    auto item = slot.load();
     if (item && item->d_func()->m_dynamic) {
       return true;
     }
@@ -331,7 +394,8 @@ uint TopDUContextDynamicData::DUChainItemStorage<Item>::allocateItemIndex(const
     data->loadData();
   }
   if (!temporary) {
-    items.append(item);
+    Slot::acquire(Slot::pointer(item));
+    items.append(QAtomicPointer<typename Slot::Target>(Slot::pointer(item)));
     return items.size();
   } else {
     temporaryItems.append(item);
@@ -349,7 +413,7 @@ bool TopDUContextDynamicData::DUChainItemStorage<Item>::isItemForIndexLoaded(uin
     if (index == 0 || index > uint(items.size())) {
       return false;
     }
-    return items[index-1];
+    return items[index-1].loadAcquire();
   } else {
     // temporary item
     return true;
@@ -371,24 +435,34 @@ Item TopDUContextDynamicData::DUChainItemStorage<Item>::getItemForIndex(uint ind
     qCWarning(LANGUAGE) << "item index out of bounds:" << index << "count:" << items.size();
     return {};
   }
-  const uint realIndex = index - 1;;
-  const auto& item = items.at(realIndex);
-  if (item) {
+  const uint realIndex = index - 1;
+  //Pairs with the release store that publishes a newly created item
+  if (auto item = items.at(realIndex).loadAcquire()) {
     //Shortcut, because this is the most common case
-    return item;
+    return Slot::item(item);
   }
 
   if (realIndex < (uint)offsets.size() && offsets[realIndex].dataOffset) {
     Q_ASSERT(!data->m_itemRetrievalForbidden);
 
+    //Items may be requested by multiple readers at the same time, make sure only one of them creates the item
+    QMutexLocker lock(&data->m_itemMutex);
+    if (auto item = items.at(realIndex).load()) {
+      return Slot::item(item);
+    }
+    //Creating an item may request it again, e.g. when a context loads its children eagerly
+    const auto pending = pendingItems.constFind(realIndex);
+    if (pending != pendingItems.constEnd()) {
+      return *pending;
+    }
+
     //Construct the context, and eventuall its parent first
     ///TODO: ugly, remove need for const_cast
     auto itemData = const_cast<DUChainBaseData*>(
       reinterpret_cast<const DUChainBaseData*>(data->pointerInData(offsets[realIndex].dataOffset))
     );
 
-    auto& item = items[realIndex];
-    item = dynamic_cast<typename PtrType<Item>::value>(DUChainItemSystem::self().create(itemData));
+    Item item(dynamic_cast<typename PtrType<Item>::value>(DUChainItemSystem::self().create(itemData)));
     if (!item) {
       //When this happens, the item has not been registered correctly.
       //We can stop here, because else we will get crashes later.
@@ -403,29 +477,42 @@ Item TopDUContextDynamicData::DUChainItemStorage<Item>::getItemForIndex(uint ind
       item->makeDynamic();
     }
 
+    pendingItems.insert(realIndex, item);
     auto parent = data->getContextForIndex(offsets[realIndex].parentContext);
     Q_ASSERT_X(parent, Q_FUNC_INFO, "Could not find parent context for loaded item.\n"
                                     "Potentially, the context has been deleted without deleting its children.");
     item->rebuildDynamicData(parent, index);
-  } else {
-    qCWarning(LANGUAGE) << "invalid item for index" << index << offsets.size() << offsets.value(realIndex).dataOffset;
+    pendingItems.remove(realIndex);
+
+    //Readers take the item without the mutex, so it is only published once it is complete
+    Slot::acquire(Slot::pointer(item));
+    items[realIndex].storeRelease(Slot::pointer(item));
+    return item;
   }
 
-  return item;
+  qCWarning(LANGUAGE) << "invalid item for index" << index << offsets.size() << offsets.value(realIndex).dataOffset;
+  return {};
 }
 
 template<class Item>
 void TopDUContextDynamicData::DUChainItemStorage<Item>::deleteOnDisk()
 {
-  for (auto& item : items) {
-    if (item) {
+  //Items are only created on demand, so create the remaining ones before their data goes away
+  for (int a = 0; a < items.size(); ++a) {
+    if (!items[a].load() && a < offsets.size() && offsets[a].dataOffset) {
+      getItemForIndex(a + 1);
+    }
+  }
+
+  for (const auto& slot : items) {
+    if (auto item = slot.load()) {
       item->makeDynamic();
     }
   }
 }
 
 template<class Item>
-void TopDUContextDynamicData::DUChainItemStorage<Item>::loadData(QFile* file) const
+void TopDUContextDynamicData::DUChainItemStorage<Item>::loadData(QIODevice* file) const
 {
   Q_ASSERT(offsets.isEmpty());
   Q_ASSERT(items.isEmpty());
@@ -441,7 +528,7 @@ void TopDUContextDynamicData::DUChainItemStorage<Item>::loadData(QFile* file) co
 }
 
 template<class Item>
-void TopDUContextDynamicData::DUChainItemStorage<Item>::writeData(QFile* file)
+void TopDUContextDynamicData::DUChainItemStorage<Item>::writeData(QIODevice* file)
 {
   uint writeValue = offsets.size();
   file->write((char*)&writeValue, sizeof(uint));
@@ -472,7 +559,18 @@ TopDUContextDynamicData::TopDUContextDynamicData(TopDUContext* topContext)
   , m_mappedData(nullptr)
   , m_mappedDataSize(0)
   , m_itemRetrievalForbidden(false)
+  , m_itemMutex(QMutex::Recursive)
+{
+}
+
+bool TopDUContextDynamicData::lazyItemLoading()
 {
+  return lazyItemLoadingEnabled;
+}
+
+void TopDUContextDynamicData::setLazyItemLoading(bool enabled)
+{
+  lazyItemLoadingEnabled = enabled;
 }
 
 void KDevelop::TopDUContextDynamicData::clear()
@@ -490,13 +588,14 @@ TopDUContextDynamicData::~TopDUContextDynamicData()
 void KDevelop::TopDUContextDynamicData::unmap() {
   delete m_mappedFile;
   m_mappedFile = nullptr;
+  m_mappedRecord = TopDUContextSegmentStore::Record();
   m_mappedData = nullptr;
   m_mappedDataSize = 0;
 }
 
 bool TopDUContextDynamicData::fileExists(uint topContextIndex)
 {
-  return QFile::exists(pathForTopContext(topContextIndex));
+  return TopDUContextSegmentStore::self().contains(topContextIndex) || QFile::exists(pathForTopContext(topContextIndex));
 }
 
 QList<IndexedDUContext> TopDUContextDynamicData::loadImporters(uint topContextIndex) {
@@ -538,10 +637,11 @@ void TopDUContextDynamicData::loadData() const {
   Q_ASSERT(!m_dataLoaded);
   Q_ASSERT(m_data.isEmpty());
 
-  QFile* file = new QFile(pathForTopContext(m_topContext->ownIndex()));
-  bool open = file->open(QIODevice::ReadOnly);
+  StoredTopContext source(m_topContext->ownIndex());
+  bool open = source.open();
   Q_UNUSED(open);
   Q_ASSERT(open);
+  QIODevice* file = source.device();
   Q_ASSERT(file->size());
 
   //Skip the offsets, we're already read them
@@ -554,15 +654,25 @@ void TopDUContextDynamicData::loadData() const {
   m_declarations.loadData(file);
   m_problems.loadData(file);
 
+  if(source.record().isValid()) {
+    //The segment is mapped already, so just point into it
+    m_mappedRecord = source.record();
+    m_mappedData = reinterpret_cast<uchar*>(const_cast<char*>(m_mappedRecord.data)) + file->pos();
+    m_mappedDataSize = m_mappedRecord.size - file->pos();
+    m_dataLoaded = true;
+    return;
+  }
+
 #ifdef USE_MMAP
 
-  m_mappedData = file->map(file->pos(), file->size() - file->pos());
+  QFile* mappedFile = static_cast<QFile*>(file);
+  m_mappedData = mappedFile->map(file->pos(), file->size() - file->pos());
   if(m_mappedData) {
-    m_mappedFile = file;
+    m_mappedFile = source.takeFile();
     m_mappedDataSize = file->size() - file->pos();
     file->close(); //Close the file, so there is less open file descriptors(May be problematic)
   }else{
-    qCDebug(LANGUAGE) << "Failed to map" << file->fileName();
+    qCDebug(LANGUAGE) << "Failed to map" << source.name();
   }
 
 #endif
@@ -570,17 +680,17 @@ void TopDUContextDynamicData::loadData() const {
   if(!m_mappedFile) {
     QByteArray data = file->readAll();
     m_data.append({data, (uint)data.size()});
-    delete file;
   }
 
   m_dataLoaded = true;
 }
 
 TopDUContext* TopDUContextDynamicData::load(uint topContextIndex) {
-  QFile file(pathForTopContext(topContextIndex));
-  if(file.open(QIODevice::ReadOnly)) {
+  StoredTopContext source(topContextIndex);
+  if(source.open()) {
+    QIODevice& file(*source.device());
     if(file.size() == 0) {
-      qCWarning(LANGUAGE) << "Top-context file is empty" << file.fileName();
+      qCWarning(LANGUAGE) << "Top-context file is empty" << source.name();
       return nullptr;
     }
     QVector<ItemDataInfo> contextDataOffsets;
@@ -594,7 +704,7 @@ TopDUContext* TopDUContextDynamicData::load(uint topContextIndex) {
     DUChainBaseData* topData = reinterpret_cast<DUChainBaseData*>(topContextData.data());
     TopDUContext* ret = dynamic_cast<TopDUContext*>(DUChainItemSystem::self().create(topData));
     if(!ret) {
-      qCWarning(LANGUAGE) << "Cannot load a top-context from file" << file.fileName() << "- the required language-support for handling ID" << topData->classId << "is probably not loaded";
+      qCWarning(LANGUAGE) << "Cannot load a top-context from file" << source.name() << "- the required language-support for handling ID" << topData->classId << "is probably not loaded";
       return nullptr;
     }
 
@@ -631,9 +741,14 @@ void TopDUContextDynamicData::deleteOnDisk() {
 
   m_onDisk = false;
 
-  bool successfullyRemoved = QFile::remove(filePath());
-  Q_UNUSED(successfullyRemoved);
-  Q_ASSERT(successfullyRemoved);
+  TopDUContextSegmentStore& segments = TopDUContextSegmentStore::self();
+  if(segments.contains(m_topContext->ownIndex())) {
+    segments.remove(m_topContext->ownIndex());
+  } else {
+    bool successfullyRemoved = QFile::remove(filePath());
+    Q_UNUSED(successfullyRemoved);
+    Q_ASSERT(successfullyRemoved);
+  }
   qCDebug(LANGUAGE) << "deletion ready";
 }
 
@@ -712,6 +827,21 @@ void TopDUContextDynamicData::store() {
 
     unmap();
 
+    if(TopDUContextSegmentStore::enabled()) {
+      QByteArray data;
+      QBuffer buffer(&data);
+      buffer.open(QIODevice::WriteOnly);
+      writeData(&buffer, topContextDataSize);
+      buffer.close();
+
+      TopDUContextSegmentStore::self().write(m_topContext->ownIndex(), data);
+      m_onDisk = true;
+
+      //Remove the file that was written while the packed store was disabled
+      QFile::remove(filePath());
+      return;
+    }
+
     QDir().mkpath(basePath());
 
     QFile file(filePath());
@@ -719,18 +849,11 @@ void TopDUContextDynamicData::store() {
 
       file.resize(0);
 
-      file.write((char*)&topContextDataSize, sizeof(uint));
-      foreach(const ArrayWithPosition& pos, m_topContextData)
-        file.write(pos.array.constData(), pos.position);
-
-      m_contexts.writeData(&file);
-      m_declarations.writeData(&file);
-      m_problems.writeData(&file);
-
-      foreach(const ArrayWithPosition& pos, m_data)
-        file.write(pos.array.constData(), pos.position);
+      writeData(&file, topContextDataSize);
 
       m_onDisk = true;
+      //Drop the record that was written while the packed store was enabled
+      TopDUContextSegmentStore::self().remove(m_topContext->ownIndex());
 
       if (file.size() == 0) {
         qCWarning(LANGUAGE) << "Saving zero size top ducontext data";
@@ -742,6 +865,20 @@ void TopDUContextDynamicData::store() {
 //   qCDebug(LANGUAGE) << "stored" << m_topContext->url().str() << m_topContext->ownIndex() << "import-count:" << m_topContext->importedParentContexts().size();
 }
 
+void TopDUContextDynamicData::writeData(QIODevice* device, uint topContextDataSize)
+{
+  device->write((char*)&topContextDataSize, sizeof(uint));
+  foreach(const ArrayWithPosition& pos, m_topContextData)
+    device->write(pos.array.constData(), pos.position);
+
+  m_contexts.writeData(device);
+  m_declarations.writeData(device);
+  m_problems.writeData(device);
+
+  foreach(const ArrayWithPosition& pos, m_data)
+    device->write(pos.array.constData(), pos.position);
+}
+
 TopDUContextDynamicData::ItemDataInfo TopDUContextDynamicData::writeDataInfo(const ItemDataInfo& info, const DUChainBaseData* data, uint& totalDataOffset) {
   ItemDataInfo ret(info);
   Q_ASSERT(info.dataOffset);
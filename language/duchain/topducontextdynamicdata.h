@@ -20,13 +20,17 @@
 #define KDEVPLATFORM_TOPDUCONTEXTDYNAMICDATA_H
 
 #include <QtCore/QVector>
+#include <QtCore/QHash>
 #include <QtCore/QMutex>
+#include <QtCore/QAtomicPointer>
 #include <QtCore/QByteArray>
 #include <QtCore/QPair>
 #include <interfaces/iastcontainer.h>
 #include "problem.h"
+#include "topducontextsegmentstore.h"
 
 class QFile;
+class QIODevice;
 
 namespace KDevelop {
 
@@ -83,7 +87,12 @@ class TopDUContextDynamicData {
   void clearProblems();
 
   ///Stores this top-context to disk
+  ///Only touches the data of this top-context, so different top-contexts may be stored from different threads
+  ///at the same time, as long as the duchain is write-locked during the whole time.
   void store();
+
+  ///Whether store() would have to write anything
+  bool hasChanged() const;
   
   ///Stores all remainings of this top-context that are on disk. The top-context will be fully dynamic after this.
   void deleteOnDisk();
@@ -105,6 +114,17 @@ class TopDUContextDynamicData {
   
   static QList<IndexedDUContext> loadImports(uint topContextIndex);
 
+  ///Whether the child contexts and local declarations of a loaded context are only created when they are accessed.
+  ///Enabled by default, the environment variable KDEV_DUCHAIN_EAGER_ITEM_LOADING disables it.
+  static bool lazyItemLoading();
+  static void setLazyItemLoading(bool enabled);
+
+  ///Recursive mutex that is locked while items are created from the stored data
+  QMutex* itemMutex() const
+  {
+    return &m_itemMutex;
+  }
+
   bool isTemporaryContextIndex(uint index) const;
   bool isTemporaryDeclarationIndex(uint index) const ;
   
@@ -122,8 +142,6 @@ class TopDUContextDynamicData {
   };
 
   private:
-    bool hasChanged() const;
-
     void unmap();
     //Converts away from an mmap opened file to a data array
     
@@ -133,10 +151,38 @@ class TopDUContextDynamicData {
 
     const char* pointerInData(uint offset) const;
 
+    ///Writes the whole top-context in the format read by load() and loadData()
+    void writeData(QIODevice* device, uint topContextDataSize);
+
     ItemDataInfo writeDataInfo(const ItemDataInfo& info, const DUChainBaseData* data, uint& totalDataOffset);
 
     TopDUContext* m_topContext;
 
+    ///Loaded items are read from their slots without a lock, so the slots are atomic pointers to the items
+    template<class Item>
+    struct ItemSlot;
+
+    template<class T>
+    struct ItemSlot<T*>
+    {
+      using Target = T;
+      static T* pointer(T* item) { return item; }
+      static T* item(T* pointer) { return pointer; }
+      static void acquire(T*) {}
+      static void release(T*) {}
+    };
+
+    ///Shared items, like problems, hold a reference while they are in a slot
+    template<class T>
+    struct ItemSlot<QExplicitlySharedDataPointer<T>>
+    {
+      using Target = T;
+      static T* pointer(const QExplicitlySharedDataPointer<T>& item) { return item.data(); }
+      static QExplicitlySharedDataPointer<T> item(T* pointer) { return QExplicitlySharedDataPointer<T>(pointer); }
+      static void acquire(T* pointer) { if (pointer) pointer->ref.ref(); }
+      static void release(T* pointer) { if (pointer && !pointer->ref.deref()) delete pointer; }
+    };
+
     template<class Item>
     struct DUChainItemStorage
     {
@@ -156,12 +202,16 @@ class TopDUContextDynamicData {
       void deleteOnDisk();
       bool isItemForIndexLoaded(uint index) const;
 
-      void loadData(QFile* file) const;
-      void writeData(QFile* file);
+      void loadData(QIODevice* file) const;
+      void writeData(QIODevice* file);
+
+      using Slot = ItemSlot<Item>;
 
-      //May contain zero items if they were deleted
-      mutable QVector<Item> items;
+      //May contain zero items if they were deleted, or not created yet. Only changed under the item mutex or a write-lock.
+      mutable QVector<QAtomicPointer<typename Slot::Target>> items;
       mutable QVector<ItemDataInfo> offsets;
+      //Items that are being created by the thread holding the item mutex, they are only published in items once complete
+      mutable QHash<uint, Item> pendingItems;
       QVector<Item> temporaryItems;
       TopDUContextDynamicData* const data;
     };
@@ -178,9 +228,12 @@ class TopDUContextDynamicData {
     mutable bool m_dataLoaded;
 
     mutable QFile* m_mappedFile;
+    ///Keeps the mapping alive while m_mappedData points into the packed segment store
+    mutable TopDUContextSegmentStore::Record m_mappedRecord;
     mutable uchar* m_mappedData;
     mutable size_t m_mappedDataSize;
     mutable bool m_itemRetrievalForbidden;
+    mutable QMutex m_itemMutex;
 };
 }
 
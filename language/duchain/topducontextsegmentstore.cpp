@@ -0,0 +1,552 @@
+/* This file is part of KDevelop
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "topducontextsegmentstore.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QVector>
+
+#include <climits>
+
+#include "util/debug.h"
+
+using namespace KDevelop;
+
+namespace {
+
+const uint recordMagic = 0x53435444;
+const uint indexVersion = 1;
+
+/// A new segment is started once the newest one has reached this size
+const qint64 segmentSizeLimit = 64 * 1024 * 1024;
+/// flushChanges() leaves segments alone that contain less garbage than this
+const qint64 backgroundCompactionGarbage = 4 * 1024 * 1024;
+
+struct RecordHeader
+{
+  uint magic;
+  uint topContextIndex;
+  uint size;
+};
+
+struct IndexEntry
+{
+  uint topContextIndex;
+  uint segment;
+  uint offset;
+  uint size;
+};
+
+/// Records start on 8-byte boundaries. Behind the 12 byte header and the leading size-field
+/// of the top-context data, the data itself then is 8-byte aligned again.
+qint64 alignedRecordSize(uint size)
+{
+  return (qint64(sizeof(RecordHeader)) + size + 7) & ~qint64(7);
+}
+
+bool packedStoreEnabled = qEnvironmentVariableIsSet("KDEV_DUCHAIN_PACKED_STORE");
+
+}
+
+struct TopDUContextSegmentStore::SegmentMapping
+{
+  SegmentMapping() : data(nullptr), size(0) {}
+
+  QFile file;
+  const char* data;
+  qint64 size;
+  ///Holds a copy of the segment if it could not be mapped
+  QByteArray buffer;
+};
+
+struct TopDUContextSegmentStore::Segment
+{
+  Segment() : number(0), size(0), liveBytes(0) {}
+
+  uint number;
+  ///Only open while the segment is written to
+  QFile file;
+  qint64 size;
+  qint64 liveBytes;
+  ///The newest mapping, users of older mappings keep them alive themselves
+  QSharedPointer<const SegmentMapping> mapping;
+};
+
+TopDUContextSegmentStore::TopDUContextSegmentStore(ItemRepositoryRegistry* registry)
+  : m_registry(registry)
+  , m_indexChanged(false)
+{
+  if(m_registry)
+    m_registry->registerRepository(this, nullptr);
+}
+
+TopDUContextSegmentStore::~TopDUContextSegmentStore()
+{
+  if(m_registry)
+    m_registry->unRegisterRepository(this);
+  else
+    close();
+}
+
+TopDUContextSegmentStore& TopDUContextSegmentStore::self()
+{
+  static TopDUContextSegmentStore store;
+  return store;
+}
+
+bool TopDUContextSegmentStore::enabled()
+{
+  return packedStoreEnabled;
+}
+
+void TopDUContextSegmentStore::setEnabled(bool enabled)
+{
+  packedStoreEnabled = enabled;
+}
+
+bool TopDUContextSegmentStore::contains(uint topContextIndex) const
+{
+  QMutexLocker lock(&m_mutex);
+  return m_index.value(topContextIndex).size;
+}
+
+TopDUContextSegmentStore::Record TopDUContextSegmentStore::read(uint topContextIndex) const
+{
+  QMutexLocker lock(&m_mutex);
+  ItemRepositoryCounters::add(m_counters.lookups);
+
+  Record ret;
+  auto it = m_index.constFind(topContextIndex);
+  if(it == m_index.constEnd() || !it->size)
+    return ret;
+
+  const qint64 dataOffset = it->offset + sizeof(RecordHeader);
+  ret.mapping = mappingFor(m_segments.value(it->segment), dataOffset + it->size);
+  if(ret.mapping) {
+    ret.data = ret.mapping->data + dataOffset;
+    ret.size = it->size;
+  }
+  return ret;
+}
+
+void TopDUContextSegmentStore::write(uint topContextIndex, const QByteArray& data)
+{
+  Q_ASSERT(!data.isEmpty());
+  QMutexLocker lock(&m_mutex);
+  appendRecord(topContextIndex, data.constData(), data.size());
+}
+
+void TopDUContextSegmentStore::remove(uint topContextIndex)
+{
+  QMutexLocker lock(&m_mutex);
+  if(!m_index.value(topContextIndex).size)
+    return;
+  //An empty record shadows the older ones, so they are not found again when the index is rebuilt
+  appendRecord(topContextIndex, nullptr, 0);
+}
+
+qint64 TopDUContextSegmentStore::compact()
+{
+  QMutexLocker lock(&m_mutex);
+  qint64 freed = 0;
+  compactSegments(INT_MAX, 0, &freed);
+  return freed;
+}
+
+TopDUContextSegmentStore::Statistics TopDUContextSegmentStore::statistics() const
+{
+  QMutexLocker lock(&m_mutex);
+  Statistics ret = {uint(m_segments.size()), 0, 0, 0};
+  foreach(const Location& location, m_index) {
+    if(location.size)
+      ++ret.records;
+  }
+  foreach(const Segment* segment, m_segments) {
+    ret.totalBytes += segment->size;
+    ret.liveBytes += segment->liveBytes;
+  }
+  return ret;
+}
+
+QString TopDUContextSegmentStore::segmentPath(uint number) const
+{
+  return m_path + QStringLiteral("segment_%1").arg(number);
+}
+
+TopDUContextSegmentStore::Segment* TopDUContextSegmentStore::writableSegment(bool forceNewSegment)
+{
+  Segment* segment = m_segments.isEmpty() ? nullptr : m_segments.last();
+
+  if(segment && (forceNewSegment || segment->size >= segmentSizeLimit)) {
+    segment->file.close();
+    segment = nullptr;
+  }
+
+  if(!segment) {
+    QDir().mkpath(m_path);
+    segment = new Segment;
+    segment->number = m_segments.isEmpty() ? 1 : m_segments.lastKey() + 1;
+    m_segments.insert(segment->number, segment);
+  }
+
+  if(!segment->file.isOpen()) {
+    segment->file.setFileName(segmentPath(segment->number));
+    if(!segment->file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+      qCWarning(LANGUAGE) << "Cannot open top-context segment for writing" << segment->file.fileName();
+      return nullptr;
+    }
+    //A torn record at the end would shadow everything appended behind it
+    if(segment->file.size() != segment->size)
+      segment->file.resize(segment->size);
+  }
+
+  return segment;
+}
+
+bool TopDUContextSegmentStore::appendRecord(uint topContextIndex, const char* data, uint size, bool forceNewSegment)
+{
+  Segment* segment = writableSegment(forceNewSegment);
+  if(!segment)
+    return false;
+
+  const RecordHeader header = {recordMagic, topContextIndex, size};
+  const qint64 recordSize = alignedRecordSize(size);
+  const QByteArray padding(recordSize - sizeof(RecordHeader) - size, 0);
+
+  bool written = segment->file.write(reinterpret_cast<const char*>(&header), sizeof(RecordHeader)) == sizeof(RecordHeader);
+  written = written && (!size || segment->file.write(data, size) == size);
+  written = written && segment->file.write(padding) == padding.size();
+  //Flush right away, so the record is visible to the readers that map the segment
+  written = written && segment->file.flush();
+  if(!written) {
+    qCWarning(LANGUAGE) << "Failed to write top-context" << topContextIndex << "into segment" << segment->file.fileName();
+    segment->file.close();
+    return false;
+  }
+
+  ItemRepositoryCounters::add(m_counters.bytesStored, recordSize);
+
+  auto it = m_index.find(topContextIndex);
+  if(it != m_index.end()) {
+    //The previous record is garbage from now on
+    if(Segment* previous = m_segments.value(it->segment))
+      previous->liveBytes -= alignedRecordSize(it->size);
+  }
+
+  m_index.insert(topContextIndex, Location{segment->number, uint(segment->size), size});
+  segment->size += recordSize;
+  segment->liveBytes += recordSize;
+  m_indexChanged = true;
+  return true;
+}
+
+QSharedPointer<const TopDUContextSegmentStore::SegmentMapping> TopDUContextSegmentStore::mappingFor(Segment* segment, qint64 minimumSize) const
+{
+  if(!segment)
+    return {};
+
+  if(segment->mapping && segment->mapping->size >= minimumSize)
+    return segment->mapping;
+
+  //The segment has grown since it was mapped. The old mapping stays alive until its last user releases it.
+  QSharedPointer<SegmentMapping> mapping(new SegmentMapping);
+  mapping->file.setFileName(segmentPath(segment->number));
+  if(!mapping->file.open(QIODevice::ReadOnly)) {
+    qCWarning(LANGUAGE) << "Cannot open top-context segment" << mapping->file.fileName();
+    return {};
+  }
+
+  ItemRepositoryCounters::add(m_counters.bucketLoads);
+
+  mapping->size = mapping->file.size();
+  mapping->data = reinterpret_cast<const char*>(mapping->file.map(0, mapping->size));
+  if(!mapping->data) {
+    qCDebug(LANGUAGE) << "Failed to map" << mapping->file.fileName();
+    mapping->buffer = mapping->file.readAll();
+    mapping->data = mapping->buffer.constData();
+    mapping->size = mapping->buffer.size();
+  }
+  //The mapping stays valid after the file is closed, so less file descriptors are used
+  mapping->file.close();
+
+  if(mapping->size < minimumSize) {
+    qCWarning(LANGUAGE) << "Top-context segment is truncated" << mapping->file.fileName();
+    return {};
+  }
+
+  segment->mapping = mapping;
+  return segment->mapping;
+}
+
+int TopDUContextSegmentStore::compactSegments(int maxRecords, qint64 minimumGarbage, qint64* freedBytes)
+{
+  int pending = 0;
+
+  foreach(Segment* segment, m_segments.values()) {
+    const qint64 garbage = segment->size - segment->liveBytes;
+    if(!segment->size || garbage < segment->liveBytes || garbage < minimumGarbage)
+      continue;
+
+    QVector<IndexEntry> moved;
+    for(auto it = m_index.constBegin(); it != m_index.constEnd(); ++it) {
+      if(it->segment == segment->number)
+        moved.append({it.key(), it->segment, it->offset, it->size});
+    }
+
+    if(moved.size() > maxRecords) {
+      pending += moved.size() - maxRecords;
+      moved.resize(maxRecords);
+    }
+
+    const bool isOldest = segment == m_segments.first();
+    const auto mapping = mappingFor(segment, segment->size);
+    if(!mapping && !moved.isEmpty())
+      continue;
+
+    foreach(const IndexEntry& entry, moved) {
+      if(!entry.size && isOldest) {
+        //There is no older record left that would have to be shadowed
+        m_index.remove(entry.topContextIndex);
+        segment->liveBytes -= alignedRecordSize(0);
+        m_indexChanged = true;
+        continue;
+      }
+      const char* data = entry.size ? mapping->data + entry.offset + sizeof(RecordHeader) : nullptr;
+      //Never append to the segment that is being emptied
+      if(!appendRecord(entry.topContextIndex, data, entry.size, segment == m_segments.last()))
+        return pending;
+    }
+
+    maxRecords -= moved.size();
+
+    if(!segment->liveBytes) {
+      segment->file.close();
+      segment->mapping.clear();
+      if(QFile::remove(segmentPath(segment->number))) {
+        if(freedBytes)
+          *freedBytes += segment->size;
+        m_segments.remove(segment->number);
+        delete segment;
+        m_indexChanged = true;
+      } else {
+        //Keep the segment known, else its records could be found again when the index is rebuilt
+        qCWarning(LANGUAGE) << "Cannot remove compacted top-context segment" << segmentPath(segment->number);
+      }
+    }
+
+    if(maxRecords <= 0)
+      break;
+  }
+
+  return pending;
+}
+
+void TopDUContextSegmentStore::updateLiveBytes()
+{
+  foreach(Segment* segment, m_segments)
+    segment->liveBytes = 0;
+
+  for(auto it = m_index.begin(); it != m_index.end(); ) {
+    if(Segment* segment = m_segments.value(it->segment)) {
+      segment->liveBytes += alignedRecordSize(it->size);
+      ++it;
+    } else {
+      it = m_index.erase(it);
+    }
+  }
+}
+
+bool TopDUContextSegmentStore::readIndex()
+{
+  QFile file(m_path + QStringLiteral("index"));
+  if(!file.open(QIODevice::ReadOnly))
+    return false;
+
+  uint version = 0, segmentCount = 0;
+  file.read(reinterpret_cast<char*>(&version), sizeof(uint));
+  file.read(reinterpret_cast<char*>(&segmentCount), sizeof(uint));
+  if(version != indexVersion || segmentCount != uint(m_segments.size()))
+    return false;
+
+  //The index is only usable if the segments have not changed since it was written
+  for(uint a = 0; a < segmentCount; ++a) {
+    uint number = 0;
+    qint64 size = 0;
+    file.read(reinterpret_cast<char*>(&number), sizeof(uint));
+    file.read(reinterpret_cast<char*>(&size), sizeof(qint64));
+    Segment* segment = m_segments.value(number);
+    if(!segment || segment->size != size)
+      return false;
+  }
+
+  uint entryCount = 0;
+  file.read(reinterpret_cast<char*>(&entryCount), sizeof(uint));
+  QVector<IndexEntry> entries(entryCount);
+  const qint64 entryBytes = qint64(sizeof(IndexEntry)) * entryCount;
+  if(file.read(reinterpret_cast<char*>(entries.data()), entryBytes) != entryBytes)
+    return false;
+
+  m_index.clear();
+  m_index.reserve(entryCount);
+  foreach(const IndexEntry& entry, entries)
+    m_index.insert(entry.topContextIndex, Location{entry.segment, entry.offset, entry.size});
+
+  return true;
+}
+
+void TopDUContextSegmentStore::rebuildIndex()
+{
+  m_index.clear();
+
+  foreach(Segment* segment, m_segments) {
+    QFile file(segmentPath(segment->number));
+    if(!file.open(QIODevice::ReadOnly))
+      continue;
+
+    const qint64 fileSize = file.size();
+    qint64 position = 0;
+    RecordHeader header;
+    while(position + qint64(sizeof(RecordHeader)) <= fileSize) {
+      file.seek(position);
+      if(file.read(reinterpret_cast<char*>(&header), sizeof(RecordHeader)) != sizeof(RecordHeader)
+         || header.magic != recordMagic || position + alignedRecordSize(header.size) > fileSize)
+        break;
+      //Segments are visited from the oldest to the newest, so the last record of a top-context wins
+      m_index.insert(header.topContextIndex, Location{segment->number, uint(position), header.size});
+      position += alignedRecordSize(header.size);
+    }
+
+    if(position != fileSize)
+      qCDebug(LANGUAGE) << "Ignoring the torn end of top-context segment" << file.fileName() << "at" << position;
+    //Appending continues behind the last complete record
+    segment->size = position;
+  }
+
+  qCDebug(LANGUAGE) << "Rebuilt the index of" << m_segments.size() << "top-context segments";
+  m_indexChanged = true;
+}
+
+bool TopDUContextSegmentStore::open(const QString& path)
+{
+  QMutexLocker lock(&m_mutex);
+
+  closeSegments();
+  m_path = path + QStringLiteral("/topcontext_segments/");
+
+  const QStringList names = QDir(m_path).entryList({QStringLiteral("segment_*")}, QDir::Files);
+  foreach(const QString& name, names) {
+    bool ok = false;
+    const uint number = name.mid(8).toUInt(&ok);
+    if(!ok || !number)
+      continue;
+    auto segment = new Segment;
+    segment->number = number;
+    segment->size = QFileInfo(m_path + name).size();
+    m_segments.insert(number, segment);
+  }
+
+  if(!m_segments.isEmpty() && !readIndex())
+    rebuildIndex();
+  updateLiveBytes();
+
+  return true;
+}
+
+void TopDUContextSegmentStore::closeSegments()
+{
+  //Users of a mapping keep it alive on their own
+  qDeleteAll(m_segments);
+  m_segments.clear();
+  m_index.clear();
+  m_indexChanged = false;
+}
+
+void TopDUContextSegmentStore::close(bool doStore)
+{
+  if(doStore)
+    store();
+
+  QMutexLocker lock(&m_mutex);
+  closeSegments();
+  m_path.clear();
+}
+
+void TopDUContextSegmentStore::store()
+{
+  QMutexLocker lock(&m_mutex);
+  if(!m_indexChanged || m_path.isEmpty())
+    return;
+
+  QDir().mkpath(m_path);
+
+  //Write a new file and replace the old one, so there never is a half-written index
+  const QString indexPath = m_path + QStringLiteral("index");
+  QFile file(indexPath + QStringLiteral(".new"));
+  if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    qCWarning(LANGUAGE) << "Cannot open the top-context segment index for writing";
+    return;
+  }
+
+  const uint segmentCount = m_segments.size();
+  file.write(reinterpret_cast<const char*>(&indexVersion), sizeof(uint));
+  file.write(reinterpret_cast<const char*>(&segmentCount), sizeof(uint));
+  foreach(const Segment* segment, m_segments) {
+    file.write(reinterpret_cast<const char*>(&segment->number), sizeof(uint));
+    file.write(reinterpret_cast<const char*>(&segment->size), sizeof(qint64));
+  }
+
+  QVector<IndexEntry> entries;
+  entries.reserve(m_index.size());
+  for(auto it = m_index.constBegin(); it != m_index.constEnd(); ++it)
+    entries.append({it.key(), it->segment, it->offset, it->size});
+
+  const uint entryCount = entries.size();
+  file.write(reinterpret_cast<const char*>(&entryCount), sizeof(uint));
+  file.write(reinterpret_cast<const char*>(entries.constData()), qint64(sizeof(IndexEntry)) * entryCount);
+  file.close();
+
+  QFile::remove(indexPath);
+  if(file.rename(indexPath))
+    m_indexChanged = false;
+  else
+    qCWarning(LANGUAGE) << "Cannot replace the top-context segment index";
+}
+
+int TopDUContextSegmentStore::flushChanges(int maxBuckets)
+{
+  QMutexLocker lock(&m_mutex);
+  return compactSegments(maxBuckets, backgroundCompactionGarbage, nullptr);
+}
+
+int TopDUContextSegmentStore::finalCleanup()
+{
+  return compact();
+}
+
+QString TopDUContextSegmentStore::repositoryName() const
+{
+  return QStringLiteral("Top-Context Segments");
+}
+
+QString TopDUContextSegmentStore::printStatistics() const
+{
+  const Statistics stats = statistics();
+  return QStringLiteral("segments: %1 records: %2 total bytes: %3 live bytes: %4")
+         .arg(stats.segments).arg(stats.records).arg(stats.totalBytes).arg(stats.liveBytes);
+}
@@ -0,0 +1,146 @@
+/* This file is part of KDevelop
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KDEVPLATFORM_TOPDUCONTEXTSEGMENTSTORE_H
+#define KDEVPLATFORM_TOPDUCONTEXTSEGMENTSTORE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QSharedPointer>
+
+#include <language/languageexport.h>
+#include <serialization/abstractitemrepository.h>
+#include <serialization/itemrepositoryregistry.h>
+
+namespace KDevelop {
+
+/**
+ * Stores the data of top-contexts packed into a few large append-only segment files, instead of
+ * writing one file per top-context.
+ *
+ * Storing a top-context appends a record to the newest segment, and points the in-memory index
+ * from top-context index to record location at it. The index is written to disk in store(). When it
+ * does not match the segments anymore, for example after a crash, it is rebuilt by scanning them.
+ *
+ * Replaced and removed records stay in their segment until it is compacted. That happens step by step
+ * in flushChanges(), which is called by the background flusher of the registry, and completely in
+ * finalCleanup() and compact().
+ *
+ * Reading a record maps its whole segment once, the returned Record keeps that mapping alive.
+ *
+ * The segments are only written to while enabled(), but stored records are always found, so a
+ * session can be switched between the packed and the per-file storage.
+ */
+class KDEVPLATFORMLANGUAGE_EXPORT TopDUContextSegmentStore : public AbstractItemRepository
+{
+  public:
+    struct SegmentMapping;
+
+    /// The stored data of one top-context. Stays valid as long as a copy of the record exists.
+    struct Record
+    {
+      Record() : data(nullptr), size(0) {}
+
+      bool isValid() const
+      {
+        return data;
+      }
+
+      const char* data;
+      uint size;
+      QSharedPointer<const SegmentMapping> mapping;
+    };
+
+    struct Statistics
+    {
+      uint segments;
+      uint records;
+      qint64 totalBytes;
+      qint64 liveBytes;
+    };
+
+    ///@param registry May be zero, then the store is not registered, and open()/store() have to be called manually.
+    explicit TopDUContextSegmentStore(ItemRepositoryRegistry* registry = &globalItemRepositoryRegistry());
+    ~TopDUContextSegmentStore() override;
+
+    /// The store used for the top-contexts of the duchain
+    static TopDUContextSegmentStore& self();
+
+    /// Whether stored top-contexts are written into the segments instead of one file each.
+    /// Disabled by default, enabled by setting the environment variable KDEV_DUCHAIN_PACKED_STORE.
+    static bool enabled();
+    static void setEnabled(bool enabled);
+
+    bool contains(uint topContextIndex) const;
+
+    /// Returns an invalid record if nothing is stored for the given top-context
+    Record read(uint topContextIndex) const;
+
+    /// Replaces the stored data of the given top-context
+    void write(uint topContextIndex, const QByteArray& data);
+
+    void remove(uint topContextIndex);
+
+    /// Rewrites all segments of which at least half is occupied by replaced or removed records.
+    /// @returns Count of bytes that have been freed
+    qint64 compact();
+
+    Statistics statistics() const;
+
+    bool open(const QString& path) override;
+    void close(bool doStore = false) override;
+    void store() override;
+    /// Compacts up to @p maxBuckets records, but only from segments that contain at least a few megabytes of garbage
+    int flushChanges(int maxBuckets) override;
+    int finalCleanup() override;
+    QString repositoryName() const override;
+    QString printStatistics() const override;
+
+  private:
+    struct Segment;
+
+    struct Location
+    {
+      uint segment;
+      uint offset;
+      uint size; ///< Zero for the record that marks the removal of a top-context
+    };
+
+    Segment* writableSegment(bool forceNewSegment);
+    bool appendRecord(uint topContextIndex, const char* data, uint size, bool forceNewSegment = false);
+    QSharedPointer<const SegmentMapping> mappingFor(Segment* segment, qint64 minimumSize) const;
+    /// @returns Count of records that are still waiting to be moved
+    int compactSegments(int maxRecords, qint64 minimumGarbage, qint64* freedBytes);
+    bool readIndex();
+    void rebuildIndex();
+    void updateLiveBytes();
+    void closeSegments();
+    QString segmentPath(uint number) const;
+
+    ItemRepositoryRegistry* m_registry;
+    mutable QMutex m_mutex;
+    QString m_path;
+    QMap<uint, Segment*> m_segments;
+    QHash<uint, Location> m_index;
+    bool m_indexChanged;
+};
+
+}
+
+#endif
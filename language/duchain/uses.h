@@ -29,6 +29,7 @@ namespace KDevelop {
 
 /**
  * Global mapping of Declaration-Ids to top-contexts, protected through DUChainLock.
+ * The mapping is stored in DeclarationIdIndex.
  *
  * To retrieve the actual uses, query the duchain for the files.
  * */
@@ -53,9 +54,6 @@ namespace KDevelop {
 
     ///Gets the top-contexts of all users assigned to the declaration-id
     KDevVarLengthArray<IndexedTopDUContext> uses(const DeclarationId& id) const;
-
-    private:
-      class UsesPrivate* d;
   };
 }
 
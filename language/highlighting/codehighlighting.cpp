@@ -39,6 +39,7 @@
 #include "../duchain/types/structuretype.h"
 #include "../duchain/functiondefinition.h"
 #include "../duchain/use.h"
+#include "../duchain/duchainlock.h"
 
 #include "colorcache.h"
 #include "configurablecolors.h"
@@ -188,6 +189,10 @@ void CodeHighlighting::highlightDUChain(ReferencedTopDUContext context)
 
   CodeHighlightingInstance* instance = createInstance();
 
+  //Only the document and what is visible from it is looked at, so with top-context locking,
+  //files that are not imported by it can be parsed meanwhile
+  DUChainReadScope scope(context.data());
+
   lock.unlock();
 
   instance->highlightDUChain(context.data());
@@ -18,6 +18,8 @@
 
 #include "abstractitemrepository.h"
 
+#include <QtCore/QAtomicPointer>
+
 #include "config-kdevplatform.h"
 
 namespace KDevelop {
@@ -27,10 +29,140 @@ uint staticItemRepositoryVersion()
   return KDEV_ITEMREPOSITORY_VERSION;
 }
 
+bool itemRepositoryUsesWritableMapping()
+{
+#ifdef Q_OS_UNIX
+  return qEnvironmentVariableIsSet("KDEV_ITEMREPOSITORY_WRITABLE_MMAP");
+#else
+  return false;
+#endif
+}
+
+ItemRepositoryCounters::Values::Values()
+  : indexHits(0)
+  , indexInserts(0)
+  , lookups(0)
+  , bucketLoads(0)
+  , bucketCopies(0)
+  , lockWaitTime(0)
+  , bytesStored(0)
+{
+}
+
+ItemRepositoryCounters::ItemRepositoryCounters()
+  : indexHits(0)
+  , indexInserts(0)
+  , lookups(0)
+  , bucketLoads(0)
+  , bucketCopies(0)
+  , lockWaitTime(0)
+  , bytesStored(0)
+{
+}
+
+ItemRepositoryCounters::Values ItemRepositoryCounters::snapshot() const
+{
+  Values ret;
+  ret.indexHits = indexHits.load();
+  ret.indexInserts = indexInserts.load();
+  ret.lookups = lookups.load();
+  ret.bucketLoads = bucketLoads.load();
+  ret.bucketCopies = bucketCopies.load();
+  ret.lockWaitTime = lockWaitTime.load();
+  ret.bytesStored = bytesStored.load();
+  return ret;
+}
+
+//One slot for every thread that has read from item-repositories. Slots are re-used when their thread exits, and never freed.
+struct ItemRepositoryReaderSlot
+{
+  QAtomicInteger<quint64> epoch; //The epoch the thread entered its outermost guard in, or zero
+  QAtomicInt used;
+  int depth; //Only accessed by the thread owning the slot
+  ItemRepositoryReaderSlot* next;
+};
+
+namespace {
+
+QAtomicInteger<quint64> globalEpoch(1);
+QAtomicPointer<ItemRepositoryReaderSlot> readerSlots;
+
+ItemRepositoryReaderSlot* acquireReaderSlot()
+{
+  for(ItemRepositoryReaderSlot* slot = readerSlots.loadAcquire(); slot; slot = slot->next) {
+    if(slot->used.testAndSetAcquire(0, 1))
+      return slot;
+  }
+
+  auto* slot = new ItemRepositoryReaderSlot;
+  slot->epoch.store(0);
+  slot->used.store(1);
+  slot->depth = 0;
+  do {
+    slot->next = readerSlots.loadAcquire();
+  } while(!readerSlots.testAndSetRelease(slot->next, slot));
+  return slot;
+}
+
+struct ThreadReaderSlot
+{
+  ~ThreadReaderSlot()
+  {
+    if(slot)
+      slot->used.storeRelease(0);
+  }
+
+  ItemRepositoryReaderSlot* slot = nullptr;
+};
+
+thread_local ThreadReaderSlot threadReaderSlot;
+
+}
+
+quint64 ItemRepositoryEpochs::retire()
+{
+  return globalEpoch.fetchAndAddOrdered(1);
+}
+
+quint64 ItemRepositoryEpochs::safeEpoch()
+{
+  quint64 ret = globalEpoch.loadAcquire();
+  for(ItemRepositoryReaderSlot* slot = readerSlots.loadAcquire(); slot; slot = slot->next) {
+    const quint64 epoch = slot->epoch.loadAcquire();
+    if(epoch && epoch < ret)
+      ret = epoch;
+  }
+  return ret;
+}
+
+ItemRepositoryReadGuard::ItemRepositoryReadGuard()
+{
+  ItemRepositoryReaderSlot*& slot(threadReaderSlot.slot);
+  if(!slot)
+    slot = acquireReaderSlot();
+  m_slot = slot;
+
+  //The ordered store makes sure the epoch is visible to writers before any repository data is read.
+  //A stale epoch only delays freeing.
+  if(m_slot->depth++ == 0)
+    m_slot->epoch.fetchAndStoreOrdered(globalEpoch.loadAcquire());
+}
+
+ItemRepositoryReadGuard::~ItemRepositoryReadGuard()
+{
+  if(--m_slot->depth == 0)
+    m_slot->epoch.storeRelease(0);
+}
+
 AbstractItemRepository::~AbstractItemRepository()
 {
 }
 
+int AbstractItemRepository::flushChanges(int /*maxBuckets*/)
+{
+  return 0;
+}
+
 AbstractRepositoryManager::AbstractRepositoryManager() : m_repository(nullptr)
 {
 }
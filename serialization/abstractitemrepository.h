@@ -21,6 +21,7 @@
 
 #include <QtCore/QString>
 #include <QtCore/QMutex>
+#include <QtCore/QAtomicInteger>
 
 #include "serializationexport.h"
 
@@ -29,6 +30,79 @@ namespace KDevelop {
 /// Returns a version-number that is used to reset the item-repository after incompatible layout changes.
 KDEVPLATFORMSERIALIZATION_EXPORT uint staticItemRepositoryVersion();
 
+/// Returns whether item-repositories work directly on a writable shared memory-mapping of their files,
+/// instead of copying every changed bucket to the heap and writing it back in store().
+/// Enabled by setting the environment variable KDEV_ITEMREPOSITORY_WRITABLE_MMAP. Only supported on unix.
+/// @note Evaluated whenever a repository is opened.
+KDEVPLATFORMSERIALIZATION_EXPORT bool itemRepositoryUsesWritableMapping();
+
+/// Usage counters of one item-repository. They are always enabled, so updating them must stay cheap:
+/// Only relaxed atomic increments are used, and nothing is counted on the lock-free read path.
+struct KDEVPLATFORMSERIALIZATION_EXPORT ItemRepositoryCounters
+{
+    /// A copy of the counter values, see snapshot().
+    struct Values
+    {
+        Values();
+
+        quint64 indexHits;           ///< Calls to index() that found an existing item
+        quint64 indexInserts;        ///< Calls to index() that inserted a new item
+        quint64 lookups;             ///< Calls to findIndex()
+        quint64 bucketLoads;         ///< Buckets loaded from disk
+        quint64 bucketCopies;        ///< Memory-mapped buckets copied to the heap in order to be changed
+        quint64 lockWaitTime;        ///< Nanoseconds spent waiting for the repository mutex
+        quint64 bytesStored;         ///< Bytes written to the repository files
+    };
+
+    ItemRepositoryCounters();
+
+    Values snapshot() const;
+
+    static void add(QAtomicInteger<quint64>& counter, quint64 value = 1)
+    {
+        counter.fetchAndAddRelaxed(value);
+    }
+
+    QAtomicInteger<quint64> indexHits;
+    QAtomicInteger<quint64> indexInserts;
+    QAtomicInteger<quint64> lookups;
+    QAtomicInteger<quint64> bucketLoads;
+    QAtomicInteger<quint64> bucketCopies;
+    QAtomicInteger<quint64> lockWaitTime;
+    QAtomicInteger<quint64> bytesStored;
+
+  private:
+    Q_DISABLE_COPY(ItemRepositoryCounters)
+};
+
+/// Epoch-based reclamation of memory that lock-free readers of item-repositories may still use.
+///
+/// Readers keep an ItemRepositoryReadGuard alive while they use data they found without locking the repository.
+/// A writer that unpublishes such data calls retire(), and only frees the data once the returned epoch is lower
+/// than safeEpoch(), which means that every reader that could have found the data has left its guard.
+class KDEVPLATFORMSERIALIZATION_EXPORT ItemRepositoryEpochs
+{
+  public:
+    /// Advances the global epoch. Call this after unpublishing data.
+    /// @returns The epoch the data was retired in.
+    static quint64 retire();
+    /// Data retired in an epoch lower than the returned one is not in use by any reader.
+    static quint64 safeEpoch();
+};
+
+/// Marks the current thread as a lock-free reader of item-repositories while it exists, see ItemRepositoryEpochs.
+/// Guards may be nested. They are cheap, but must not be held for a long time, as they delay freeing memory.
+class KDEVPLATFORMSERIALIZATION_EXPORT ItemRepositoryReadGuard
+{
+  public:
+    ItemRepositoryReadGuard();
+    ~ItemRepositoryReadGuard();
+
+  private:
+    Q_DISABLE_COPY(ItemRepositoryReadGuard)
+    struct ItemRepositoryReaderSlot* m_slot;
+};
+
 /// The interface class for an item-repository object.
 class KDEVPLATFORMSERIALIZATION_EXPORT AbstractItemRepository
 {
@@ -40,11 +114,24 @@ class KDEVPLATFORMSERIALIZATION_EXPORT AbstractItemRepository
     virtual void close(bool doStore = false) = 0;
     /// Stores the repository contents to disk, eventually unloading unused data to save memory.
     virtual void store() = 0;
+    /// Writes up to @p maxBuckets units of changed data to disk ahead of the next store(), only locking the repository briefly.
+    /// The data on disk is only consistent again after the next store().
+    /// @returns The count of units that are still waiting to be written.
+    virtual int flushChanges(int maxBuckets);
     /// Does a big cleanup, removing all non-persistent items in the repositories.
     /// @returns Count of bytes of data that have been removed.
     virtual int finalCleanup() = 0;
     virtual QString repositoryName() const = 0;
     virtual QString printStatistics() const = 0;
+
+    /// The usage counters of this repository, maintained by the implementation.
+    const ItemRepositoryCounters& counters() const
+    {
+        return m_counters;
+    }
+
+  protected:
+    mutable ItemRepositoryCounters m_counters;
 };
 
 /// Internal helper class that wraps around a repository object and manages its lifetime.
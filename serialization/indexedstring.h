@@ -23,6 +23,7 @@
 
 #include <QtCore/QMetaType>
 #include <QUrl>
+#include <QVector>
 
 #include "referencecounting.h"
 
@@ -82,9 +83,12 @@ class KDEVPLATFORMSERIALIZATION_EXPORT IndexedString {
   /**
    * When the information is already available, try using the other constructor.
    *
+   * @param hash must be a hash of @p str as constructed with hashString or RunningHash.
+   *             If it is zero, it will be computed.
+   *
    * @note This is expensive.
    */
-  explicit IndexedString( const QByteArray& str );
+  explicit IndexedString( const QByteArray& str, unsigned int hash = 0 );
 
   IndexedString( IndexedString&& o ) Q_DECL_NOEXCEPT
     : m_index(o.m_index)
@@ -202,18 +206,24 @@ class KDEVPLATFORMSERIALIZATION_EXPORT IndexedString {
    * Use this to construct a hash-value on-the-fly
    *
    * To read it, just use the hash member, and when a new string is started, call @c clear().
+   * The result is the same as the one of hashString, so it can be passed to the constructor.
    *
    * This needs very fast performance(per character operation), so it must stay inlined.
+   *
+   * @note Since KDEV_ITEMREPOSITORY_VERSION 88 this is a CRC32C instead of the former djb2 hash
+   *       (hash * 33 + c, starting at 5381). The hash is stored in the string repositories, so
+   *       repositories written with the old hash are discarded, and code that inlined the old
+   *       RunningHash has to be recompiled, as its hashes would not match hashString anymore.
    */
   struct RunningHash {
-    enum {
-      HashInitialValue = 5381
+    enum : unsigned int {
+      HashInitialValue = 0xffffffff
     };
 
-    RunningHash() : hash(HashInitialValue) { //We initialize the hash with zero, because we want empty strings to create a zero hash(invalid)
+    RunningHash() : hash(HashInitialValue) {
     }
     inline void append(const char c) {
-      hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+      hash = hashTable[(hash ^ static_cast<unsigned char>(c)) & 0xff] ^ (hash >> 8); /* crc32c step */
     }
     inline void clear() {
       hash = HashInitialValue;
@@ -221,6 +231,13 @@ class KDEVPLATFORMSERIALIZATION_EXPORT IndexedString {
     unsigned int hash;
   };
 
+  /**
+   * Computes the hash used for the strings in the repository: a CRC32C of the utf8 data,
+   * without the final inversion.
+   *
+   * Uses the crc32 instruction of SSE 4.2 when the CPU supports it, so prefer this over
+   * feeding a RunningHash when the whole string is available.
+   */
   static unsigned int hashString(const char* str, unsigned short length);
 
   /**
@@ -233,6 +250,9 @@ class KDEVPLATFORMSERIALIZATION_EXPORT IndexedString {
  private:
    explicit IndexedString(bool);
    uint m_index;
+
+   /// CRC32C lookup table used by RunningHash
+   static const unsigned int hashTable[256];
 };
 
 // the following function would need to be exported in case you'd remove the inline keyword.
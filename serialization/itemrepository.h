@@ -19,13 +19,28 @@
 #ifndef KDEVPLATFORM_ITEMREPOSITORY_H
 #define KDEVPLATFORM_ITEMREPOSITORY_H
 
+#include <QAtomicInt>
+#include <QAtomicPointer>
 #include <QDebug>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QHash>
+#include <QSet>
 
 #include <KMessageBox>
 #include <KLocalizedString>
 
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
 #include "referencecounting.h"
 #include "abstractitemrepository.h"
 #include "repositorymanager.h"
@@ -127,23 +142,31 @@ class Bucket {
       CheckStart = 0xff00ff1,
       CheckEnd = 0xfafcfb
     };
+    enum {
+      CompressedBucketMarker = 0xffffffff //Stored instead of the monster-bucket extent when the bucket was stored compressed
+    };
     Bucket()
       : m_monsterBucketExtent(0)
       , m_available(0)
       , m_data(nullptr)
       , m_mappedData(nullptr)
+      , m_mappedHeader(nullptr)
+      , m_changeJournal(nullptr)
+      , m_counters(nullptr)
+      , m_bucketNumber(0)
       , m_objectMap(nullptr)
       , m_largestFreeItem(0)
       , m_freeItemCount(0)
       , m_nextBucketHash(nullptr)
       , m_dirty(false)
       , m_changed(false)
+      , m_storedCompressed(false)
       , m_lastUsed(0)
     {
     }
     ~Bucket() {
-      if(m_data != m_mappedData) {
-        delete[] m_data;
+      if(m_data.load() != m_mappedData) {
+        delete[] m_data.load();
         delete[] m_nextBucketHash;
         delete[] m_objectMap;
       }
@@ -153,8 +176,8 @@ class Bucket {
       if(!m_data) {
         m_monsterBucketExtent = monsterBucketExtent;
         m_available = ItemRepositoryBucketSize;
-        m_data = new char[ItemRepositoryBucketSize + monsterBucketExtent * DataSize];
-        memset(m_data, 0, (ItemRepositoryBucketSize + monsterBucketExtent * DataSize) * sizeof(char));
+        char* data = new char[ItemRepositoryBucketSize + monsterBucketExtent * DataSize];
+        memset(data, 0, (ItemRepositoryBucketSize + monsterBucketExtent * DataSize) * sizeof(char));
         //The bigger we make the map, the lower the probability of a clash(and thus bad performance). However it increases memory usage.
         m_objectMap = new short unsigned int[ObjectMapSize];
         memset(m_objectMap, 0, ObjectMapSize * sizeof(short unsigned int));
@@ -162,7 +185,8 @@ class Bucket {
         memset(m_nextBucketHash, 0, NextBucketHashSize * sizeof(short unsigned int));
         m_changed = true;
         m_dirty = false;
-        m_lastUsed = 0;
+        m_lastUsed.store(0);
+        m_data.storeRelease(data);
       }
     }
 
@@ -172,6 +196,12 @@ class Bucket {
       from += sizeof(T);
     }
 
+    template<class T>
+    static void writeValue(char*& to, const T& from) {
+      *reinterpret_cast<T*>(to) = from;
+      to += sizeof(T);
+    }
+
     void initializeFromMap(char* current) {
       if(!m_data) {
           char* start = current;
@@ -185,15 +215,96 @@ class Bucket {
           readValue(current, m_largestFreeItem);
           readValue(current, m_freeItemCount);
           readValue(current, m_dirty);
-          m_data = current;
           m_mappedData = current;
+          m_data.storeRelease(current);
 
           m_changed = false;
-          m_lastUsed = 0;
+          m_lastUsed.store(0);
           VERIFY(current - start == (DataSize - ItemRepositoryBucketSize));
       }
     }
 
+    ///Initializes the bucket on top of a writable shared file-mapping. The data is never copied,
+    ///all changes go directly into the mapping. Use storeInPlace() instead of store() then.
+    void initializeInPlace(char* current) {
+      if(!m_data) {
+        initializeFromMap(current);
+        m_mappedHeader = current;
+      }
+    }
+
+    ///Initializes the bucket from data created by compressedData()
+    void initializeFromCompressed(const QByteArray& compressed) {
+      if(!m_data) {
+        QByteArray data = qUncompress(compressed);
+        if(data.size() != DataSize) {
+          qWarning() << "failed to decompress bucket, got" << data.size() << "bytes";
+          initialize(0);
+          return;
+        }
+        initializeFromMap(data.data());
+        //Copy the data, but keep the bucket unchanged, so it is not written back uncompressed
+        makeDataPrivate();
+        m_mappedData = nullptr;
+        m_storedCompressed = true;
+      }
+    }
+
+    ///Returns the data as it is written by store(), compressed with qCompress(). Only for normal buckets.
+    QByteArray compressedData() const {
+      Q_ASSERT(m_data && !m_monsterBucketExtent);
+      QByteArray data(DataSize, 0);
+      char* current = data.data();
+      writeValue(current, m_monsterBucketExtent);
+      writeValue(current, m_available);
+      memcpy(current, m_objectMap, sizeof(short unsigned int) * ObjectMapSize);
+      current += sizeof(short unsigned int) * ObjectMapSize;
+      memcpy(current, m_nextBucketHash, sizeof(short unsigned int) * NextBucketHashSize);
+      current += sizeof(short unsigned int) * NextBucketHashSize;
+      writeValue(current, m_largestFreeItem);
+      writeValue(current, m_freeItemCount);
+      writeValue(current, m_dirty);
+      memcpy(current, m_data, ItemRepositoryBucketSize);
+      //Favor speed, the buckets are decompressed while the user waits
+      return qCompress(data, 1);
+    }
+
+    ///Whether the bucket was loaded from a compressed representation that is still valid on disk
+    bool storedCompressed() const {
+      return m_storedCompressed;
+    }
+
+    ///Writes an empty bucket to the given position of a writable file-mapping
+    static void formatInPlace(char* current) {
+      memset(current, 0, DataSize);
+      const unsigned int monsterBucketExtent = 0;
+      const unsigned int available = ItemRepositoryBucketSize;
+      memcpy(current, &monsterBucketExtent, sizeof(unsigned int));
+      memcpy(current + sizeof(unsigned int), &available, sizeof(unsigned int));
+    }
+
+    ///Whether this bucket was initialized through initializeInPlace()
+    bool isInPlace() const {
+      return m_mappedHeader;
+    }
+
+    ///Writes the header values that are cached in members back into the mapping. Everything else is already there.
+    ///Returns the range that has to be synchronized to disk.
+    QPair<char*, uint> storeInPlace() {
+      Q_ASSERT(m_mappedHeader);
+      char* current = m_mappedHeader;
+      writeValue(current, m_monsterBucketExtent);
+      writeValue(current, m_available);
+      current += sizeof(short unsigned int) * (ObjectMapSize + NextBucketHashSize);
+      writeValue(current, m_largestFreeItem);
+      writeValue(current, m_freeItemCount);
+      writeValue(current, m_dirty);
+      Q_ASSERT(current == m_data);
+
+      m_changed = false;
+      return qMakePair(m_mappedHeader, static_cast<uint>(DataSize));
+    }
+
     void store(QFile* file, size_t offset) {
       if(!m_data)
         return;
@@ -271,7 +382,7 @@ class Bucket {
 
     //Tries to find the index this item has in this bucket, or returns zero if the item isn't there yet.
     unsigned short findIndex(const ItemRequest& request) const {
-      m_lastUsed = 0;
+      m_lastUsed.store(0);
 
       unsigned short localHash = request.hash() % ObjectMapSize;
       unsigned short index = m_objectMap[localHash];
@@ -291,7 +402,7 @@ class Bucket {
     //Tries to get the index within this bucket, or returns zero. Will put the item into the bucket if there is room.
     //Created indices will never begin with 0xffff____, so you can use that index-range for own purposes.
     unsigned short index(const ItemRequest& request, unsigned int itemSize) {
-      m_lastUsed = 0;
+      m_lastUsed.store(0);
 
       unsigned short localHash = request.hash() % ObjectMapSize;
       unsigned short index = m_objectMap[localHash];
@@ -469,7 +580,7 @@ class Bucket {
 
       Q_ASSERT(modulo % ObjectMapSize == 0);
 
-      m_lastUsed = 0;
+      m_lastUsed.store(0);
 
       uint hashMod = hash % modulo;
       unsigned short localHash = hash % ObjectMapSize;
@@ -532,7 +643,7 @@ class Bucket {
     void deleteItem(unsigned short index, unsigned int hash, Repository& repository) {
       ifDebugLostSpace( Q_ASSERT(!lostSpace()); )
 
-      m_lastUsed = 0;
+      m_lastUsed.store(0);
       prepareChange();
 
       unsigned int size = itemFromIndex(index)->itemSize();
@@ -614,8 +725,10 @@ class Bucket {
     ///         If you need to change something, use dynamicItemFromIndex
     ///@warning When using multi-threading, mutex() must be locked as long as you use the returned data
     inline const Item* itemFromIndex(unsigned short index) const {
-      m_lastUsed = 0;
-      return reinterpret_cast<Item*>(m_data+index);
+      //Lock-free readers of the same bucket would otherwise all write the same cache-line
+      if(m_lastUsed.load())
+        m_lastUsed.store(0);
+      return reinterpret_cast<Item*>(m_data.loadAcquire()+index);
     }
 
     bool isEmpty() const {
@@ -640,7 +753,7 @@ class Bucket {
 
     template<class Visitor>
     bool visitAllItems(Visitor& visitor) const {
-      m_lastUsed = 0;
+      m_lastUsed.store(0);
       for(uint a = 0; a < ObjectMapSize; ++a) {
         uint currentIndex = m_objectMap[a];
         while(currentIndex) {
@@ -687,12 +800,12 @@ class Bucket {
     }
 
     unsigned short nextBucketForHash(uint hash) const {
-      m_lastUsed = 0;
+      m_lastUsed.store(0);
       return m_nextBucketHash[hash % NextBucketHashSize];
     }
 
     void setNextBucketForHash(unsigned int hash, unsigned short bucket) {
-      m_lastUsed = 0;
+      m_lastUsed.store(0);
       prepareChange();
       m_nextBucketHash[hash % NextBucketHashSize] = bucket;
     }
@@ -739,12 +852,12 @@ class Bucket {
     }
 
     void tick() const {
-      ++m_lastUsed;
+      m_lastUsed.ref();
     }
 
     //How many ticks ago the item was last used
     int lastUsed() const {
-      return m_lastUsed;
+      return m_lastUsed.load();
     }
 
     //Whether this bucket was changed since it was last stored
@@ -752,8 +865,25 @@ class Bucket {
       return m_changed;
     }
 
+    ///The bucket number is appended to @p journal whenever this bucket becomes changed(), so the repository
+    ///does not need to search for changed buckets. Is also appended right away if the bucket is changed already.
+    void setChangeJournal(QVector<uint>* journal, uint bucketNumber) {
+      m_changeJournal = journal;
+      m_bucketNumber = bucketNumber;
+      if(m_changed)
+        m_changeJournal->append(m_bucketNumber);
+    }
+
+    ///Copies of memory-mapped data done by prepareChange() are counted in @p counters
+    void setCounters(ItemRepositoryCounters* counters) {
+      m_counters = counters;
+    }
+
     void prepareChange() {
+      if(!m_changed && m_changeJournal)
+        m_changeJournal->append(m_bucketNumber);
       m_changed = true;
+      m_storedCompressed = false; //Will be stored uncompressed
       m_dirty = true;
       makeDataPrivate();
     }
@@ -795,17 +925,24 @@ class Bucket {
   private:
 
     void makeDataPrivate() {
-      if(m_mappedData == m_data) {
-        short unsigned int* oldObjectMap = m_objectMap;
-        short unsigned int* oldNextBucketHash = m_nextBucketHash;
-
-        m_data = new char[ItemRepositoryBucketSize + m_monsterBucketExtent * DataSize];
-        m_objectMap = new short unsigned int[ObjectMapSize];
-        m_nextBucketHash = new short unsigned int[NextBucketHashSize];
-
-        memcpy(m_data, m_mappedData, ItemRepositoryBucketSize + m_monsterBucketExtent * DataSize);
-        memcpy(m_objectMap, oldObjectMap, ObjectMapSize * sizeof(short unsigned int));
-        memcpy(m_nextBucketHash, oldNextBucketHash, NextBucketHashSize * sizeof(short unsigned int));
+      //Buckets in a writable mapping are changed in place
+      if(m_mappedData == m_data && !m_mappedHeader) {
+        char* data = new char[ItemRepositoryBucketSize + m_monsterBucketExtent * DataSize];
+        short unsigned int* objectMap = new short unsigned int[ObjectMapSize];
+        short unsigned int* nextBucketHash = new short unsigned int[NextBucketHashSize];
+
+        memcpy(data, m_mappedData, ItemRepositoryBucketSize + m_monsterBucketExtent * DataSize);
+        memcpy(objectMap, m_objectMap, ObjectMapSize * sizeof(short unsigned int));
+        memcpy(nextBucketHash, m_nextBucketHash, NextBucketHashSize * sizeof(short unsigned int));
+
+        m_objectMap = objectMap;
+        m_nextBucketHash = nextBucketHash;
+        //Lock-free readers in itemFromIndex() may use the bucket at any time, so the copy is only published once it is complete.
+        //The mapped data stays valid, readers that still use it see the same contents.
+        m_data.storeRelease(data);
+
+        if(m_counters)
+          ItemRepositoryCounters::add(m_counters->bucketCopies);
       }
     }
 
@@ -957,8 +1094,12 @@ class Bucket {
 
     int m_monsterBucketExtent; //If this is a monster-bucket, this contains the count of follower-buckets that belong to this one
     unsigned int m_available;
-    char* m_data; //Structure of the data: <Position of next item with same hash modulo ItemRepositoryBucketSize>(2 byte), <Item>(item.size() byte)
+    QAtomicPointer<char> m_data; //Structure of the data: <Position of next item with same hash modulo ItemRepositoryBucketSize>(2 byte), <Item>(item.size() byte)
     char* m_mappedData; //Read-only memory-mapped data. If this equals m_data, m_data must not be written
+    char* m_mappedHeader; //Start of this bucket in a writable memory-mapping, if it was initialized in place. Then m_data may be written
+    QVector<uint>* m_changeJournal; //Journal of changed buckets in the repository, see setChangeJournal()
+    ItemRepositoryCounters* m_counters; //Counters of the repository, see setCounters()
+    uint m_bucketNumber;
     short unsigned int* m_objectMap; //Points to the first object in m_data with (hash % ObjectMapSize) == index. Points to the item itself, so subtract 1 to get the pointer to the next item with same local hash.
     short unsigned int m_largestFreeItem; //Points to the largest item that is currently marked as free, or zero. That one points to the next largest one through followerIndex
     unsigned int m_freeItemCount;
@@ -967,7 +1108,8 @@ class Bucket {
 
     bool m_dirty; //Whether the data was changed since the last finalCleanup
     bool m_changed; //Whether this bucket was changed since it was last stored to disk
-    mutable int m_lastUsed; //How many ticks ago this bucket was last accessed
+    bool m_storedCompressed; //Whether this bucket was loaded from a compressed representation
+    mutable QAtomicInt m_lastUsed; //How many ticks ago this bucket was last accessed. Atomic, since it is also touched by lock-free readers
 };
 
 template<bool lock>
@@ -975,18 +1117,223 @@ struct Locker { //This is a dummy that does nothing
   template<class T>
   explicit Locker(const T& /*t*/) {
   }
+  template<class T>
+  Locker(const T& /*t*/, ItemRepositoryCounters& /*counters*/) {
+  }
 };
 template<>
 struct Locker<true> {
   explicit Locker(QMutex* mutex) : m_mutex(mutex) {
     m_mutex->lock();
   }
+  ///Adds the time spent waiting for the mutex to @p counters
+  Locker(QMutex* mutex, ItemRepositoryCounters& counters) : m_mutex(mutex) {
+    if(!m_mutex->tryLock()) {
+      QElapsedTimer timer;
+      timer.start();
+      m_mutex->lock();
+      ItemRepositoryCounters::add(counters.lockWaitTime, timer.nsecsElapsed());
+    }
+  }
   ~Locker() {
     m_mutex->unlock();
   }
   QMutex* m_mutex;
 };
 
+///Table of bucket pointers that can be read without locking the repository mutex.
+///The pointers are stored in chunks that are never moved or freed while the table exists, so a reader
+///never observes a table that is being reallocated by a concurrent writer.
+///Writers must hold the repository mutex, and must only publish completely initialized buckets through set().
+template<class BucketType>
+class BucketTable {
+  public:
+    enum {
+      ChunkSize = 256,
+      //Leaves room for the over-allocation done by ItemRepository::index()
+      ChunkCount = (ItemRepositoryBucketLimit / ChunkSize) * 2
+    };
+
+    BucketTable() : m_size(0) {
+    }
+
+    ~BucketTable() {
+      for(int a = 0; a < ChunkCount; ++a)
+        delete[] m_chunks[a].load();
+    }
+
+    int size() const {
+      return m_size.loadAcquire();
+    }
+
+    ///Returns the bucket published for @p index, or zero if it is not loaded
+    inline BucketType* at(int index) const {
+      Q_ASSERT(index >= 0 && index < size());
+      QAtomicPointer<BucketType>* chunk = m_chunks[index / ChunkSize].loadAcquire();
+      return chunk ? chunk[index % ChunkSize].loadAcquire() : nullptr;
+    }
+
+    inline BucketType* operator[](int index) const {
+      return at(index);
+    }
+
+    ///Publishes @p bucket for @p index. It becomes visible to lock-free readers immediately.
+    void set(int index, BucketType* bucket) {
+      Q_ASSERT(index >= 0 && index < size());
+      m_chunks[index / ChunkSize].load()[index % ChunkSize].storeRelease(bucket);
+    }
+
+    ///Entries added through growing are zero. Entries removed through shrinking must not hold a bucket any more.
+    void resize(int newSize) {
+      Q_ASSERT(newSize >= 0 && newSize <= ChunkCount * ChunkSize);
+      for(int a = newSize; a < size(); ++a)
+        Q_ASSERT(!at(a));
+
+      for(int chunk = 0; chunk * ChunkSize < newSize; ++chunk) {
+        if(!m_chunks[chunk].load())
+          m_chunks[chunk].storeRelease(new QAtomicPointer<BucketType>[ChunkSize]);
+      }
+      m_size.storeRelease(newSize);
+    }
+
+  private:
+    Q_DISABLE_COPY(BucketTable)
+
+    QAtomicInt m_size;
+    QAtomicPointer<QAtomicPointer<BucketType> > m_chunks[ChunkCount];
+};
+
+///Set of the buckets that have reusable free space, ordered by the largest free size and then by the bucket number,
+///so ItemRepository::index() can pick the bucket that fits best.
+///The buckets are segregated into classes by their largest free size, and every class is a small sorted vector.
+///That way changing the free size of one bucket only moves the entries of the buckets in the same class,
+///and a search can skip all classes that are too small or empty.
+class FreeSpaceBucketIndex {
+  public:
+    enum {
+      SizeClassShift = 8,
+      SizeClassCount = 0x10000 >> SizeClassShift
+    };
+
+    FreeSpaceBucketIndex() : m_size(0) {
+      memset(m_usedClasses, 0, sizeof(m_usedClasses));
+    }
+
+    int size() const {
+      return m_size;
+    }
+
+    bool contains(uint bucket) const {
+      return bucket < static_cast<uint>(m_keys.size()) && m_keys[bucket];
+    }
+
+    ///Inserts @p bucket with the given largest free size, or moves it if it is already contained
+    void insert(uint bucket, ushort largestFreeSize) {
+      Q_ASSERT(bucket && bucket < 0x10000);
+      remove(bucket);
+
+      const uint entry = key(bucket, largestFreeSize);
+      const uint sizeClass = largestFreeSize >> SizeClassShift;
+      QVector<uint>& classEntries = m_classes[sizeClass];
+      classEntries.insert(std::lower_bound(classEntries.begin(), classEntries.end(), entry), entry);
+      m_usedClasses[sizeClass / 64] |= (quint64(1) << (sizeClass % 64));
+
+      if(bucket >= static_cast<uint>(m_keys.size()))
+        m_keys.resize(bucket + 1);
+      m_keys[bucket] = entry;
+      ++m_size;
+    }
+
+    void remove(uint bucket) {
+      if(!contains(bucket))
+        return;
+
+      const uint entry = m_keys[bucket];
+      const uint sizeClass = (entry >> 16) >> SizeClassShift;
+      QVector<uint>& classEntries = m_classes[sizeClass];
+      auto it = std::lower_bound(classEntries.begin(), classEntries.end(), entry);
+      Q_ASSERT(it != classEntries.end() && *it == entry);
+      classEntries.erase(it);
+      if(classEntries.isEmpty())
+        m_usedClasses[sizeClass / 64] &= ~(quint64(1) << (sizeClass % 64));
+
+      m_keys[bucket] = 0;
+      --m_size;
+    }
+
+    void clear() {
+      for(auto& classEntries : m_classes)
+        classEntries.clear();
+      memset(m_usedClasses, 0, sizeof(m_usedClasses));
+      m_keys.clear();
+      m_size = 0;
+    }
+
+    ///Calls @p visitor for all contained buckets with a largest free size of at least @p minimumSize, in ascending
+    ///order, until it returns true.
+    ///@return The bucket for which @p visitor returned true, or zero.
+    template<class Visitor>
+    uint find(uint minimumSize, const Visitor& visitor) const {
+      if(minimumSize >= 0x10000)
+        return 0;
+
+      uint sizeClass = minimumSize >> SizeClassShift;
+      const QVector<uint>& firstEntries = m_classes[sizeClass];
+      for(auto it = std::lower_bound(firstEntries.begin(), firstEntries.end(), minimumSize << 16); it != firstEntries.end(); ++it) {
+        if(visitor(*it & 0xffff))
+          return *it & 0xffff;
+      }
+
+      while((sizeClass = nextUsedClass(sizeClass + 1)) < SizeClassCount) {
+        for(uint entry : m_classes[sizeClass]) {
+          if(visitor(entry & 0xffff))
+            return entry & 0xffff;
+        }
+      }
+      return 0;
+    }
+
+    ///Returns the entries in their order, as stored to disk. Every entry holds the bucket in the lower 16 bits,
+    ///and the largest free size it was sorted by in the upper 16 bits.
+    QVector<uint> entries() const {
+      QVector<uint> ret;
+      ret.reserve(m_size);
+      for(const auto& classEntries : m_classes)
+        ret += classEntries;
+      return ret;
+    }
+
+    void setEntries(const QVector<uint>& storedEntries) {
+      clear();
+      for(uint entry : storedEntries)
+        insert(entry & 0xffff, entry >> 16);
+    }
+
+  private:
+    static uint key(uint bucket, ushort largestFreeSize) {
+      return (uint(largestFreeSize) << 16) | bucket;
+    }
+
+    ///Returns the first class starting at @p sizeClass that has entries, or SizeClassCount
+    uint nextUsedClass(uint sizeClass) const {
+      while(sizeClass < SizeClassCount) {
+        quint64 used = m_usedClasses[sizeClass / 64] >> (sizeClass % 64);
+        if(used) {
+          for(; !(used & 1); used >>= 1)
+            ++sizeClass;
+          return sizeClass;
+        }
+        sizeClass = (sizeClass / 64 + 1) * 64;
+      }
+      return SizeClassCount;
+    }
+
+    QVector<uint> m_classes[SizeClassCount];
+    quint64 m_usedClasses[SizeClassCount / 64]; //Bit set for every class that has entries
+    QVector<uint> m_keys; //The entry of every contained bucket, zero for the others
+    int m_size;
+};
+
 ///This object needs to be kept alive as long as you change the contents of an item
 ///stored in the repository. It is needed to correctly track the reference counting
 ///within disk-storage.
@@ -1051,6 +1398,10 @@ class ItemRepository : public AbstractItemRepository {
     BucketStartOffset = sizeof(uint) * 7 + sizeof(short unsigned int) * bucketHashSize //Position in the data where the bucket array starts
   };
 
+  enum {
+    BucketsPerMappedExtent = 64 //When using a writable mapping, the file is grown and mapped in extents of this many buckets
+  };
+
   public:
   ///@param registry May be zero, then the repository will not be registered at all. Else, the repository will register itself to that registry.
   ///                If this is zero, you have to care about storing the data using store() and/or close() by yourself. It does not happen automatically.
@@ -1062,14 +1413,23 @@ class ItemRepository : public AbstractItemRepository {
     , m_repositoryName(repositoryName)
     , m_registry(registry)
     , m_file(nullptr)
+    , m_fileMap(nullptr)
+    , m_fileMapSize(0)
+    , m_writableMapping(false)
+    , m_unstoredInPlaceChanges(false)
     , m_dynamicFile(nullptr)
     , m_repositoryVersion(repositoryVersion)
+    , m_bucketLimit(0xfffe) //We have reserved the last bucket index 0xffff for special purposes
+    , m_compressAfterTicks(qgetenv("KDEV_ITEMREPOSITORY_COMPRESS_AFTER").toInt())
+    , m_statCompressedBuckets(0)
+    , m_statCompressedBytes(0)
+    , m_statDecompressedBuckets(0)
+    , m_statDecompressionTime(0)
     , m_manager(manager)
   {
     m_unloadingEnabled = true;
     m_metaDataChanged = true;
     m_buckets.resize(10);
-    m_buckets.fill(nullptr);
 
     memset(m_firstBucketForHash, 0, bucketHashSize * sizeof(short unsigned int));
 
@@ -1091,13 +1451,78 @@ class ItemRepository : public AbstractItemRepository {
       m_unloadingEnabled = enabled;
   }
 
+  ///Restricts the bucket numbers used for new items to be smaller than @p limit, so that indices
+  ///can be remapped by a wrapper like ShardedItemRepository. Must be called before items are inserted.
+  void setBucketLimit(uint limit) {
+    Q_ASSERT(limit > 1 && limit <= 0xfffe);
+    m_bucketLimit = limit;
+  }
+
+  ///Enables storing buckets compressed on disk once they were not used during @p idleStoreCycles calls to store().
+  ///They are decompressed when they are loaded again. Zero disables the compression, which is the default unless
+  ///the environment variable KDEV_ITEMREPOSITORY_COMPRESS_AFTER is set to a count of store cycles.
+  ///@note Unused buckets are kept in memory until they are compressed, so values bigger than 2 delay the unloading.
+  void setColdBucketCompression(int idleStoreCycles) {
+    ThisLocker lock(m_mutex, m_counters);
+    m_compressAfterTicks = idleStoreCycles;
+  }
+
   ///Returns the index for the given item. If the item is not in the repository yet, it is inserted.
   ///The index can never be zero. Zero is reserved for your own usage as invalid
   ///@param request Item to retrieve the index from
   unsigned int index(const ItemRequest& request) {
 
-    ThisLocker lock(m_mutex);
+    ThisLocker lock(m_mutex, m_counters);
+
+    return indexLocked(request);
+  }
+
+  ///Returns the indices for the @p count items starting at @p requests, in the same order.
+  ///Equivalent to calling index() for every request, but the mutex is only locked once,
+  ///and the bucket table is grown once up-front for all the items that may have to be inserted.
+  ///An index is zero if there was no room for the item, just like with index().
+  QVector<uint> indexMany(const ItemRequest* requests, int count) {
+    QVector<uint> indices(count);
+
+    ThisLocker lock(m_mutex, m_counters);
+
+    reserveBucketsFor(requests, count);
+
+    for(int a = 0; a < count; ++a)
+      indices[a] = indexLocked(requests[a]);
+
+    return indices;
+  }
+
+  ///Returns zero if the item is not in the repository yet
+  unsigned int findIndex(const ItemRequest& request) {
+
+    ThisLocker lock(m_mutex, m_counters);
+    ItemRepositoryCounters::add(m_counters.lookups);
+
+    return walkBucketChain(request.hash(), [this, &request](ushort bucketIdx, const MyBucket* bucketPtr) {
+        const ushort indexInBucket = bucketPtr->findIndex(request);
+        return indexInBucket ? createIndex(bucketIdx, indexInBucket) : 0u;
+    });
+  }
+
+  private:
+  ///Grows the bucket table so that it has room for all of @p requests, even if none of them is in the
+  ///repository yet and no deleted space can be reused. This way index() does not have to grow it repeatedly.
+  void reserveBucketsFor(const ItemRequest* requests, int count) {
+    quint64 totalSize = 0;
+    for(int a = 0; a < count; ++a)
+      totalSize += requests[a].itemSize() + MyBucket::AdditionalSpacePerItem;
+
+    //Every bucket that is filled up wastes some space, so leave the same slack index() uses when growing
+    const quint64 neededBuckets = totalSize / MyBucket::DataSize + 10;
+    const int newSize = static_cast<int>(qMin<quint64>(m_currentBucket + neededBuckets, m_bucketLimit));
+    if(newSize > m_buckets.size())
+      m_buckets.resize(newSize);
+  }
 
+  ///Implementation of index(), the mutex must be locked
+  unsigned int indexLocked(const ItemRequest& request) {
     const uint hash = request.hash();
     const uint size = request.itemSize();
 
@@ -1119,9 +1544,12 @@ class ItemRepository : public AbstractItemRepository {
 
     if (foundIndexInBucket) {
       // 'request' is already present, return the existing index
+      ItemRepositoryCounters::add(m_counters.indexHits);
       return createIndex(lastBucketWalked, foundIndexInBucket);
     }
 
+    ItemRepositoryCounters::add(m_counters.indexInserts);
+
     /*
      * Disclaimer: Writer of comment != writer of code, believe with caution
      *
@@ -1138,49 +1566,37 @@ class ItemRepository : public AbstractItemRepository {
      */
 
     m_metaDataChanged = true;
+    noteInPlaceChange();
 
     const bool pickedBucketInChain = bucketInChainWithSpace;
     int useBucket = bucketInChainWithSpace;
-    int reOrderFreeSpaceBucketIndex = -1;
 
     if (!pickedBucketInChain) {
-      //Try finding an existing bucket with deleted space to store the data into
-      for(int a = 0; a < m_freeSpaceBuckets.size(); ++a) {
-        MyBucket* bucketPtr = bucketForIndex(m_freeSpaceBuckets[a]);
+      //Try finding an existing bucket with deleted space to store the data into.
+      //Buckets whose largest free item is smaller than the request can not hold it, so they are skipped.
+      useBucket = m_freeSpaceBuckets.find(size, [this, size](uint bucket) {
+        MyBucket* bucketPtr = bucketForIndex(bucket);
         Q_ASSERT(bucketPtr->largestFreeSize());
-
-        if(bucketPtr->canAllocateItem(size)) {
-          //The item fits into the bucket.
-          useBucket = m_freeSpaceBuckets[a];
-          reOrderFreeSpaceBucketIndex = a;
-          break;
-        }
-      }
+        return bucketPtr->canAllocateItem(size);
+      });
 
       if (!useBucket) {
         useBucket = m_currentBucket;
       }
-    } else {
-      reOrderFreeSpaceBucketIndex = m_freeSpaceBuckets.indexOf(useBucket);
     }
 
     //The item isn't in the repository yet, find a new bucket for it
     while(1) {
-      if(useBucket >= m_buckets.size()) {
-          if(m_buckets.size() >= 0xfffe) { //We have reserved the last bucket index 0xffff for special purposes
-          //the repository has overflown.
-          qWarning() << "Found no room for an item in" << m_repositoryName << "size of the item:" << request.itemSize();
-          return 0;
-        }else{
-          //Allocate new buckets
-          m_buckets.resize(m_buckets.size() + 10);
-        }
+      if(useBucket >= static_cast<int>(m_bucketLimit)) {
+        //the repository has overflown.
+        qWarning() << "Found no room for an item in" << m_repositoryName << "size of the item:" << request.itemSize();
+        return 0;
       }
-      MyBucket* bucketPtr = m_buckets.at(useBucket);
-      if(!bucketPtr) {
-        initializeBucket(useBucket);
-        bucketPtr = m_buckets.at(useBucket);
+      if(useBucket >= m_buckets.size()) {
+        //Allocate new buckets
+        m_buckets.resize(m_buckets.size() + 10);
       }
+      MyBucket* bucketPtr = bucketForIndex(useBucket);
 
       ENSURE_REACHABLE(useBucket);
       Q_ASSERT_X(!bucketPtr->findIndex(request), Q_FUNC_INFO, "found item in unexpected bucket, ensure your ItemRequest::equals method is correct. Note: For custom AbstractType's e.g. ensure you have a proper equals() override");
@@ -1198,39 +1614,44 @@ class ItemRepository : public AbstractItemRepository {
         useBucket = 0;
         //The item did not fit in, we need a monster-bucket(Merge consecutive buckets)
         ///Step one: Search whether we can merge multiple empty buckets in the free-list into one monster-bucket
+        //Empty buckets have the biggest possible free size, so they are all found at the end, ordered by their number
         int rangeStart = -1;
         int rangeEnd = -1;
-        for(int a = 0; a < m_freeSpaceBuckets.size(); ++a) {
-          MyBucket* bucketPtr = bucketForIndex(m_freeSpaceBuckets[a]);
+        const uint mergeEnd = m_freeSpaceBuckets.find(0, [&](uint index) {
+          MyBucket* bucketPtr = bucketForIndex(index);
           if(bucketPtr->isEmpty()) {
             //This bucket is a candidate for monster-bucket merging
-            int index = (int)m_freeSpaceBuckets[a];
-            if(rangeEnd != index) {
+            if(rangeEnd != (int)index) {
               rangeStart = index;
               rangeEnd = index+1;
             }else{
               ++rangeEnd;
             }
-            if(rangeStart != rangeEnd) {
-              uint extent = rangeEnd - rangeStart - 1;
-              uint totalAvailableSpace = bucketForIndex(rangeStart)->available() + MyBucket::DataSize * (rangeEnd - rangeStart - 1);
-              if(totalAvailableSpace > totalSize) {
-                Q_ASSERT(extent);
-                ///We can merge these buckets into one monster-bucket that can hold the data
-                Q_ASSERT((uint)m_freeSpaceBuckets[a-extent] == (uint)rangeStart);
-                m_freeSpaceBuckets.remove(a-extent, extent+1);
-                useBucket = rangeStart;
-                convertMonsterBucket(rangeStart, extent);
-
-                break;
-              }
+            uint totalAvailableSpace = bucketForIndex(rangeStart)->available() + MyBucket::DataSize * (rangeEnd - rangeStart - 1);
+            if(totalAvailableSpace > totalSize) {
+              ///We can merge these buckets into one monster-bucket that can hold the data
+              return true;
             }
           }
+          return false;
+        });
+        if(mergeEnd) {
+          Q_ASSERT((int)mergeEnd == rangeEnd - 1);
+          uint extent = rangeEnd - rangeStart - 1;
+          Q_ASSERT(extent);
+          for(int index = rangeStart; index < rangeEnd; ++index)
+            m_freeSpaceBuckets.remove(index);
+          useBucket = rangeStart;
+          convertMonsterBucket(rangeStart, extent);
         }
         if(!useBucket) {
           //Create a new monster-bucket at the end of the data
           int needMonsterExtent = (totalSize - ItemRepositoryBucketSize) / MyBucket::DataSize + 1;
           Q_ASSERT(needMonsterExtent);
+          if(m_currentBucket + needMonsterExtent + 1 > static_cast<int>(m_bucketLimit)) {
+            qWarning() << "Found no room for a monster-bucket in" << m_repositoryName << "size of the item:" << request.itemSize();
+            return 0;
+          }
           if(m_currentBucket + needMonsterExtent + 1 > m_buckets.size()) {
             m_buckets.resize(m_buckets.size() + 10 + needMonsterExtent + 1);
           }
@@ -1316,14 +1737,13 @@ class ItemRepository : public AbstractItemRepository {
           }
         }
 
-        if(reOrderFreeSpaceBucketIndex != -1)
-          updateFreeSpaceOrder(reOrderFreeSpaceBucketIndex);
+        if(m_freeSpaceBuckets.contains(useBucket))
+          updateFreeSpaceOrder(useBucket);
 
         return createIndex(useBucket, indexInBucket);
       }else{
         //This should never happen when we picked a bucket for re-use
         Q_ASSERT(!pickedBucketInChain);
-        Q_ASSERT(reOrderFreeSpaceBucketIndex == -1);
         Q_ASSERT(useBucket == m_currentBucket);
 
         if(!bucketForIndex(useBucket)->isEmpty())
@@ -1340,23 +1760,14 @@ class ItemRepository : public AbstractItemRepository {
     return 0;
   }
 
-  ///Returns zero if the item is not in the repository yet
-  unsigned int findIndex(const ItemRequest& request) {
-
-    ThisLocker lock(m_mutex);
-
-    return walkBucketChain(request.hash(), [this, &request](ushort bucketIdx, const MyBucket* bucketPtr) {
-        const ushort indexInBucket = bucketPtr->findIndex(request);
-        return indexInBucket ? createIndex(bucketIdx, indexInBucket) : 0u;
-    });
-  }
-
+  public:
   ///Deletes the item from the repository.
   void deleteItem(unsigned int index) {
     verifyIndex(index);
-    ThisLocker lock(m_mutex);
+    ThisLocker lock(m_mutex, m_counters);
 
     m_metaDataChanged = true;
+    noteInPlaceChange();
 
     const uint hash = itemFromIndex(index)->hash();
     const ushort bucket = (index >> 16);
@@ -1420,7 +1831,7 @@ class ItemRepository : public AbstractItemRepository {
       for(uint created = bucket; created < bucket + newBuckets; ++created) {
         putIntoFreeList(created, bucketForIndex(created));
 #ifdef DEBUG_MONSTERBUCKETS
-        Q_ASSERT(m_freeSpaceBuckets.indexOf(created) != -1);
+        Q_ASSERT(m_freeSpaceBuckets.contains(created));
 #endif
       }
     }else{
@@ -1438,16 +1849,13 @@ class ItemRepository : public AbstractItemRepository {
   MyDynamicItem dynamicItemFromIndex(unsigned int index) {
     verifyIndex(index);
 
-    ThisLocker lock(m_mutex);
+    ThisLocker lock(m_mutex, m_counters);
 
     unsigned short bucket = (index >> 16);
 
-    MyBucket* bucketPtr = m_buckets.at(bucket);
-    if(!bucketPtr) {
-      initializeBucket(bucket);
-      bucketPtr = m_buckets.at(bucket);
-    }
+    MyBucket* bucketPtr = bucketForIndex(bucket);
     bucketPtr->prepareChange();
+    noteInPlaceChange();
     unsigned short indexInBucket = index & 0xffff;
     return MyDynamicItem(const_cast<Item*>(bucketPtr->itemFromIndex(indexInBucket)), bucketPtr->data(), bucketPtr->dataSize());
   }
@@ -1462,33 +1870,50 @@ class ItemRepository : public AbstractItemRepository {
   Item* dynamicItemFromIndexSimple(unsigned int index) {
     verifyIndex(index);
 
-    ThisLocker lock(m_mutex);
+    ThisLocker lock(m_mutex, m_counters);
 
     unsigned short bucket = (index >> 16);
 
-    MyBucket* bucketPtr = m_buckets.at(bucket);
-    if(!bucketPtr) {
-      initializeBucket(bucket);
-      bucketPtr = m_buckets.at(bucket);
-    }
+    MyBucket* bucketPtr = bucketForIndex(bucket);
     bucketPtr->prepareChange();
+    noteInPlaceChange();
     unsigned short indexInBucket = index & 0xffff;
     return const_cast<Item*>(bucketPtr->itemFromIndex(indexInBucket));
   }
 
   ///@param index The index. It must be valid(match an existing item), and nonzero.
+  ///@note mutex() is only locked if the bucket containing the item needs to be loaded first.
+  ///@warning When using multi-threading, mutex() must be locked, or an ItemRepositoryReadGuard must exist,
+  ///         as long as you use the returned data
   const Item* itemFromIndex(unsigned int index) const {
-    verifyIndex(index);
+    {
+      //Protects the bucket during the lookup, in case it is unloaded concurrently
+      ItemRepositoryReadGuard guard;
+      if(const Item* item = loadedItemFromIndex(index))
+        return item;
+    }
 
-    ThisLocker lock(m_mutex);
+    ThisLocker lock(m_mutex, m_counters);
 
-    unsigned short bucket = (index >> 16);
+    unsigned short indexInBucket = index & 0xffff;
+    return bucketForIndex(index >> 16)->itemFromIndex(indexInBucket);
+  }
+
+  ///Lock-free lookup: Returns the item if the bucket containing it is currently loaded, else zero.
+  ///This never locks mutex() and never loads anything, so it may also be used without holding mutex()
+  ///when threadSafe is false, as long as the item is not deleted concurrently.
+  ///Without holding mutex(), an ItemRepositoryReadGuard must exist for as long as the returned item is used,
+  ///else the bucket may be freed by a concurrent store().
+  ///@param index The index. It must be valid(match an existing item), and nonzero.
+  const Item* loadedItemFromIndex(unsigned int index) const {
+    verifyIndex(index);
+
+    //Buckets are only published when completely initialized, and unloaded buckets are only deleted once
+    //no ItemRepositoryReadGuard that was entered before they were unpublished exists any more.
+    const MyBucket* bucketPtr = m_buckets.at(index >> 16);
+    if(!bucketPtr)
+      return nullptr;
 
-    const MyBucket* bucketPtr = m_buckets.at(bucket);
-    if(!bucketPtr) {
-      initializeBucket(bucket);
-      bucketPtr = m_buckets.at(bucket);
-    }
     unsigned short indexInBucket = index & 0xffff;
     return bucketPtr->itemFromIndex(indexInBucket);
   }
@@ -1496,7 +1921,8 @@ class ItemRepository : public AbstractItemRepository {
   struct Statistics {
     Statistics() : loadedBuckets(-1), currentBucket(-1), usedMemory(-1), loadedMonsterBuckets(-1), usedSpaceForBuckets(-1),
                    freeSpaceInBuckets(-1), lostSpace(-1), freeUnreachableSpace(-1), hashClashedItems(-1), totalItems(-1), hashSize(-1), hashUse(-1),
-                   averageInBucketHashSize(-1), averageInBucketUsedSlotCount(-1), averageInBucketSlotChainLength(-1), longestInBucketChain(-1), longestNextBucketChain(-1), totalBucketFollowerSlots(-1), averageNextBucketForHashSequenceLength(-1) {
+                   averageInBucketHashSize(-1), averageInBucketUsedSlotCount(-1), averageInBucketSlotChainLength(-1), longestInBucketChain(-1), longestNextBucketChain(-1), totalBucketFollowerSlots(-1), averageNextBucketForHashSequenceLength(-1),
+                   compressedBuckets(0), compressionRatio(0), decompressedBuckets(0), decompressionTime(0) {
     }
 
     uint loadedBuckets;
@@ -1521,6 +1947,11 @@ class ItemRepository : public AbstractItemRepository {
     uint totalBucketFollowerSlots; //Total count of used slots in the nextBucketForHash structure
     float averageNextBucketForHashSequenceLength; //Average sequence length of a nextBucketForHash sequence(If not empty)
 
+    uint compressedBuckets; //Count of cold buckets that were compressed since the repository was opened
+    float compressionRatio; //Uncompressed size divided by the compressed size of those buckets
+    uint decompressedBuckets; //Count of compressed buckets that were loaded since the repository was opened
+    float decompressionTime; //Total time spent decompressing those buckets, in milliseconds
+
     QString print() const {
       QString ret;
       ret += QStringLiteral("loaded buckets: %1 current bucket: %2 used memory: %3 loaded monster buckets: %4").arg(loadedBuckets).arg(currentBucket).arg(usedMemory).arg(loadedMonsterBuckets);
@@ -1530,6 +1961,7 @@ class ItemRepository : public AbstractItemRepository {
       ret += QStringLiteral("\nhash size: %1 hash slots used: %2").arg(hashSize).arg(hashUse);
       ret += QStringLiteral("\naverage in-bucket hash size: %1 average in-bucket used hash slot count: %2 average in-bucket slot chain length: %3 longest in-bucket follower chain: %4").arg(averageInBucketHashSize).arg(averageInBucketUsedSlotCount).arg(averageInBucketSlotChainLength).arg(longestInBucketChain);
       ret += QStringLiteral("\ntotal count of used next-bucket-for-hash slots: %1 average next-bucket-for-hash sequence length: %2 longest next-bucket chain: %3").arg(totalBucketFollowerSlots).arg(averageNextBucketForHashSequenceLength).arg(longestNextBucketChain);
+      ret += QStringLiteral("\ncompressed buckets: %1 compression ratio: %2 decompressed buckets: %3 decompression time: %4 ms").arg(compressedBuckets).arg(compressionRatio).arg(decompressedBuckets).arg(decompressionTime);
       return ret;
     }
     operator QString() const {
@@ -1549,14 +1981,12 @@ class ItemRepository : public AbstractItemRepository {
         ++loadedBuckets;
 
 #ifdef DEBUG_MONSTERBUCKETS
-    for(int a = 0; a < m_freeSpaceBuckets.size(); ++a) {
-      if(a > 0) {
-        uint prev = a-1;
-        uint prevLargestFree = bucketForIndex(m_freeSpaceBuckets[prev])->largestFreeSize();
-        uint largestFree = bucketForIndex(m_freeSpaceBuckets[a])->largestFreeSize();
-        Q_ASSERT( (prevLargestFree < largestFree) || (prevLargestFree == largestFree &&
-                         m_freeSpaceBuckets[prev] < m_freeSpaceBuckets[a]) );
-      }
+    const QVector<uint> freeSpaceBuckets = m_freeSpaceBuckets.entries();
+    for(int a = 0; a < freeSpaceBuckets.size(); ++a) {
+      //The free size the bucket is sorted by must be up to date
+      Q_ASSERT(bucketForIndex(freeSpaceBuckets[a] & 0xffff)->largestFreeSize() == freeSpaceBuckets[a] >> 16);
+      if(a > 0)
+        Q_ASSERT(freeSpaceBuckets[a-1] < freeSpaceBuckets[a]);
     }
 #endif
     ret.hashSize = bucketHashSize;
@@ -1609,7 +2039,7 @@ class ItemRepository : public AbstractItemRepository {
 
         uint bucketFreeSpace = bucket->totalFreeItemsSize() + bucket->available();
         freeBucketSpace += bucketFreeSpace;
-        if(m_freeSpaceBuckets.indexOf(a) == -1)
+        if(!m_freeSpaceBuckets.contains(a))
           freeUnreachableSpace += bucketFreeSpace;
 
         if(bucket->isEmpty()) {
@@ -1644,6 +2074,12 @@ class ItemRepository : public AbstractItemRepository {
     ret.averageInBucketUsedSlotCount = totalInBucketUsedSlotCount / bucketCount;
     ret.averageInBucketSlotChainLength = float(totalInBucketChainLengths) / totalInBucketUsedSlotCount;
 
+    ret.compressedBuckets = m_statCompressedBuckets;
+    if(m_statCompressedBytes)
+      ret.compressionRatio = float(m_statCompressedBuckets) * MyBucket::DataSize / m_statCompressedBytes;
+    ret.decompressedBuckets = m_statDecompressedBuckets;
+    ret.decompressionTime = m_statDecompressionTime / 1000000.0f;
+
     //If m_statBucketHashClashes is high, the bucket-hash needs to be bigger
     return ret;
   }
@@ -1664,7 +2100,7 @@ class ItemRepository : public AbstractItemRepository {
   ///@param onlyInMemory If this is true, only items are visited that are currently in memory.
   template<class Visitor>
   void visitAllItems(Visitor& visitor, bool onlyInMemory = false) const {
-    ThisLocker lock(m_mutex);
+    ThisLocker lock(m_mutex, m_counters);
     for(int a = 1; a <= m_currentBucket; ++a) {
       if(!onlyInMemory || m_buckets.at(a)) {
         if(bucketForIndex(a) && !bucketForIndex(a)->visitAllItems(visitor))
@@ -1677,6 +2113,9 @@ class ItemRepository : public AbstractItemRepository {
   ///Should be called on a regular basis. Can be called centrally from the global item repository registry.
   void store() override {
     QMutexLocker lock(m_mutex);
+
+    reclaimRetiredBuckets();
+
     if(m_file) {
 
       if(!m_file->open( QFile::ReadWrite ) || !m_dynamicFile->open( QFile::ReadWrite )) {
@@ -1684,16 +2123,20 @@ class ItemRepository : public AbstractItemRepository {
         return;
       }
 
+      //Only the buckets from the journal can have changed, everything else was already written by store() or flushChanges()
+      storeJournaledBuckets(m_changedBuckets.size());
+
       for(int a = 0; a < m_buckets.size(); ++a) {
         if(m_buckets[a]) {
-          if(m_buckets[a]->changed()) {
-            storeBucket(a);
-          }
+          Q_ASSERT(!m_buckets[a]->changed());
           if(m_unloadingEnabled) {
-            const int unloadAfterTicks = 2;
+            //When compressing, buckets are kept until they are cold enough
+            const int unloadAfterTicks = qMax(2, m_compressAfterTicks);
             if(m_buckets[a]->lastUsed() > unloadAfterTicks) {
-                delete m_buckets[a];
-                m_buckets[a] = nullptr;
+                const MyBucket* bucketPtr = m_buckets[a];
+                if(m_compressAfterTicks && !bucketPtr->monsterBucketExtent() && !bucketPtr->isInPlace() && !bucketPtr->storedCompressed())
+                  m_coldBuckets.insert(a, bucketPtr);
+                retireBucket(a);
             }else{
                 m_buckets[a]->tick();
             }
@@ -1720,16 +2163,43 @@ class ItemRepository : public AbstractItemRepository {
         Q_ASSERT(m_file->pos() == BucketStartOffset);
 
         m_dynamicFile->seek(0);
-        const uint freeSpaceBucketsSize = static_cast<uint>(m_freeSpaceBuckets.size());
+        const QVector<uint> freeSpaceBuckets = m_freeSpaceBuckets.entries();
+        const uint freeSpaceBucketsSize = static_cast<uint>(freeSpaceBuckets.size());
         m_dynamicFile->write((char*)&freeSpaceBucketsSize, sizeof(uint));
-        m_dynamicFile->write((char*)m_freeSpaceBuckets.data(), sizeof(uint) * freeSpaceBucketsSize);
+        m_dynamicFile->write((char*)freeSpaceBuckets.data(), sizeof(uint) * freeSpaceBucketsSize);
+        ItemRepositoryCounters::add(m_counters.bytesStored, BucketStartOffset + sizeof(uint) * (1 + freeSpaceBucketsSize));
       }
       //To protect us from inconsistency due to crashes. flush() is not enough. We need to close.
       m_file->close();
       m_dynamicFile->close();
       Q_ASSERT(!m_file->isOpen());
       Q_ASSERT(!m_dynamicFile->isOpen());
+      m_unstoredInPlaceChanges = false;
+    }
+  }
+
+  ///Writes up to @p maxBuckets changed buckets to disk ahead of the next store(), so that store() has less work left.
+  ///The repository is only locked while writing this one batch. The header is not written, so the file only becomes
+  ///consistent again with the next store(). Until then, the registry keeps the repository directory marked as inconsistent.
+  ///@return The count of changed buckets still waiting to be written
+  int flushChanges(int maxBuckets) override {
+    QMutexLocker lock(m_mutex);
+
+    if(!m_file || m_changedBuckets.isEmpty())
+      return 0;
+
+    if(m_registry)
+      m_registry->markUnstoredChanges();
+
+    if(!m_file->open( QFile::ReadWrite )) {
+      qWarning() << "cannot re-open repository file for flushing" << m_file->fileName();
+      return 0; //Leave it to store()
     }
+    storeJournaledBuckets(maxBuckets);
+    //To protect us from inconsistency due to crashes. flush() is not enough. We need to close.
+    m_file->close();
+
+    return m_changedBuckets.size();
   }
 
   ///This mutex is used for the thread-safe locking when threadSafe is true. Even if threadSafe is false, it is
@@ -1772,11 +2242,7 @@ class ItemRepository : public AbstractItemRepository {
     unsigned short bucketIndex = m_firstBucketForHash[hash % bucketHashSize];
 
     while (bucketIndex) {
-      auto* bucketPtr = m_buckets.at(bucketIndex);
-      if (!bucketPtr) {
-        initializeBucket(bucketIndex);
-        bucketPtr = m_buckets.at(bucketIndex);
-      }
+      auto* bucketPtr = bucketForIndex(bucketIndex);
 
       if (auto visitResult = visitor(bucketIndex, bucketPtr)) {
         return visitResult;
@@ -1788,48 +2254,20 @@ class ItemRepository : public AbstractItemRepository {
     return {};
   }
 
-  ///Makes sure the order within m_freeSpaceBuckets is correct, after largestFreeSize has been changed for m_freeSpaceBuckets[index].
+  ///Makes sure the position of @p bucket within m_freeSpaceBuckets is correct, after its largestFreeSize has been changed.
   ///If too few space is free within the given bucket, it is removed from m_freeSpaceBuckets.
-  void updateFreeSpaceOrder(uint index) {
+  void updateFreeSpaceOrder(uint bucket) {
     m_metaDataChanged = true;
 
-    unsigned int* freeSpaceBuckets = m_freeSpaceBuckets.data();
-
-    Q_ASSERT(index < static_cast<uint>(m_freeSpaceBuckets.size()));
-    MyBucket* bucketPtr = bucketForIndex(freeSpaceBuckets[index]);
+    MyBucket* bucketPtr = bucketForIndex(bucket);
 
     unsigned short largestFreeSize = bucketPtr->largestFreeSize();
 
     if(largestFreeSize == 0 || (bucketPtr->freeItemCount() <= MyBucket::MaxFreeItemsForHide && largestFreeSize <= MyBucket::MaxFreeSizeForHide)) {
       //Remove the item from freeSpaceBuckets
-      m_freeSpaceBuckets.remove(index);
+      m_freeSpaceBuckets.remove(bucket);
     }else{
-
-      while(1) {
-        int prev = index-1;
-        int next = index+1;
-        if(prev >= 0 && (bucketForIndex(freeSpaceBuckets[prev])->largestFreeSize() > largestFreeSize ||
-                         (bucketForIndex(freeSpaceBuckets[prev])->largestFreeSize() == largestFreeSize && freeSpaceBuckets[index] < freeSpaceBuckets[prev]))
-          ) {
-          //This item should be behind the successor, either because it has a lower largestFreeSize, or because the index is lower
-          uint oldPrevValue = freeSpaceBuckets[prev];
-          freeSpaceBuckets[prev] = freeSpaceBuckets[index];
-          freeSpaceBuckets[index] = oldPrevValue;
-          index = prev;
-        }else if(next < m_freeSpaceBuckets.size()
-            && (bucketForIndex(freeSpaceBuckets[next])->largestFreeSize() < largestFreeSize
-            || (bucketForIndex(freeSpaceBuckets[next])->largestFreeSize() == largestFreeSize
-                && freeSpaceBuckets[index] > freeSpaceBuckets[next])))
-        {
-          //This item should be behind the successor, either because it has a higher largestFreeSize, or because the index is higher
-          uint oldNextValue = freeSpaceBuckets[next];
-          freeSpaceBuckets[next] = freeSpaceBuckets[index];
-          freeSpaceBuckets[index] = oldNextValue;
-          index = next;
-        }else {
-          break;
-        }
-      }
+      m_freeSpaceBuckets.insert(bucket, largestFreeSize);
     }
   }
 
@@ -1843,11 +2281,7 @@ class ItemRepository : public AbstractItemRepository {
   ///              When it is nonzero, it is converted to a monster-bucket.
   MyBucket* convertMonsterBucket(int bucketNumber, int extent) {
     Q_ASSERT(bucketNumber);
-    MyBucket* bucketPtr = m_buckets.at(bucketNumber);
-    if(!bucketPtr) {
-      initializeBucket(bucketNumber);
-      bucketPtr = m_buckets.at(bucketNumber);
-    }
+    MyBucket* bucketPtr = bucketForIndex(bucketNumber);
 
     if(extent) {
       //Convert to monster-bucket
@@ -1855,15 +2289,15 @@ class ItemRepository : public AbstractItemRepository {
       for(int index = bucketNumber; index < bucketNumber + 1 + extent; ++index) {
         Q_ASSERT(bucketPtr->isEmpty());
         Q_ASSERT(!bucketPtr->monsterBucketExtent());
-        Q_ASSERT(m_freeSpaceBuckets.indexOf(index) == -1);
+        Q_ASSERT(!m_freeSpaceBuckets.contains(index));
       }
 #endif
       for(int index = bucketNumber; index < bucketNumber + 1 + extent; ++index)
         deleteBucket(index);
 
-      m_buckets[bucketNumber] = new MyBucket();
-
-      m_buckets[bucketNumber]->initialize(extent);
+      MyBucket* monsterBucketPtr = new MyBucket();
+      monsterBucketPtr->initialize(extent);
+      publishBucket(bucketNumber, monsterBucketPtr);
 
 #ifdef DEBUG_MONSTERBUCKETS
 
@@ -1880,10 +2314,10 @@ class ItemRepository : public AbstractItemRepository {
 
       for(int index = bucketNumber; index < bucketNumber + 1 + oldExtent; ++index) {
         Q_ASSERT(!m_buckets[index]);
-        m_buckets[index] = new MyBucket();
-
-        m_buckets[index]->initialize(0);
-        Q_ASSERT(!m_buckets[index]->monsterBucketExtent());
+        MyBucket* newBucketPtr = new MyBucket();
+        newBucketPtr->initialize(0);
+        Q_ASSERT(!newBucketPtr->monsterBucketExtent());
+        publishBucket(index, newBucketPtr);
       }
     }
     return m_buckets[bucketNumber];
@@ -1903,6 +2337,7 @@ class ItemRepository : public AbstractItemRepository {
 
     close();
     //qDebug() << "opening repository" << m_repositoryName << "at" << path;
+    m_writableMapping = itemRepositoryUsesWritableMapping();
     QDir dir(path);
     m_file = new QFile(dir.absoluteFilePath( m_repositoryName ));
     m_dynamicFile = new QFile(dir.absoluteFilePath( m_repositoryName + QLatin1String("_dynamic") ));
@@ -1930,7 +2365,6 @@ class ItemRepository : public AbstractItemRepository {
       m_file->write((char*)&m_statItemCount, sizeof(uint));
 
       m_buckets.resize(10);
-      m_buckets.fill(nullptr);
       uint bucketCount = m_buckets.size();
       m_file->write((char*)&bucketCount, sizeof(uint));
 
@@ -1983,15 +2417,17 @@ class ItemRepository : public AbstractItemRepository {
 
       uint freeSpaceBucketsSize = 0;
       m_dynamicFile->read((char*)&freeSpaceBucketsSize, sizeof(uint));
-      m_freeSpaceBuckets.resize(freeSpaceBucketsSize);
-      m_dynamicFile->read((char*)m_freeSpaceBuckets.data(), sizeof(uint) * freeSpaceBucketsSize);
+      QVector<uint> freeSpaceBuckets(freeSpaceBucketsSize);
+      m_dynamicFile->read((char*)freeSpaceBuckets.data(), sizeof(uint) * freeSpaceBucketsSize);
+      m_freeSpaceBuckets.setEntries(freeSpaceBuckets);
     }
 
     m_fileMapSize = 0;
     m_fileMap = nullptr;
 
 #ifdef ITEMREPOSITORY_USE_MMAP_LOADING
-    if(m_file->size() > BucketStartOffset){
+    //With a writable mapping, the extents are mapped on demand in writableBucketMapping()
+    if(!m_writableMapping && m_file->size() > BucketStartOffset){
       m_fileMap = m_file->map(BucketStartOffset, m_file->size() - BucketStartOffset);
       Q_ASSERT(m_file->isOpen());
       Q_ASSERT(m_file->size() >= BucketStartOffset);
@@ -2017,18 +2453,28 @@ class ItemRepository : public AbstractItemRepository {
 
     if(m_file)
       m_file->close();
+    //Deleting the file also unmaps all its extents
     delete m_file;
     m_file = nullptr;
     m_fileMap = nullptr;
     m_fileMapSize = 0;
+    m_mappedExtents.clear();
 
     if(m_dynamicFile)
       m_dynamicFile->close();
     delete m_dynamicFile;
     m_dynamicFile = nullptr;
 
-    qDeleteAll(m_buckets);
-    m_buckets.clear();
+    for(int a = 0; a < m_buckets.size(); ++a) {
+      delete m_buckets[a];
+      m_buckets.set(a, nullptr);
+    }
+    m_buckets.resize(0);
+    m_coldBuckets.clear();
+    for(const auto& retired : m_retiredBuckets)
+      delete retired.second;
+    m_retiredBuckets.clear();
+    m_changedBuckets.clear();
 
     memset(m_firstBucketForHash, 0, bucketHashSize * sizeof(short unsigned int));
   }
@@ -2065,12 +2511,13 @@ class ItemRepository : public AbstractItemRepository {
   }
 
   int finalCleanup() override {
-    ThisLocker lock(m_mutex);
+    ThisLocker lock(m_mutex, m_counters);
 
     int changed = 0;
     for(int a = 1; a <= m_currentBucket; ++a) {
       MyBucket* bucket = bucketForIndex(a);
       if(bucket && bucket->dirty()) { ///@todo Faster dirty check, without loading bucket
+        noteInPlaceChange();
         changed += bucket->finalCleanup(*this);
       }
       a += bucket->monsterBucketExtent(); //Skip buckets that are attached as tail to monster-buckets
@@ -2091,14 +2538,21 @@ class ItemRepository : public AbstractItemRepository {
 #endif
 
     if(!m_buckets[bucketNumber]) {
-      m_buckets[bucketNumber] = new MyBucket();
+      MyBucket* bucketPtr = new MyBucket();
 
       bool doMMapLoading = (bool)m_fileMap;
+      char* writableMap = (m_file && m_writableMapping) ? writableBucketMapping(bucketNumber) : nullptr;
 
       uint offset = ((bucketNumber-1) * MyBucket::DataSize);
-      if(m_file && offset < m_fileMapSize && doMMapLoading && *reinterpret_cast<uint*>(m_fileMap + offset) == 0) {
+      if(writableMap && *reinterpret_cast<uint*>(writableMap) == 0) {
+        //Normal buckets are changed directly within the file mapping. Monster buckets may span multiple extents,
+        //so they are loaded the classical way.
+        bucketPtr->initializeInPlace(writableMap);
+        ItemRepositoryCounters::add(m_counters.bucketLoads);
+      } else if(m_file && offset < m_fileMapSize && doMMapLoading && *reinterpret_cast<uint*>(m_fileMap + offset) == 0) {
 //         qDebug() << "loading bucket mmap:" << bucketNumber;
-        m_buckets[bucketNumber]->initializeFromMap(reinterpret_cast<char*>(m_fileMap + offset));
+        bucketPtr->initializeFromMap(reinterpret_cast<char*>(m_fileMap + offset));
+        ItemRepositoryCounters::add(m_counters.bucketLoads);
       } else if(m_file) {
         //Either memory-mapping is disabled, or the item is not in the existing memory-map,
         //so we have to load it the classical way.
@@ -2110,37 +2564,212 @@ class ItemRepository : public AbstractItemRepository {
           m_file->seek(offset);
           uint monsterBucketExtent;
           m_file->read((char*)(&monsterBucketExtent), sizeof(unsigned int));;
-          m_file->seek(offset);
-          ///FIXME: use the data here instead of copying it again in prepareChange
-          QByteArray data = m_file->read((1+monsterBucketExtent) * MyBucket::DataSize);
-          m_buckets[bucketNumber]->initializeFromMap(data.data());
-          m_buckets[bucketNumber]->prepareChange();
+          if(monsterBucketExtent == MyBucket::CompressedBucketMarker) {
+            uint compressedSize;
+            m_file->read((char*)(&compressedSize), sizeof(unsigned int));
+            const QByteArray compressed = m_file->read(compressedSize);
+            QElapsedTimer timer;
+            timer.start();
+            bucketPtr->initializeFromCompressed(compressed);
+            m_statDecompressionTime += timer.nsecsElapsed();
+            ++m_statDecompressedBuckets;
+          }else{
+            m_file->seek(offset);
+            ///FIXME: use the data here instead of copying it again in prepareChange
+            QByteArray data = m_file->read((1+monsterBucketExtent) * MyBucket::DataSize);
+            bucketPtr->initializeFromMap(data.data());
+            bucketPtr->prepareChange();
+          }
+          ItemRepositoryCounters::add(m_counters.bucketLoads);
         }else{
-          m_buckets[bucketNumber]->initialize(0);
+          bucketPtr->initialize(0);
         }
 
         m_file->close();
 
       }else{
-        m_buckets[bucketNumber]->initialize(0);
+        bucketPtr->initialize(0);
       }
+
+      //Publish the bucket only now, lock-free readers may pick it up right away
+      publishBucket(bucketNumber, bucketPtr);
     }else{
       m_buckets[bucketNumber]->initialize(0);
     }
   }
 
+  void publishBucket(int bucketNumber, MyBucket* bucketPtr) const {
+    bucketPtr->setChangeJournal(&m_changedBuckets, bucketNumber);
+    bucketPtr->setCounters(&m_counters);
+    m_buckets.set(bucketNumber, bucketPtr);
+  }
+
   ///Can only be called on empty buckets
   void deleteBucket(int bucketNumber) {
     Q_ASSERT(bucketForIndex(bucketNumber)->isEmpty());
     Q_ASSERT(bucketForIndex(bucketNumber)->noNextBuckets());
-    delete m_buckets[bucketNumber];
-    m_buckets[bucketNumber] = nullptr;
+    retireBucket(bucketNumber);
+  }
+
+  ///Unpublishes the given bucket. It is only deleted by reclaimRetiredBuckets() once no lock-free reader can use it any more.
+  void retireBucket(int bucketNumber) {
+    MyBucket* bucketPtr = m_buckets[bucketNumber];
+    m_buckets.set(bucketNumber, nullptr);
+    m_retiredBuckets.append(qMakePair(ItemRepositoryEpochs::retire(), bucketPtr));
+  }
+
+  ///Deletes the retired buckets that are not in use by lock-free readers any more. The cold ones among them are
+  ///compressed first, as the readers may still have been reading their data from the mapping of the file.
+  void reclaimRetiredBuckets() {
+    const quint64 safeEpoch = ItemRepositoryEpochs::safeEpoch();
+    QSet<const MyBucket*> reclaimable;
+    QVector<QPair<quint64, MyBucket*>> inUse;
+    for(const auto& retired : m_retiredBuckets) {
+      if(retired.first < safeEpoch)
+        reclaimable.insert(retired.second);
+      else
+        inUse.append(retired);
+    }
+
+    compressColdBuckets(reclaimable);
+
+    for(const auto& bucketPtr : reclaimable)
+      delete bucketPtr;
+    m_retiredBuckets = inUse;
+  }
+
+  ///Writes the buckets from m_coldBuckets that are in @p reclaimable compressed into their place in the file,
+  ///unless they were loaded again meanwhile. The others stay in m_coldBuckets.
+  void compressColdBuckets(const QSet<const MyBucket*>& reclaimable) {
+    if(m_coldBuckets.isEmpty())
+      return;
+
+    const bool fileOpen = m_file && m_file->open( QFile::ReadWrite );
+    for(auto it = m_coldBuckets.begin(); it != m_coldBuckets.end(); ) {
+      if(m_buckets[it.key()]) {
+        it = m_coldBuckets.erase(it);
+      } else if(reclaimable.contains(it.value())) {
+        if(fileOpen)
+          compressBucket(it.key(), it.value());
+        it = m_coldBuckets.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if(fileOpen)
+      m_file->close();
+  }
+
+  //m_file must be opened
+  void compressBucket(uint bucketNumber, const MyBucket* bucketPtr) {
+    const QByteArray compressed = bucketPtr->compressedData();
+    const uint compressedSize = compressed.size();
+    const uint storedSize = sizeof(uint) * 2 + compressedSize;
+    if(storedSize >= MyBucket::DataSize)
+      return; //Not compressible enough
+
+    const qint64 offset = BucketStartOffset + static_cast<qint64>(bucketNumber-1) * MyBucket::DataSize;
+    const uint marker = MyBucket::CompressedBucketMarker;
+    m_file->seek(offset);
+    m_file->write((char*)&marker, sizeof(uint));
+    m_file->write((char*)&compressedSize, sizeof(uint));
+    m_file->write(compressed);
+    if(m_file->pos() != offset + storedSize)
+    {
+      KMessageBox::error(nullptr, i18n("Failed writing to %1, probably the disk is full", m_file->fileName()));
+      abort();
+    }
+#if defined(Q_OS_LINUX) && defined(FALLOC_FL_PUNCH_HOLE)
+    //Give the rest of the bucket space back to the file system
+    m_file->flush();
+    fallocate(m_file->handle(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset + storedSize, MyBucket::DataSize - storedSize);
+#endif
+
+    ++m_statCompressedBuckets;
+    m_statCompressedBytes += storedSize;
+    ItemRepositoryCounters::add(m_counters.bytesStored, storedSize);
+  }
+
+  //Stores up to @p maxBuckets buckets from the journal of changed buckets. m_file must be opened
+  void storeJournaledBuckets(int maxBuckets) {
+    int stored = 0;
+    while(stored < maxBuckets && !m_changedBuckets.isEmpty()) {
+      const uint bucketNumber = m_changedBuckets.takeLast();
+      //The journal may still contain buckets that were stored and unloaded, or deleted, in the meantime
+      if(static_cast<int>(bucketNumber) < m_buckets.size() && m_buckets[bucketNumber] && m_buckets[bucketNumber]->changed()) {
+        storeBucket(bucketNumber);
+        ++stored;
+      }
+    }
   }
 
   //m_file must be opened
   void storeBucket(int bucketNumber) const {
     if(m_file && m_buckets[bucketNumber]) {
-      m_buckets[bucketNumber]->store(m_file, BucketStartOffset + (bucketNumber-1) * MyBucket::DataSize);
+      if(m_buckets[bucketNumber]->isInPlace()) {
+        const QPair<char*, uint> range = m_buckets[bucketNumber]->storeInPlace();
+        syncMapping(range.first, range.second);
+      }else{
+        m_buckets[bucketNumber]->store(m_file, BucketStartOffset + (bucketNumber-1) * MyBucket::DataSize);
+      }
+      ItemRepositoryCounters::add(m_counters.bytesStored, MyBucket::DataSize * (1 + m_buckets[bucketNumber]->monsterBucketExtent()));
+    }
+  }
+
+  ///Flushes the given range of a writable mapping to disk, so only the pages of changed buckets are written
+  static void syncMapping(char* start, uint size) {
+#ifdef Q_OS_UNIX
+    static const quintptr pageSize = sysconf(_SC_PAGESIZE);
+    const quintptr alignedStart = reinterpret_cast<quintptr>(start) & ~(pageSize - 1);
+    if(msync(reinterpret_cast<void*>(alignedStart), reinterpret_cast<quintptr>(start) + size - alignedStart, MS_SYNC) != 0)
+      qWarning() << "msync failed for repository mapping";
+#else
+    Q_UNUSED(start);
+    Q_UNUSED(size);
+#endif
+  }
+
+  ///Returns the start of the given bucket within the writable file-mapping, or zero if it cannot be mapped.
+  ///The file is grown and mapped in extents of BucketsPerMappedExtent buckets, so pointers into the mapping
+  ///stay valid until close(). Buckets that were not in the file yet are formatted as empty buckets.
+  char* writableBucketMapping(int bucketNumber) const {
+    const int extent = (bucketNumber - 1) / BucketsPerMappedExtent;
+    while(m_mappedExtents.size() <= extent) {
+      const qint64 extentSize = static_cast<qint64>(BucketsPerMappedExtent) * MyBucket::DataSize;
+      const qint64 extentOffset = BucketStartOffset + m_mappedExtents.size() * extentSize;
+
+      if(!m_file->open(QFile::ReadWrite))
+        return nullptr;
+      const qint64 oldSize = m_file->size();
+      if(oldSize < extentOffset + extentSize && !m_file->resize(extentOffset + extentSize)) {
+        qWarning() << "growing" << m_file->fileName() << "FAILED!";
+        m_file->close();
+        return nullptr;
+      }
+      //A mapping of a file opened for writing is shared, so changes go directly into the file
+      uchar* extentMap = m_file->map(extentOffset, extentSize);
+      m_file->close();
+      if(!extentMap) {
+        qWarning() << "mapping" << m_file->fileName() << "FAILED!";
+        return nullptr;
+      }
+
+      for(int a = 0; a < BucketsPerMappedExtent; ++a) {
+        if(extentOffset + (a + 1) * MyBucket::DataSize > oldSize)
+          MyBucket::formatInPlace(reinterpret_cast<char*>(extentMap) + a * MyBucket::DataSize);
+      }
+      m_mappedExtents.append(extentMap);
+    }
+    return reinterpret_cast<char*>(m_mappedExtents[extent]) + ((bucketNumber - 1) % BucketsPerMappedExtent) * MyBucket::DataSize;
+  }
+
+  ///When using a writable mapping, changes reach the file before store() is called. So the repository directory
+  ///is marked as inconsistent until the next store(), and will be discarded if we crash in between.
+  void noteInPlaceChange() {
+    if(m_writableMapping && !m_unstoredInPlaceChanges) {
+      m_unstoredInPlaceChanges = true;
+      if(m_registry)
+        m_registry->markUnstoredChanges();
     }
   }
 
@@ -2176,24 +2805,17 @@ class ItemRepository : public AbstractItemRepository {
 
   void putIntoFreeList(unsigned short bucket, MyBucket* bucketPtr) {
     Q_ASSERT(!bucketPtr->monsterBucketExtent());
-    int indexInFree = m_freeSpaceBuckets.indexOf(bucket);
+    const bool inFreeList = m_freeSpaceBuckets.contains(bucket);
 
-    if(indexInFree == -1 && (bucketPtr->freeItemCount() >= MyBucket::MinFreeItemsForReuse || bucketPtr->largestFreeSize() >= MyBucket::MinFreeSizeForReuse)) {
+    if(!inFreeList && (bucketPtr->freeItemCount() >= MyBucket::MinFreeItemsForReuse || bucketPtr->largestFreeSize() >= MyBucket::MinFreeSizeForReuse)) {
 
       //Add the bucket to the list of buckets from where to re-assign free space
       //We only do it when a specific threshold of empty items is reached, because that way items can stay "somewhat" semantically ordered.
       Q_ASSERT(bucketPtr->largestFreeSize());
-      int insertPos;
-      for(insertPos = 0; insertPos < m_freeSpaceBuckets.size(); ++insertPos) {
-        if(bucketForIndex(m_freeSpaceBuckets[insertPos])->largestFreeSize() > bucketPtr->largestFreeSize())
-          break;
-      }
-
-      m_freeSpaceBuckets.insert(insertPos, bucket);
-      updateFreeSpaceOrder(insertPos);
-    }else if(indexInFree != -1) {
+      updateFreeSpaceOrder(bucket);
+    }else if(inFreeList) {
       ///Re-order so the order in m_freeSpaceBuckets is correct(sorted by largest free item size)
-      updateFreeSpaceOrder(indexInFree);
+      updateFreeSpaceOrder(bucket);
     }
 #ifdef DEBUG_MONSTERBUCKETS
     if(bucketPtr->isEmpty()) {
@@ -2226,8 +2848,14 @@ class ItemRepository : public AbstractItemRepository {
   QString m_repositoryName;
   mutable int m_currentBucket;
   //List of buckets that have free space available that can be assigned. Sorted by size: Smallest space first. Second order sorting: Bucket index
-  QVector<uint> m_freeSpaceBuckets;
-  mutable QVector<MyBucket* > m_buckets;
+  FreeSpaceBucketIndex m_freeSpaceBuckets;
+  mutable BucketTable<MyBucket> m_buckets;
+  //Buckets that were unpublished from m_buckets together with the epoch they were retired in, see reclaimRetiredBuckets()
+  QVector<QPair<quint64, MyBucket*>> m_retiredBuckets;
+  //Journal of the buckets that were changed since they were last written, see Bucket::setChangeJournal()
+  mutable QVector<uint> m_changedBuckets;
+  //Buckets from m_retiredBuckets that were unloaded because they were cold, and will be compressed in the next store()
+  QHash<uint, const MyBucket*> m_coldBuckets;
   uint m_statBucketHashClashes, m_statItemCount;
   //Maps hash-values modulo 1<<bucketHashSizeBits to the first bucket such a hash-value appears in
   short unsigned int m_firstBucketForHash[bucketHashSize];
@@ -2237,9 +2865,23 @@ class ItemRepository : public AbstractItemRepository {
   QFile* m_file;
   uchar* m_fileMap;
   uint m_fileMapSize;
+  //Whether buckets are changed in place within a writable shared mapping of m_file, see itemRepositoryUsesWritableMapping()
+  bool m_writableMapping;
+  //Extents of BucketsPerMappedExtent buckets each, mapped writable when m_writableMapping is true
+  mutable QVector<uchar*> m_mappedExtents;
+  //Whether buckets were changed in place since the last store()
+  bool m_unstoredInPlaceChanges;
   //File that contains more dynamic data, like the list of buckets with deleted items
   QFile* m_dynamicFile;
   uint m_repositoryVersion;
+  //Bucket numbers of new items are always smaller than this
+  uint m_bucketLimit;
+  //Count of store cycles a bucket must be unused before it is compressed, or zero, see setColdBucketCompression()
+  int m_compressAfterTicks;
+  uint m_statCompressedBuckets;
+  qint64 m_statCompressedBytes;
+  mutable uint m_statDecompressedBuckets;
+  mutable qint64 m_statDecompressionTime; //In nanoseconds
   bool m_unloadingEnabled;
   AbstractRepositoryManager* m_manager;
   friend class ::TestItemRepository;
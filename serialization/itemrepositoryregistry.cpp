@@ -22,7 +22,11 @@
 #include <QtCore/QProcessEnvironment>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
 #include <QDataStream>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QStandardPaths>
 
 #include <KLocalizedString>
@@ -39,6 +43,19 @@ namespace {
 //If KDevelop crashed this many times consicutively, clean up the repository
 const int crashesBeforeCleanup = 1;
 
+//Interval in which the changed data of all repositories is written in the background
+const int flushIntervalMs = 5000;
+
+//Count of buckets written per repository while holding the locks
+const int bucketsPerFlushBatch = 16;
+
+//Flushed buckets keep the directory marked as inconsistent until the next store(), so a crash in between
+//discards the whole cache. That is why the background flushing is opt-in.
+bool backgroundFlushEnabled()
+{
+  return qEnvironmentVariableIsSet("KDEV_ITEMREPOSITORY_BACKGROUND_FLUSH");
+}
+
 void setCrashCounter(QFile& crashesFile, int count)
 {
   crashesFile.close();
@@ -115,6 +132,8 @@ bool shouldClear(const QString& path)
 
 namespace KDevelop {
 
+class ItemRepositoryFlusher;
+
 struct ItemRepositoryRegistryPrivate {
   ItemRepositoryRegistry* m_owner;
   bool m_shallDelete;
@@ -122,17 +141,29 @@ struct ItemRepositoryRegistryPrivate {
   ISessionLock::Ptr m_sessionLock;
   QMap<AbstractItemRepository*, AbstractRepositoryManager*> m_repositories;
   QMap<QString, QAtomicInt*> m_customCounters;
+  //Set when a repository has changed its files since the last store()
+  QAtomicInt m_unstoredChanges;
+  //Set by finalCleanup(), as its results must only reach the disk through store()
+  QAtomicInt m_flushingSuspended;
+  ItemRepositoryFlusher* m_flusher;
   mutable QMutex m_mutex;
 
   explicit ItemRepositoryRegistryPrivate(ItemRepositoryRegistry* owner)
   : m_owner(owner)
   , m_shallDelete(false)
+  , m_unstoredChanges(0)
+  , m_flushingSuspended(0)
+  , m_flusher(nullptr)
   , m_mutex(QMutex::Recursive)
   {
   }
 
   void lockForWriting();
   void unlockForWriting();
+  /// Writes the changed data of all repositories in small batches, until nothing is left or @p stop is set.
+  /// Does nothing while flushing is suspended by finalCleanup().
+  void flushChanges(const QAtomicInt& stop);
+  void stopFlusher();
   void deleteDataDirectory(const QString& path, bool recreate = true);
 
   /// @param path  A shared directory-path that the item-repositories are to be loaded from.
@@ -147,6 +178,46 @@ struct ItemRepositoryRegistryPrivate {
   void close();
 };
 
+/// Periodically writes the changed buckets of all repositories, so store() has little work left
+/// when it is called from within the duchain cleanup.
+class ItemRepositoryFlusher : public QThread
+{
+public:
+  explicit ItemRepositoryFlusher(ItemRepositoryRegistryPrivate* registry)
+  : m_registry(registry)
+  , m_stop(0)
+  {
+  }
+
+  void stopThread()
+  {
+    {
+      QMutexLocker lock(&m_waitMutex);
+      m_stop.store(1);
+      m_wait.wakeAll(); //Wakes the thread up, so it notices it should exit
+    }
+    wait();
+  }
+
+private:
+  void run() override
+  {
+    while(!m_stop.load()) {
+      {
+        QMutexLocker lock(&m_waitMutex);
+        if(!m_stop.load())
+          m_wait.wait(&m_waitMutex, flushIntervalMs);
+      }
+      m_registry->flushChanges(m_stop);
+    }
+  }
+
+  ItemRepositoryRegistryPrivate* m_registry;
+  QAtomicInt m_stop;
+  QWaitCondition m_wait;
+  QMutex m_waitMutex;
+};
+
 //The global item-reposity registry
 ItemRepositoryRegistry* ItemRepositoryRegistry::m_self = nullptr;
 
@@ -155,6 +226,11 @@ ItemRepositoryRegistry::ItemRepositoryRegistry(const ISessionLock::Ptr& session)
 {
   Q_ASSERT(session);
   d->open(repositoryPathForSession(session));
+
+  if(backgroundFlushEnabled()) {
+    d->m_flusher = new ItemRepositoryFlusher(d);
+    d->m_flusher->start(QThread::LowPriority);
+  }
 }
 
 void ItemRepositoryRegistry::initialize(const ISessionLock::Ptr& session)
@@ -242,6 +318,9 @@ void ItemRepositoryRegistry::lockForWriting()
 void ItemRepositoryRegistryPrivate::unlockForWriting()
 {
   QMutexLocker lock(&m_mutex);
+  //Repositories have changed their files after they were stored, so the directory stays inconsistent until the next store()
+  if(m_unstoredChanges.load())
+    return;
   //Delete is_writing
   QFile::remove(m_path + "/is_writing");
 }
@@ -251,6 +330,46 @@ void ItemRepositoryRegistry::unlockForWriting()
   d->unlockForWriting();
 }
 
+void ItemRepositoryRegistryPrivate::flushChanges(const QAtomicInt& stop)
+{
+  bool pending = true;
+  while(pending && !stop.load()) {
+    pending = false;
+    //Re-acquire the lock for every round of batches, so store() and the users of the repositories are never blocked for long
+    QMutexLocker lock(&m_mutex);
+    if(m_flushingSuspended.load())
+      return;
+    foreach(AbstractItemRepository* repository, m_repositories.keys()) {
+      if(repository->flushChanges(bucketsPerFlushBatch))
+        pending = true;
+    }
+  }
+}
+
+void ItemRepositoryRegistry::flushChanges()
+{
+  d->flushChanges(QAtomicInt(0));
+}
+
+void ItemRepositoryRegistryPrivate::stopFlusher()
+{
+  if(m_flusher) {
+    m_flusher->stopThread();
+    delete m_flusher;
+    m_flusher = nullptr;
+  }
+}
+
+void ItemRepositoryRegistry::markUnstoredChanges()
+{
+  //We cannot lock the mutex here, see path()
+  if(d->m_unstoredChanges.testAndSetOrdered(0, 1)) {
+    QFile f(d->m_path + "/is_writing");
+    f.open(QIODevice::WriteOnly);
+    f.close();
+  }
+}
+
 void ItemRepositoryRegistry::unRegisterRepository(AbstractItemRepository* repository)
 {
   QMutexLocker lock(&d->m_mutex);
@@ -322,6 +441,9 @@ bool ItemRepositoryRegistryPrivate::open(const QString& path)
 void ItemRepositoryRegistry::store()
 {
   QMutexLocker lock(&d->m_mutex);
+  //Repositories changed during the storing mark themselves again
+  d->m_unstoredChanges.store(0);
+  d->m_flushingSuspended.store(0);
   foreach(AbstractItemRepository* repository, d->m_repositories.keys()) {
     repository->store();
   }
@@ -358,9 +480,43 @@ void ItemRepositoryRegistry::printAllStatistics() const
   }
 }
 
+QMap<QString, ItemRepositoryCounters::Values> ItemRepositoryRegistry::counters() const
+{
+  QMutexLocker lock(&d->m_mutex);
+  QMap<QString, ItemRepositoryCounters::Values> ret;
+  foreach(AbstractItemRepository* repository, d->m_repositories.keys()) {
+    ret.insert(repository->repositoryName(), repository->counters().snapshot());
+  }
+  return ret;
+}
+
+QByteArray ItemRepositoryRegistry::countersToJson() const
+{
+  const QMap<QString, ItemRepositoryCounters::Values> allCounters = counters();
+
+  QJsonObject ret;
+  for(auto it = allCounters.constBegin(); it != allCounters.constEnd(); ++it) {
+    const ItemRepositoryCounters::Values& values = it.value();
+    QJsonObject repository;
+    //JSON numbers are doubles, which is precise enough for the counter values
+    repository.insert(QStringLiteral("indexHits"), double(values.indexHits));
+    repository.insert(QStringLiteral("indexInserts"), double(values.indexInserts));
+    repository.insert(QStringLiteral("lookups"), double(values.lookups));
+    repository.insert(QStringLiteral("bucketLoads"), double(values.bucketLoads));
+    repository.insert(QStringLiteral("bucketCopies"), double(values.bucketCopies));
+    repository.insert(QStringLiteral("lockWaitTimeNs"), double(values.lockWaitTime));
+    repository.insert(QStringLiteral("bytesStored"), double(values.bytesStored));
+    ret.insert(it.key(), repository);
+  }
+  return QJsonDocument(ret).toJson();
+}
+
 int ItemRepositoryRegistry::finalCleanup()
 {
   QMutexLocker lock(&d->m_mutex);
+  //The results of the final cleanup are not necessarily stored, so they must not reach the disk through the flusher either.
+  //Flushing resumes with the next store(). No flush is running meanwhile, as it holds the lock.
+  d->m_flushingSuspended.store(1);
   int changed = false;
   foreach(AbstractItemRepository* repository, d->m_repositories.keys()) {
     int added = repository->finalCleanup();
@@ -383,6 +539,8 @@ void ItemRepositoryRegistryPrivate::close()
 
 ItemRepositoryRegistry::~ItemRepositoryRegistry()
 {
+  //Must happen without the lock held, the flusher may be waiting for it
+  d->stopFlusher();
   QMutexLocker lock(&d->m_mutex);
   d->close();
   foreach(QAtomicInt * counter, d->m_customCounters) {
@@ -393,6 +551,8 @@ ItemRepositoryRegistry::~ItemRepositoryRegistry()
 
 void ItemRepositoryRegistry::shutdown()
 {
+  //Must happen without the lock held, the flusher may be waiting for it
+  d->stopFlusher();
   QMutexLocker lock(&d->m_mutex);
   QString path = d->m_path;
 
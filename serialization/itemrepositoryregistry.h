@@ -25,6 +25,7 @@
 #include <QtCore/QMap>
 
 #include "serializationexport.h"
+#include "abstractitemrepository.h"
 
 #include <interfaces/isessionlock.h>
 
@@ -71,6 +72,13 @@ class KDEVPLATFORMSERIALIZATION_EXPORT ItemRepositoryRegistry {
     /// @note Should be called on a regular basis.
     void store();
 
+    /// Writes the changed data of all repositories to disk ahead of the next store(), in small batches
+    /// so the repositories stay usable meanwhile. If the environment variable KDEV_ITEMREPOSITORY_BACKGROUND_FLUSH
+    /// is set, this also happens periodically in a background thread.
+    /// Suspended from @ref finalCleanup() until the next @ref store().
+    /// @note The data on disk is only consistent again after the next store(), until then the directory is marked as inconsistent.
+    void flushChanges();
+
     /// Indicates that the application has been closed gracefully.
     /// @note Must be called somewhere at the end of the shutdown sequence.
     void shutdown();
@@ -82,13 +90,26 @@ class KDEVPLATFORMSERIALIZATION_EXPORT ItemRepositoryRegistry {
     /// Prints the statistics of all registered item-repositories to the command line using qDebug().
     void printAllStatistics() const;
 
+    /// @returns The usage counters of all registered item-repositories, by repository name.
+    QMap<QString, ItemRepositoryCounters::Values> counters() const;
+
+    /// @returns The usage counters of all registered item-repositories as an indented JSON object,
+    ///          with one member per repository name.
+    QByteArray countersToJson() const;
+
     /// Marks the directory as inconsistent, so it will be discarded
     /// on next startup if the application crashes during the write process.
     void lockForWriting();
 
     /// Removes the inconsistency mark set by @ref lockForWriting().
+    /// @note The mark is kept if @ref markUnstoredChanges() was called since the last @ref store().
     void unlockForWriting();
 
+    /// Called by repositories that change their files outside of store(), e.g. through a writable memory-mapping.
+    /// Marks the directory as inconsistent like @ref lockForWriting(), until the next @ref store() and @ref unlockForWriting().
+    /// @note Does not lock the registry mutex, so it may be called with a repository locked.
+    void markUnstoredChanges();
+
     /// Returns a custom counter persistently stored as part of item-repositories in the
     /// same directory, possibly creating it.
     /// @param identity     The string used to identify a counter.
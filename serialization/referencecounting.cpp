@@ -26,38 +26,64 @@
 #include "serialization/itemrepository.h"
 
 namespace KDevelop {
+  QAtomicInt refCountingEnabledCount;
+}
 
-  bool doReferenceCounting = false;
-
-  //Protects the reference-counting data through a spin-lock
-  QMutex refCountingLock;
-
-  QMap<void*, QPair<uint, uint> >* refCountingRanges = new QMap<void*, QPair<uint, uint> >(); //ptr, <size, count>, leaked intentionally!
-  bool refCountingHasAdditionalRanges = false; //Whether 'refCountingRanges' is non-empty
+namespace {
 
+///The reference-counted ranges of one thread
+struct ThreadRefCountingRanges
+{
   //Speedup: In most cases there is only exactly one reference-counted range active,
   //so the first reference-counting range can be marked here.
-  void* refCountingFirstRangeStart = nullptr;
-  QPair<uint, uint> refCountingFirstRangeExtent = qMakePair(0u, 0u);
+  void* firstRangeStart = nullptr;
+  QPair<uint, uint> firstRangeExtent = qMakePair(0u, 0u); //<size, count>
+
+  QMap<void*, QPair<uint, uint> > additionalRanges; //ptr, <size, count>
+};
+
+thread_local ThreadRefCountingRanges threadRanges;
+
+}
+
+bool KDevelop::shouldDoDUChainReferenceCountingInThread(void* item)
+{
+  const ThreadRefCountingRanges& ranges(threadRanges);
+
+  if(ranges.firstRangeStart &&
+     (((char*)ranges.firstRangeStart) <= (char*)item) &&
+     ((char*)item < ((char*)ranges.firstRangeStart) + ranges.firstRangeExtent.first))
+      return true;
+
+  if(ranges.additionalRanges.isEmpty())
+    return false;
+
+  auto it = ranges.additionalRanges.upperBound(item);
+  if (it != ranges.additionalRanges.constBegin()) {
+    --it;
+    return ((char*)it.key()) <= (char*)item && (char*)item < ((char*)it.key()) + it.value().first;
+  }
+
+  return false;
 }
 
 void KDevelop::disableDUChainReferenceCounting(void* start)
 {
-  QMutexLocker lock(&refCountingLock);
+  ThreadRefCountingRanges& ranges(threadRanges);
 
-  if(refCountingFirstRangeStart && ((char*)refCountingFirstRangeStart) <= (char*)start && (char*)start < ((char*)refCountingFirstRangeStart) + refCountingFirstRangeExtent.first)
+  if(ranges.firstRangeStart && ((char*)ranges.firstRangeStart) <= (char*)start && (char*)start < ((char*)ranges.firstRangeStart) + ranges.firstRangeExtent.first)
   {
-    Q_ASSERT(refCountingFirstRangeExtent.second > 0);
-    --refCountingFirstRangeExtent.second;
-    if(refCountingFirstRangeExtent.second == 0) {
-      refCountingFirstRangeExtent = qMakePair<uint, uint>(0, 0);
-      refCountingFirstRangeStart = nullptr;
+    Q_ASSERT(ranges.firstRangeExtent.second > 0);
+    --ranges.firstRangeExtent.second;
+    if(ranges.firstRangeExtent.second == 0) {
+      ranges.firstRangeExtent = qMakePair<uint, uint>(0, 0);
+      ranges.firstRangeStart = nullptr;
     }
   }
-  else if(refCountingHasAdditionalRanges)
+  else if(!ranges.additionalRanges.isEmpty())
   {
-    QMap< void*, QPair<uint, uint> >::iterator it = refCountingRanges->upperBound(start);
-    if(it != refCountingRanges->begin()) {
+    QMap< void*, QPair<uint, uint> >::iterator it = ranges.additionalRanges.upperBound(start);
+    if(it != ranges.additionalRanges.begin()) {
       --it;
       if(((char*)it.key()) <= (char*)start && (char*)start < ((char*)it.key()) + it.value().first)
       {
@@ -69,49 +95,45 @@ void KDevelop::disableDUChainReferenceCounting(void* start)
     Q_ASSERT(it.value().second > 0);
     --it.value().second;
     if(it.value().second == 0)
-      refCountingRanges->erase(it);
-    refCountingHasAdditionalRanges = !refCountingRanges->isEmpty();
+      ranges.additionalRanges.erase(it);
   }else{
     Q_ASSERT(0);
   }
 
-  if(!refCountingFirstRangeStart && !refCountingHasAdditionalRanges)
-    doReferenceCounting = false;
+  refCountingEnabledCount.deref();
 }
 
 void KDevelop::enableDUChainReferenceCounting(void* start, unsigned int size)
 {
-  QMutexLocker lock(&refCountingLock);
+  ThreadRefCountingRanges& ranges(threadRanges);
 
-  doReferenceCounting = true;
-
-  if(refCountingFirstRangeStart && ((char*)refCountingFirstRangeStart) <= (char*)start && (char*)start < ((char*)refCountingFirstRangeStart) + refCountingFirstRangeExtent.first)
+  if(ranges.firstRangeStart && ((char*)ranges.firstRangeStart) <= (char*)start && (char*)start < ((char*)ranges.firstRangeStart) + ranges.firstRangeExtent.first)
   {
     //Increase the count for the first range
-    ++refCountingFirstRangeExtent.second;
-  }else if(refCountingHasAdditionalRanges || refCountingFirstRangeStart)
+    ++ranges.firstRangeExtent.second;
+  }else if(!ranges.additionalRanges.isEmpty() || ranges.firstRangeStart)
   {
     //There is additional ranges in the ranges-structure. Add any new ranges there as well.
-    QMap< void*, QPair<uint, uint> >::iterator it = refCountingRanges->upperBound(start);
-    if(it != refCountingRanges->begin()) {
+    QMap< void*, QPair<uint, uint> >::iterator it = ranges.additionalRanges.upperBound(start);
+    if(it != ranges.additionalRanges.begin()) {
       --it;
       if(((char*)it.key()) <= (char*)start && (char*)start < ((char*)it.key()) + it.value().first)
       {
         //Contained, count up
       }else{
-        it = refCountingRanges->end(); //Insert own item
+        it = ranges.additionalRanges.end(); //Insert own item
       }
-    }else if(it != refCountingRanges->end() && it.key() > start) {
+    }else if(it != ranges.additionalRanges.end() && it.key() > start) {
       //The item is behind
-      it = refCountingRanges->end();
+      it = ranges.additionalRanges.end();
     }
 
-    if(it == refCountingRanges->end()) {
-      QMap< void*, QPair<uint, uint> >::iterator inserted = refCountingRanges->insert(start, qMakePair(size, 1u));
+    if(it == ranges.additionalRanges.end()) {
+      QMap< void*, QPair<uint, uint> >::iterator inserted = ranges.additionalRanges.insert(start, qMakePair(size, 1u));
       //Merge following ranges
       QMap< void*, QPair<uint, uint> >::iterator it = inserted;
       ++it;
-      while(it != refCountingRanges->end() && it.key() < ((char*)start) + size) {
+      while(it != ranges.additionalRanges.end() && it.key() < ((char*)start) + size) {
 
         inserted.value().second += it.value().second; //Accumulate count
         if(((char*)start) + size < ((char*)inserted.key()) + it.value().first) {
@@ -119,22 +141,20 @@ void KDevelop::enableDUChainReferenceCounting(void* start, unsigned int size)
           inserted.value().first = (((char*)inserted.key()) + it.value().first) - ((char*)start);
         }
 
-        it = refCountingRanges->erase(it);
+        it = ranges.additionalRanges.erase(it);
       }
     }else{
       ++it.value().second;
       if(it.value().first < size)
         it.value().first = size;
     }
-
-    refCountingHasAdditionalRanges = true;
   }else{
-    refCountingFirstRangeStart = start;
-    refCountingFirstRangeExtent.first = size;
-    refCountingFirstRangeExtent.second = 1;
+    ranges.firstRangeStart = start;
+    ranges.firstRangeExtent.first = size;
+    ranges.firstRangeExtent.second = 1;
   }
 
-  Q_ASSERT(refCountingHasAdditionalRanges == (refCountingRanges && !refCountingRanges->isEmpty()));
+  refCountingEnabledCount.ref();
 #ifdef TEST_REFERENCE_COUNTING
   Q_ASSERT(shouldDoDUChainReferenceCounting(start));
   Q_ASSERT(shouldDoDUChainReferenceCounting(((char*)start + (size-1))));
@@ -23,6 +23,7 @@
 
 #include "serializationexport.h"
 
+#include <QAtomicInt>
 #include <QMap>
 #include <QPair>
 #include <QMutexLocker>
@@ -40,51 +41,37 @@ namespace KDevelop {
 
   ///Since shouldDoDUChainReferenceCounting is called extremely often, we export some internals into the header here,
   ///so the reference-counting code can be inlined.
-  
-  KDEVPLATFORMSERIALIZATION_EXPORT extern bool doReferenceCounting;
-  KDEVPLATFORMSERIALIZATION_EXPORT  extern QMutex refCountingLock;
-  KDEVPLATFORMSERIALIZATION_EXPORT  extern QMap<void*, QPair<uint, uint> >* refCountingRanges;
-  KDEVPLATFORMSERIALIZATION_EXPORT  extern bool refCountingHasAdditionalRanges;
-  KDEVPLATFORMSERIALIZATION_EXPORT  extern void* refCountingFirstRangeStart;
-  KDEVPLATFORMSERIALIZATION_EXPORT  extern QPair<uint, uint> refCountingFirstRangeExtent;
+  ///
+  ///@note Since the ranges are registered per thread, the former globals doReferenceCounting, refCountingLock,
+  ///refCountingRanges, refCountingHasAdditionalRanges, refCountingFirstRangeStart and refCountingFirstRangeExtent
+  ///are gone. Code that inlined the old shouldDoDUChainReferenceCounting references them, so the library
+  ///SO version was increased and such plugins have to be recompiled.
+
+  ///How often reference-counting is currently enabled, summed up over all threads. The ranges themselves
+  ///are registered per thread, so threads that store different top-contexts in parallel share nothing else.
+  KDEVPLATFORMSERIALIZATION_EXPORT  extern QAtomicInt refCountingEnabledCount;
 
   KDEVPLATFORMSERIALIZATION_EXPORT void initReferenceCounting();
 
-  ///@internal The spin-lock ,must already be locked
-  inline bool shouldDoDUChainReferenceCountingInternal(void* item)
-  {
-    auto it = make_const(refCountingRanges)->upperBound(item);
-    if (it != refCountingRanges->constBegin()) {
-      --it;
-      return ((char*)it.key()) <= (char*)item && (char*)item < ((char*)it.key()) + it.value().first;
-    }
-    
-    return false;
-  }
+  ///@internal Checks the ranges the current thread has enabled reference-counting for
+  KDEVPLATFORMSERIALIZATION_EXPORT bool shouldDoDUChainReferenceCountingInThread(void* item);
   
   ///This is used by indexed items to decide whether they should do reference-counting
   inline bool shouldDoDUChainReferenceCounting(void* item) 
   {
-    if(!doReferenceCounting) //Fast path, no place has been marked for reference counting, 99% of cases
+    //A range enabled by this thread is always visible here, the ranges of other threads don't matter
+    if(!refCountingEnabledCount.load()) //Fast path, no place has been marked for reference counting, 99% of cases
       return false;
 
-    QMutexLocker lock(&refCountingLock);
-
-    if(refCountingFirstRangeStart &&
-       (((char*)refCountingFirstRangeStart) <= (char*)item) &&
-       ((char*)item < ((char*)refCountingFirstRangeStart) + refCountingFirstRangeExtent.first))
-        return true;
-
-    if(refCountingHasAdditionalRanges)
-      return shouldDoDUChainReferenceCountingInternal(item);
-    else
-      return false;
+    return shouldDoDUChainReferenceCountingInThread(item);
   }
   
   ///Enable reference-counting for the given range
   ///You should only enable the reference-counting for the time it's really needed,
   ///and it always has to be enabled too when the items are deleted again, else
   ///it will lead to inconsistencies in the repository.
+  ///Reference-counting is only done for the items that the calling thread accesses within the range,
+  ///and it has to be disabled again from the same thread.
   ///@warning If you are not working on the duchain internal storage mechanism, you should
   ///not care about this stuff at all.
   ///@param start Position where to start the reference-counting
@@ -0,0 +1,202 @@
+/*
+   This file is part of KDevelop
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KDEVPLATFORM_SHARDEDITEMREPOSITORY_H
+#define KDEVPLATFORM_SHARDEDITEMREPOSITORY_H
+
+#include "itemrepository.h"
+
+#include <vector>
+
+namespace KDevelop {
+
+/**
+ * An item repository that splits the hash space across @p shardCount independently locked ItemRepository instances.
+ *
+ * Inserting items through index() only locks the shard the request hashes into, so threads interning
+ * different items mostly don't serialize on a single mutex.
+ *
+ * The indices have the same format as the ones of a plain ItemRepository: The shard is encoded into the bucket
+ * number, as bucket = bucketInShard * shardCount + shard. Every shard uses less than 0xfffe / shardCount buckets,
+ * so the 0xffff____ index range stays free for own purposes, and zero is never returned for a valid item.
+ *
+ * Every shard is stored into an own file named "<repositoryName>_shard<number>".
+ *
+ * @tparam shardCount Count of shards, must be a power of two.
+ * @see ItemRepository for the other template parameters
+ */
+template<class Item, class ItemRequest, uint shardCount = 8, bool markForReferenceCounting = true, uint fixedItemSize = 0, unsigned int targetBucketHashSize = 524288*2>
+class ShardedItemRepository {
+  static_assert(shardCount && !(shardCount & (shardCount - 1)), "shardCount must be a power of two");
+
+  public:
+  //Every shard gets an equal part of the bucket hash, so the total memory usage stays the same
+  typedef ItemRepository<Item, ItemRequest, markForReferenceCounting, true, fixedItemSize, targetBucketHashSize / shardCount> Shard;
+  typedef typename Shard::MyDynamicItem MyDynamicItem;
+
+  enum {
+    BucketLimitPerShard = 0xfffe / shardCount
+  };
+
+  ///@param registry May be zero, then the shards will not be registered at all, and you have to call store() yourself.
+  ///@see ItemRepository::ItemRepository
+  explicit ShardedItemRepository(const QString& repositoryName, ItemRepositoryRegistry* registry = &globalItemRepositoryRegistry(),
+                                 uint repositoryVersion = 1, AbstractRepositoryManager* manager = nullptr)
+  {
+    for(uint a = 0; a < shardCount; ++a) {
+      m_shards[a] = new Shard(repositoryName + QStringLiteral("_shard%1").arg(a), registry, repositoryVersion, manager);
+      m_shards[a]->setBucketLimit(BucketLimitPerShard);
+    }
+  }
+
+  ~ShardedItemRepository() {
+    for(uint a = 0; a < shardCount; ++a)
+      delete m_shards[a];
+  }
+
+  Q_DISABLE_COPY(ShardedItemRepository)
+
+  void setUnloadingEnabled(bool enabled) {
+    for(uint a = 0; a < shardCount; ++a)
+      m_shards[a]->setUnloadingEnabled(enabled);
+  }
+
+  ///@see ItemRepository::index. Only locks the mutex of the shard @p request belongs to.
+  unsigned int index(const ItemRequest& request) {
+    const uint shard = shardForHash(request.hash());
+    return indexFromShard(m_shards[shard]->index(request), shard);
+  }
+
+  ///@see ItemRepository::indexMany. The requests are grouped by shard, so every involved shard is only locked once.
+  QVector<uint> indexMany(const ItemRequest* requests, int count) {
+    QVector<uint> indices(count);
+
+    QVector<int> positions[shardCount];
+    for(int a = 0; a < count; ++a)
+      positions[shardForHash(requests[a].hash())].append(a);
+
+    for(uint shard = 0; shard < shardCount; ++shard) {
+      const QVector<int>& shardPositions = positions[shard];
+      if(shardPositions.isEmpty())
+        continue;
+
+      std::vector<ItemRequest> shardRequests;
+      shardRequests.reserve(shardPositions.size());
+      for(int position : shardPositions)
+        shardRequests.push_back(requests[position]);
+
+      const QVector<uint> shardIndices = m_shards[shard]->indexMany(shardRequests.data(), shardRequests.size());
+      for(int a = 0; a < shardIndices.size(); ++a)
+        indices[shardPositions[a]] = indexFromShard(shardIndices[a], shard);
+    }
+
+    return indices;
+  }
+
+  ///@see ItemRepository::findIndex
+  unsigned int findIndex(const ItemRequest& request) {
+    const uint shard = shardForHash(request.hash());
+    return indexFromShard(m_shards[shard]->findIndex(request), shard);
+  }
+
+  ///@see ItemRepository::deleteItem
+  void deleteItem(unsigned int index) {
+    m_shards[shardForIndex(index)]->deleteItem(indexInShard(index));
+  }
+
+  ///@see ItemRepository::itemFromIndex
+  const Item* itemFromIndex(unsigned int index) const {
+    return m_shards[shardForIndex(index)]->itemFromIndex(indexInShard(index));
+  }
+
+  ///@see ItemRepository::loadedItemFromIndex
+  const Item* loadedItemFromIndex(unsigned int index) const {
+    return m_shards[shardForIndex(index)]->loadedItemFromIndex(indexInShard(index));
+  }
+
+  ///@see ItemRepository::dynamicItemFromIndex
+  ///@warning Lock mutexForIndex() instead of a global mutex while using the returned item.
+  MyDynamicItem dynamicItemFromIndex(unsigned int index) {
+    return m_shards[shardForIndex(index)]->dynamicItemFromIndex(indexInShard(index));
+  }
+
+  ///@see ItemRepository::dynamicItemFromIndexSimple
+  ///@warning Lock mutexForIndex() instead of a global mutex while using the returned item.
+  Item* dynamicItemFromIndexSimple(unsigned int index) {
+    return m_shards[shardForIndex(index)]->dynamicItemFromIndexSimple(indexInShard(index));
+  }
+
+  ///Returns the mutex that protects the item with the given index
+  QMutex* mutexForIndex(unsigned int index) const {
+    return m_shards[shardForIndex(index)]->mutex();
+  }
+
+  ///@see ItemRepository::visitAllItems
+  template<class Visitor>
+  void visitAllItems(Visitor& visitor, bool onlyInMemory = false) const {
+    for(uint a = 0; a < shardCount; ++a)
+      m_shards[a]->visitAllItems(visitor, onlyInMemory);
+  }
+
+  ///Only needs to be called when no registry was given to the constructor
+  void store() {
+    for(uint a = 0; a < shardCount; ++a)
+      m_shards[a]->store();
+  }
+
+  ///Total count of items over all shards
+  uint totalItems() const {
+    uint ret = 0;
+    for(uint a = 0; a < shardCount; ++a)
+      ret += m_shards[a]->statistics().totalItems;
+    return ret;
+  }
+
+  const Shard* shard(uint shard) const {
+    Q_ASSERT(shard < shardCount);
+    return m_shards[shard];
+  }
+
+  private:
+  static uint shardForHash(uint hash) {
+    //Mix the hash, so the shard does not correlate with the slot the item gets in the shard's bucket hash
+    return ((hash * 2654435761u) >> 16) % shardCount;
+  }
+
+  static uint shardForIndex(uint index) {
+    Q_ASSERT(index);
+    return (index >> 16) % shardCount;
+  }
+
+  static uint indexInShard(uint index) {
+    return (((index >> 16) / shardCount) << 16) | (index & 0xffff);
+  }
+
+  static uint indexFromShard(uint index, uint shard) {
+    if(!index)
+      return 0;
+    Q_ASSERT((index >> 16) < BucketLimitPerShard);
+    return ((((index >> 16) * shardCount) + shard) << 16) | (index & 0xffff);
+  }
+
+  Shard* m_shards[shardCount];
+};
+
+}
+
+#endif
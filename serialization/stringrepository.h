@@ -33,14 +33,8 @@ struct StringData {
     return sizeof(StringData) + length;
   }
   unsigned int hash() const {
-    IndexedString::RunningHash running;
     const char* str = ((const char*)this) + sizeof(StringData);
-    for(int a = length-1; a >= 0; --a) {
-      running.append(*str);
-      ++str;
-    }
-    return running.hash;
-    
+    return IndexedString::hashString(str, length);
   }
 };
 
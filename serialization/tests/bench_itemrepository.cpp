@@ -26,10 +26,15 @@
 #include <tests/autotestshell.h>
 
 #include <serialization/itemrepository.h>
+#include <serialization/shardeditemrepository.h>
 #include <serialization/indexedstring.h>
 
 #include <algorithm>
 #include <QtTest/QTest>
+#include <QtConcurrentRun>
+#include <QFuture>
+#include <QThread>
+#include <QThreadPool>
 
 QTEST_GUILESS_MAIN(TestItemRepository);
 
@@ -108,6 +113,7 @@ struct TestDataRepositoryItemRequest
 };
 
 typedef ItemRepository<TestData, TestDataRepositoryItemRequest, false, true> TestDataRepository;
+typedef ShardedItemRepository<TestData, TestDataRepositoryItemRequest, 8, false> ShardedTestDataRepository;
 
 void TestItemRepository::initTestCase()
 {
@@ -155,6 +161,58 @@ void TestItemRepository::insert()
   QCOMPARE(repo.statistics().totalItems, uint(data.size()));
 }
 
+void TestItemRepository::insertContended_data()
+{
+  QTest::addColumn<bool>("sharded");
+  QTest::addColumn<int>("threads");
+
+  for (int threads : {1, 2, 4, 8}) {
+    QTest::newRow(qPrintable(QStringLiteral("single-%1").arg(threads))) << false << threads;
+    QTest::newRow(qPrintable(QStringLiteral("sharded-%1").arg(threads))) << true << threads;
+  }
+}
+
+template<typename Repository>
+static void insertDataConcurrently(const QVector<QString>& data, Repository& repo, int threads)
+{
+  QVector<QFuture<void>> futures;
+  const int chunkSize = data.size() / threads + 1;
+  for(int i = 0; i < threads; ++i) {
+    futures << QtConcurrent::run([&data, &repo, i, chunkSize] () {
+      const int end = qMin(data.size(), (i + 1) * chunkSize);
+      for(int a = i * chunkSize; a < end; ++a) {
+        const QByteArray byteArray = data[a].toUtf8();
+        repo.index(TestDataRepositoryItemRequest(byteArray.constData(), byteArray.length()));
+      }
+    });
+  }
+  foreach(const QFuture<void>& future, futures) {
+    future.waitForFinished();
+  }
+}
+
+void TestItemRepository::insertContended()
+{
+  QFETCH(bool, sharded);
+  QFETCH(int, threads);
+
+  QVector<QString> data = generateData();
+  QThreadPool::globalInstance()->setMaxThreadCount(qMax(threads, QThread::idealThreadCount()));
+  if (sharded) {
+    ShardedTestDataRepository repo("TestDataRepositoryInsertContendedSharded");
+    QBENCHMARK_ONCE {
+      insertDataConcurrently(data, repo, threads);
+    }
+    QCOMPARE(repo.totalItems(), uint(data.size()));
+  } else {
+    TestDataRepository repo("TestDataRepositoryInsertContended");
+    QBENCHMARK_ONCE {
+      insertDataConcurrently(data, repo, threads);
+    }
+    QCOMPARE(repo.statistics().totalItems, uint(data.size()));
+  }
+}
+
 void TestItemRepository::remove()
 {
   TestDataRepository repo("TestDataRepositoryRemove");
@@ -192,6 +250,65 @@ void TestItemRepository::removeDisk()
   QCOMPARE(repo.statistics().totalItems, 0u);
 }
 
+static QByteArray traceItem(int file, int item, int revision)
+{
+  // a few items are big, like the data of large declarations
+  const int padding = (item % 17 == 0) ? 500 + (file * 131 + item + revision) % 2000 : (file * 31 + item * 7 + revision) % 40;
+  return "/file" + QByteArray::number(file) + '/' + QByteArray::number(item) + '/' + QByteArray::number(revision)
+         + QByteArray(padding, 'x');
+}
+
+void TestItemRepository::insertDeleteTrace()
+{
+  // Replays the pattern of a reparse storm: every file owns a set of items, and reparsing a file
+  // deletes all of them and inserts the new ones, of which a few changed. Most reparses hit a small
+  // set of hot files. That leaves many buckets with free space that has to be found again.
+  static const int NUM_FILES = 1000;
+  static const int ITEMS_PER_FILE = 50;
+  static const int NUM_REPARSES = 5000;
+
+  TestDataRepository repo("TestDataRepositoryInsertDeleteTrace");
+  QVector<QVector<uint>> fileIndices(NUM_FILES);
+  auto insertFile = [&repo, &fileIndices] (int file, const QVector<QByteArray>& items) {
+    QVector<uint>& indices = fileIndices[file];
+    indices.clear();
+    foreach(const QByteArray& item, items) {
+      indices << repo.index(TestDataRepositoryItemRequest(item.constData(), item.length()));
+    }
+  };
+
+  for(int file = 0; file < NUM_FILES; ++file) {
+    QVector<QByteArray> items;
+    for(int item = 0; item < ITEMS_PER_FILE; ++item) {
+      items << traceItem(file, item, 0);
+    }
+    insertFile(file, items);
+  }
+
+  srand(0);
+  QVector<int> traceFiles(NUM_REPARSES);
+  QVector<QVector<QByteArray>> traceItems(NUM_REPARSES);
+  for(int i = 0; i < NUM_REPARSES; ++i) {
+    const int file = (rand() % 4) ? rand() % (NUM_FILES / 20) : rand() % NUM_FILES;
+    traceFiles[i] = file;
+    for(int item = 0; item < ITEMS_PER_FILE; ++item) {
+      // every fifth item changes with a reparse
+      traceItems[i] << traceItem(file, item, (item % 5) ? 0 : i + 1);
+    }
+  }
+
+  QBENCHMARK_ONCE {
+    for(int i = 0; i < NUM_REPARSES; ++i) {
+      foreach(uint index, fileIndices[traceFiles[i]]) {
+        repo.deleteItem(index);
+      }
+      insertFile(traceFiles[i], traceItems[i]);
+    }
+    repo.store();
+  }
+  QCOMPARE(repo.statistics().totalItems, uint(NUM_FILES * ITEMS_PER_FILE));
+}
+
 void TestItemRepository::lookupKey()
 {
   TestDataRepository repo("TestDataRepositoryLookupKey");
@@ -206,6 +323,45 @@ void TestItemRepository::lookupKey()
   }
 }
 
+void TestItemRepository::lookupKeyContended_data()
+{
+  QTest::addColumn<bool>("locked");
+
+  QTest::newRow("lock-free") << false;
+  QTest::newRow("locked") << true;
+}
+
+void TestItemRepository::lookupKeyContended()
+{
+  QFETCH(bool, locked);
+
+  TestDataRepository repo("TestDataRepositoryLookupKeyContended");
+  QVector<QString> data = generateData();
+  QVector<uint> indices = insertData(data, repo);
+  srand(0);
+  std::random_shuffle(indices.begin(), indices.end());
+  const int threadCount = qMax(2, QThread::idealThreadCount());
+  QBENCHMARK {
+    QVector<QFuture<void>> futures;
+    for(int i = 0; i < threadCount; ++i) {
+      futures << QtConcurrent::run([&repo, &indices, locked] () {
+        foreach(uint index, indices) {
+          if(locked) {
+            // every lookup took the repository mutex before the lock-free read path existed
+            QMutexLocker lock(repo.mutex());
+            repo.itemFromIndex(index);
+          } else {
+            repo.itemFromIndex(index);
+          }
+        }
+      });
+    }
+    foreach(const QFuture<void>& future, futures) {
+      future.waitForFinished();
+    }
+  }
+}
+
 void TestItemRepository::lookupValue()
 {
   TestDataRepository repo("TestDataRepositoryLookupValue");
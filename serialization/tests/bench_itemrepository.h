@@ -32,9 +32,14 @@ private slots:
     void cleanupTestCase();
 
     void insert();
+    void insertContended_data();
+    void insertContended();
     void remove();
     void removeDisk();
+    void insertDeleteTrace();
     void lookupKey();
+    void lookupKeyContended_data();
+    void lookupKeyContended();
     void lookupValue();
 };
 
@@ -26,8 +26,10 @@
 
 #include <language/util/kdevhash.h>
 #include <serialization/indexedstring.h>
+#include <serialization/referencecounting.h>
 #include <QtTest/QTest>
 
+#include <thread>
 #include <utility>
 
 QTEST_GUILESS_MAIN(TestIndexedString);
@@ -208,6 +210,44 @@ void TestIndexedString::bench_qSet()
   }
 }
 
+void TestIndexedString::bench_copy_data()
+{
+  QTest::addColumn<int>("refCountedRanges");
+
+  QTest::newRow("no-refcounting") << 0;
+  QTest::newRow("refcounting-elsewhere") << 1;
+  QTest::newRow("refcounting-elsewhere-many-ranges") << 9;
+}
+
+void TestIndexedString::bench_copy()
+{
+  QFETCH(int, refCountedRanges);
+
+  QVector<IndexedString> strings;
+  foreach(const QString& string, generateData()) {
+    strings << IndexedString(string);
+  }
+
+  // reference counting enabled for unrelated memory, like while a top-context is being stored,
+  // makes every copy check whether the copy lives in a reference-counted range
+  QVector<QByteArray> ranges;
+  for (int i = 0; i < refCountedRanges; ++i) {
+    ranges << QByteArray(1024, 0);
+    enableDUChainReferenceCounting(ranges.last().data(), ranges.last().size());
+  }
+
+  QBENCHMARK {
+    foreach(const IndexedString& string, strings) {
+      IndexedString copy(string);
+      Q_UNUSED(copy);
+    }
+  }
+
+  for (auto& range : ranges) {
+    disableDUChainReferenceCounting(range.data());
+  }
+}
+
 void TestIndexedString::test()
 {
   QFETCH(QString, data);
@@ -249,3 +289,48 @@ void TestIndexedString::testCString()
     QCOMPARE(str.index(), 0u);
     QVERIFY(str.isEmpty());
 }
+
+void TestIndexedString::testReferenceCountingPerThread()
+{
+    QByteArray range(64, 0);
+    enableDUChainReferenceCounting(range.data(), range.size());
+    QVERIFY(shouldDoDUChainReferenceCounting(range.data()));
+    QVERIFY(shouldDoDUChainReferenceCounting(range.data() + range.size() - 1));
+    QVERIFY(!shouldDoDUChainReferenceCounting(range.data() + range.size()));
+
+    // the range is only reference-counted for the thread that enabled it
+    bool otherThread = true;
+    std::thread thread([&range, &otherThread]() {
+        otherThread = shouldDoDUChainReferenceCounting(range.data());
+    });
+    thread.join();
+    QVERIFY(!otherThread);
+
+    disableDUChainReferenceCounting(range.data());
+    QVERIFY(!shouldDoDUChainReferenceCounting(range.data()));
+}
+
+void TestIndexedString::testHashString()
+{
+    // CRC32C check value, without the final inversion
+    QCOMPARE(IndexedString::hashString("123456789", 9), ~0xe3069283u);
+
+    // all lengths and alignments must give the same result as the per-character hash
+    QByteArray data;
+    for (int i = 0; i < 100; ++i) {
+        data.append(static_cast<char>(i * 37 + 200));
+    }
+    for (int offset = 0; offset < 8; ++offset) {
+        for (int length = 0; length + offset <= data.size(); ++length) {
+            IndexedString::RunningHash running;
+            for (int i = 0; i < length; ++i) {
+                running.append(data[offset + i]);
+            }
+            QCOMPARE(IndexedString::hashString(data.constData() + offset, length), running.hash);
+        }
+    }
+
+    const QByteArray string("asdf()?=");
+    const uint hash = IndexedString::hashString(string.constData(), string.size());
+    QCOMPARE(IndexedString(string, hash), IndexedString(string));
+}
@@ -43,11 +43,15 @@ private slots:
     void bench_hashString();
     void bench_kdevhash();
     void bench_qSet();
+    void bench_copy_data();
+    void bench_copy();
 
     void test();
     void test_data();
 
     void testCString();
+    void testHashString();
+    void testReferenceCountingPerThread();
 };
 
 #endif // TESTINDEXEDSTRING_H
@@ -1,9 +1,11 @@
 #include <QObject>
 #include <QtTest/QtTest>
 #include <serialization/itemrepository.h>
+#include <serialization/shardeditemrepository.h>
 #include <serialization/indexedstring.h>
 #include <stdlib.h>
 #include <time.h>
+#include <vector>
 
 #include <tests/testcore.h>
 #include <tests/autotestshell.h>
@@ -201,6 +203,303 @@ class TestItemRepository : public QObject {
           delete[] item;
       }
     }
+    void testShardedItemRepository()
+    {
+      KDevelop::ShardedItemRepository<TestItem, TestItemRequest, 4> repository(QStringLiteral("TestShardedItemRepository"));
+      QList<TestItem*> items;
+      QList<uint> indices;
+      for(int i = 0; i < 10000; ++i) {
+        TestItem* item = createItem(i * 7919, (i % 100) + sizeof(TestItem));
+        const uint index = repository.index(TestItemRequest(*item, true));
+        QVERIFY(index);
+        // the shard must be encoded without touching the reserved 0xffff____ range
+        QVERIFY((index >> 16) != 0xffff);
+        items << item;
+        indices << index;
+      }
+      QCOMPARE(repository.totalItems(), 10000u);
+
+      for(int i = 0; i < items.size(); ++i) {
+        QVERIFY(items[i]->equals(repository.itemFromIndex(indices[i])));
+        QCOMPARE(repository.findIndex(TestItemRequest(*items[i], true)), indices[i]);
+      }
+
+      for(int i = 0; i < items.size(); i += 2) {
+        repository.deleteItem(indices[i]);
+        QVERIFY(!repository.findIndex(TestItemRequest(*items[i], true)));
+        QCOMPARE(repository.findIndex(TestItemRequest(*items[i + 1], true)), indices[i + 1]);
+      }
+      QCOMPARE(repository.totalItems(), 5000u);
+
+      foreach(auto item, items) {
+          delete[] item;
+      }
+    }
+    void testWritableMapping()
+    {
+      qputenv("KDEV_ITEMREPOSITORY_WRITABLE_MMAP", "1");
+      QList<TestItem*> items;
+      QList<uint> indices;
+      {
+        KDevelop::ItemRepository<TestItem, TestItemRequest> repository(QStringLiteral("TestWritableMappingRepository"));
+        for(int i = 0; i < 5000; ++i) {
+          // every 500th item is put into a monster bucket, which is not changed in place
+          const uint dataSize = (i % 500) ? (rand() % 1000) : KDevelop::ItemRepositoryBucketSize + 10;
+          TestItem* item = createItem(i, dataSize + sizeof(TestItem));
+          items << item;
+          indices << repository.index(TestItemRequest(*item, true));
+          QVERIFY(indices.last());
+        }
+        repository.store();
+
+        for(int i = 0; i < items.size(); i += 3) {
+          repository.deleteItem(indices[i]);
+        }
+        repository.store();
+
+        auto& abstractRepository = static_cast<KDevelop::AbstractItemRepository&>(repository);
+        abstractRepository.close();
+        QVERIFY(abstractRepository.open(KDevelop::globalItemRepositoryRegistry().path()));
+
+        for(int i = 0; i < items.size(); ++i) {
+          if(i % 3) {
+            QCOMPARE(repository.findIndex(TestItemRequest(*items[i], true)), indices[i]);
+            QVERIFY(items[i]->equals(repository.itemFromIndex(indices[i])));
+          } else {
+            QVERIFY(!repository.findIndex(TestItemRequest(*items[i], true)));
+          }
+        }
+      }
+      qunsetenv("KDEV_ITEMREPOSITORY_WRITABLE_MMAP");
+
+      foreach(auto item, items) {
+          delete[] item;
+      }
+    }
+    void testFlushChanges()
+    {
+      QList<TestItem*> items;
+      QList<uint> indices;
+      {
+        KDevelop::ItemRepository<TestItem, TestItemRequest> repository(QStringLiteral("TestFlushChangesRepository"));
+        auto& abstractRepository = static_cast<KDevelop::AbstractItemRepository&>(repository);
+        for(int i = 0; i < 5000; ++i) {
+          TestItem* item = createItem(i, (rand() % 1000) + sizeof(TestItem));
+          items << item;
+          indices << repository.index(TestItemRequest(*item, true));
+        }
+
+        // the journal is written in batches, until nothing is left
+        int pending = abstractRepository.flushChanges(2);
+        QVERIFY(pending > 0);
+        int previous = pending;
+        while(pending) {
+          pending = abstractRepository.flushChanges(2);
+          QVERIFY(pending < previous);
+          previous = pending;
+        }
+
+        // changing items again after the flush puts their buckets back into the journal
+        for(int i = 0; i < items.size(); i += 2) {
+          repository.deleteItem(indices[i]);
+        }
+        QVERIFY(abstractRepository.flushChanges(0) > 0);
+
+        repository.store();
+        QCOMPARE(abstractRepository.flushChanges(1), 0);
+
+        abstractRepository.close();
+        QVERIFY(abstractRepository.open(KDevelop::globalItemRepositoryRegistry().path()));
+
+        for(int i = 0; i < items.size(); ++i) {
+          if(i % 2) {
+            QCOMPARE(repository.findIndex(TestItemRequest(*items[i], true)), indices[i]);
+          } else {
+            QVERIFY(!repository.findIndex(TestItemRequest(*items[i], true)));
+          }
+        }
+      }
+
+      foreach(auto item, items) {
+          delete[] item;
+      }
+    }
+    void testColdBucketCompression()
+    {
+      QList<TestItem*> items;
+      QList<uint> indices;
+      KDevelop::ItemRepository<TestItem, TestItemRequest> repository(QStringLiteral("TestColdBucketCompressionRepository"));
+      repository.setColdBucketCompression(3);
+      for(int i = 0; i < 2000; ++i) {
+        TestItem* item = createItem(i, (i % 1000) + sizeof(TestItem));
+        items << item;
+        indices << repository.index(TestItemRequest(*item, true));
+      }
+
+      // the buckets become cold while nobody uses them, and are compressed in the store() after they were unloaded
+      for(int cycle = 0; cycle < 6; ++cycle) {
+        repository.store();
+      }
+      auto stats = repository.statistics();
+      QVERIFY(stats.compressedBuckets > 0);
+      QVERIFY(stats.compressionRatio > 1);
+      QVERIFY(stats.print().contains(QStringLiteral("compression ratio")));
+
+      for(int i = 0; i < items.size(); ++i) {
+        QVERIFY(items[i]->equals(repository.itemFromIndex(indices[i])));
+      }
+      QVERIFY(repository.statistics().decompressedBuckets > 0);
+
+      foreach(auto item, items) {
+          delete[] item;
+      }
+    }
+    void testReadGuardEpochs()
+    {
+      const quint64 before = KDevelop::ItemRepositoryEpochs::retire();
+      QVERIFY(before < KDevelop::ItemRepositoryEpochs::safeEpoch());
+
+      quint64 retired;
+      {
+        KDevelop::ItemRepositoryReadGuard guard;
+        {
+          KDevelop::ItemRepositoryReadGuard nested;
+        }
+        // the reader may have found the data before it was retired
+        retired = KDevelop::ItemRepositoryEpochs::retire();
+        QVERIFY(retired >= KDevelop::ItemRepositoryEpochs::safeEpoch());
+      }
+      QVERIFY(retired < KDevelop::ItemRepositoryEpochs::safeEpoch());
+    }
+    void testReadGuardKeepsUnloadedBuckets()
+    {
+      QList<TestItem*> items;
+      QList<uint> indices;
+      KDevelop::ItemRepository<TestItem, TestItemRequest> repository(QStringLiteral("TestReadGuardRepository"));
+      repository.setColdBucketCompression(3);
+      for(int i = 0; i < 2000; ++i) {
+        TestItem* item = createItem(i, (i % 1000) + sizeof(TestItem));
+        items << item;
+        indices << repository.index(TestItemRequest(*item, true));
+      }
+      repository.store();
+
+      {
+        KDevelop::ItemRepositoryReadGuard guard;
+        const TestItem* found = repository.loadedItemFromIndex(indices.first());
+        QVERIFY(found);
+        for(int cycle = 0; cycle < 6; ++cycle) {
+          repository.store();
+        }
+        // the bucket was unloaded, but is neither freed nor compressed while the reader may still use it
+        QVERIFY(!repository.loadedItemFromIndex(indices.first()));
+        QVERIFY(items.first()->equals(found));
+        QCOMPARE(repository.statistics().compressedBuckets, uint(0));
+      }
+
+      repository.store();
+      QVERIFY(repository.statistics().compressedBuckets > 0);
+      for(int i = 0; i < items.size(); ++i) {
+        QVERIFY(items[i]->equals(repository.itemFromIndex(indices[i])));
+      }
+
+      foreach(auto item, items) {
+          delete[] item;
+      }
+    }
+    void testCounters()
+    {
+      KDevelop::ItemRepository<TestItem, TestItemRequest> repository(QStringLiteral("TestCountersRepository"));
+      QScopedArrayPointer<TestItem> first(createItem(1, 100));
+      QScopedArrayPointer<TestItem> second(createItem(2, 100));
+
+      repository.index(TestItemRequest(*first, true));
+      repository.index(TestItemRequest(*second, true));
+      repository.index(TestItemRequest(*first, true));
+      repository.findIndex(TestItemRequest(*second, true));
+      repository.store();
+
+      const auto values = repository.counters().snapshot();
+      QCOMPARE(values.indexInserts, quint64(2));
+      QCOMPARE(values.indexHits, quint64(1));
+      QCOMPARE(values.lookups, quint64(1));
+      QVERIFY(values.bytesStored > 0);
+
+      auto& registry = KDevelop::globalItemRepositoryRegistry();
+      QCOMPARE(registry.counters().value(QStringLiteral("TestCountersRepository")).indexInserts, quint64(2));
+      QVERIFY(registry.countersToJson().contains("\"TestCountersRepository\""));
+    }
+    void testFreeSpaceBucketIndex()
+    {
+      KDevelop::FreeSpaceBucketIndex index;
+      index.insert(5, 1000);
+      index.insert(3, 1000);
+      index.insert(7, 200);
+      index.insert(9, 60000);
+      index.insert(2, 3000);
+      QCOMPARE(index.size(), 5);
+
+      // ordered by the free size, then by the bucket number
+      QVector<uint> order;
+      index.find(0, [&order](uint bucket) { order << bucket; return false; });
+      QCOMPARE(order, QVector<uint>({7, 3, 5, 2, 9}));
+
+      // the best fitting bucket is found first
+      QCOMPARE(index.find(900, [](uint) { return true; }), 3u);
+      QCOMPARE(index.find(1001, [](uint) { return true; }), 2u);
+      QCOMPARE(index.find(60001, [](uint) { return true; }), 0u);
+      QCOMPARE(index.find(0, [](uint bucket) { return bucket == 5; }), 5u);
+
+      // moving and removing
+      index.insert(3, 100);
+      index.remove(2);
+      QVERIFY(!index.contains(2));
+      QVERIFY(index.contains(3));
+      QCOMPARE(index.size(), 4);
+      QCOMPARE(index.find(1, [](uint) { return true; }), 3u);
+      QCOMPARE(index.find(201, [](uint) { return true; }), 5u);
+
+      // the entries are stored to disk, and must restore the same order
+      KDevelop::FreeSpaceBucketIndex restored;
+      restored.setEntries(index.entries());
+      QCOMPARE(restored.entries(), index.entries());
+      QCOMPARE(restored.size(), 4);
+    }
+    void testIndexMany()
+    {
+      KDevelop::ItemRepository<TestItem, TestItemRequest> repository(QStringLiteral("TestIndexManyRepository"));
+      KDevelop::ShardedItemRepository<TestItem, TestItemRequest, 4> sharded(QStringLiteral("TestIndexManyShardedRepository"));
+      QList<TestItem*> items;
+      std::vector<TestItemRequest> requests;
+      for(int i = 0; i < 2000; ++i) {
+        // include a monster item, and let every item appear twice in the batch
+        TestItem* item = createItem(i, i == 1000 ? 100000 : (i % 500) + sizeof(TestItem));
+        items << item;
+        requests.push_back(TestItemRequest(*item, true));
+        if(i % 2)
+          requests.push_back(TestItemRequest(*items[i / 2], true));
+      }
+
+      const QVector<uint> indices = repository.indexMany(requests.data(), requests.size());
+      const QVector<uint> shardedIndices = sharded.indexMany(requests.data(), requests.size());
+      QCOMPARE(indices.size(), static_cast<int>(requests.size()));
+      QCOMPARE(shardedIndices.size(), static_cast<int>(requests.size()));
+      QCOMPARE(repository.statistics().totalItems, 2000u);
+      QCOMPARE(sharded.totalItems(), 2000u);
+
+      for(uint i = 0; i < requests.size(); ++i) {
+        QVERIFY(indices[i]);
+        QVERIFY(requests[i].m_item.equals(repository.itemFromIndex(indices[i])));
+        QCOMPARE(repository.index(requests[i]), indices[i]);
+        QVERIFY(requests[i].m_item.equals(sharded.itemFromIndex(shardedIndices[i])));
+        QCOMPARE(sharded.index(requests[i]), shardedIndices[i]);
+      }
+      QCOMPARE(repository.statistics().totalItems, 2000u);
+
+      foreach(auto item, items) {
+          delete[] item;
+      }
+    }
     void testStringSharing()
     {
       QString qString;
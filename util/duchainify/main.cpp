@@ -32,6 +32,8 @@
 #include <language/duchain/problem.h>
 #include <language/duchain/persistentsymboltable.h>
 
+#include <serialization/itemrepositoryregistry.h>
+
 #include <interfaces/iplugincontroller.h>
 #include <interfaces/ilanguagecontroller.h>
 #include <tests/autotestshell.h>
@@ -42,6 +44,7 @@
 #include <QCommandLineOption>
 #include <QDebug>
 #include <QDirIterator>
+#include <QFile>
 #include <QStringList>
 #include <QTimer>
 
@@ -93,6 +96,10 @@ void Manager::init()
         QCoreApplication::exit(1);
     }
 
+    if (m_args->isSet(QStringLiteral("lock-profile"))) {
+        DUChain::lock()->setProfiling(true);
+    }
+
     uint features = TopDUContext::VisibleDeclarationsAndContexts;
     if(m_args->isSet(QStringLiteral("features")))
     {
@@ -269,6 +276,26 @@ QSet< QUrl > Manager::waiting()
 void Manager::finish()
 {
     std::cerr << "ready" << std::endl;
+
+    if (m_args->isSet(QStringLiteral("dump-repository-counters"))) {
+        const QByteArray json = globalItemRepositoryRegistry().countersToJson();
+        const QString fileName = m_args->value(QStringLiteral("dump-repository-counters"));
+        if (fileName == QLatin1String("-")) {
+            std::cout << json.constData() << std::endl;
+        } else {
+            QFile file(fileName);
+            if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                file.write(json);
+            } else {
+                std::cerr << "could not write repository counters to " << qPrintable(fileName) << std::endl;
+            }
+        }
+    }
+
+    if (m_args->isSet(QStringLiteral("lock-profile"))) {
+        std::cerr << qPrintable(DUChain::lock()->profilingReport(50));
+    }
+
     QApplication::quit();
 }
 
@@ -305,6 +332,8 @@ int main(int argc, char** argv)
     parser.addOption(QCommandLineOption{QStringList{QStringLiteral("dump-graph")}, i18n("Dump DUChain graph (in .dot format)")});
     parser.addOption(QCommandLineOption{QStringList{QStringLiteral("d"), QStringLiteral("dump-errors")}, i18n("Print problems encountered during parsing")});
     parser.addOption(QCommandLineOption{QStringList{QStringLiteral("dump-imported-errors")}, i18n("Recursively dump errors from imported contexts.")});
+    parser.addOption(QCommandLineOption{QStringList{QStringLiteral("lock-profile")}, i18n("Print the DUChain lock wait- and hold-times per acquisition site when done")});
+    parser.addOption(QCommandLineOption{QStringList{QStringLiteral("dump-repository-counters")}, i18n("Write the usage counters of all item-repositories as JSON to the given file when done, or to stdout for \"-\""), QStringLiteral("file")});
 
     parser.process(app);
 